@@ -0,0 +1,115 @@
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <omp.h>
+#include "obcore/base/Timer.h"
+#include "obcore/base/Logger.h"
+#include "obcore/math/mathbase.h"
+#include "obvision/reconstruct/grid/TsdGrid.h"
+#include "obvision/reconstruct/grid/SensorPolar2D.h"
+#include "obvision/reconstruct/space/TsdFusionKernel.h"
+
+using namespace std;
+using namespace obvious;
+
+/**
+ * Simulate scan of a rectangular room with a window, i.e., beams through the window return no echo
+ */
+static void simulateScan(SensorPolar2D* sensor, const double pose[3], double* data)
+{
+  const double room[2] = {12.0, 9.0};
+  for(unsigned int i=0; i<sensor->getRealMeasurementSize(); i++)
+  {
+    const double phi = pose[2] + sensor->getPhiMin() + i*sensor->getAngularResolution();
+    const double dir[2] = {cos(phi), sin(phi)};
+    double r = INFINITY;
+    for(int k=0; k<2; k++)
+    {
+      if(fabs(dir[k])<1e-12) continue;
+      const double wall = dir[k]>0 ? room[k] : 0.0;
+      const double d = (wall-pose[k])/dir[k];
+      if(d<r) r = d;
+    }
+    const double y = pose[1] + r*dir[1];
+    if(dir[0]>0 && y>3.0 && y<4.5) r = INFINITY;
+    data[i] = r;
+  }
+}
+
+/**
+ * Benchmark of TsdGrid::push for each available fusion kernel
+ * Usage: tsd_grid_push_benchmark [number of pushes] [number of threads]
+ */
+int main(int argc, char* argv[])
+{
+  LOGMSG_CONF("tsd_grid_push_benchmark.log", Logger::file_off|Logger::screen_on, DBG_ERROR, DBG_ERROR);
+
+  unsigned int pushes = 200;
+  if(argc>1) pushes = atoi(argv[1]);
+  if(argc>2) omp_set_num_threads(atoi(argv[2]));
+
+  const obfloat cellSize = 0.025;
+  const EnumTsdFusionKernel kernels[3] = {FUSIONKERNEL_SCALAR, FUSIONKERNEL_SSE2, FUSIONKERNEL_AVX2};
+  const char* kernelNames[3] = {"scalar", "SSE2", "AVX2"};
+  const EnumTsdFusionKernel available = TsdFusionKernel::getKernel();
+
+  // LMS100 (270 degrees, 0.5 degree resolution) and sensors of the same field of view with 1080 beams
+  const unsigned int beams[2]     = {541, 1081};
+  const double angularRes[2]      = {deg2rad(0.5), deg2rad(0.25)};
+  const char* sensorNames[2]      = {"LMS100 (541 beams)", "1081 beams"};
+
+  for(unsigned int s=0; s<2; s++)
+  {
+    SensorPolar2D sensor(beams[s], angularRes[s], deg2rad(-135.0), 20.0, 0.05, 8.0);
+    double* data = new double[beams[s]];
+
+    // One grid per kernel, pushes are interleaved, so that all kernels run under the same cache and memory conditions
+    TsdGrid* grids[3];
+    double elapsed[3];
+    for(unsigned int k=0; k<3; k++)
+    {
+      grids[k] = new TsdGrid(cellSize, LAYOUT_32x32, LAYOUT_1024x1024);
+      grids[k]->setMaxTruncation(4.0*cellSize);
+      elapsed[k] = 0.0;
+    }
+
+    Timer t;
+    for(unsigned int i=0; i<pushes; i++)
+    {
+      // Sensor moves along an ellipse through the room
+      const double theta = 2.0*M_PI*((double)i)/pushes;
+      const double pose[3] = {6.0 + 4.0*cos(theta), 4.5 + 3.0*sin(theta), theta + M_PI*0.5};
+      simulateScan(&sensor, pose, data);
+      sensor.setRealMeasurementData(data);
+      sensor.setStandardMask();
+
+      double tf[9] = {cos(pose[2]), -sin(pose[2]), pose[0],
+                      sin(pose[2]),  cos(pose[2]), pose[1],
+                      0,             0,            1};
+      Matrix T(3, 3);
+      T.setData(tf);
+      Matrix P = sensor.getTransformation();
+      P.invert();
+      Matrix D = T * P;
+      sensor.transform(&D);
+
+      for(unsigned int k=0; k<3 && kernels[k]<=available; k++)
+      {
+        TsdFusionKernel::setKernel(kernels[k]);
+        t.start();
+        grids[k]->push(&sensor);
+        elapsed[k] += t.elapsed();
+      }
+    }
+
+    cout << sensorNames[s] << ", " << pushes << " pushes" << endl;
+    for(unsigned int k=0; k<3 && kernels[k]<=available; k++)
+      cout << "  " << kernelNames[k] << ": " << 1000.0*elapsed[k]/pushes << " ms/push" << endl;
+
+    for(unsigned int k=0; k<3; k++)
+      delete grids[k];
+    TsdFusionKernel::setKernel(available);
+
+    delete [] data;
+  }
+}
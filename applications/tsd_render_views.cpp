@@ -0,0 +1,135 @@
+#include <iostream>
+#include <cstdlib>
+#include "obcore/base/tools.h"
+#include "obcore/base/Timer.h"
+#include "obvision/reconstruct/space/TsdSpace.h"
+#include "obvision/reconstruct/space/SensorProjective3D.h"
+#include "obvision/reconstruct/space/RayCast3D.h"
+#include "obcore/base/Logger.h"
+
+using namespace std;
+using namespace obvious;
+
+/**
+ * Benchmark of batched rendering of depth and normal images from hypothetical poses
+ * Usage: tsd_render_views [number of views] [iterations]
+ */
+int main(int argc, char* argv[])
+{
+  LOGMSG_CONF("tsd_render_views.log", Logger::file_off|Logger::screen_on, DBG_ERROR, DBG_ERROR);
+
+  unsigned int views      = 32;
+  unsigned int iterations = 5;
+  if(argc>1) views      = atoi(argv[1]);
+  if(argc>2) iterations = atoi(argv[2]);
+
+  obfloat voxelSize = 0.02;
+  TsdSpace space(voxelSize, LAYOUT_8x8x8, LAYOUT_256x256x256);
+  space.setMaxTruncation(3.0*voxelSize);
+
+  // translation of sensor
+  obfloat tr[3];
+  space.getCentroid(tr);
+  tr[2] = 0.001;
+
+  double tf[16]={1, 0, 0, tr[0],
+                 0, 1, 0, tr[1],
+                 0, 0, 1, tr[2],
+                 0, 0, 0, 1};
+  Matrix T(4, 4);
+  T.setData(tf);
+
+  int rows = 120;
+  int cols = 160;
+
+  // Setup synthetic perspective projection
+  double su = 125;
+  double sv = 125;
+  double tu = 80;
+  double tv = 60;
+  double PData[12]  = {su, 0, tu, 0, 0, sv, tv, 0, 0, 0, 1, 0};
+
+  SensorProjective3D sensor(cols, rows, PData);
+  sensor.transform(&T);
+
+  // Background with distance = 3.0m, centered square with distance = 1.5m
+  double* distZ = new double[cols*rows];
+  for(int u=0; u<cols; u++)
+    for(int v=0; v<rows; v++)
+    {
+      double s = (u>=cols/4 && u<3*cols/4 && v>=rows/4 && v<3*rows/4) ? 1.5 : 3.0;
+      double x = s*(((double)u) - tu) / su;
+      double y = s*(((double)v) - tv) / sv;
+      double z = s;
+      distZ[v*cols+u] = sqrt(x*x+y*y+z*z);
+    }
+  sensor.setRealMeasurementData(distZ);
+  space.push(&sensor);
+
+  // Hypothetical poses: sensor moved sideways and rotated about the y-axis
+  Matrix** poses = new Matrix*[views];
+  for(unsigned int i=0; i<views; i++)
+  {
+    double theta = (((double)i) / views - 0.5) * 20.0 * M_PI / 180.0;
+    double dx    = (((double)i) / views - 0.5) * 0.5;
+    double tp[16]={cos(theta),  0, sin(theta), tr[0]+dx,
+                   0,           1, 0,          tr[1],
+                   -sin(theta), 0, cos(theta), tr[2],
+                   0,           0, 0,          1};
+    poses[i] = new Matrix(4, 4);
+    poses[i]->setData(tp);
+  }
+
+  double* depth   = new double[views*cols*rows];
+  double* normals = new double[3*views*cols*rows];
+  RayCast3D raycaster;
+  Timer t;
+
+  // Sequential rendering, i.e., one raycast per view with the sensor moved to the hypothetical pose
+  double* coords = new double[3*cols*rows];
+  bool* mask = new bool[cols*rows];
+  unsigned int size;
+  unsigned int validSequential = 0;
+  t.start();
+  for(unsigned int k=0; k<iterations; k++)
+  {
+    validSequential = 0;
+    for(unsigned int i=0; i<views; i++)
+    {
+      Matrix P = sensor.getTransformation();
+      P.invert();
+      Matrix D = P * (*poses[i]);
+      sensor.transform(&D);
+      raycaster.calcCoordsFromCurrentPoseMask(&space, &sensor, coords, normals, NULL, mask, &size);
+      for(int j=0; j<cols*rows; j++)
+        if(mask[j]) validSequential++;
+    }
+  }
+  double elapsedSequential = t.elapsed();
+
+  // Move sensor back to the initial pose, rays are rotated along with the sensor
+  Matrix P = sensor.getTransformation();
+  P.invert();
+  Matrix D = P * T;
+  sensor.transform(&D);
+
+  // Batched rendering
+  unsigned int validBatch = 0;
+  t.start();
+  for(unsigned int k=0; k<iterations; k++)
+    validBatch = raycaster.renderViews(&space, &sensor, poses, views, depth, normals);
+  double elapsedBatch = t.elapsed();
+
+  cout << views << " views of " << cols << "x" << rows << " pixels" << endl;
+  cout << "sequential: " << (views*iterations)/elapsedSequential << " views/s, " << validSequential << " pixels with surface" << endl;
+  cout << "batch:      " << (views*iterations)/elapsedBatch << " views/s, " << validBatch << " pixels with surface" << endl;
+
+  for(unsigned int i=0; i<views; i++)
+    delete poses[i];
+  delete [] poses;
+  delete [] depth;
+  delete [] normals;
+  delete [] coords;
+  delete [] mask;
+  delete [] distZ;
+}
@@ -0,0 +1,246 @@
+#ifndef PARTITIONHASH_H
+#define PARTITIONHASH_H
+
+#include <vector>
+#include <cstddef>
+
+namespace obvious
+{
+
+/**
+ * @class PartitionHash
+ * @brief Open addressing hash table mapping linear partition indices to partitions
+ * Lookups may be performed concurrently, as long as no insertion or removal takes place at the same time.
+ * Partitions are owned by the caller, i.e., the table never deletes them.
+ * @tparam T partition type, e.g., TsdGridPartition or TsdSpacePartition
+ * @author Stefan May
+ */
+template <class T>
+class PartitionHash
+{
+public:
+
+  /**
+   * Constructor
+   * @param[in] capacity initial number of slots, rounded up to the next power of two
+   */
+  PartitionHash(unsigned int capacity=1024);
+
+  /**
+   * Destructor
+   */
+  ~PartitionHash();
+
+  /**
+   * Find partition
+   * @param[in] key linear partition index
+   * @return partition or NULL, if no partition is stored for the key
+   */
+  T* find(const unsigned int key) const
+  {
+    unsigned int slot = hash(key) & _mask;
+    while(_keys[slot]!=EMPTYKEY)
+    {
+      if(_keys[slot]==key) return _values[slot];
+      slot = (slot+1) & _mask;
+    }
+    return NULL;
+  }
+
+  /**
+   * Insert partition, an existing entry with the same key is replaced
+   * @param[in] key linear partition index
+   * @param[in] partition partition instance
+   */
+  void insert(const unsigned int key, T* partition);
+
+  /**
+   * Remove partition from table
+   * @param[in] key linear partition index
+   * @return removed partition or NULL, if no partition is stored for the key
+   */
+  T* erase(const unsigned int key);
+
+  /**
+   * Remove all entries
+   */
+  void clear();
+
+  /**
+   * Get number of stored partitions
+   * @return number of partitions
+   */
+  unsigned int size() const { return _size; }
+
+  /**
+   * Get all stored partitions
+   * @param[out] partitions partition list (appended)
+   * @param[out] keys corresponding linear partition indices (appended), may be NULL
+   */
+  void getPartitions(std::vector<T*> &partitions, std::vector<unsigned int>* keys=NULL) const;
+
+private:
+
+  static const unsigned int EMPTYKEY = 0xFFFFFFFF;
+
+  static unsigned int hash(unsigned int key)
+  {
+    key ^= key >> 16;
+    key *= 0x85ebca6b;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35;
+    key ^= key >> 16;
+    return key;
+  }
+
+  void allocate(const unsigned int capacity);
+
+  void rehash(const unsigned int capacity);
+
+  unsigned int* _keys;
+
+  T** _values;
+
+  unsigned int _capacity;
+
+  unsigned int _mask;
+
+  unsigned int _size;
+};
+
+template <class T>
+PartitionHash<T>::PartitionHash(unsigned int capacity)
+{
+  unsigned int c = 16;
+  while(c < capacity) c <<= 1;
+  allocate(c);
+  _size = 0;
+}
+
+template <class T>
+PartitionHash<T>::~PartitionHash()
+{
+  delete [] _keys;
+  delete [] _values;
+}
+
+template <class T>
+void PartitionHash<T>::insert(const unsigned int key, T* partition)
+{
+  // Keep load factor below 0.5 to obtain short probe sequences
+  if(2*(_size+1) > _capacity) rehash(_capacity << 1);
+
+  unsigned int slot = hash(key) & _mask;
+  while(_keys[slot]!=EMPTYKEY)
+  {
+    if(_keys[slot]==key)
+    {
+      _values[slot] = partition;
+      return;
+    }
+    slot = (slot+1) & _mask;
+  }
+  _keys[slot] = key;
+  _values[slot] = partition;
+  _size++;
+}
+
+template <class T>
+T* PartitionHash<T>::erase(const unsigned int key)
+{
+  unsigned int slot = hash(key) & _mask;
+  while(_keys[slot]!=key)
+  {
+    if(_keys[slot]==EMPTYKEY) return NULL;
+    slot = (slot+1) & _mask;
+  }
+
+  T* partition = _values[slot];
+
+  // Backward shift deletion: move following entries of the probe sequence into the gap
+  unsigned int gap = slot;
+  unsigned int next = (gap+1) & _mask;
+  while(_keys[next]!=EMPTYKEY)
+  {
+    unsigned int home = hash(_keys[next]) & _mask;
+    // Entry may be moved, if its home slot does not lie cyclically in (gap, next]
+    bool movable = (gap<=next) ? (home<=gap || home>next) : (home<=gap && home>next);
+    if(movable)
+    {
+      _keys[gap] = _keys[next];
+      _values[gap] = _values[next];
+      gap = next;
+    }
+    next = (next+1) & _mask;
+  }
+  _keys[gap] = EMPTYKEY;
+  _values[gap] = NULL;
+  _size--;
+
+  return partition;
+}
+
+template <class T>
+void PartitionHash<T>::clear()
+{
+  for(unsigned int i=0; i<_capacity; i++)
+  {
+    _keys[i] = EMPTYKEY;
+    _values[i] = NULL;
+  }
+  _size = 0;
+}
+
+template <class T>
+void PartitionHash<T>::getPartitions(std::vector<T*> &partitions, std::vector<unsigned int>* keys) const
+{
+  for(unsigned int i=0; i<_capacity; i++)
+  {
+    if(_keys[i]!=EMPTYKEY)
+    {
+      partitions.push_back(_values[i]);
+      if(keys) keys->push_back(_keys[i]);
+    }
+  }
+}
+
+template <class T>
+void PartitionHash<T>::allocate(const unsigned int capacity)
+{
+  _capacity = capacity;
+  _mask = _capacity-1;
+  _keys = new unsigned int[_capacity];
+  _values = new T*[_capacity];
+  for(unsigned int i=0; i<_capacity; i++)
+  {
+    _keys[i] = EMPTYKEY;
+    _values[i] = NULL;
+  }
+}
+
+template <class T>
+void PartitionHash<T>::rehash(const unsigned int capacity)
+{
+  unsigned int* keys = _keys;
+  T** values = _values;
+  unsigned int capacityPrev = _capacity;
+
+  allocate(capacity);
+
+  for(unsigned int i=0; i<capacityPrev; i++)
+  {
+    if(keys[i]==EMPTYKEY) continue;
+    unsigned int slot = hash(keys[i]) & _mask;
+    while(_keys[slot]!=EMPTYKEY)
+      slot = (slot+1) & _mask;
+    _keys[slot] = keys[i];
+    _values[slot] = values[i];
+  }
+
+  delete [] keys;
+  delete [] values;
+}
+
+}
+
+#endif
@@ -283,6 +283,12 @@ bool Sensor::hasRealMeasurementRGB()
 
 void Sensor::setRealMeasurementRGB(unsigned char* rgb)
 {
+  if(!rgb)
+  {
+    delete [] _rgb;
+    _rgb = NULL;
+    return;
+  }
   if(!_rgb) _rgb = new unsigned char[_size*3];
   memcpy(_rgb, rgb, _size*3*sizeof(*rgb));
 }
@@ -92,12 +92,12 @@ public:
    * Set transformation matrix
    * @param T transformation matrix
    */
-  void setTransformation(Matrix T);
+  virtual void setTransformation(Matrix T);
 
   /**
    * Reset sensor pose to identity
    */
-  void resetTransformation();
+  virtual void resetTransformation();
 
   /**
    * Accessor to sensor translation
@@ -219,7 +219,7 @@ public:
 
   /**
    * Copy rgb data to internal buffer
-   * @param rgb color/texture data
+   * @param rgb color/texture data, NULL discards color data of former measurements
    */
   virtual void setRealMeasurementRGB(unsigned char* rgb);
 
@@ -0,0 +1,247 @@
+#include "TsdChunkFile.h"
+#include "obcore/base/Logger.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace obvious
+{
+
+/**
+ * Lookup tables of CRC-32 (polynomial 0xEDB88320) for processing 8 bytes per step (slicing-by-8),
+ * built during static initialization, so that checksums can be computed concurrently
+ */
+struct TsdCrcTable
+{
+  uint32_t table[8][256];
+
+  TsdCrcTable()
+  {
+    for(uint32_t i=0; i<256; i++)
+    {
+      uint32_t c = i;
+      for(int k=0; k<8; k++)
+        c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+      table[0][i] = c;
+    }
+    for(int k=1; k<8; k++)
+      for(uint32_t i=0; i<256; i++)
+        table[k][i] = (table[k-1][i] >> 8) ^ table[0][table[k-1][i] & 0xFF];
+  }
+};
+
+static const TsdCrcTable _crc;
+
+TsdChunkFile::TsdChunkFile(const char* magic, const uint32_t version, const size_t headerSize, const size_t chunkSize)
+{
+  strncpy(_magic, magic, sizeof(_magic));
+  _version = version;
+  _headerSize = headerSize;
+  _chunkSize = chunkSize;
+  _fd = -1;
+  _length = 0;
+  _data = NULL;
+  _index = NULL;
+  _header = NULL;
+}
+
+TsdChunkFile::~TsdChunkFile()
+{
+  close();
+}
+
+bool TsdChunkFile::hasMagic(const char* filename, const char* magic)
+{
+  char m[8];
+  std::ifstream f(filename, std::ios_base::in | std::ios_base::binary);
+  if(!f.read(m, sizeof(m))) return false;
+  return (strncmp(m, magic, sizeof(m))==0);
+}
+
+uint32_t TsdChunkFile::checksum(const void* data, const size_t size, const uint32_t crc)
+{
+  const uint32_t (*t)[256] = _crc.table;
+  const unsigned char* p = (const unsigned char*)data;
+  uint32_t c = ~crc;
+  size_t n = size;
+
+  // Bytes are assembled explicitly, i.e., the result does not depend on byte order
+  for(; n>=8; n-=8, p+=8)
+  {
+    uint32_t w = c ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+    c = t[7][w & 0xFF] ^ t[6][(w >> 8) & 0xFF] ^ t[5][(w >> 16) & 0xFF] ^ t[4][w >> 24]
+      ^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+  }
+  for(; n>0; n--, p++)
+    c = t[0][(c ^ *p) & 0xFF] ^ (c >> 8);
+  return ~c;
+}
+
+bool TsdChunkFile::open(const char* filename)
+{
+  close();
+
+  _fd = ::open(filename, O_RDONLY);
+  if(_fd<0)
+  {
+    LOGMSG(DBG_ERROR, "Could not open " << filename);
+    return false;
+  }
+
+  struct stat st;
+  if(fstat(_fd, &st)!=0 || (size_t)st.st_size < _headerSize)
+  {
+    LOGMSG(DBG_ERROR, filename << " is no valid TSD file");
+    close();
+    return false;
+  }
+
+  _length = st.st_size;
+  void* data = mmap(NULL, _length, PROT_READ, MAP_PRIVATE, _fd, 0);
+  if(data==MAP_FAILED)
+  {
+    LOGMSG(DBG_ERROR, "Could not map " << filename);
+    _length = 0;
+    close();
+    return false;
+  }
+  _data = (const unsigned char*)data;
+  _header = (const TsdChunkFileHeader*)_data;
+
+  if(strncmp(_header->magic, _magic, sizeof(_magic))!=0 || _header->version!=_version)
+  {
+    LOGMSG(DBG_ERROR, filename << " is no TSD file of a supported version");
+    close();
+    return false;
+  }
+
+  std::vector<unsigned char> header(_data, _data + _headerSize);
+  ((TsdChunkFileHeader*)&header[0])->checksum = 0;
+  if(checksum(&header[0], _headerSize)!=_header->checksum)
+  {
+    LOGMSG(DBG_ERROR, filename << " has a corrupted header");
+    close();
+    return false;
+  }
+
+  // Index table must be aligned and lie within the file, chunks must lie between header and index table
+  uint64_t indexOffset = _header->indexOffset;
+  uint64_t indexSize = (uint64_t)_header->chunks * _chunkSize;
+  if(indexOffset%8!=0 || indexOffset<_headerSize || indexOffset>_length || indexSize>_length-indexOffset
+     || checksum(_data + indexOffset, indexSize)!=_header->indexChecksum)
+  {
+    LOGMSG(DBG_ERROR, filename << " has a corrupted index table");
+    close();
+    return false;
+  }
+  _index = _data + indexOffset;
+  for(unsigned int i=0; i<_header->chunks; i++)
+  {
+    const TsdChunk& c = entry(i);
+    if(c.offset<_headerSize || c.offset>indexOffset || c.size>indexOffset-c.offset)
+    {
+      LOGMSG(DBG_ERROR, filename << " has a corrupted chunk " << i);
+      close();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool TsdChunkFile::verifyChunk(const unsigned int i) const
+{
+  return (checksum(getChunkData(i), entry(i).size)==entry(i).checksum);
+}
+
+void TsdChunkFile::close()
+{
+  if(_data) munmap((void*)_data, _length);
+  if(_fd>=0) ::close(_fd);
+  _fd = -1;
+  _length = 0;
+  _data = NULL;
+  _index = NULL;
+  _header = NULL;
+}
+
+TsdChunkFileWriter::TsdChunkFileWriter(const char* magic, const uint32_t version, const size_t headerSize, const size_t chunkSize)
+{
+  strncpy(_magic, magic, sizeof(_magic));
+  _version = version;
+  _header.assign(headerSize, 0);
+  _chunkSize = chunkSize;
+  _offset = 0;
+}
+
+TsdChunkFileWriter::~TsdChunkFileWriter()
+{
+  if(_f.is_open()) close();
+}
+
+bool TsdChunkFileWriter::open(const char* filename, const TsdChunkFileHeader* header)
+{
+  memcpy(&_header[0], header, _header.size());
+  TsdChunkFileHeader* h = (TsdChunkFileHeader*)&_header[0];
+  memcpy(h->magic, _magic, sizeof(h->magic));
+  h->version = _version;
+  h->checksum = 0;
+  h->chunks = 0;
+  h->indexChecksum = 0;
+  h->indexOffset = 0;
+  _index.clear();
+
+  _f.open(filename, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+  if(!_f)
+  {
+    LOGMSG(DBG_ERROR, "Could not create " << filename);
+    return false;
+  }
+
+  // Header is rewritten on close
+  _f.write((const char*)&_header[0], _header.size());
+  _offset = _header.size();
+
+  return _f.good();
+}
+
+bool TsdChunkFileWriter::write(const TsdChunk* chunk, const unsigned char* data)
+{
+  size_t pos = _index.size();
+  _index.insert(_index.end(), (const unsigned char*)chunk, (const unsigned char*)chunk + _chunkSize);
+  TsdChunk* c = (TsdChunk*)&_index[pos];
+  c->offset = _offset;
+  c->checksum = TsdChunkFile::checksum(data, c->size);
+  if(c->size) _f.write((const char*)data, c->size);
+  _offset += c->size;
+  return _f.good();
+}
+
+bool TsdChunkFileWriter::close()
+{
+  // Align index table for direct access in mapped memory
+  const char padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  unsigned int pad = (8 - _offset%8) % 8;
+  _f.write(padding, pad);
+  _offset += pad;
+
+  TsdChunkFileHeader* h = (TsdChunkFileHeader*)&_header[0];
+  h->chunks = _index.size() / _chunkSize;
+  h->indexOffset = _offset;
+  h->indexChecksum = TsdChunkFile::checksum(_index.empty() ? NULL : &_index[0], _index.size());
+  if(!_index.empty()) _f.write((const char*)&_index[0], _index.size());
+
+  h->checksum = 0;
+  h->checksum = TsdChunkFile::checksum(&_header[0], _header.size());
+  _f.seekp(0);
+  _f.write((const char*)&_header[0], _header.size());
+
+  bool good = _f.good();
+  _f.close();
+  return good;
+}
+
+}
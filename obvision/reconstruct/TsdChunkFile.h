@@ -0,0 +1,216 @@
+#ifndef TSDCHUNKFILE_H
+#define TSDCHUNKFILE_H
+
+#include <vector>
+#include <fstream>
+#include <stdint.h>
+#include <cstddef>
+
+namespace obvious
+{
+
+/**
+ * @struct TsdChunkFileHeader
+ * @brief Leading part of headers of binary TSD files, format specific fields follow. All numbers are stored in native byte order.
+ */
+struct TsdChunkFileHeader
+{
+  char magic[8];
+
+  uint32_t version;
+
+  // checksum of complete header, computed with this field set to zero
+  uint32_t checksum;
+
+  uint32_t chunks;
+
+  // checksum of chunk index table
+  uint32_t indexChecksum;
+
+  // file offset of chunk index table
+  uint64_t indexOffset;
+};
+
+/**
+ * @struct TsdChunk
+ * @brief Leading part of entries of the chunk index table, the partition index follows. There is one chunk per stored partition.
+ */
+struct TsdChunk
+{
+  uint32_t flags;
+
+  // checksum of chunk data
+  uint32_t checksum;
+
+  double initWeight;
+
+  uint64_t offset;
+
+  uint64_t size;
+};
+
+/**
+ * @class TsdChunkFile
+ * @brief Memory-mapped binary file of encoded partitions, base of TsdGridFile and TsdSpaceFile.
+ * The file consists of a header, encoded partition chunks and a trailing chunk index table.
+ * Header, index table and chunks are protected by CRC-32 checksums. Chunks can be decoded independently.
+ * @author Stefan May
+ */
+class TsdChunkFile
+{
+public:
+
+  /**
+   * Constructor
+   * @param[in] magic magic number of format
+   * @param[in] version supported version of format
+   * @param[in] headerSize size of format specific header
+   * @param[in] chunkSize size of format specific index entry
+   */
+  TsdChunkFile(const char* magic, const uint32_t version, const size_t headerSize, const size_t chunkSize);
+
+  /**
+   * Destructor, unmaps file
+   */
+  ~TsdChunkFile();
+
+  /**
+   * Check for magic number
+   * @param[in] filename file name
+   * @param[in] magic magic number of format
+   * @return true, if file starts with the magic number
+   */
+  static bool hasMagic(const char* filename, const char* magic);
+
+  /**
+   * Compute CRC-32 checksum
+   * @param[in] data data
+   * @param[in] size number of bytes
+   * @param[in] crc checksum of preceding data, used for continuing the computation
+   * @return checksum
+   */
+  static uint32_t checksum(const void* data, const size_t size, const uint32_t crc=0);
+
+  /**
+   * Map file into memory and validate header and index table
+   * @param[in] filename file name
+   * @return success
+   */
+  bool open(const char* filename);
+
+  /**
+   * Get number of chunks
+   * @return number of chunks
+   */
+  unsigned int getChunkCount() const { return _header->chunks; }
+
+  /**
+   * Get encoded partition data
+   * @param[in] i chunk number
+   * @return pointer into mapped memory
+   */
+  const unsigned char* getChunkData(const unsigned int i) const { return _data + entry(i).offset; }
+
+  /**
+   * Verify checksum of chunk data
+   * @param[in] i chunk number
+   * @return true, if data is intact
+   */
+  bool verifyChunk(const unsigned int i) const;
+
+protected:
+
+  const TsdChunk& entry(const unsigned int i) const { return *(const TsdChunk*)(_index + i*_chunkSize); }
+
+  void close();
+
+  const unsigned char* _data;
+
+  const unsigned char* _index;
+
+private:
+
+  char _magic[8];
+
+  uint32_t _version;
+
+  size_t _headerSize;
+
+  size_t _chunkSize;
+
+  int _fd;
+
+  size_t _length;
+
+  const TsdChunkFileHeader* _header;
+};
+
+/**
+ * @class TsdChunkFileWriter
+ * @brief Writer of binary TSD files, base of TsdGridFileWriter and TsdSpaceFileWriter.
+ * Chunks are appended one by one, the index table is written on close.
+ * @author Stefan May
+ */
+class TsdChunkFileWriter
+{
+public:
+
+  /**
+   * Constructor
+   * @param[in] magic magic number of format
+   * @param[in] version version of format
+   * @param[in] headerSize size of format specific header
+   * @param[in] chunkSize size of format specific index entry
+   */
+  TsdChunkFileWriter(const char* magic, const uint32_t version, const size_t headerSize, const size_t chunkSize);
+
+  /**
+   * Destructor, closes file
+   */
+  ~TsdChunkFileWriter();
+
+  /**
+   * Write index table and header
+   * @return success
+   */
+  bool close();
+
+protected:
+
+  /**
+   * Create file
+   * @param[in] filename file name
+   * @param[in] header format specific header, magic, version, checksums, chunk number and index offset are set by the writer
+   * @return success
+   */
+  bool open(const char* filename, const TsdChunkFileHeader* header);
+
+  /**
+   * Append chunk
+   * @param[in] chunk format specific index entry, offset and checksum are determined by the writer
+   * @param[in] data encoded partition data of chunk->size bytes
+   * @return success
+   */
+  bool write(const TsdChunk* chunk, const unsigned char* data);
+
+private:
+
+  char _magic[8];
+
+  uint32_t _version;
+
+  std::ofstream _f;
+
+  std::vector<unsigned char> _header;
+
+  // index table, entries of chunkSize bytes
+  std::vector<unsigned char> _index;
+
+  size_t _chunkSize;
+
+  uint64_t _offset;
+};
+
+}
+
+#endif
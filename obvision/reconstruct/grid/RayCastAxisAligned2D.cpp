@@ -12,12 +12,11 @@ RayCastAxisAligned2D::~RayCastAxisAligned2D() {
 
 void RayCastAxisAligned2D::calcCoords(TsdGrid* grid, obfloat* coords, obfloat* normals, unsigned int* cnt, char* occupiedGrid)
 {
-  unsigned int partitionsInX = grid->getCellsX() / grid->getPartitionSize();
-  unsigned int partitionsInY = partitionsInX;
+  unsigned int partitionsInX = grid->getPartitionsInX();
+  unsigned int partitionsInY = grid->getPartitionsInY();
   double cellSize = grid->getCellSize();
-  TsdGridPartition*** partitions = grid->getPartitions();
-  unsigned int cellsPPart = partitions[0][0]->getHeight() * partitions[0][0]->getWidth();
-  unsigned int cellsPPX = partitions[0][0]->getWidth();
+  unsigned int cellsPPart = grid->getPartitionSize() * grid->getPartitionSize();
+  unsigned int cellsPPX = grid->getPartitionSize();
   unsigned int gridOffset = 0;
 
   *cnt = 0;
@@ -26,7 +25,9 @@ void RayCastAxisAligned2D::calcCoords(TsdGrid* grid, obfloat* coords, obfloat* n
   {
     for(unsigned int x=1; x<partitionsInX-1; x++)
     {
-      TsdGridPartition* p = partitions[y][x];
+      // Partitions of hashed grids might not be allocated
+      TsdGridPartition* p = grid->getPartition(x, y);
+      if(!p) continue;
       if(p->isInitialized())
       {
         if(!(p->isEmpty()))
@@ -51,8 +52,8 @@ void RayCastAxisAligned2D::calcCoords(TsdGrid* grid, obfloat* coords, obfloat* n
               if((tsd_prev > 0 && tsd < 0) || (tsd_prev < 0 && tsd > 0))
               {
                 interp = tsd_prev / (tsd_prev - tsd);
-                coords[(*cnt)]   = px*cellSize + cellSize * (interp-1.0) + (x * p->getWidth()) * cellSize;
-                coords[(*cnt)+1] = py*cellSize + (y * p->getHeight())* cellSize;
+                coords[(*cnt)]   = px*cellSize + cellSize * (interp-1.0) + (x * p->getWidth()) * cellSize + grid->getMinX();
+                coords[(*cnt)+1] = py*cellSize + (y * p->getHeight())* cellSize + grid->getMinY();
                 if(normals)
                   grid->interpolateNormal(coords, &(normals[*cnt]));
                 (*cnt) += 2;
@@ -73,8 +74,8 @@ void RayCastAxisAligned2D::calcCoords(TsdGrid* grid, obfloat* coords, obfloat* n
               if((tsd_prev > 0 && tsd < 0) || (tsd_prev < 0 && tsd > 0))
               {
                 interp = tsd_prev / (tsd_prev - tsd);
-                coords[(*cnt)]   = px*cellSize + (x * p->getWidth()) * cellSize;
-                coords[(*cnt)+1] = py*cellSize + cellSize * (interp-1.0) + (y * p->getHeight())* cellSize;
+                coords[(*cnt)]   = px*cellSize + (x * p->getWidth()) * cellSize + grid->getMinX();
+                coords[(*cnt)+1] = py*cellSize + cellSize * (interp-1.0) + (y * p->getHeight())* cellSize + grid->getMinY();
                 if(normals)
                   grid->interpolateNormal(coords, &(normals[*cnt]));
                 (*cnt) += 2;
@@ -204,15 +204,15 @@ bool RayCastPolar2D::rayCastFromCurrentView(TsdGrid* grid, obfloat tr[2], obfloa
 
   obfloat xmin   = _xmin;
   obfloat ymin   = _ymin;
-  if(fabs(ray[0])>10e-6) xmin = ((obfloat)(ray[0] > 0.0 ? 0 : (xDim-1)*cellSize) - tr[0]) / ray[0];
-  if(fabs(ray[1])>10e-6) ymin = ((obfloat)(ray[1] > 0.0 ? 0 : (yDim-1)*cellSize) - tr[1]) / ray[1];
+  if(fabs(ray[0])>10e-6) xmin = ((obfloat)(ray[0] > 0.0 ? 0 : (xDim-1)*cellSize) + grid->getMinX() - tr[0]) / ray[0];
+  if(fabs(ray[1])>10e-6) ymin = ((obfloat)(ray[1] > 0.0 ? 0 : (yDim-1)*cellSize) + grid->getMinY() - tr[1]) / ray[1];
   obfloat idxMin = max(xmin, ymin);
   idxMin        = max(idxMin, TSDZERO);
 
   obfloat xmax   = _xmax;
   obfloat ymax   = _ymax;
-  if(fabs(ray[0])>10e-6) xmax = ((obfloat)(ray[0] > 0.0 ? (xDim-1)*cellSize : 0) - tr[0]) / ray[0];
-  if(fabs(ray[1])>10e-6) ymax = ((obfloat)(ray[1] > 0.0 ? (yDim-1)*cellSize : 0) - tr[1]) / ray[1];
+  if(fabs(ray[0])>10e-6) xmax = ((obfloat)(ray[0] > 0.0 ? (xDim-1)*cellSize : 0) + grid->getMinX() - tr[0]) / ray[0];
+  if(fabs(ray[1])>10e-6) ymax = ((obfloat)(ray[1] > 0.0 ? (yDim-1)*cellSize : 0) + grid->getMinY() - tr[1]) / ray[1];
   obfloat idxMax = min(xmax, ymax);
 
   idxMin = max(idxMin, _idxMin);
@@ -4,12 +4,16 @@
 #include "obcore/math/mathbase.h"
 #include "TsdGrid.h"
 #include "TsdGridBranch.h"
-#include "obcore/base/tools.h"
+#include "TsdGridFile.h"
 
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
 #include <cmath>
 #include <omp.h>
 #include <istream>
+#include <fstream>
+#include <sstream>
 #include <assert.h>
 
 namespace obvious
@@ -17,101 +21,50 @@ namespace obvious
 
 #define MAXWEIGHT 32.0
 
-TsdGrid::TsdGrid(const obfloat cellSize, const EnumTsdGridLayout layoutPartition, const EnumTsdGridLayout layoutGrid)
+TsdGrid::TsdGrid(const obfloat cellSize, const EnumTsdGridLayout layoutPartition, const EnumTsdGridLayout layoutGrid, const EnumTsdGridStorage storage)
 {
-  this->init(cellSize, layoutPartition, layoutGrid);
+  this->init(cellSize, layoutPartition, layoutGrid, storage);
 }
 
-TsdGrid::TsdGrid(const std::string& data, const EnumTsdGridLoadSource source)
+TsdGrid::TsdGrid(const std::string& data, const EnumTsdGridLoadSource source, const EnumTsdGridStorage storage)
 {
-  /* Data file:
-   * Cell dimensions
-   * Grid dimensions
-   * Grid data partition[row][col].cells[row][col]
-   */
-  std::istream* istream=NULL;
-  std::ifstream inFile;
-  std::stringstream ss;
+  // Members released by the destructor, if loading fails before initialization
+  _storage = storage;
+  _partitions = NULL;
+  _hash = NULL;
+  _tree = NULL;
 
-  if(source == FILE_SOURCE)
+  if(!deserialize(data, source, storage, NULL, NULL))
   {
-    inFile.open(data.c_str(), std::fstream::in);
-    if(!inFile.is_open())
-    {
-      LOGMSG(DBG_ERROR, " error opening file " << data << "\n");
-      std::exit(2);
-    }
-    istream = &inFile;
-  }
-  else if(source == STRING_SOURCE)
-  {
-    ss << data;
-    LOGMSG(DBG_DEBUG, "loaded " << ss.str().size() << " characters into stringstream\n");
-    istream = &ss;
-  }
+    LOGMSG(DBG_ERROR, "Loading of grid data failed, grid might be incomplete");
 
-  const double cellSize = getDoubleLine(*istream);
-  const EnumTsdGridLayout layoutPartition = static_cast<EnumTsdGridLayout>(getIntLine(*istream));
-  const EnumTsdGridLayout layoutGrid = static_cast<EnumTsdGridLayout>(getIntLine(*istream));
-  if( (layoutGrid < 0) || (layoutPartition < 0) || (layoutGrid > 15) || (layoutPartition > 15) )
-  {
-    LOGMSG(DBG_ERROR, " error! Partition or Gridlayout invalid!\n");
-    if(source == FILE_SOURCE)
-      inFile.close();
-    std::exit(3);
+    // Grid of a single cell in case of an invalid header
+    if(!_partitions && !_hash)
+      init(1.0, LAYOUT_1x1, LAYOUT_1x1, storage);
   }
+}
 
-  const double maxTruncation = getDoubleLine(*istream);
-  //inFile.getline(buffer, 1000);
-  //maxTruncation=std::atof(buffer);
-  this->init(cellSize, layoutPartition, layoutGrid);
-  this->setMaxTruncation(maxTruncation);
-  for(int y = 0; y < _partitionsInY; y++)
-  {
-    for(int x = 0; x < _partitionsInX; x++)
-    {
-      EnumTsdGridPartitionIdentifier id=static_cast<EnumTsdGridPartitionIdentifier>(getIntLine(*istream));
-      TsdGridPartition* curPart=_partitions[y][x];
-      if(id == UNINITIALIZED)
-      {
-        continue;
-      }
-      else if(id == EMPTY)
-      {
-        curPart->_initWeight=static_cast<obfloat>(getDoubleLine(*istream));
-        curPart->_initWeight = std::min(curPart->_initWeight, TSDGRIDMAXWEIGHT);
-      }
-      else if(id == CONTENT)
-      {
-        curPart->init(_maxTruncation);
-        for(unsigned int py=0; py < curPart->getHeight(); py++)
-        {
-          for(unsigned int px = 0; px < curPart->getWidth(); px++)
-          {
-              curPart->_grid[py][px].tsd=static_cast<obfloat>(getDoubleLine(*istream));
-              curPart->_grid[py][px].weight=static_cast<obfloat>(getDoubleLine(*istream));
-          }
-        }
-      }
-      else
-      {
-        LOGMSG(DBG_ERROR, "Unknown partition identifier for partition(" << x << "/" << y << ")");
-        inFile.close();
-        std::exit(3);
-      }
-    }
-  }
-  if(source == FILE_SOURCE)
-  {
-  inFile.close();
-  if(inFile.is_open())
-    LOGMSG(DBG_DEBUG, "Closing of file " << data << " failed.");
-  }
+TsdGrid::TsdGrid()
+{
+  _storage = STORAGE_GRID_DENSE;
+  _partitions = NULL;
+  _hash = NULL;
+  _tree = NULL;
 }
 
-void TsdGrid::init(const double cellSize, const EnumTsdGridLayout layoutPartition, const EnumTsdGridLayout layoutGrid)
+void TsdGrid::init(const double cellSize, const EnumTsdGridLayout layoutPartition, const EnumTsdGridLayout layoutGrid, const EnumTsdGridStorage storage)
 {
   _initialPushAccomplished = false;
+  _storage = storage;
+  _partitions = NULL;
+  _hash = NULL;
+  _tree = NULL;
+  _pushes = 0;
+  _revision = 0;
+  _rolling = false;
+  _rollingThreshold = 1;
+  _windowIndex[0] = 0;
+  _windowIndex[1] = 0;
   _cellSize = cellSize;
   _invCellSize = 1.0 / _cellSize;
 
@@ -142,6 +95,17 @@ void TsdGrid::init(const double cellSize, const EnumTsdGridLayout layoutPartitio
   _minY = 0.0;
   _maxY = ((obfloat)_cellsY + 0.5) * _cellSize;
 
+  _layoutPartitions = layoutPartition;
+  _layoutGrid = layoutGrid;
+
+  if(_storage==STORAGE_GRID_HASHED)
+  {
+    // Partitions are created on demand while pushing data, the quadtree is not available
+    LOGMSG(DBG_DEBUG, "Hashing up to " << _partitionsInX << "x" << _partitionsInY << " partitions");
+    _hash = new PartitionHash<TsdGridPartition>();
+    return;
+  }
+
   LOGMSG(DBG_DEBUG, "Allocating " << _partitionsInX << "x" << _partitionsInY << " partitions");
   System<TsdGridPartition*>::allocate(_partitionsInY, _partitionsInX, _partitions);
 
@@ -153,7 +117,15 @@ void TsdGrid::init(const double cellSize, const EnumTsdGridLayout layoutPartitio
     }
   }
 
-  int depthTree = layoutGrid-layoutPartition;
+  buildTree();
+}
+
+void TsdGrid::buildTree()
+{
+  // Branches do not own leafs
+  if(_tree && !_tree->isLeaf()) delete _tree;
+
+  int depthTree = _layoutGrid-_layoutPartitions;
   if(depthTree == 0)
   {
     _tree = _partitions[0][0];
@@ -163,14 +135,49 @@ void TsdGrid::init(const double cellSize, const EnumTsdGridLayout layoutPartitio
     TsdGridBranch* tree = new TsdGridBranch((TsdGridComponent***)_partitions, 0, 0, depthTree);
     _tree = tree;
   }
-  _layoutPartitions = layoutPartition;
-  _layoutGrid = layoutGrid;
 }
 
 TsdGrid::~TsdGrid(void)
 {
-  delete _tree;
-  System<TsdGridPartition*>::deallocate(_partitions);
+  // Branches do not own leafs
+  if(_tree && !_tree->isLeaf()) delete _tree;
+
+  vector<TsdGridPartition*> partitions;
+  getAllocatedPartitions(partitions);
+  for(unsigned int i=0; i<partitions.size(); i++)
+    delete partitions[i];
+
+  if(_partitions) System<TsdGridPartition*>::deallocate(_partitions);
+  delete _hash;
+}
+
+void TsdGrid::getAllocatedPartitions(vector<TsdGridPartition*> &partitions) const
+{
+  if(_storage==STORAGE_GRID_HASHED)
+  {
+    _hash->getPartitions(partitions);
+    return;
+  }
+
+  if(!_partitions) return;
+
+  for(int py=0; py<_partitionsInY; py++)
+    for(int px=0; px<_partitionsInX; px++)
+      partitions.push_back(_partitions[py][px]);
+}
+
+TsdGridPartition* TsdGrid::acquirePartition(const unsigned int px, const unsigned int py)
+{
+  TsdGridPartition* part = getPartition(px, py);
+  if(!part)
+  {
+    const obfloat origin[2] = {_minX, _minY};
+    part = new TsdGridPartition(px*_dimPartition, py*_dimPartition, _dimPartition, _dimPartition, _cellSize, origin);
+    part->_lastPush = _pushes;
+    part->_revision = _revision;
+    _hash->insert(py*_partitionsInX+px, part);
+  }
+  return part;
 }
 
 void TsdGrid::getCentroid(double centroid[2])
@@ -194,133 +201,212 @@ void TsdGrid::push(SensorPolar2D* sensor)
 {
   Timer t;
   t.start();
-  const double* data     = sensor->getRealMeasurementData();
-  const bool* mask       = sensor->getRealMeasurementMask();
   obfloat tr[2];
   sensor->getPosition(tr);
 
-  unsigned int partSize = (_partitions[0][0])->getSize();
+  _pushes++;
 
-#pragma omp parallel
+  if(_rolling) followSensor(tr);
+
+  // Partitions out of reach are not visited, i.e., the effort depends on the sensor range rather than on the grid size
+  int pMin[2];
+  int pMax[2];
+  obfloat range;
+  if(getPartitionRange(sensor, tr, pMin, pMax, &range))
   {
-    int* idx = new int[partSize];
-#pragma omp for schedule(dynamic)
-    for(unsigned int i=0; i<(unsigned int)(_partitionsInX*_partitionsInY); i++)
+    TsdGridFusionFrame frame;
+    TsdGridFusionKernel::initFrame(sensor, _maxTruncation, &frame);
+
+    if(_storage==STORAGE_GRID_HASHED)
+    {
+      pushHashed(sensor, frame, pMin, pMax);
+    }
+    else
     {
-      TsdGridPartition* part = _partitions[0][i];
-      if(!part->isInRange(tr, sensor, _maxTruncation)) continue;
+      const int cols = pMax[0]-pMin[0]+1;
+      const int partitions = cols*(pMax[1]-pMin[1]+1);
+#pragma omp parallel
+      {
+        int* idx = new int[_dimPartition*_dimPartition];
+        obfloat* sd = new obfloat[_dimPartition*_dimPartition];
+#pragma omp for schedule(dynamic)
+        for(int i=0; i<partitions; i++)
+        {
+          TsdGridPartition* part = _partitions[pMin[1]+i/cols][pMin[0]+i%cols];
+          if(!part->isInRange(tr, sensor, _maxTruncation)) continue;
+          fusePartition(sensor, frame, part, idx, sd);
+        }
+        delete [] idx;
+        delete [] sd;
+      }
+    }
 
-      part->init(_maxTruncation);
+    refreshPartitions(tr, range, pMin, pMax);
 
-      const obfloat* partCentroid = part->getCentroid();
-      obfloat distCentroid = sqrt((partCentroid[0]-tr[0])*(partCentroid[0]-tr[0])+(partCentroid[1]-tr[1])*(partCentroid[1]-tr[1]));
-      if(distCentroid > sensor->getMaximumRange()) distCentroid = sensor->getMaximumRange();
-      obfloat partWeight = (sensor->getMaximumRange()-distCentroid)/sensor->getMaximumRange();
-      partWeight *= partWeight;
+    propagateBorders(pMin, pMax);
+  }
 
-      Matrix* partCoords = part->getPartitionCoords();
-      Matrix* cellCoordsHom = part->getCellCoordsHom();
-      sensor->backProject(cellCoordsHom, idx);
-      const double lowReflectivityRange = sensor->getLowReflectivityRange();
+  LOGMSG(DBG_DEBUG, "Elapsed push: " << t.elapsed() << "s");
 
-      for(unsigned int c=0; c<partSize; c++)
-      {
-        // Index of laser beam
-        const int index = idx[c];
+  _initialPushAccomplished = true;
+}
 
-        if(index>=0)
-        {
-          if(mask[index])
-          {
-            if(!isinf(data[index]))
-            {
-              // calculate signed distance, i.e., measurement minus distance of current cell to sensor
-              const double sd = data[index] - sqrt( ((*cellCoordsHom)(c,0)-tr[0]) * ((*cellCoordsHom)(c,0)-tr[0]) + ((*cellCoordsHom)(c,1)-tr[1]) * ((*cellCoordsHom)(c,1)-tr[1]));
-
-              part->addTsd((*partCoords)(c, 0), (*partCoords)(c, 1), sd, partWeight);
-            }
-            else
-            {
-              const double dist = sqrt( ((*cellCoordsHom)(c,0)-tr[0]) * ((*cellCoordsHom)(c,0)-tr[0]) + ((*cellCoordsHom)(c,1)-tr[1]) * ((*cellCoordsHom)(c,1)-tr[1]));
-              if(dist<lowReflectivityRange)
-                part->addTsd((*partCoords)(c, 0), (*partCoords)(c, 1), _maxTruncation, partWeight);
-            }
-          }
-        }
+bool TsdGrid::getPartitionRange(SensorPolar2D* sensor, obfloat pos[2], int pMin[2], int pMax[2], obfloat* range) const
+{
+  const double* data = sensor->getRealMeasurementData();
+  const bool* mask   = sensor->getRealMeasurementMask();
+
+  // Only partitions within reach of the farthest measurement can receive data, infinite measurements free space up to the low reflectivity range
+  double r = 0.0;
+  for(unsigned int i=0; i<sensor->getRealMeasurementSize(); i++)
+  {
+    if(isinf(data[i]))
+      r = max(r, sensor->getLowReflectivityRange());
+    else if(mask[i] && data[i]>r)
+      r = data[i];
+  }
+  *range = min(r, sensor->getMaximumRange()) + _maxTruncation;
+
+  const obfloat partitionSize = _dimPartition * _cellSize;
+  const obfloat origin[2] = {_minX, _minY};
+  const int pCnt[2] = {_partitionsInX, _partitionsInY};
+  for(int i=0; i<2; i++)
+  {
+    pMin[i] = max((int)floor((pos[i]-origin[i]-*range) / partitionSize), 0);
+    pMax[i] = min((int)floor((pos[i]-origin[i]+*range) / partitionSize), pCnt[i]-1);
+    if(pMin[i]>pMax[i]) return false;
+  }
+  return true;
+}
+
+void TsdGrid::pushHashed(SensorPolar2D* sensor, const TsdGridFusionFrame& frame, const int pMin[2], const int pMax[2])
+{
+  obfloat pos[2] = {frame.pos[0], frame.pos[1]};
+
+  // Determine candidates serially, since the hash table must not be modified during concurrent lookups
+  vector<unsigned int> keys;
+  vector<TsdGridPartition*> candidates;
+  for(int py=pMin[1]; py<=pMax[1]; py++)
+  {
+    for(int px=pMin[0]; px<=pMax[0]; px++)
+    {
+      keys.push_back(py*_partitionsInX+px);
+      candidates.push_back(_hash->find(keys.back()));
+    }
+  }
+
+  vector<TsdGridPartition*> created(candidates.size(), (TsdGridPartition*)NULL);
+  const obfloat origin[2] = {_minX, _minY};
+
+#pragma omp parallel
+  {
+    int* idx = new int[_dimPartition*_dimPartition];
+    obfloat* sd = new obfloat[_dimPartition*_dimPartition];
+#pragma omp for schedule(dynamic)
+    for(int i=0; i<(int)candidates.size(); i++)
+    {
+      TsdGridPartition* part = candidates[i];
+      if(part)
+      {
+        if(!part->isInRange(pos, sensor, _maxTruncation)) continue;
+        fusePartition(sensor, frame, part, idx, sd);
+      }
+      else
+      {
+        const unsigned int key = keys[i];
+        part = new TsdGridPartition((key % _partitionsInX)*_dimPartition, (key / _partitionsInX)*_dimPartition, _dimPartition, _dimPartition, _cellSize, origin);
+        if(part->isInRange(pos, sensor, _maxTruncation))
+          fusePartition(sensor, frame, part, idx, sd);
+
+        // Keep partition only if it has been observed, i.e., cells received data or the partition has been seen empty
+        if(part->isInitialized() || part->isEmpty())
+          created[i] = part;
+        else
+          delete part;
       }
     }
     delete [] idx;
+    delete [] sd;
   }
 
-  propagateBorders();
+  for(unsigned int i=0; i<created.size(); i++)
+  {
+    if(created[i]) _hash->insert(keys[i], created[i]);
+  }
+}
 
-  LOGMSG(DBG_DEBUG, "Elapsed push: " << t.elapsed() << "s");
+void TsdGrid::fusePartition(SensorPolar2D* sensor, const TsdGridFusionFrame& frame, TsdGridPartition* part, int* idx, obfloat* sd)
+{
+  const obfloat* partCentroid = part->getCentroid();
+  obfloat distCentroid = sqrt((partCentroid[0]-frame.pos[0])*(partCentroid[0]-frame.pos[0])+(partCentroid[1]-frame.pos[1])*(partCentroid[1]-frame.pos[1]));
+  if(distCentroid > sensor->getMaximumRange()) distCentroid = sensor->getMaximumRange();
+  obfloat partWeight = (sensor->getMaximumRange()-distCentroid)/sensor->getMaximumRange();
+  partWeight *= partWeight;
+
+  // Back project rows of cells, signed distances are computed only for cells within reach of their measurements
+  const obfloat offset[2] = {part->getX()*_cellSize + _minX, part->getY()*_cellSize + _minY};
+  unsigned int cnt = 0;
+  for(int y=0; y<_dimPartition; y++)
+  {
+    const obfloat coord[2] = {offset[0], ((obfloat)y + 0.5) * _cellSize + offset[1]};
+    cnt += TsdGridFusionKernel::projectRow(frame, coord, _cellSize, _dimPartition, &idx[y*_dimPartition], &sd[y*_dimPartition]);
+  }
 
-  _initialPushAccomplished = true;
+  // Cells are allocated on first contact
+  if(cnt==0) return;
+  part->init(_maxTruncation);
+  for(int y=0; y<_dimPartition; y++)
+    TsdGridFusionKernel::fuseRow((obfloat*)part->_grid[y], &idx[y*_dimPartition], &sd[y*_dimPartition], _dimPartition,
+                                 part->_invMaxTruncation, part->_eps, partWeight, TSDGRIDMAXWEIGHT);
 }
 
 void TsdGrid::pushTree(SensorPolar2D* sensor)
 {
+  if(!_tree)
+  {
+    // Hashed storage provides no quadtree
+    push(sensor);
+    return;
+  }
+
   Timer t;
   t.start();
-  double* data     = sensor->getRealMeasurementData();
 
   obfloat tr[2];
   sensor->getPosition(tr);
 
+  _pushes++;
+
+  if(_rolling) followSensor(tr);
+
   TsdGridComponent* comp = _tree;
   vector<TsdGridPartition*> partitionsToCheck;
   pushRecursion(sensor, tr, comp, partitionsToCheck);
 
   LOGMSG(DBG_DEBUG, "Partitions to check: " << partitionsToCheck.size());
 
+  TsdGridFusionFrame frame;
+  TsdGridFusionKernel::initFrame(sensor, _maxTruncation, &frame);
+
 #pragma omp parallel
   {
-    unsigned int partSize = (_partitions[0][0])->getSize();
-    int* idx = new int[partSize];
+    int* idx = new int[_dimPartition*_dimPartition];
+    obfloat* sd = new obfloat[_dimPartition*_dimPartition];
 #pragma omp for schedule(dynamic)
     for(unsigned int i=0; i<partitionsToCheck.size(); i++)
-    {
-      TsdGridPartition* part = partitionsToCheck[i];
-      part->init(_maxTruncation);
-
-      obfloat* partCentroid = part->getCentroid();
-      obfloat distCentroid = sqrt((partCentroid[0]-tr[0])*(partCentroid[0]-tr[0])+(partCentroid[1]-tr[1])*(partCentroid[1]-tr[1]));
-      if(distCentroid > sensor->getMaximumRange()) distCentroid = sensor->getMaximumRange();
-      obfloat partWeight = (sensor->getMaximumRange()-distCentroid)/sensor->getMaximumRange();
-      partWeight *= partWeight;
-
-      Matrix* partCoords = part->getPartitionCoords();
-      Matrix* cellCoordsHom = part->getCellCoordsHom();
-      sensor->backProject(cellCoordsHom, idx);
-
-      for(unsigned int c=0; c<partSize; c++)
-      {
-        // Index of laser beam
-        int index = idx[c];
-
-        if(index>=0)
-        {
-          if(!isinf(data[index]))
-          {
-            // calculate signed distance, i.e. measurement minus distance of current cell to sensor
-            double sd = data[index] - sqrt( ((*cellCoordsHom)(c,0)-tr[0]) * ((*cellCoordsHom)(c,0)-tr[0]) + ((*cellCoordsHom)(c,1)-tr[1]) * ((*cellCoordsHom)(c,1)-tr[1]));
-
-            part->addTsd((*partCoords)(c, 0), (*partCoords)(c, 1), sd, partWeight);
-          }
-          else
-          {
-            double dist = sqrt( ((*cellCoordsHom)(c,0)-tr[0]) * ((*cellCoordsHom)(c,0)-tr[0]) + ((*cellCoordsHom)(c,1)-tr[1]) * ((*cellCoordsHom)(c,1)-tr[1]));
-            if(dist<sensor->getLowReflectivityRange())
-              part->addTsd((*partCoords)(c, 0), (*partCoords)(c, 1), _maxTruncation, partWeight);
-          }
-        }
-      }
-    }
+      fusePartition(sensor, frame, partitionsToCheck[i], idx, sd);
     delete [] idx;
+    delete [] sd;
   }
 
-  propagateBorders();
+  int pMin[2];
+  int pMax[2];
+  obfloat range;
+  if(getPartitionRange(sensor, tr, pMin, pMax, &range))
+  {
+    refreshPartitions(tr, range, pMin, pMax);
+    propagateBorders(pMin, pMax);
+  }
 
   LOGMSG(DBG_DEBUG, "Elapsed pushTree: " << t.elapsed() << "s");
 }
@@ -345,75 +431,184 @@ void TsdGrid::pushRecursion(SensorPolar2D* sensor, obfloat pos[2], TsdGridCompon
   }
 }
 
-void TsdGrid::propagateBorders()
+void TsdGrid::refreshPartitions(obfloat pos[2], const obfloat range, const int pMin[2], const int pMax[2])
+{
+  // Partitions within reach are a superset of the ones modified by the push
+  _revision++;
+  for(int py=pMin[1]; py<=pMax[1]; py++)
+  {
+    for(int px=pMin[0]; px<=pMax[0]; px++)
+    {
+      // Closest possible distance of any cell in partition is compared with the reach of measurements
+      TsdGridPartition* part = getPartition(px, py);
+      if(part && euklideanDistance<obfloat>(pos, part->getCentroid(), 2) - part->getCircumradius() <= range)
+      {
+        part->_lastPush = _pushes;
+        part->_revision = _revision;
+      }
+    }
+  }
+}
+
+unsigned int TsdGrid::releasePartitions(const unsigned int age)
 {
-  unsigned int width  = _partitions[0][0]->getWidth();
-  unsigned int height = _partitions[0][0]->getHeight();
+  vector<TsdGridPartition*> partitions;
+  getAllocatedPartitions(partitions);
 
+  _revision++;
+  unsigned int released = 0;
+  for(unsigned int i=0; i<partitions.size(); i++)
+  {
+    TsdGridPartition* part = partitions[i];
+    if(_pushes - part->getLastPush() <= age) continue;
+    if(!part->isInitialized() && !part->isEmpty()) continue;
+
+    const unsigned int px = part->getX() / _dimPartition;
+    const unsigned int py = part->getY() / _dimPartition;
+    if(_storage==STORAGE_GRID_HASHED)
+    {
+      _hash->erase(py*_partitionsInX+px);
+      delete part;
+    }
+    else
+    {
+      part->reset();
+      part->_revision = _revision;
+    }
+    invalidateBorders(px, py);
+    released++;
+  }
+
+  LOGMSG(DBG_DEBUG, "Released " << released << " partitions");
+
+  return released;
+}
+
+void TsdGrid::propagateBorders()
+{
   // Copy valid tsd values of neighbors to borders of each partition.
   // Skip outmost partitions for the moment, they are negligible.
-  for(int py=0; py<_partitionsInY; py++)
+  if(_storage==STORAGE_GRID_HASHED)
   {
+    vector<TsdGridPartition*> partitions;
+    _hash->getPartitions(partitions);
+    for(unsigned int i=0; i<partitions.size(); i++)
+      propagateBorders(partitions[i]);
+    return;
+  }
+
+  for(int py=0; py<_partitionsInY; py++)
     for(int px=0; px<_partitionsInX; px++)
+      propagateBorders(_partitions[py][px]);
+}
+
+void TsdGrid::propagateBorders(const int pMin[2], const int pMax[2])
+{
+  // Left and lower neighbors refer to partitions within the range
+  for(int py=max(pMin[1]-1, 0); py<=pMax[1]; py++)
+  {
+    for(int px=max(pMin[0]-1, 0); px<=pMax[0]; px++)
     {
-      TsdGridPartition* partCur       = _partitions[py][px];
+      TsdGridPartition* part = getPartition(px, py);
+      if(part) propagateBorders(part);
+    }
+  }
+}
 
-      if(!partCur->isInitialized()) continue;
+void TsdGrid::propagateBorders(TsdGridPartition* partCur)
+{
+  if(!partCur->isInitialized()) return;
 
-      if(px<(_partitionsInX-1))
-      {
-        TsdGridPartition* partRight     = _partitions[py][px+1];
-        if(partRight->isInitialized())
-        {
-          // Copy right border
-          for(unsigned int i=0; i<height; i++)
-          {
-            partCur->_grid[i][width].tsd = partRight->_grid[i][0].tsd;
-            partCur->_grid[i][width].weight = partRight->_grid[i][0].weight;
-          }
-        }
-      }
+  const unsigned int width  = _dimPartition;
+  const unsigned int height = _dimPartition;
+  const int px = partCur->getX() / _dimPartition;
+  const int py = partCur->getY() / _dimPartition;
 
-      if(py<(_partitionsInY-1))
+  if(px<(_partitionsInX-1))
+  {
+    TsdGridPartition* partRight     = getPartition(px+1, py);
+    if(partRight && partRight->isInitialized())
+    {
+      // Copy right border
+      for(unsigned int i=0; i<height; i++)
       {
-        TsdGridPartition* partUp        = _partitions[py+1][px];
-        if(partUp->isInitialized())
-        {
-          // Copy upper border
-          for(unsigned int i=0; i<width; i++)
-          {
-            partCur->_grid[height][i].tsd = partUp->_grid[0][i].tsd;
-            partCur->_grid[height][i].weight = partUp->_grid[0][i].weight;
-          }
-        }
+        partCur->_grid[i][width].tsd = partRight->_grid[i][0].tsd;
+        partCur->_grid[i][width].weight = partRight->_grid[i][0].weight;
       }
+    }
+  }
 
-      if(px<(_partitionsInX-1) && py<(_partitionsInY-1))
+  if(py<(_partitionsInY-1))
+  {
+    TsdGridPartition* partUp        = getPartition(px, py+1);
+    if(partUp && partUp->isInitialized())
+    {
+      // Copy upper border
+      for(unsigned int i=0; i<width; i++)
       {
-        TsdGridPartition* partUpRight   = _partitions[py+1][px+1];
-        if(partUpRight->isInitialized())
-        {
-          // Copy upper right corner
-          partCur->_grid[height][width].tsd = partUpRight->_grid[0][0].tsd;
-          partCur->_grid[height][width].weight = partUpRight->_grid[0][0].weight;
-        }
+        partCur->_grid[height][i].tsd = partUp->_grid[0][i].tsd;
+        partCur->_grid[height][i].weight = partUp->_grid[0][i].weight;
       }
     }
   }
+
+  if(px<(_partitionsInX-1) && py<(_partitionsInY-1))
+  {
+    TsdGridPartition* partUpRight   = getPartition(px+1, py+1);
+    if(partUpRight && partUpRight->isInitialized())
+    {
+      // Copy upper right corner
+      partCur->_grid[height][width].tsd = partUpRight->_grid[0][0].tsd;
+      partCur->_grid[height][width].weight = partUpRight->_grid[0][0].weight;
+    }
+  }
+}
+
+void TsdGrid::invalidateBorders(const unsigned int px, const unsigned int py)
+{
+  const unsigned int width  = _dimPartition;
+  const unsigned int height = _dimPartition;
+
+  TsdGridPartition* partLeft = (px>0) ? getPartition(px-1, py) : NULL;
+  if(partLeft && partLeft->isInitialized())
+  {
+    for(unsigned int i=0; i<height; i++)
+    {
+      partLeft->_grid[i][width].tsd = NAN;
+      partLeft->_grid[i][width].weight = 0.0;
+    }
+  }
+
+  TsdGridPartition* partDown = (py>0) ? getPartition(px, py-1) : NULL;
+  if(partDown && partDown->isInitialized())
+  {
+    for(unsigned int i=0; i<width; i++)
+    {
+      partDown->_grid[height][i].tsd = NAN;
+      partDown->_grid[height][i].weight = 0.0;
+    }
+  }
+
+  TsdGridPartition* partDownLeft = (px>0 && py>0) ? getPartition(px-1, py-1) : NULL;
+  if(partDownLeft && partDownLeft->isInitialized())
+  {
+    partDownLeft->_grid[height][width].tsd = NAN;
+    partDownLeft->_grid[height][width].weight = 0.0;
+  }
 }
 
 void TsdGrid::grid2ColorImage(unsigned char* image, unsigned int width, unsigned int height)
 {
   unsigned char rgb[3];
 
-  obfloat stepW = getMaxX() / (obfloat)width;
-  obfloat stepH = getMaxY() / (obfloat)height;
+  obfloat stepW = (getMaxX()-getMinX()) / (obfloat)width;
+  obfloat stepH = (getMaxY()-getMinY()) / (obfloat)height;
 
-  obfloat py = 0.0;
+  obfloat py = getMinY();
   unsigned int i = 0;
   for(unsigned int h=0; h<height; h++)
   {
-    obfloat px = 0.0;
+    obfloat px = getMinX();
     for(unsigned int w=0; w<width; w++, i++)
     {
       obfloat coord[2];
@@ -426,10 +621,14 @@ void TsdGrid::grid2ColorImage(unsigned char* image, unsigned int width, unsigned
 
       if(coord2Cell(coord, &p, &x, &y, &dx, &dy))
       {
-        if(_partitions[0][p]->isInitialized())
-          tsd = _partitions[0][p]->_grid[y][x].tsd;
+        TsdGridPartition* part = getPartition(p);
+        if(part)
+        {
+          if(part->isInitialized())
+            tsd = part->_grid[y][x].tsd;
 
-        isEmpty = _partitions[0][p]->isEmpty();
+          isEmpty = part->isEmpty();
+        }
       }
 
       if(tsd>0.0)
@@ -472,14 +671,15 @@ void TsdGrid::getData(std::vector<double>& data)
   obfloat dx = 0.0;
   obfloat dy = 0.0;
   obfloat tsd = 0.0;
-  for(coordVar[1] = 0.0; coordVar[1] < _maxY; coordVar[1] += _cellSize)
+  for(coordVar[1] = _minY; coordVar[1] < _maxY; coordVar[1] += _cellSize)
   {
-    for(coordVar[0] = 0.0; coordVar[0] < _maxX; coordVar[0] += _cellSize)
+    for(coordVar[0] = _minX; coordVar[0] < _maxX; coordVar[0] += _cellSize)
     {
       if(this->coord2Cell(coordVar, &p, &x, &y, &dx, &dy))
       {
-        if(_partitions[0][p]->isInitialized())
-          tsd = _partitions[0][p]->_grid[y][x].tsd;
+        TsdGridPartition* part = getPartition(p);
+        if(part && part->isInitialized())
+          tsd = part->_grid[y][x].tsd;
         else
           tsd = NAN;
       }
@@ -521,13 +721,16 @@ bool TsdGrid::interpolateNormal(const obfloat* coord, obfloat* normal)
   return true;
 }
 
-bool TsdGrid::storeGrid(const std::string& path)
+bool TsdGrid::storeGrid(const std::string& path, const EnumTsdGridFormat format)
 {
   if(!path.size())
   {
     LOGMSG(DBG_ERROR, " error! Path invalid!\n");
     return(false);
   }
+  if(format != FORMAT_GRID_ASCII)
+    return storeBinary(path, format == FORMAT_GRID_QUANTIZED);
+
   std::fstream outFile;
   outFile.open(path.c_str(), std::fstream::out);
   if(!outFile.is_open())
@@ -545,9 +748,9 @@ bool TsdGrid::storeGrid(const std::string& path)
     for(int x = 0; x < _partitionsInX; x++)
     {
       //generate partition identifier
-      TsdGridPartition* curPart = _partitions[y][x];
+      TsdGridPartition* curPart = getPartition(x, y);
       EnumTsdGridPartitionIdentifier id;
-      if(curPart->isInitialized())
+      if(curPart && curPart->isInitialized())
       {
         id = CONTENT;
         outFile << id << "\n";
@@ -562,7 +765,7 @@ bool TsdGrid::storeGrid(const std::string& path)
       }
       else //partition is not initialized
       {
-        if(curPart->isEmpty()) //partition is not initialized but empty
+        if(curPart && curPart->isEmpty()) //partition is not initialized but empty
         {
           id = EMPTY;
           outFile << id << "\n";
@@ -584,10 +787,10 @@ bool TsdGrid::storeGrid(const std::string& path)
 
 bool TsdGrid::freeFootprint(const obfloat centerCoords[2], const obfloat width, const obfloat height)
 {
-  unsigned int minX = static_cast<unsigned int>((centerCoords[0] - width * 0.5) / _cellSize + 0.5);
-  unsigned int maxX = static_cast<unsigned int>((centerCoords[0] + width * 0.5) / _cellSize + 0.5);
-  unsigned int minY = static_cast<unsigned int>((centerCoords[1] - height * 0.5) / _cellSize + 0.5);
-  unsigned int maxY = static_cast<unsigned int>((centerCoords[1] + height * 0.5) / _cellSize + 0.5);
+  unsigned int minX = static_cast<unsigned int>((centerCoords[0] - _minX - width * 0.5) / _cellSize + 0.5);
+  unsigned int maxX = static_cast<unsigned int>((centerCoords[0] - _minX + width * 0.5) / _cellSize + 0.5);
+  unsigned int minY = static_cast<unsigned int>((centerCoords[1] - _minY - height * 0.5) / _cellSize + 0.5);
+  unsigned int maxY = static_cast<unsigned int>((centerCoords[1] - _minY + height * 0.5) / _cellSize + 0.5);
 
   //check whether indices are in bounds
   if((minX > static_cast<unsigned int>(_cellsX)) || (maxX > static_cast<unsigned int>(_cellsX)) ||
@@ -596,20 +799,580 @@ bool TsdGrid::freeFootprint(const obfloat centerCoords[2], const obfloat width,
     LOGMSG(DBG_ERROR, " Error indices out of bounds\n");
     return false;
   }
-  unsigned int dimPartition = static_cast<unsigned int>(_dimPartition);
-  for(unsigned int rows = minY; rows < maxY; rows++)
+  if(minX >= maxX || minY >= maxY) return true;
+
+  _revision++;
+  const unsigned int dimPartition = static_cast<unsigned int>(_dimPartition);
+  for(unsigned int py = minY / dimPartition; py <= (maxY-1) / dimPartition; py++)
+  {
+    for(unsigned int px = minX / dimPartition; px <= (maxX-1) / dimPartition; px++)
+    {
+      // Covered cells of partition
+      const unsigned int cxMin = max(minX, px*dimPartition) - px*dimPartition;
+      const unsigned int cxMax = min(maxX, (px+1)*dimPartition) - px*dimPartition;
+      const unsigned int cyMin = max(minY, py*dimPartition) - py*dimPartition;
+      const unsigned int cyMax = min(maxY, (py+1)*dimPartition) - py*dimPartition;
+
+      TsdGridPartition* part = acquirePartition(px, py);
+      part->_lastPush = _pushes;
+      part->_revision = _revision;
+
+      if(cxMin==0 && cyMin==0 && cxMax==dimPartition && cyMax==dimPartition)
+      {
+        // Partition is free as a whole, cells are released. Emptiness keeps the confidence of cells, at least that of a single observation.
+        obfloat weight = max(part->_initWeight, (obfloat)1.0);
+        if(part->isInitialized())
+        {
+          for(unsigned int cy = 0; cy < dimPartition; cy++)
+            for(unsigned int cx = 0; cx < dimPartition; cx++)
+              weight = max(weight, part->_grid[cy][cx].weight);
+        }
+        part->setEmpty(weight);
+        continue;
+      }
+
+      if(!part->isInitialized())   //partition uninitialized -> initialize
+        part->init(_maxTruncation);
+      for(unsigned int cy = cyMin; cy < cyMax; cy++)
+        for(unsigned int cx = cxMin; cx < cxMax; cx++)
+          (*part)(cy, cx) = TSDINC;
+    }
+  }
+
+  // Freed cells are copied to borders of neighbors
+  const int pMin[2] = {(int)(minX / dimPartition), (int)(minY / dimPartition)};
+  const int pMax[2] = {(int)((maxX-1) / dimPartition), (int)((maxY-1) / dimPartition)};
+  propagateBorders(pMin, pMax);
+
+  return true;
+}
+
+void TsdGrid::setRollingWindow(const bool enable, const unsigned int threshold)
+{
+  _rolling = enable;
+  _rollingThreshold = threshold;
+}
+
+void TsdGrid::setEvictionStore(const char* path)
+{
+  if(path)
+    _storePath = path;
+  else
+    _storePath.clear();
+}
+
+void TsdGrid::getWindowIndex(int idx[2]) const
+{
+  idx[0] = _windowIndex[0];
+  idx[1] = _windowIndex[1];
+}
+
+void TsdGrid::followSensor(obfloat pos[2])
+{
+  obfloat partitionSize = _dimPartition * _cellSize;
+
+  // Displacement of sensor from central partition
+  int d[2];
+  d[0] = (int)floor((pos[0]-_minX) / partitionSize) - _partitionsInX/2;
+  d[1] = (int)floor((pos[1]-_minY) / partitionSize) - _partitionsInY/2;
+
+  for(int i=0; i<2; i++)
+    if(abs(d[i]) <= (int)_rollingThreshold) d[i] = 0;
+
+  shiftWindow(d[0], d[1]);
+}
+
+void TsdGrid::shiftWindow(const int dx, const int dy)
+{
+  if(dx==0 && dy==0) return;
+
+  _revision++;
+
+  Timer timer;
+  timer.start();
+
+  vector<TsdGridPartition*> partitions;
+  getAllocatedPartitions(partitions);
+
+  // Separate partitions remaining in grid from leaving ones
+  vector<TsdGridPartition*> remaining;
+  vector<TsdGridPartition*> evicted;
+  unsigned int stored = 0;
+  for(unsigned int i=0; i<partitions.size(); i++)
   {
-    for(unsigned int cols = minX; cols < maxX; cols++)
+    TsdGridPartition* part = partitions[i];
+    const int px = part->getX() / _dimPartition;
+    const int py = part->getY() / _dimPartition;
+
+    if(px-dx>=0 && px-dx<_partitionsInX && py-dy>=0 && py-dy<_partitionsInY)
+    {
+      remaining.push_back(part);
+    }
+    else
     {
-      unsigned int py = rows / dimPartition;
-      unsigned int px = cols / dimPartition;
-      if(!_partitions[py][px]->isInitialized())   //partition uninitialized -> initialize
-        _partitions[py][px]->init(_maxTruncation);
-      unsigned int cy = rows % dimPartition;
-      unsigned int cx = cols % dimPartition;
-      (*_partitions[py][px])(cy, cx) = TSDINC;
+      if(!_storePath.empty() && (part->isInitialized() || part->isEmpty()))
+      {
+        storePartition(part, px+_windowIndex[0], py+_windowIndex[1]);
+        stored++;
+      }
+      part->reset();
+      evicted.push_back(part);
     }
   }
+
+  // Move origin of grid
+  obfloat partitionSize = _dimPartition * _cellSize;
+  _windowIndex[0] += dx;
+  _windowIndex[1] += dy;
+  _minX = ((obfloat)_windowIndex[0]) * partitionSize;
+  _minY = ((obfloat)_windowIndex[1]) * partitionSize;
+  _maxX = _minX + ((obfloat)_cellsX + 0.5) * _cellSize;
+  _maxY = _minY + ((obfloat)_cellsY + 0.5) * _cellSize;
+  obfloat origin[2] = {_minX, _minY};
+
+  // Remaining partitions keep their position in world coordinates, but get new indices
+  for(unsigned int i=0; i<remaining.size(); i++)
+  {
+    TsdGridPartition* part = remaining[i];
+    part->relocate(part->getX()-dx*_dimPartition, part->getY()-dy*_dimPartition, origin);
+  }
+
+  unsigned int restored = 0;
+  if(_storage==STORAGE_GRID_HASHED)
+  {
+    _hash->clear();
+    for(unsigned int i=0; i<remaining.size(); i++)
+    {
+      TsdGridPartition* part = remaining[i];
+      _hash->insert((part->getY()/_dimPartition)*_partitionsInX+part->getX()/_dimPartition, part);
+    }
+    for(unsigned int i=0; i<evicted.size(); i++)
+      delete evicted[i];
+
+    // Restore stored partitions entering the grid, i.e., the slots on the opposite side of the evicted ones
+    if(!_stored.empty())
+    {
+      for(int py=0; py<_partitionsInY; py++)
+      {
+        for(int px=0; px<_partitionsInX; px++)
+        {
+          if(px+dx>=0 && px+dx<_partitionsInX && py+dy>=0 && py+dy<_partitionsInY) continue;
+          TsdGridPartition* part = new TsdGridPartition(px*_dimPartition, py*_dimPartition, _dimPartition, _dimPartition, _cellSize, origin);
+          if(restorePartition(part, px+_windowIndex[0], py+_windowIndex[1]))
+          {
+            part->_lastPush = _pushes;
+            _hash->insert(py*_partitionsInX+px, part);
+            restored++;
+          }
+          else
+            delete part;
+        }
+      }
+    }
+  }
+  else
+  {
+    for(int py=0; py<_partitionsInY; py++)
+      for(int px=0; px<_partitionsInX; px++)
+        _partitions[py][px] = NULL;
+
+    for(unsigned int i=0; i<remaining.size(); i++)
+    {
+      TsdGridPartition* part = remaining[i];
+      _partitions[part->getY()/_dimPartition][part->getX()/_dimPartition] = part;
+    }
+
+    // Recycle evicted partitions for vacant slots, number of both is equal
+    unsigned int e = 0;
+    for(int py=0; py<_partitionsInY; py++)
+    {
+      for(int px=0; px<_partitionsInX; px++)
+      {
+        if(_partitions[py][px]) continue;
+        TsdGridPartition* part = evicted[e++];
+        part->relocate(px*_dimPartition, py*_dimPartition, origin);
+        part->_lastPush = _pushes;
+        _partitions[py][px] = part;
+        if(!_stored.empty() && restorePartition(part, px+_windowIndex[0], py+_windowIndex[1]))
+          restored++;
+      }
+    }
+
+    buildTree();
+  }
+
+  // Neighborhoods changed at the edges of the grid, borders are rebuilt
+  partitions.clear();
+  getAllocatedPartitions(partitions);
+  for(unsigned int i=0; i<partitions.size(); i++)
+    partitions[i]->clearBorders();
+  propagateBorders();
+
+  LOGMSG(DBG_DEBUG, "Shifted grid by (" << dx << ", " << dy << ") partitions in " << timer.elapsed() << "s, evicted: "
+      << evicted.size() << ", stored: " << stored << ", restored: " << restored);
+}
+
+std::string TsdGrid::getStoreFilename(const int gx, const int gy) const
+{
+  std::stringstream s;
+  s << _storePath << "/partition_" << gx << "_" << gy << ".tsd";
+  return s.str();
+}
+
+void TsdGrid::storePartition(TsdGridPartition* part, const int gx, const int gy)
+{
+  std::string filename = getStoreFilename(gx, gy);
+
+  // Partitions are stored as binary files with a single chunk
+  TsdGridFileHeader header;
+  getFileHeader(&header);
+  TsdGridFileWriter writer;
+  if(!writer.open(filename.c_str(), header))
+  {
+    LOGMSG(DBG_ERROR, "Could not store partition in " << filename);
+    return;
+  }
+
+  vector<unsigned char> buf;
+  part->serialize(buf);
+  TsdGridChunk chunk;
+  memset(&chunk, 0, sizeof(chunk));
+  chunk.index[0] = gx;
+  chunk.index[1] = gy;
+  chunk.flags = part->isInitialized() ? GRIDCHUNK_INITIALIZED : 0;
+  chunk.initWeight = part->_initWeight;
+  chunk.size = buf.size();
+  writer.write(chunk, buf.empty() ? NULL : &buf[0]);
+  if(!writer.close())
+  {
+    LOGMSG(DBG_ERROR, "Could not store partition in " << filename);
+    return;
+  }
+
+  StoreIndex idx;
+  idx.x = gx;
+  idx.y = gy;
+  _stored.insert(idx);
+}
+
+bool TsdGrid::restorePartition(TsdGridPartition* part, const int gx, const int gy)
+{
+  StoreIndex idx;
+  idx.x = gx;
+  idx.y = gy;
+  if(_stored.find(idx)==_stored.end()) return false;
+  _stored.erase(idx);
+
+  std::string filename = getStoreFilename(gx, gy);
+  TsdGridFile file;
+  if(!file.open(filename.c_str()) || file.getChunkCount()!=1)
+  {
+    LOGMSG(DBG_ERROR, "Could not restore partition from " << filename);
+    return false;
+  }
+  bool success = decodeChunk(file, 0, part);
+  remove(filename.c_str());
+
+  return success;
+}
+
+void TsdGrid::getFileHeader(TsdGridFileHeader* header) const
+{
+  memset(header, 0, sizeof(*header));
+  header->cellSize = _cellSize;
+  header->maxTruncation = _maxTruncation;
+  header->layoutPartition = _layoutPartitions;
+  header->layoutGrid = _layoutGrid;
+  header->window[0] = _windowIndex[0];
+  header->window[1] = _windowIndex[1];
+}
+
+bool TsdGrid::decodeChunk(const TsdGridFile& file, const unsigned int chunk, TsdGridPartition* part)
+{
+  const TsdGridChunk& c = file.getChunk(chunk);
+  part->reset();
+  part->_revision = _revision;
+
+  if(!file.verifyChunk(chunk))
+  {
+    LOGMSG(DBG_ERROR, "Checksum mismatch of partition (" << c.index[0] << ", " << c.index[1] << ")");
+    return false;
+  }
+
+  if((c.flags & GRIDCHUNK_INITIALIZED) && !part->load(file.getChunkData(chunk), c.size, _maxTruncation, (c.flags & GRIDCHUNK_QUANTIZED)!=0))
+  {
+    LOGMSG(DBG_ERROR, "Corrupted data of partition (" << c.index[0] << ", " << c.index[1] << ")");
+    part->reset();
+    return false;
+  }
+  part->_initWeight = min((obfloat)c.initWeight, TSDGRIDMAXWEIGHT);
+
+  return true;
+}
+
+bool TsdGrid::isPartitionInRegion(const int px, const int py, const obfloat* coordMin, const obfloat* coordMax) const
+{
+  if(!coordMin || !coordMax) return true;
+
+  obfloat partitionSize = _dimPartition * _cellSize;
+  obfloat x = _minX + px * partitionSize;
+  obfloat y = _minY + py * partitionSize;
+  return (x <= coordMax[0] && x + partitionSize >= coordMin[0] && y <= coordMax[1] && y + partitionSize >= coordMin[1]);
+}
+
+bool TsdGrid::loadChunks(const TsdGridFile& file, const obfloat* coordMin, const obfloat* coordMax)
+{
+  // Instantiation is serial, since the hash table must not be modified during concurrent access
+  _revision++;
+  vector<TsdGridPartition*> parts;
+  vector<unsigned int> chunks;
+  for(unsigned int i=0; i<file.getChunkCount(); i++)
+  {
+    const TsdGridChunk& c = file.getChunk(i);
+    int px = c.index[0] - _windowIndex[0];
+    int py = c.index[1] - _windowIndex[1];
+    if(px<0 || px>=_partitionsInX || py<0 || py>=_partitionsInY) continue;
+    if(!isPartitionInRegion(px, py, coordMin, coordMax)) continue;
+    parts.push_back(acquirePartition(px, py));
+    chunks.push_back(i);
+  }
+
+  int corrupted = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:corrupted)
+  for(int i=0; i<(int)parts.size(); i++)
+  {
+    if(!decodeChunk(file, chunks[i], parts[i]))
+      corrupted++;
+  }
+
+  propagateBorders();
+
+  LOGMSG(DBG_DEBUG, "Loaded " << parts.size()-corrupted << " of " << file.getChunkCount() << " partitions");
+
+  return (corrupted==0);
+}
+
+bool TsdGrid::initLayout(const double cellSize, const int layoutPartition, const int layoutGrid, const double maxTruncation, const EnumTsdGridStorage storage)
+{
+  if(!(cellSize > 0.0) || isinf(cellSize) || !(maxTruncation > 0.0) || isinf(maxTruncation))
+  {
+    LOGMSG(DBG_ERROR, "Invalid cell size or truncation radius");
+    return false;
+  }
+  if(layoutPartition < LAYOUT_1x1 || layoutGrid > LAYOUT_36768x36768 || layoutPartition > layoutGrid)
+  {
+    LOGMSG(DBG_ERROR, "Invalid partition or grid layout");
+    return false;
+  }
+
+  init(cellSize, (EnumTsdGridLayout)layoutPartition, (EnumTsdGridLayout)layoutGrid, storage);
+  setMaxTruncation(maxTruncation);
+  return true;
+}
+
+/**
+ * Read a line containing a single number
+ * @return false, if the line is missing or does not start with a number
+ */
+static bool readLine(std::istream& source, double* value)
+{
+  std::string line;
+  if(!std::getline(source, line)) return false;
+  char* end;
+  *value = strtod(line.c_str(), &end);
+  return (end != line.c_str());
+}
+
+static bool readLine(std::istream& source, int* value)
+{
+  std::string line;
+  if(!std::getline(source, line)) return false;
+  char* end;
+  *value = (int)strtol(line.c_str(), &end, 10);
+  return (end != line.c_str());
+}
+
+bool TsdGrid::loadAscii(std::istream& source, const EnumTsdGridStorage storage, const obfloat* coordMin, const obfloat* coordMax)
+{
+  /* Data file:
+   * Cell dimensions
+   * Grid dimensions
+   * Grid data partition[row][col].cells[row][col]
+   */
+  double cellSize;
+  int layoutPartition;
+  int layoutGrid;
+  double maxTruncation;
+  if(!readLine(source, &cellSize) || !readLine(source, &layoutPartition) || !readLine(source, &layoutGrid) || !readLine(source, &maxTruncation))
+  {
+    LOGMSG(DBG_ERROR, "Incomplete header of grid data");
+    return false;
+  }
+  if(!initLayout(cellSize, layoutPartition, layoutGrid, maxTruncation, storage)) return false;
+
+  bool success = true;
+  for(int y = 0; y < _partitionsInY && success; y++)
+  {
+    for(int x = 0; x < _partitionsInX && success; x++)
+    {
+      int id;
+      if(!readLine(source, &id))
+      {
+        LOGMSG(DBG_ERROR, "Grid data is truncated at partition (" << x << "/" << y << ")");
+        success = false;
+        break;
+      }
+
+      // Partitions outside of the region of interest are parsed, but not kept
+      const bool keep = isPartitionInRegion(x, y, coordMin, coordMax);
+      if(id == UNINITIALIZED)
+      {
+        continue;
+      }
+      else if(id == EMPTY)
+      {
+        double initWeight;
+        success = readLine(source, &initWeight);
+        if(success && keep)
+        {
+          TsdGridPartition* curPart = acquirePartition(x, y);
+          curPart->_initWeight = std::min(static_cast<obfloat>(initWeight), TSDGRIDMAXWEIGHT);
+        }
+      }
+      else if(id == CONTENT)
+      {
+        TsdGridPartition* curPart = keep ? acquirePartition(x, y) : NULL;
+        if(curPart) curPart->init(_maxTruncation);
+        for(int i = 0; i < _dimPartition*_dimPartition && success; i++)
+        {
+          double tsd;
+          double weight;
+          success = readLine(source, &tsd) && readLine(source, &weight);
+          if(success && curPart)
+          {
+            curPart->_grid[i/_dimPartition][i%_dimPartition].tsd = static_cast<obfloat>(tsd);
+            curPart->_grid[i/_dimPartition][i%_dimPartition].weight = static_cast<obfloat>(weight);
+          }
+        }
+      }
+      else
+      {
+        LOGMSG(DBG_ERROR, "Unknown partition identifier for partition(" << x << "/" << y << ")");
+        success = false;
+      }
+
+      if(!success && (id == EMPTY || id == CONTENT))
+        LOGMSG(DBG_ERROR, "Grid data is corrupted at partition (" << x << "/" << y << ")");
+    }
+  }
+  propagateBorders();
+
+  return success;
+}
+
+bool TsdGrid::deserialize(const std::string& data, const EnumTsdGridLoadSource source, const EnumTsdGridStorage storage,
+                          const obfloat* coordMin, const obfloat* coordMax)
+{
+  if(source == FILE_SOURCE && TsdGridFile::isBinary(data.c_str()))
+  {
+    TsdGridFile file;
+    if(!file.open(data.c_str())) return false;
+    const TsdGridFileHeader& h = file.getHeader();
+    if(!initLayout(h.cellSize, h.layoutPartition, h.layoutGrid, h.maxTruncation, storage)) return false;
+    shiftWindow(h.window[0], h.window[1]);
+    return loadChunks(file, coordMin, coordMax);
+  }
+
+  if(source == FILE_SOURCE)
+  {
+    std::ifstream inFile(data.c_str(), std::fstream::in);
+    if(!inFile.is_open())
+    {
+      LOGMSG(DBG_ERROR, " error opening file " << data << "\n");
+      return false;
+    }
+    return loadAscii(inFile, storage, coordMin, coordMax);
+  }
+
+  std::stringstream ss;
+  ss << data;
+  LOGMSG(DBG_DEBUG, "loaded " << ss.str().size() << " characters into stringstream\n");
+  return loadAscii(ss, storage, coordMin, coordMax);
+}
+
+TsdGrid* TsdGrid::load(const std::string& path, const EnumTsdGridStorage storage, const obfloat* coordMin, const obfloat* coordMax)
+{
+  TsdGrid* grid = new TsdGrid();
+  if(!grid->deserialize(path, FILE_SOURCE, storage, coordMin, coordMax))
+  {
+    LOGMSG(DBG_ERROR, "Could not load grid from " << path);
+    delete grid;
+    return NULL;
+  }
+  return grid;
+}
+
+bool TsdGrid::loadRegion(const std::string& path, const obfloat coordMin[2], const obfloat coordMax[2])
+{
+  TsdGridFile file;
+  if(!file.open(path.c_str())) return false;
+
+  const TsdGridFileHeader& h = file.getHeader();
+  if(h.cellSize!=_cellSize || h.layoutPartition!=_layoutPartitions)
+  {
+    LOGMSG(DBG_ERROR, path << " does not match resolution or partition layout of grid");
+    return false;
+  }
+
+  return loadChunks(file, coordMin, coordMax);
+}
+
+bool TsdGrid::storeBinary(const std::string& path, const bool quantize)
+{
+  TsdGridFileHeader header;
+  getFileHeader(&header);
+
+  // Output is moved to its destination when complete, so that an existing file is not lost on failure
+  std::string tmp = path + ".tmp";
+  TsdGridFileWriter writer;
+  if(!writer.open(tmp.c_str(), header)) return false;
+
+  // Encode partitions row-wise in parallel, write chunks serially
+  vector< vector<unsigned char> > bufs(_partitionsInX);
+  vector<TsdGridChunk> chunks(_partitionsInX);
+  vector<char> keep(_partitionsInX);
+  bool success = true;
+  for(int py=0; py<_partitionsInY; py++)
+  {
+#pragma omp parallel for schedule(dynamic)
+    for(int px=0; px<_partitionsInX; px++)
+    {
+      // Partitions without any information are omitted
+      TsdGridPartition* part = getPartition(px, py);
+      keep[px] = (part && (part->isInitialized() || part->isEmpty()));
+      if(!keep[px]) continue;
+
+      TsdGridChunk& chunk = chunks[px];
+      memset(&chunk, 0, sizeof(chunk));
+      chunk.index[0] = px+_windowIndex[0];
+      chunk.index[1] = py+_windowIndex[1];
+      part->serialize(bufs[px], quantize);
+      chunk.flags = (part->isInitialized() ? GRIDCHUNK_INITIALIZED : 0) | (quantize ? GRIDCHUNK_QUANTIZED : 0);
+      chunk.initWeight = part->_initWeight;
+      chunk.size = bufs[px].size();
+    }
+
+    for(int px=0; px<_partitionsInX; px++)
+      if(keep[px]) success &= writer.write(chunks[px], bufs[px].empty() ? NULL : &bufs[px][0]);
+  }
+
+  if(!writer.close() || !success || rename(tmp.c_str(), path.c_str())!=0)
+  {
+    LOGMSG(DBG_ERROR, "Could not write file " << path);
+    remove(tmp.c_str());
+    return false;
+  }
+
   return true;
 }
 
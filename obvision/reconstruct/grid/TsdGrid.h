@@ -4,6 +4,12 @@
 #include "obcore/math/linalg/linalg.h"
 #include "obvision/reconstruct/grid/SensorPolar2D.h"
 #include "TsdGridPartition.h"
+#include "obvision/reconstruct/PartitionHash.h"
+#include "TsdGridFile.h"
+#include "TsdGridFusionKernel.h"
+
+#include <set>
+#include <string>
 
 namespace obvious
 {
@@ -38,6 +44,13 @@ enum EnumTsdGridLoadSource{ FILE_SOURCE = 0,
   STRING_SOURCE = 1
 };
 
+enum EnumTsdGridStorage { STORAGE_GRID_DENSE=0,
+  STORAGE_GRID_HASHED=1};
+
+enum EnumTsdGridFormat { FORMAT_GRID_ASCII=0,
+  FORMAT_GRID_BINARY=1,
+  FORMAT_GRID_QUANTIZED=2};
+
 /**
  * @class TsdGrid
  * @brief Grid on the basis of true signed distance functions
@@ -53,15 +66,21 @@ public:
    * @param[in] cellSize Size of cell in meters
    * @param[in] layoutPartition Partition layout, i.e., cells in partition
    * @param[in] layoutGrid Grid layout, i.e., partitions in grid
+   * @param[in] storage Partition storage: STORAGE_GRID_DENSE instantiates all partitions in advance,
+   *                    STORAGE_GRID_HASHED creates partitions on demand, when they are observed for the first time
    */
-  TsdGrid(const obfloat cellSize, const EnumTsdGridLayout layoutPartition, const EnumTsdGridLayout layoutGrid);
+  TsdGrid(const obfloat cellSize, const EnumTsdGridLayout layoutPartition, const EnumTsdGridLayout layoutGrid,
+          const EnumTsdGridStorage storage=STORAGE_GRID_DENSE);
 
   /**
    * Constructor
-   * Loads the grid data out of a given file. File has to be correct it is not being checked.
-   * @param[in] path path to the data file
+   * Loads the grid data out of a given file or string, binary files (see storeGrid) are detected automatically.
+   * Invalid data is reported by an error message and the grid keeps the data loaded so far, see TsdGrid::load for detecting failures.
+   * @param[in] data path to the data file or data itself
+   * @param[in] source source of data
+   * @param[in] storage partition storage of created grid
    */
-  TsdGrid(const std::string& data, const EnumTsdGridLoadSource source = FILE_SOURCE);
+  TsdGrid(const std::string& data, const EnumTsdGridLoadSource source = FILE_SOURCE, const EnumTsdGridStorage storage=STORAGE_GRID_DENSE);
 
   /**
    * Destructor
@@ -70,7 +89,7 @@ public:
 
   /**
    * Access truncated signed distance at specific cell. This method does not check validity of indices.
-   * The specific cell might not be instantiated.
+   * The specific cell might not be instantiated, with hashed storage neither its partition.
    * @param y y coordinate
    * @param x x coordinate
    * @return truncated signed distance
@@ -86,7 +105,7 @@ public:
     // Cell index
     unsigned int cy = y % _dimPartition;
 
-    return (*_partitions[py][px])(cy, cx);
+    return (*getPartition(px, py))(cy, cx);
   }
 
   /**
@@ -141,7 +160,25 @@ public:
    * Get number of cells along edge
    * @return number of cells
    */
-  unsigned int getPartitionSize() const { return _partitions[0][0]->getWidth(); }
+  unsigned int getPartitionSize() const { return _dimPartition; }
+
+  /**
+   * Get number of partitions in x-dimension
+   * @return number of partitions
+   */
+  unsigned int getPartitionsInX() const { return _partitionsInX; }
+
+  /**
+   * Get number of partitions in y-dimension
+   * @return number of partitions
+   */
+  unsigned int getPartitionsInY() const { return _partitionsInY; }
+
+  /**
+   * Get partition storage type
+   * @return storage type
+   */
+  EnumTsdGridStorage getStorage() const { return _storage; }
 
   /**
    * Set maximum truncation radius
@@ -199,10 +236,36 @@ public:
 
   /**
    * Get pointer to internal partition space
-   * @return pointer to 3D partition space
+   * @return pointer to 2D partition space, NULL for hashed storage (use getPartition instead)
    */
   TsdGridPartition*** getPartitions() const { return _partitions; }
 
+  /**
+   * Get partition by its indices
+   * @param[in] px partition index in x-dimension
+   * @param[in] py partition index in y-dimension
+   * @return partition or NULL, if no partition has been allocated (hashed storage only)
+   */
+  TsdGridPartition* getPartition(const unsigned int px, const unsigned int py) const
+  {
+    if(_storage==STORAGE_GRID_DENSE) return _partitions[py][px];
+    return _hash->find(py*_partitionsInX+px);
+  }
+
+  /**
+   * Get all allocated partitions
+   * @param[out] partitions partition list (appended)
+   */
+  void getAllocatedPartitions(vector<TsdGridPartition*> &partitions) const;
+
+  /**
+   * Release partitions, which have not been within reach of measurements for a number of pushes. Released partitions
+   * lose their data, with hashed storage they are deleted.
+   * @param[in] age number of pushes
+   * @return number of released partitions
+   */
+  unsigned int releasePartitions(const unsigned int age);
+
   /**
    * Determine whether sensor is in grid
    * @param sensor
@@ -212,12 +275,35 @@ public:
   /**
    * Method to write the content of the grid into a given file
    * @param path Path where data file is created
+   * @param format FORMAT_GRID_ASCII writes one line per value, FORMAT_GRID_BINARY writes checksummed partition chunks and an index table
+   * (see TsdGridFile), FORMAT_GRID_QUANTIZED additionally reduces the precision of cells to 16 bit per value
    * @return True in case of success
    */
-  bool storeGrid(const std::string& path);
+  bool storeGrid(const std::string& path, const EnumTsdGridFormat format=FORMAT_GRID_ASCII);
 
   /**
-   * Method to set the grid in a certain area as empty
+   * Load grid from file, the file format is detected automatically
+   * @param[in] path path to the data file
+   * @param[in] storage partition storage of created grid
+   * @param[in] coordMin minimum coordinates of region of interest, partitions outside are not loaded (NULL: whole grid)
+   * @param[in] coordMax maximum coordinates of region of interest
+   * @return grid instance, NULL if the file is missing, truncated or corrupted
+   */
+  static TsdGrid* load(const std::string& path, const EnumTsdGridStorage storage=STORAGE_GRID_DENSE,
+                       const obfloat* coordMin=NULL, const obfloat* coordMax=NULL);
+
+  /**
+   * Load further partitions of a binary file within a region of interest, e.g., after loading the surrounding of the robot on startup.
+   * Data of loaded partitions is replaced.
+   * @param[in] path path to binary data file of same resolution and partition layout
+   * @param[in] coordMin minimum coordinates of region
+   * @param[in] coordMax maximum coordinates of region
+   * @return false, if the file is not compatible or any partition within the region is corrupted
+   */
+  bool loadRegion(const std::string& path, const obfloat coordMin[2], const obfloat coordMax[2]);
+
+  /**
+   * Method to set the grid in a certain area as empty. Cells of partitions lying completely inside the area are released.
    * @param centerCoords footprint center
    * @param width width of footprint
    * @param height height of footprint
@@ -225,14 +311,145 @@ public:
    */
   bool freeFootprint(const obfloat centerCoords[2], const obfloat width, const obfloat height);
 
+  /**
+   * Enable rolling window mode: before data is pushed, the grid is shifted in steps of whole partitions
+   * in order to keep the sensor close to the centroid. Partitions leaving the grid are evicted and their memory is reused
+   * for partitions entering it on the opposite side.
+   * @param[in] enable enable flag
+   * @param[in] threshold tolerated displacement of the sensor from the central partition (in partitions) before shifting
+   */
+  void setRollingWindow(const bool enable, const unsigned int threshold=1);
+
+  /**
+   * Set directory for storing evicted partitions. Stored partitions are restored, when they re-enter the grid.
+   * @param[in] path existing directory, NULL disables storing (evicted partitions are discarded)
+   */
+  void setEvictionStore(const char* path);
+
+  /**
+   * Shift grid by whole partitions
+   * @param[in] dx shift in x-direction (in partitions)
+   * @param[in] dy shift in y-direction (in partitions)
+   */
+  void shiftWindow(const int dx, const int dy);
+
+  /**
+   * Get partition index of grid origin, i.e., the number of partitions the grid has been shifted by
+   * @param[out] idx partition index
+   */
+  void getWindowIndex(int idx[2]) const;
+
+  /**
+   * Get revision of grid, which is increased by every operation modifying cells. Modified partitions are stamped with
+   * the current revision, i.e., consumers of the grid can determine partitions changed since they have been visited last.
+   * @return revision
+   */
+  unsigned int getRevision() const { return _revision; }
+
 private:
 
-  void init(const double cellSize, const EnumTsdGridLayout layoutPartition, const EnumTsdGridLayout layoutGrid);
+  /**
+   * Constructor of uninitialized grid for loading
+   */
+  TsdGrid();
+
+  void init(const double cellSize, const EnumTsdGridLayout layoutPartition, const EnumTsdGridLayout layoutGrid, const EnumTsdGridStorage storage);
+
+  /**
+   * Get partition by its linear index, see coord2Cell
+   */
+  TsdGridPartition* getPartition(const unsigned int p) const
+  {
+    if(_storage==STORAGE_GRID_DENSE) return _partitions[0][p];
+    return _hash->find(p);
+  }
+
+  /**
+   * Get partition by its indices, with hashed storage a missing partition is created. Must not be called concurrently.
+   */
+  TsdGridPartition* acquirePartition(const unsigned int px, const unsigned int py);
+
+  /**
+   * Determine partitions within reach of the current measurements
+   * @param[out] pMin lower partition indices
+   * @param[out] pMax upper partition indices (inclusive)
+   * @param[out] range farthest distance of any cell, which can receive data
+   * @return false, if no partition is within reach
+   */
+  bool getPartitionRange(SensorPolar2D* sensor, obfloat pos[2], int pMin[2], int pMax[2], obfloat* range) const;
+
+  void pushHashed(SensorPolar2D* sensor, const TsdGridFusionFrame& frame, const int pMin[2], const int pMax[2]);
+
+  /**
+   * Fuse measurements into cells of a partition, cells are allocated when they receive data
+   * @param idx buffer for beam indices (size: number of cells in partition)
+   * @param sd buffer for signed distances (size: number of cells in partition)
+   */
+  void fusePartition(SensorPolar2D* sensor, const TsdGridFusionFrame& frame, TsdGridPartition* part, int* idx, obfloat* sd);
 
   void pushRecursion(SensorPolar2D* sensor, obfloat pos[2], TsdGridComponent* comp, vector<TsdGridPartition*> &partitionsToCheck);
 
+  /**
+   * Mark partitions within reach of the measurements with the current push number
+   */
+  void refreshPartitions(obfloat pos[2], const obfloat range, const int pMin[2], const int pMax[2]);
+
   void propagateBorders();
 
+  /**
+   * Propagate borders of partitions, whose data might have changed within a range of partitions
+   */
+  void propagateBorders(const int pMin[2], const int pMax[2]);
+
+  /**
+   * Copy data of neighbors to border cells of a partition
+   */
+  void propagateBorders(TsdGridPartition* partCur);
+
+  /**
+   * Invalidate border cells of neighbors referring to a partition
+   */
+  void invalidateBorders(const unsigned int px, const unsigned int py);
+
+  void buildTree();
+
+  /**
+   * Validate layout read from data and initialize grid
+   * @return false, if layout is invalid
+   */
+  bool initLayout(const double cellSize, const int layoutPartition, const int layoutGrid, const double maxTruncation, const EnumTsdGridStorage storage);
+
+  bool deserialize(const std::string& data, const EnumTsdGridLoadSource source, const EnumTsdGridStorage storage,
+                   const obfloat* coordMin, const obfloat* coordMax);
+
+  bool loadAscii(std::istream& source, const EnumTsdGridStorage storage, const obfloat* coordMin, const obfloat* coordMax);
+
+  /**
+   * Decode chunks of partitions within a region of interest in parallel
+   * @return false, if any chunk is corrupted
+   */
+  bool loadChunks(const TsdGridFile& file, const obfloat* coordMin, const obfloat* coordMax);
+
+  bool decodeChunk(const TsdGridFile& file, const unsigned int chunk, TsdGridPartition* part);
+
+  bool isPartitionInRegion(const int px, const int py, const obfloat* coordMin, const obfloat* coordMax) const;
+
+  void getFileHeader(TsdGridFileHeader* header) const;
+
+  bool storeBinary(const std::string& path, const bool quantize);
+
+  void followSensor(obfloat pos[2]);
+
+  std::string getStoreFilename(const int gx, const int gy) const;
+
+  void storePartition(TsdGridPartition* part, const int gx, const int gy);
+
+  /**
+   * Restore partition from eviction store, the file is removed afterwards
+   * @return false, if no partition has been stored for the indices
+   */
+  bool restorePartition(TsdGridPartition* part, const int gx, const int gy);
+
   TsdGridComponent* _tree;
 
   int _cellsX;
@@ -257,6 +474,16 @@ private:
 
   TsdGridPartition*** _partitions;
 
+  PartitionHash<TsdGridPartition>* _hash;
+
+  EnumTsdGridStorage _storage;
+
+  // Number of pushes, see releasePartitions
+  unsigned int _pushes;
+
+  // Number of modifications, see getRevision
+  unsigned int _revision;
+
   int _dimPartition;
 
   int _partitionsInX;
@@ -269,6 +496,26 @@ private:
 
   bool _initialPushAccomplished;
 
+  bool _rolling;
+
+  unsigned int _rollingThreshold;
+
+  int _windowIndex[2];
+
+  std::string _storePath;
+
+  struct StoreIndex
+  {
+    int x, y;
+    bool operator<(const StoreIndex& i) const
+    {
+      if(y!=i.y) return y<i.y;
+      return x<i.x;
+    }
+  };
+
+  std::set<StoreIndex> _stored;
+
 };
 
 inline EnumTsdGridInterpolate TsdGrid::interpolateBilinear(obfloat coord[2], obfloat* tsd)
@@ -280,12 +527,13 @@ inline EnumTsdGridInterpolate TsdGrid::interpolateBilinear(obfloat coord[2], obf
   obfloat dy;
 
   if(!coord2Cell(coord, &p, &x, &y, &dx, &dy)) return INTERPOLATE_INVALIDINDEX;
-  if(!_partitions[0][p]->isInitialized()) return INTERPOLATE_EMPTYPARTITION;
+  TsdGridPartition* part = getPartition(p);
+  if(!part || !part->isInitialized()) return INTERPOLATE_EMPTYPARTITION;
 
   const double wx = fabs((coord[0] - dx) * _invCellSize);
   const double wy = fabs((coord[1] - dy) * _invCellSize);
 
-  *tsd = _partitions[0][p]->interpolateBilinear(x, y, wx, wy);
+  *tsd = part->interpolateBilinear(x, y, wx, wy);
 
   if(isnan(*tsd))
     return INTERPOLATE_ISNAN;
@@ -296,15 +544,15 @@ inline EnumTsdGridInterpolate TsdGrid::interpolateBilinear(obfloat coord[2], obf
 inline bool TsdGrid::coord2Cell(obfloat coord[2], int* p, int* x, int* y, obfloat* dx, obfloat* dy)
 {
   // Get cell indices
-  const obfloat dCoordX = coord[0] * _invCellSize;
-  const obfloat dCoordY = coord[1] * _invCellSize;
+  const obfloat dCoordX = (coord[0] - _minX) * _invCellSize;
+  const obfloat dCoordY = (coord[1] - _minY) * _invCellSize;
 
   int xIdx = floor(dCoordX);
   int yIdx = floor(dCoordY);
 
   // Get center point of current cell
-  *dx = (obfloat(xIdx) + 0.5) * _cellSize;
-  *dy = (obfloat(yIdx) + 0.5) * _cellSize;
+  *dx = (obfloat(xIdx) + 0.5) * _cellSize + _minX;
+  *dy = (obfloat(yIdx) + 0.5) * _cellSize + _minY;
 
   // Ensure that query point has 4 neighbors for bilinear interpolation
   if (coord[0] < *dx)
@@ -0,0 +1,112 @@
+#ifndef TSDGRIDFILE_H
+#define TSDGRIDFILE_H
+
+#include "obvision/reconstruct/TsdChunkFile.h"
+
+namespace obvious
+{
+
+#define TSDGRIDFILE_MAGIC "OBTSDGR"
+#define TSDGRIDFILE_VERSION 2
+
+enum EnumTsdGridChunkFlags { GRIDCHUNK_INITIALIZED=1,
+  GRIDCHUNK_QUANTIZED=2};
+
+/**
+ * @struct TsdGridFileHeader
+ * @brief Header of binary TSD grid files
+ */
+struct TsdGridFileHeader : public TsdChunkFileHeader
+{
+  double cellSize;
+
+  double maxTruncation;
+
+  int32_t layoutPartition;
+
+  int32_t layoutGrid;
+
+  // partition index of grid origin (rolling window)
+  int32_t window[2];
+};
+
+/**
+ * @struct TsdGridChunk
+ * @brief Entry of chunk index table
+ */
+struct TsdGridChunk : public TsdChunk
+{
+  // global partition index, i.e., including the window offset
+  int32_t index[2];
+};
+
+/**
+ * @class TsdGridFile
+ * @brief Memory-mapped binary TSD grid file, partition chunks are encoded by TsdGridPartition::serialize.
+ * Chunks can be decoded independently, e.g., for loading a region of interest.
+ * @author Stefan May
+ */
+class TsdGridFile : public TsdChunkFile
+{
+public:
+
+  /**
+   * Constructor
+   */
+  TsdGridFile() : TsdChunkFile(TSDGRIDFILE_MAGIC, TSDGRIDFILE_VERSION, sizeof(TsdGridFileHeader), sizeof(TsdGridChunk)) { }
+
+  /**
+   * Check for binary file format
+   * @param[in] filename file name
+   * @return true, if file starts with the binary magic number
+   */
+  static bool isBinary(const char* filename) { return hasMagic(filename, TSDGRIDFILE_MAGIC); }
+
+  /**
+   * Get file header
+   * @return header
+   */
+  const TsdGridFileHeader& getHeader() const { return *(const TsdGridFileHeader*)_data; }
+
+  /**
+   * Get entry of index table
+   * @param[in] i chunk number
+   * @return index entry
+   */
+  const TsdGridChunk& getChunk(const unsigned int i) const { return ((const TsdGridChunk*)_index)[i]; }
+};
+
+/**
+ * @class TsdGridFileWriter
+ * @brief Writer of binary TSD grid files
+ * @author Stefan May
+ */
+class TsdGridFileWriter : public TsdChunkFileWriter
+{
+public:
+
+  /**
+   * Constructor
+   */
+  TsdGridFileWriter() : TsdChunkFileWriter(TSDGRIDFILE_MAGIC, TSDGRIDFILE_VERSION, sizeof(TsdGridFileHeader), sizeof(TsdGridChunk)) { }
+
+  /**
+   * Create file
+   * @param[in] filename file name
+   * @param[in] header file header, magic, version, checksums, chunk number and index offset are set by the writer
+   * @return success
+   */
+  bool open(const char* filename, const TsdGridFileHeader& header) { return TsdChunkFileWriter::open(filename, &header); }
+
+  /**
+   * Append chunk
+   * @param[in] chunk index entry, offset and checksum are determined by the writer
+   * @param[in] data encoded partition data of chunk.size bytes
+   * @return success
+   */
+  bool write(const TsdGridChunk& chunk, const unsigned char* data) { return TsdChunkFileWriter::write(&chunk, data); }
+};
+
+}
+
+#endif
@@ -0,0 +1,425 @@
+#include "TsdGridFusionKernel.h"
+
+#include <cmath>
+#include <algorithm>
+
+// Intrinsics are compiled with function-level target attributes, i.e., no global instruction set flags are needed.
+#if _OBVIOUS_DOUBLE_PRECISION_ && defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && (defined(__x86_64__) || defined(__i386__))
+#define TSDGRIDFUSION_SIMD 1
+#include <immintrin.h>
+#else
+#define TSDGRIDFUSION_SIMD 0
+#endif
+
+// Relative tolerance of squared distance tests, candidates are confirmed with exact distances
+#define TSDGRIDFUSION_TOLERANCE 1e-9
+
+namespace obvious
+{
+
+void TsdGridFusionKernel::initFrame(SensorPolar2D* sensor, const obfloat maxTruncation, TsdGridFusionFrame* frame)
+{
+  Matrix PoseInv = sensor->getTransformation();
+  PoseInv.invert();
+  for(unsigned int r=0; r<2; r++)
+    for(unsigned int c=0; c<3; c++)
+      frame->T[r*3+c] = PoseInv(r, c);
+
+  sensor->getPosition(frame->pos);
+  frame->data                 = sensor->getRealMeasurementData();
+  frame->mask                 = sensor->getRealMeasurementMask();
+  frame->beams                = sensor->getRealMeasurementSize();
+  frame->phiMin               = sensor->getPhiMin();
+  frame->phiLowerBound        = sensor->getPhiLowerBound();
+  frame->phiUpperBound        = sensor->getPhiUpperBound();
+  frame->angularResInv        = 1.0 / sensor->getAngularResolution();
+  frame->maxTruncation        = maxTruncation;
+  frame->lowReflectivityRange = sensor->getLowReflectivityRange();
+
+  const double res = sensor->getAngularResolution();
+  frame->borders.resize(2*(frame->beams+1));
+  for(unsigned int k=0; k<=frame->beams; k++)
+  {
+    const double phi = frame->phiMin + ((double)k - 0.5) * res;
+    frame->borders[2*k]   = cos(phi);
+    frame->borders[2*k+1] = sin(phi);
+  }
+
+  // atan2 maps to (-pi, pi], beyond these bounds angles are wrapped and cannot be compared with borders
+  frame->incremental = (frame->beams>0 && frame->phiLowerBound >= -M_PI && frame->phiUpperBound <= M_PI);
+}
+
+/**
+ * Determine beam index of sensor coordinates, see SensorPolar2D::backProject
+ * @return index or -1, if point is outside of the field of view
+ */
+static inline int beamIndex(const TsdGridFusionFrame& frame, const double x, const double y)
+{
+  const double phi = atan2(y, x);
+  if(phi<=frame.phiLowerBound || phi>=frame.phiUpperBound) return -1;
+  return round((phi-frame.phiMin) * frame.angularResInv);
+}
+
+/**
+ * Determine beam indices of row. Starting from a known beam, the beam of the next cell is found by moving over beam borders,
+ * i.e., a point lies in beam k, if it is left of border k and right of border k+1.
+ * Within twice the cell size of the sensor the angular step between cells is large, beams are determined directly there.
+ */
+static void indexRow(const TsdGridFusionFrame& frame, const obfloat coord[2], const obfloat step, const unsigned int n, int* indices)
+{
+  const double* T = frame.T;
+  const double* B = &frame.borders[0];
+  const int beams = frame.beams;
+
+  // Contribution of y-coordinate is constant along the row
+  const double b0 = T[1]*coord[1] + T[2];
+  const double b1 = T[4]*coord[1] + T[5];
+  const double minDist2 = 4.0*step*step;
+
+  int k = -1;
+  for(unsigned int i=0; i<n; i++)
+  {
+    const obfloat x = ((obfloat)i + 0.5) * step + coord[0];
+    const double sx = T[0]*x + b0;
+    const double sy = T[3]*x + b1;
+
+    if(k<0 || !frame.incremental || sx*sx+sy*sy < minDist2)
+    {
+      k = beamIndex(frame, sx, sy);
+    }
+    else
+    {
+      while(k<beams && B[2*k+2]*sy - B[2*k+3]*sx >= 0.0) k++;
+      while(k>=0 && B[2*k]*sy - B[2*k+1]*sx < 0.0) k--;
+      if(k>=beams) k = -1;
+    }
+
+    indices[i] = (k>=0 && frame.mask[k]) ? k : -1;
+  }
+}
+
+/**
+ * Determine signed distance of a single cell
+ * @return true, if cell is to be updated
+ */
+static inline bool signedDistance(const TsdGridFusionFrame& frame, const double r, const obfloat d2, obfloat* sd)
+{
+  if(isinf(r))
+  {
+    // Free space up to the low reflectivity range
+    if(!(d2 < frame.lowReflectivityRange*frame.lowReflectivityRange*(1.0+TSDGRIDFUSION_TOLERANCE))) return false;
+    if(!(sqrt(d2) < frame.lowReflectivityRange)) return false;
+    *sd = frame.maxTruncation;
+    return true;
+  }
+
+  // Cells behind the truncation radius are rejected without square root
+  const obfloat reach = r + frame.maxTruncation;
+  if(!(reach >= 0.0 && d2 <= reach*reach*(1.0+TSDGRIDFUSION_TOLERANCE))) return false;
+  *sd = r - sqrt(d2);
+  return (*sd >= -frame.maxTruncation);
+}
+
+/**
+ * Determine signed distances of cells [from, n), cells not to be updated are marked with index -1
+ * @return number of cells to be updated
+ */
+static unsigned int truncateRow(const TsdGridFusionFrame& frame, const obfloat coord[2], const obfloat step, const unsigned int from, const unsigned int n,
+                                int* indices, obfloat* sd)
+{
+  const obfloat dy = coord[1] - frame.pos[1];
+  const obfloat dy2 = dy*dy;
+  unsigned int cnt = 0;
+  for(unsigned int i=from; i<n; i++)
+  {
+    if(indices[i]<0) continue;
+    const obfloat dx = ((obfloat)i + 0.5) * step + coord[0] - frame.pos[0];
+    if(signedDistance(frame, frame.data[indices[i]], dx*dx + dy2, &sd[i]))
+      cnt++;
+    else
+      indices[i] = -1;
+  }
+  return cnt;
+}
+
+static unsigned int projectRowScalar(const TsdGridFusionFrame& frame, const obfloat coord[2], const obfloat step, const unsigned int n, int* indices, obfloat* sd)
+{
+  indexRow(frame, coord, step, n, indices);
+  return truncateRow(frame, coord, step, 0, n, indices, sd);
+}
+
+static void fuseRowScalar(obfloat* cells, const int* indices, const obfloat* sd, const unsigned int n,
+                          const obfloat invMaxTruncation, const obfloat eps, const obfloat weight, const obfloat maxWeight)
+{
+  for(unsigned int i=0; i<n; i++)
+  {
+    if(indices[i]<0) continue;
+    obfloat* cell = &cells[2*i];
+    const obfloat tsd = std::min(sd[i] * invMaxTruncation, TSDINC);
+    obfloat w = 0.01;
+    if(fabs(sd[i])<eps) w = 1.0;
+    w *= weight;
+
+    if(isnan(cell[0]))
+    {
+      cell[0] = tsd;
+      cell[1] += w;
+    }
+    else
+    {
+      cell[0] = (cell[0] * cell[1] + tsd * w) / (cell[1] + w);
+      cell[1] = std::min(cell[1] + w, maxWeight);
+    }
+  }
+}
+
+#if TSDGRIDFUSION_SIMD
+
+__attribute__((target("sse2")))
+static inline __m128d blendSSE2(const __m128d mask, const __m128d a, const __m128d b)
+{
+  // a where mask is set, b otherwise
+  return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+__attribute__((target("sse2")))
+static unsigned int projectRowSSE2(const TsdGridFusionFrame& frame, const obfloat coord[2], const obfloat step, const unsigned int n, int* indices, obfloat* sd)
+{
+  indexRow(frame, coord, step, n, indices);
+
+  const obfloat dy = coord[1] - frame.pos[1];
+  const __m128d vDy2 = _mm_set1_pd(dy*dy);
+  const __m128d vStep = _mm_set1_pd(step);
+  const __m128d vOrigin = _mm_set1_pd(coord[0]);
+  const __m128d vPos = _mm_set1_pd(frame.pos[0]);
+  const __m128d vMaxT = _mm_set1_pd(frame.maxTruncation);
+  const __m128d vNegMaxT = _mm_set1_pd(-frame.maxTruncation);
+  const __m128d vLow = _mm_set1_pd(frame.lowReflectivityRange);
+  const __m128d vLow2 = _mm_set1_pd(frame.lowReflectivityRange*frame.lowReflectivityRange*(1.0+TSDGRIDFUSION_TOLERANCE));
+  const __m128d vTol = _mm_set1_pd(1.0+TSDGRIDFUSION_TOLERANCE);
+  const __m128d vInf = _mm_set1_pd(INFINITY);
+  const __m128d vAbs = _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+  const __m128d vZero = _mm_setzero_pd();
+  const __m128d vInc = _mm_set1_pd(2.0);
+  __m128d vi = _mm_set_pd(1.5, 0.5);
+
+  unsigned int cnt = 0;
+  unsigned int i=0;
+  for(; i+2<=n; i+=2, vi=_mm_add_pd(vi, vInc))
+  {
+    if(indices[i]<0 && indices[i+1]<0) continue;
+    const __m128d r = _mm_set_pd(indices[i+1]<0 ? 0.0 : frame.data[indices[i+1]], indices[i]<0 ? 0.0 : frame.data[indices[i]]);
+    const __m128d active = _mm_castsi128_pd(_mm_set_epi32(-(indices[i+1]>=0), -(indices[i+1]>=0), -(indices[i]>=0), -(indices[i]>=0)));
+
+    const __m128d dx = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(vi, vStep), vOrigin), vPos);
+    const __m128d d2 = _mm_add_pd(_mm_mul_pd(dx, dx), vDy2);
+    const __m128d isInf = _mm_cmpeq_pd(_mm_and_pd(r, vAbs), vInf);
+    const __m128d reach = _mm_add_pd(r, vMaxT);
+
+    // Reject cells by squared distances, comparisons with NaN evaluate to false
+    const __m128d inReach = _mm_and_pd(_mm_cmpge_pd(reach, vZero), _mm_cmple_pd(d2, _mm_mul_pd(_mm_mul_pd(reach, reach), vTol)));
+    const __m128d candidate = _mm_and_pd(active, blendSSE2(isInf, _mm_cmplt_pd(d2, vLow2), inReach));
+    const int m = _mm_movemask_pd(candidate);
+    if(m==0)
+    {
+      indices[i] = indices[i+1] = -1;
+      continue;
+    }
+
+    const __m128d dist = _mm_sqrt_pd(d2);
+    const __m128d s = blendSSE2(isInf, vMaxT, _mm_sub_pd(r, dist));
+    const __m128d valid = _mm_and_pd(candidate, blendSSE2(isInf, _mm_cmplt_pd(dist, vLow), _mm_cmpge_pd(s, vNegMaxT)));
+    const int v = _mm_movemask_pd(valid);
+    _mm_storeu_pd(&sd[i], s);
+    if(!(v & 1)) indices[i] = -1;
+    if(!(v & 2)) indices[i+1] = -1;
+    cnt += (v & 1) + (v >> 1);
+  }
+
+  return cnt + truncateRow(frame, coord, step, i, n, indices, sd);
+}
+
+__attribute__((target("sse2")))
+static void fuseRowSSE2(obfloat* cells, const int* indices, const obfloat* sd, const unsigned int n,
+                        const obfloat invMaxTruncation, const obfloat eps, const obfloat weight, const obfloat maxWeight)
+{
+  const __m128d vInvMaxT = _mm_set1_pd(invMaxTruncation);
+  const __m128d vEps = _mm_set1_pd(eps);
+  const __m128d vWeight = _mm_set1_pd(weight);
+  const __m128d vMax = _mm_set1_pd(maxWeight);
+  const __m128d vInc = _mm_set1_pd(TSDINC);
+  const __m128d vOne = _mm_set1_pd(1.0);
+  const __m128d vLow = _mm_set1_pd(0.01);
+  const __m128d vAbs = _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+
+  unsigned int i=0;
+  for(; i+2<=n; i+=2)
+  {
+    if(indices[i]<0 && indices[i+1]<0) continue;
+    const __m128d active = _mm_castsi128_pd(_mm_set_epi32(-(indices[i+1]>=0), -(indices[i+1]>=0), -(indices[i]>=0), -(indices[i]>=0)));
+
+    // Deinterleave tsd and weight of two cells
+    const __m128d a = _mm_loadu_pd(&cells[2*i]);
+    const __m128d b = _mm_loadu_pd(&cells[2*i+2]);
+    const __m128d tsdPrev = _mm_unpacklo_pd(a, b);
+    const __m128d weightPrev = _mm_unpackhi_pd(a, b);
+
+    const __m128d s = _mm_loadu_pd(&sd[i]);
+    const __m128d t = _mm_min_pd(_mm_mul_pd(s, vInvMaxT), vInc);
+    const __m128d w = _mm_mul_pd(blendSSE2(_mm_cmplt_pd(_mm_and_pd(s, vAbs), vEps), vOne, vLow), vWeight);
+
+    // Uninitialized cells take over the measurement, the weight is not limited in this case
+    const __m128d isNan = _mm_cmpunord_pd(tsdPrev, tsdPrev);
+    const __m128d sum = _mm_add_pd(weightPrev, w);
+    const __m128d avg = _mm_div_pd(_mm_add_pd(_mm_mul_pd(tsdPrev, weightPrev), _mm_mul_pd(t, w)), sum);
+    const __m128d tsd = blendSSE2(active, blendSSE2(isNan, t, avg), tsdPrev);
+    const __m128d wgt = blendSSE2(active, blendSSE2(isNan, sum, _mm_min_pd(sum, vMax)), weightPrev);
+
+    _mm_storeu_pd(&cells[2*i], _mm_unpacklo_pd(tsd, wgt));
+    _mm_storeu_pd(&cells[2*i+2], _mm_unpackhi_pd(tsd, wgt));
+  }
+
+  fuseRowScalar(&cells[2*i], &indices[i], &sd[i], n-i, invMaxTruncation, eps, weight, maxWeight);
+}
+
+__attribute__((target("avx2")))
+static unsigned int projectRowAVX2(const TsdGridFusionFrame& frame, const obfloat coord[2], const obfloat step, const unsigned int n, int* indices, obfloat* sd)
+{
+  indexRow(frame, coord, step, n, indices);
+
+  const obfloat dy = coord[1] - frame.pos[1];
+  const __m256d vDy2 = _mm256_set1_pd(dy*dy);
+  const __m256d vStep = _mm256_set1_pd(step);
+  const __m256d vOrigin = _mm256_set1_pd(coord[0]);
+  const __m256d vPos = _mm256_set1_pd(frame.pos[0]);
+  const __m256d vMaxT = _mm256_set1_pd(frame.maxTruncation);
+  const __m256d vNegMaxT = _mm256_set1_pd(-frame.maxTruncation);
+  const __m256d vLow = _mm256_set1_pd(frame.lowReflectivityRange);
+  const __m256d vLow2 = _mm256_set1_pd(frame.lowReflectivityRange*frame.lowReflectivityRange*(1.0+TSDGRIDFUSION_TOLERANCE));
+  const __m256d vTol = _mm256_set1_pd(1.0+TSDGRIDFUSION_TOLERANCE);
+  const __m256d vInf = _mm256_set1_pd(INFINITY);
+  const __m256d vAbs = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+  const __m256d vZero = _mm256_setzero_pd();
+  const __m256d vInc = _mm256_set1_pd(4.0);
+  const __m128i vInvalid = _mm_set1_epi32(-1);
+  const __m256i vNarrow = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  __m256d vi = _mm256_set_pd(3.5, 2.5, 1.5, 0.5);
+
+  unsigned int cnt = 0;
+  unsigned int i=0;
+  for(; i+4<=n; i+=4, vi=_mm256_add_pd(vi, vInc))
+  {
+    const __m128i idx = _mm_loadu_si128((const __m128i*)&indices[i]);
+    const __m128i act32 = _mm_cmpgt_epi32(idx, vInvalid);
+    if(_mm_movemask_epi8(act32)==0) continue;
+    const __m256d active = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(act32));
+
+    // Measurements of inactive lanes are not fetched
+    const __m256d r = _mm256_mask_i32gather_pd(vZero, frame.data, idx, active, 8);
+
+    const __m256d dx = _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(vi, vStep), vOrigin), vPos);
+    const __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), vDy2);
+    const __m256d isInf = _mm256_cmp_pd(_mm256_and_pd(r, vAbs), vInf, _CMP_EQ_OQ);
+    const __m256d reach = _mm256_add_pd(r, vMaxT);
+
+    // Reject cells by squared distances, ordered comparisons evaluate to false for NaN
+    const __m256d inReach = _mm256_and_pd(_mm256_cmp_pd(reach, vZero, _CMP_GE_OQ),
+                                          _mm256_cmp_pd(d2, _mm256_mul_pd(_mm256_mul_pd(reach, reach), vTol), _CMP_LE_OQ));
+    const __m256d candidate = _mm256_and_pd(active, _mm256_blendv_pd(inReach, _mm256_cmp_pd(d2, vLow2, _CMP_LT_OQ), isInf));
+    if(_mm256_movemask_pd(candidate)==0)
+    {
+      _mm_storeu_si128((__m128i*)&indices[i], vInvalid);
+      continue;
+    }
+
+    const __m256d dist = _mm256_sqrt_pd(d2);
+    const __m256d s = _mm256_blendv_pd(_mm256_sub_pd(r, dist), vMaxT, isInf);
+    const __m256d valid = _mm256_and_pd(candidate, _mm256_blendv_pd(_mm256_cmp_pd(s, vNegMaxT, _CMP_GE_OQ), _mm256_cmp_pd(dist, vLow, _CMP_LT_OQ), isInf));
+    _mm256_storeu_pd(&sd[i], s);
+
+    // Narrow 64 bit lane masks to the 32 bit lanes of the index vector
+    const __m128i isValid = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(valid), vNarrow));
+    _mm_storeu_si128((__m128i*)&indices[i], _mm_blendv_epi8(vInvalid, idx, isValid));
+    cnt += __builtin_popcount(_mm256_movemask_pd(valid));
+  }
+
+  return cnt + truncateRow(frame, coord, step, i, n, indices, sd);
+}
+
+__attribute__((target("avx2")))
+static void fuseRowAVX2(obfloat* cells, const int* indices, const obfloat* sd, const unsigned int n,
+                        const obfloat invMaxTruncation, const obfloat eps, const obfloat weight, const obfloat maxWeight)
+{
+  const __m256d vInvMaxT = _mm256_set1_pd(invMaxTruncation);
+  const __m256d vEps = _mm256_set1_pd(eps);
+  const __m256d vWeight = _mm256_set1_pd(weight);
+  const __m256d vMax = _mm256_set1_pd(maxWeight);
+  const __m256d vInc = _mm256_set1_pd(TSDINC);
+  const __m256d vOne = _mm256_set1_pd(1.0);
+  const __m256d vLow = _mm256_set1_pd(0.01);
+  const __m256d vAbs = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+  const __m128i vInvalid = _mm_set1_epi32(-1);
+
+  unsigned int i=0;
+  for(; i+4<=n; i+=4)
+  {
+    const __m128i act32 = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)&indices[i]), vInvalid);
+    if(_mm_movemask_epi8(act32)==0) continue;
+
+    // Unpacking interleaved cells yields lane order 0, 2, 1, 3, inputs are permuted accordingly
+    const __m256d a = _mm256_loadu_pd(&cells[2*i]);
+    const __m256d b = _mm256_loadu_pd(&cells[2*i+4]);
+    const __m256d tsdPrev = _mm256_unpacklo_pd(a, b);
+    const __m256d weightPrev = _mm256_unpackhi_pd(a, b);
+    const __m256d active = _mm256_permute4x64_pd(_mm256_castsi256_pd(_mm256_cvtepi32_epi64(act32)), 0xD8);
+    const __m256d s = _mm256_permute4x64_pd(_mm256_loadu_pd(&sd[i]), 0xD8);
+
+    const __m256d t = _mm256_min_pd(_mm256_mul_pd(s, vInvMaxT), vInc);
+    const __m256d w = _mm256_mul_pd(_mm256_blendv_pd(vLow, vOne, _mm256_cmp_pd(_mm256_and_pd(s, vAbs), vEps, _CMP_LT_OQ)), vWeight);
+
+    // Uninitialized cells take over the measurement, the weight is not limited in this case
+    const __m256d isNan = _mm256_cmp_pd(tsdPrev, tsdPrev, _CMP_UNORD_Q);
+    const __m256d sum = _mm256_add_pd(weightPrev, w);
+    const __m256d avg = _mm256_div_pd(_mm256_add_pd(_mm256_mul_pd(tsdPrev, weightPrev), _mm256_mul_pd(t, w)), sum);
+    const __m256d tsd = _mm256_blendv_pd(tsdPrev, _mm256_blendv_pd(avg, t, isNan), active);
+    const __m256d wgt = _mm256_blendv_pd(weightPrev, _mm256_blendv_pd(_mm256_min_pd(sum, vMax), sum, isNan), active);
+
+    _mm256_storeu_pd(&cells[2*i], _mm256_unpacklo_pd(tsd, wgt));
+    _mm256_storeu_pd(&cells[2*i+4], _mm256_unpackhi_pd(tsd, wgt));
+  }
+
+  fuseRowScalar(&cells[2*i], &indices[i], &sd[i], n-i, invMaxTruncation, eps, weight, maxWeight);
+}
+
+#endif
+
+unsigned int TsdGridFusionKernel::projectRow(const TsdGridFusionFrame& frame, const obfloat coord[2], const obfloat step, const unsigned int n, int* indices, obfloat* sd)
+{
+#if TSDGRIDFUSION_SIMD
+  const EnumTsdFusionKernel kernel = TsdFusionKernel::getKernel();
+  if(kernel==FUSIONKERNEL_AVX2) return projectRowAVX2(frame, coord, step, n, indices, sd);
+  if(kernel==FUSIONKERNEL_SSE2) return projectRowSSE2(frame, coord, step, n, indices, sd);
+#endif
+  return projectRowScalar(frame, coord, step, n, indices, sd);
+}
+
+void TsdGridFusionKernel::fuseRow(obfloat* cells, const int* indices, const obfloat* sd, const unsigned int n,
+                                  const obfloat invMaxTruncation, const obfloat eps, const obfloat weight, const obfloat maxWeight)
+{
+#if TSDGRIDFUSION_SIMD
+  const EnumTsdFusionKernel kernel = TsdFusionKernel::getKernel();
+  if(kernel==FUSIONKERNEL_AVX2)
+  {
+    fuseRowAVX2(cells, indices, sd, n, invMaxTruncation, eps, weight, maxWeight);
+    return;
+  }
+  if(kernel==FUSIONKERNEL_SSE2)
+  {
+    fuseRowSSE2(cells, indices, sd, n, invMaxTruncation, eps, weight, maxWeight);
+    return;
+  }
+#endif
+  fuseRowScalar(cells, indices, sd, n, invMaxTruncation, eps, weight, maxWeight);
+}
+
+}
@@ -0,0 +1,100 @@
+#ifndef TSDGRIDFUSIONKERNEL_H
+#define TSDGRIDFUSIONKERNEL_H
+
+#include "obvision/reconstruct/reconstruct_defs.h"
+#include "obvision/reconstruct/grid/SensorPolar2D.h"
+#include "obvision/reconstruct/space/TsdFusionKernel.h"
+
+#include <vector>
+
+namespace obvious
+{
+
+/**
+ * @struct TsdGridFusionFrame
+ * @brief Per-scan constants of polar data fusion
+ */
+struct TsdGridFusionFrame
+{
+  // transformation of world coordinates to sensor coordinates (row-major), i.e., the upper two rows of T^-1
+  double T[6];
+
+  // sensor position
+  obfloat pos[2];
+
+  const double* data;
+
+  const bool* mask;
+
+  unsigned int beams;
+
+  double phiMin;
+
+  double phiLowerBound;
+
+  double phiUpperBound;
+
+  double angularResInv;
+
+  // directions of the lower border of each beam in sensor coordinates (x, y interleaved), followed by the upper border of the last beam
+  std::vector<double> borders;
+
+  // beam borders can be tracked incrementally, i.e., the field of view does not cross the backward direction
+  bool incremental;
+
+  obfloat maxTruncation;
+
+  obfloat lowReflectivityRange;
+};
+
+/**
+ * @class TsdGridFusionKernel
+ * @brief Row kernels for integrating polar measurements into grid partitions.
+ * Beam indices are tracked incrementally along a row of cells by comparing cells with beam borders, i.e., atan2 is only needed at
+ * the start of a row, close to the sensor and outside of the field of view. Cells out of reach are rejected by squared distances,
+ * so that square roots are only computed for cells to be updated. Distances and the weighted average are vectorized with the
+ * instruction set selected by TsdFusionKernel::setKernel (AVX2, SSE2 or scalar code).
+ * @author Stefan May
+ */
+class TsdGridFusionKernel
+{
+public:
+
+  /**
+   * Setup frame constants for the current pose and measurement of a sensor
+   * @param[in] sensor sensor instance
+   * @param[in] maxTruncation maximum truncation radius
+   * @param[out] frame frame constants
+   */
+  static void initFrame(SensorPolar2D* sensor, const obfloat maxTruncation, TsdGridFusionFrame* frame);
+
+  /**
+   * Back project row of cells and determine signed distances
+   * @param[in] frame frame constants
+   * @param[in] coord world coordinates of row origin, cell i is centered at (coord[0]+(i+0.5)*step, coord[1])
+   * @param[in] step cell size
+   * @param[in] n number of cells
+   * @param[out] indices beam index per cell, -1 if cell is not to be updated
+   * @param[out] sd signed distance per cell, i.e., measurement minus distance of cell to sensor (valid for indices>=0)
+   * @return number of cells to be updated
+   */
+  static unsigned int projectRow(const TsdGridFusionFrame& frame, const obfloat coord[2], const obfloat step, const unsigned int n, int* indices, obfloat* sd);
+
+  /**
+   * Weighted running average of cells, equivalent to TsdGridPartition::addTsd
+   * @param[in,out] cells tsd and weight values of row (interleaved, see TsdCell)
+   * @param[in] indices cells with negative indices are left untouched
+   * @param[in] sd signed distances to be integrated
+   * @param[in] n number of cells
+   * @param[in] invMaxTruncation inverse of maximum truncation radius
+   * @param[in] eps cells closer to the surface are integrated with the full weight, others with a hundredth of it
+   * @param[in] weight weight of measurements
+   * @param[in] maxWeight maximum weight of cells
+   */
+  static void fuseRow(obfloat* cells, const int* indices, const obfloat* sd, const unsigned int n,
+                      const obfloat invMaxTruncation, const obfloat eps, const obfloat weight, const obfloat maxWeight);
+};
+
+}
+
+#endif
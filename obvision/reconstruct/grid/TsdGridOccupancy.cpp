@@ -0,0 +1,332 @@
+#include "TsdGridOccupancy.h"
+#include "obvision/planning/AStarMap.h"
+#include "obcore/base/System.h"
+#include "obcore/base/Logger.h"
+#include "obcore/base/Timer.h"
+
+#include <cmath>
+#include <cstring>
+#include <omp.h>
+
+namespace obvious
+{
+
+// Squared distance of cells without occupied cell in reach, large enough to exceed any distance within the grid
+#define OCCUPANCY_FAR 1e20
+
+TsdGridOccupancy::TsdGridOccupancy(TsdGrid* grid, const obfloat maxDistance)
+{
+  _grid         = grid;
+  _cellsX       = grid->getCellsX();
+  _cellsY       = grid->getCellsY();
+  _dimPartition = grid->getPartitionSize();
+
+  System<signed char>::allocate(_cellsY, _cellsX, _occupancy);
+  System<obfloat>::allocate(_cellsY, _cellsX, _distance);
+  System<char>::allocate(_cellsY, _cellsX, _map);
+  memset(*_occupancy, OCCUPANCY_UNKNOWN, _cellsX*_cellsY*sizeof(**_occupancy));
+
+  // No occupied cell is known before the first update, maps may be exported anyway
+  for(unsigned int i=0; i<_cellsX*_cellsY; i++)
+    (*_distance)[i] = maxDistance;
+
+  _present = new bool[grid->getPartitionsInX()*grid->getPartitionsInY()];
+  memset(_present, 0, grid->getPartitionsInX()*grid->getPartitionsInY()*sizeof(*_present));
+
+  _minWeight   = 0.0;
+  _maxDistance = maxDistance;
+  _revision    = 0;
+  grid->getWindowIndex(_window);
+  _full        = true;
+
+  // Nothing has been exported yet, the first export converts all cells
+  _mapRadius            = -1.0;
+  _mapUnknownIsOccupied = true;
+  _mapMin[0] = _cellsX;
+  _mapMin[1] = _cellsY;
+  _mapMax[0] = 0;
+  _mapMax[1] = 0;
+}
+
+TsdGridOccupancy::~TsdGridOccupancy()
+{
+  System<signed char>::deallocate(_occupancy);
+  System<obfloat>::deallocate(_distance);
+  System<char>::deallocate(_map);
+  delete [] _present;
+}
+
+void TsdGridOccupancy::setMinWeight(const obfloat weight)
+{
+  _minWeight = weight;
+  _full = true;
+}
+
+void TsdGridOccupancy::setMaxDistance(const obfloat maxDistance)
+{
+  _maxDistance = maxDistance;
+  _full = true;
+}
+
+void TsdGridOccupancy::invalidate()
+{
+  _full = true;
+}
+
+unsigned int TsdGridOccupancy::update()
+{
+  Timer t;
+  t.start();
+
+  // Shifting a rolling window moves all partitions
+  int window[2];
+  _grid->getWindowIndex(window);
+  const bool full = _full || window[0]!=_window[0] || window[1]!=_window[1];
+
+  // Determine modified partitions serially, since the hash table must not be accessed concurrently with modifications
+  const unsigned int partitionsInX = _grid->getPartitionsInX();
+  const unsigned int partitionsInY = _grid->getPartitionsInY();
+  vector<unsigned int> dirty;
+  int pMin[2] = {(int)partitionsInX, (int)partitionsInY};
+  int pMax[2] = {-1, -1};
+  for(unsigned int py=0; py<partitionsInY; py++)
+  {
+    for(unsigned int px=0; px<partitionsInX; px++)
+    {
+      const unsigned int i = py*partitionsInX+px;
+      TsdGridPartition* part = _grid->getPartition(px, py);
+      if(full || (part ? (part->getRevision()>_revision || !_present[i]) : _present[i]))
+      {
+        dirty.push_back(i);
+        pMin[0] = min(pMin[0], (int)px);
+        pMin[1] = min(pMin[1], (int)py);
+        pMax[0] = max(pMax[0], (int)px);
+        pMax[1] = max(pMax[1], (int)py);
+      }
+    }
+  }
+
+  _revision = _grid->getRevision();
+  _window[0] = window[0];
+  _window[1] = window[1];
+  _full = false;
+
+  if(dirty.empty()) return 0;
+
+#pragma omp parallel for schedule(dynamic)
+  for(int i=0; i<(int)dirty.size(); i++)
+    classifyPartition(dirty[i] % partitionsInX, dirty[i] / partitionsInX);
+
+  // Distances change within the range of the distance field around modified cells
+  const int cMin[2] = {pMin[0]*(int)_dimPartition, pMin[1]*(int)_dimPartition};
+  const int cMax[2] = {(pMax[0]+1)*(int)_dimPartition, (pMax[1]+1)*(int)_dimPartition};
+  updateDistanceField(cMin, cMax);
+
+  LOGMSG(DBG_DEBUG, "Updated " << dirty.size() << " partitions of occupancy grid in " << t.elapsed() << "s");
+
+  return dirty.size();
+}
+
+void TsdGridOccupancy::classifyPartition(const unsigned int px, const unsigned int py)
+{
+  TsdGridPartition* part = _grid->getPartition(px, py);
+  _present[py*_grid->getPartitionsInX()+px] = (part!=NULL);
+
+  const unsigned int x0 = px*_dimPartition;
+  const unsigned int y0 = py*_dimPartition;
+
+  if(!part || !part->isInitialized())
+  {
+    // Partitions seen empty as a whole are free
+    const signed char value = (part && part->isEmpty()) ? OCCUPANCY_FREE : OCCUPANCY_UNKNOWN;
+    for(unsigned int y=0; y<_dimPartition; y++)
+      memset(&_occupancy[y0+y][x0], value, _dimPartition*sizeof(**_occupancy));
+    return;
+  }
+
+  TsdCell** cells = part->_grid;
+  for(unsigned int y=0; y<_dimPartition; y++)
+  {
+    signed char* occupancy = &_occupancy[y0+y][x0];
+    for(unsigned int x=0; x<_dimPartition; x++)
+    {
+      const TsdCell& cell = cells[y][x];
+      if(isnan(cell.tsd) || cell.weight<_minWeight)
+        occupancy[x] = OCCUPANCY_UNKNOWN;
+      else
+        occupancy[x] = (cell.tsd>0.0) ? OCCUPANCY_FREE : OCCUPANCY_OCCUPIED;
+    }
+  }
+}
+
+/**
+ * Squared Euclidean distance transform of a sampled function (P. Felzenszwalb and D. Huttenlocher, Distance Transforms of Sampled Functions, 2012)
+ * @param[in] f function values, i.e., 0 at occupied cells
+ * @param[in] n number of samples
+ * @param[out] d squared distances
+ * @param v buffer of n elements
+ * @param z buffer of n+1 elements
+ */
+static void distanceTransform(const obfloat* f, const int n, obfloat* d, int* v, obfloat* z)
+{
+  int k = 0;
+  v[0] = 0;
+  z[0] = -INFINITY;
+  z[1] = INFINITY;
+  for(int q=1; q<n; q++)
+  {
+    // Intersection of parabola at q with the rightmost parabola of the lower envelope
+    obfloat s = ((f[q]+q*q) - (f[v[k]]+v[k]*v[k])) / (2*q - 2*v[k]);
+    while(s <= z[k])
+    {
+      k--;
+      s = ((f[q]+q*q) - (f[v[k]]+v[k]*v[k])) / (2*q - 2*v[k]);
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k+1] = INFINITY;
+  }
+
+  k = 0;
+  for(int q=0; q<n; q++)
+  {
+    while(z[k+1] < q) k++;
+    d[q] = (q-v[k])*(q-v[k]) + f[v[k]];
+  }
+}
+
+void TsdGridOccupancy::extendRegion(const int cMin[2], const int cMax[2], int regionMin[2], int regionMax[2])
+{
+  regionMin[0] = min(regionMin[0], cMin[0]);
+  regionMin[1] = min(regionMin[1], cMin[1]);
+  regionMax[0] = max(regionMax[0], cMax[0]);
+  regionMax[1] = max(regionMax[1], cMax[1]);
+}
+
+void TsdGridOccupancy::updateDistanceField(const int cMin[2], const int cMax[2])
+{
+  const int cells[2] = {(int)_cellsX, (int)_cellsY};
+  const obfloat cellSize = _grid->getCellSize();
+  const int reach = (int)ceil(_maxDistance / cellSize);
+
+  // Output region contains all cells within reach of modified ones, input region all occupied cells within reach of the output region
+  int outMin[2], outMax[2], inMin[2], inMax[2];
+  for(int i=0; i<2; i++)
+  {
+    outMin[i] = max(cMin[i]-reach, 0);
+    outMax[i] = min(cMax[i]+reach, cells[i]);
+    inMin[i]  = max(cMin[i]-2*reach, 0);
+    inMax[i]  = min(cMax[i]+2*reach, cells[i]);
+  }
+  extendRegion(outMin, outMax, _mapMin, _mapMax);
+
+  const int inW  = inMax[0]-inMin[0];
+  const int inH  = inMax[1]-inMin[1];
+  const int outW = outMax[0]-outMin[0];
+
+  // Squared distances along rows, only columns of the output region are kept
+  obfloat* rows = new obfloat[inH*outW];
+
+#pragma omp parallel
+  {
+    obfloat* f = new obfloat[inW];
+    obfloat* d = new obfloat[inW];
+    int* v     = new int[inW];
+    obfloat* z = new obfloat[inW+1];
+#pragma omp for schedule(dynamic)
+    for(int y=0; y<inH; y++)
+    {
+      const signed char* occupancy = &_occupancy[inMin[1]+y][inMin[0]];
+      obfloat* row = &rows[y*outW];
+      bool occupied = false;
+      for(int x=0; x<inW; x++)
+      {
+        f[x] = (occupancy[x]==OCCUPANCY_OCCUPIED) ? 0.0 : OCCUPANCY_FAR;
+        occupied = occupied || (f[x]==0.0);
+      }
+      if(!occupied)
+      {
+        for(int x=0; x<outW; x++)
+          row[x] = OCCUPANCY_FAR;
+        continue;
+      }
+      distanceTransform(f, inW, d, v, z);
+      memcpy(row, &d[outMin[0]-inMin[0]], outW*sizeof(*row));
+    }
+    delete [] f;
+    delete [] d;
+    delete [] v;
+    delete [] z;
+  }
+
+  // Combination with distances along columns
+#pragma omp parallel
+  {
+    obfloat* f = new obfloat[inH];
+    obfloat* d = new obfloat[inH];
+    int* v     = new int[inH];
+    obfloat* z = new obfloat[inH+1];
+#pragma omp for schedule(dynamic)
+    for(int x=0; x<outW; x++)
+    {
+      for(int y=0; y<inH; y++)
+        f[y] = rows[y*outW+x];
+      distanceTransform(f, inH, d, v, z);
+      for(int y=outMin[1]; y<outMax[1]; y++)
+        _distance[y][outMin[0]+x] = min(sqrt(d[y-inMin[1]])*cellSize, _maxDistance);
+    }
+    delete [] f;
+    delete [] d;
+    delete [] v;
+    delete [] z;
+  }
+
+  delete [] rows;
+}
+
+bool TsdGridOccupancy::exportAStarMap(AStarMap* map, const obfloat robotRadius, const bool unknownIsOccupied)
+{
+  if(map->getWidth()!=_cellsX || map->getHeight()!=_cellsY || fabs(map->getCellSize()-_grid->getCellSize())>1e-9)
+  {
+    LOGMSG(DBG_ERROR, "Dimension of planner map (" << map->getWidth() << "x" << map->getHeight() << " cells of " << map->getCellSize()
+        << "m) does not match grid (" << _cellsX << "x" << _cellsY << " cells of " << _grid->getCellSize() << "m)");
+    return false;
+  }
+
+  if(robotRadius>_maxDistance)
+    LOGMSG(DBG_WARN, "Robot radius exceeds range of distance field, obstacles are inflated by " << _maxDistance << "m only");
+
+  // Parameter changes affect all cells
+  if(robotRadius!=_mapRadius || unknownIsOccupied!=_mapUnknownIsOccupied)
+  {
+    _mapMin[0] = 0;
+    _mapMin[1] = 0;
+    _mapMax[0] = _cellsX;
+    _mapMax[1] = _cellsY;
+    _mapRadius = robotRadius;
+    _mapUnknownIsOccupied = unknownIsOccupied;
+  }
+
+#pragma omp parallel for
+  for(int y=_mapMin[1]; y<_mapMax[1]; y++)
+  {
+    for(int x=_mapMin[0]; x<_mapMax[0]; x++)
+    {
+      const signed char occupancy = _occupancy[y][x];
+      const bool blocked = (occupancy==OCCUPANCY_OCCUPIED) || (occupancy==OCCUPANCY_UNKNOWN && unknownIsOccupied) || _distance[y][x]<robotRadius;
+      _map[y][x] = blocked ? 1 : 0;
+    }
+  }
+
+  _mapMin[0] = _cellsX;
+  _mapMin[1] = _cellsY;
+  _mapMax[0] = 0;
+  _mapMax[1] = 0;
+
+  map->setData(*_map);
+
+  return true;
+}
+
+}
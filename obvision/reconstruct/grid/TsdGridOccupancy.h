@@ -0,0 +1,158 @@
+#ifndef TSDGRIDOCCUPANCY_H
+#define TSDGRIDOCCUPANCY_H
+
+#include "obcore/base/types.h"
+#include "obvision/reconstruct/grid/TsdGrid.h"
+
+namespace obvious
+{
+
+class AStarMap;
+
+/**
+ * Occupancy values in percent, unknown cells are marked with -1, i.e., cells are stored as signed char
+ */
+enum EnumOccupancy { OCCUPANCY_UNKNOWN=-1,
+  OCCUPANCY_FREE=0,
+  OCCUPANCY_OCCUPIED=100};
+
+/**
+ * @class TsdGridOccupancy
+ * @brief Occupancy grid and Euclidean distance field of a TSD grid, e.g., for path planning.
+ * Cells in front of surfaces (tsd>0) are free, cells behind surfaces are occupied. Cells without measurements or with less weight
+ * than required are unknown. Both representations are updated incrementally, i.e., only partitions modified since the last update
+ * are classified and distances are recomputed within the reach of the distance field around them.
+ * Cell (x, y) of the exported maps corresponds to cell (x, y) of the grid, i.e., to the world coordinates
+ * (grid->getMinX() + (x+0.5)*cellSize, grid->getMinY() + (y+0.5)*cellSize).
+ * @author Stefan May
+ */
+class TsdGridOccupancy
+{
+public:
+
+  /**
+   * Constructor
+   * @param[in] grid TSD grid, which must exist as long as this instance
+   * @param[in] maxDistance range of distance field (unit [m]), larger distances are truncated
+   */
+  TsdGridOccupancy(TsdGrid* grid, const obfloat maxDistance=1.0);
+
+  /**
+   * Destructor
+   */
+  ~TsdGridOccupancy();
+
+  /**
+   * Set minimum weight of cells, cells of less weight are considered as unknown
+   * @param[in] weight minimum weight
+   */
+  void setMinWeight(const obfloat weight);
+
+  /**
+   * Set range of distance field, the next update recomputes all cells
+   * @param[in] maxDistance range (unit [m])
+   */
+  void setMaxDistance(const obfloat maxDistance);
+
+  /**
+   * Get range of distance field
+   * @return range (unit [m])
+   */
+  obfloat getMaxDistance() const { return _maxDistance; }
+
+  /**
+   * Recompute all cells with the next update, e.g., after cells of the grid have been modified directly
+   */
+  void invalidate();
+
+  /**
+   * Update occupancy grid and distance field from partitions modified since the last update
+   * @return number of updated partitions
+   */
+  unsigned int update();
+
+  /**
+   * Get occupancy grid
+   * @return occupancy values (see EnumOccupancy) with access [y][x], rows are stored contiguously
+   */
+  signed char** getOccupancy() const { return _occupancy; }
+
+  /**
+   * Get distance field
+   * @return distance of cells to the closest occupied cell (unit [m]) with access [y][x], rows are stored contiguously
+   */
+  obfloat** getDistanceField() const { return _distance; }
+
+  /**
+   * Get width of maps
+   * @return number of cells in x-dimension
+   */
+  unsigned int getWidth() const { return _cellsX; }
+
+  /**
+   * Get height of maps
+   * @return number of cells in y-dimension
+   */
+  unsigned int getHeight() const { return _cellsY; }
+
+  /**
+   * Export inflated occupancy grid to planner map. Only cells updated since the last export are converted, as long as the parameters
+   * are unchanged. Paths are planned in grid coordinates by passing the offset (-grid->getMinX(), -grid->getMinY()) to AStar::pathFind.
+   * Before the first update, all cells are unknown.
+   * @param[in,out] map planner map of the same dimension and cell size as the grid
+   * @param[in] robotRadius cells closer to occupied cells are blocked (unit [m]), limited by the range of the distance field
+   * @param[in] unknownIsOccupied block unknown cells
+   * @return success
+   */
+  bool exportAStarMap(AStarMap* map, const obfloat robotRadius, const bool unknownIsOccupied=true);
+
+private:
+
+  void classifyPartition(const unsigned int px, const unsigned int py);
+
+  void updateDistanceField(const int cMin[2], const int cMax[2]);
+
+  void extendRegion(const int cMin[2], const int cMax[2], int regionMin[2], int regionMax[2]);
+
+  TsdGrid* _grid;
+
+  unsigned int _cellsX;
+
+  unsigned int _cellsY;
+
+  unsigned int _dimPartition;
+
+  signed char** _occupancy;
+
+  obfloat** _distance;
+
+  // Planner map of last export
+  char** _map;
+
+  // Partition slots, which contained a partition in the last update (hashed storage)
+  bool* _present;
+
+  obfloat _minWeight;
+
+  obfloat _maxDistance;
+
+  // Grid revision of last update
+  unsigned int _revision;
+
+  int _window[2];
+
+  bool _full;
+
+  // Cells updated since the last export of the planner map
+  int _mapMin[2];
+
+  int _mapMax[2];
+
+  obfloat _mapRadius;
+
+  bool _mapUnknownIsOccupied;
+};
+
+}
+
+#endif
@@ -6,60 +6,84 @@
 
 #include <cstring>
 #include <cmath>
+#include <stdint.h>
 
 namespace obvious
 {
 
-Matrix* TsdGridPartition::_partCoords = NULL;
-
 TsdGridPartition::TsdGridPartition(const unsigned int x,
     const unsigned int y,
     const unsigned int cellsX,
     const unsigned int cellsY,
-    const obfloat cellSize) : TsdGridComponent(true)
+    const obfloat cellSize,
+    const obfloat* origin) : TsdGridComponent(true)
 {
   _initialized = false;
 
-  _x = x;
-  _y = y;
-
   _grid = NULL;
-  _cellCoordsHom = NULL;
+  _lastPush = 0;
+  _revision = 0;
 
   _cellSize = cellSize;
   _componentSize = cellSize * (obfloat)cellsX;
 
   _initWeight = 0.0;
 
-  if(!_partCoords)
+  _cellsX = cellsX;
+  _cellsY = cellsY;
+
+  _edgeCoordsHom = new Matrix(4, 3);
+  relocate(x, y, origin);
+}
+
+TsdGridPartition::~TsdGridPartition()
+{
+  if(_grid) System<TsdCell>::deallocate(_grid);
+  delete _edgeCoordsHom;
+}
+
+void TsdGridPartition::clearBorders()
+{
+  if(!_initialized) return;
+
+  for(unsigned int y=0; y<=_cellsY; y++)
   {
-    _partCoords = new Matrix(cellsX*cellsY, 2);
-    unsigned int i=0;
-    for(unsigned int iy=0; iy<cellsY; iy++)
-    {
-      for(unsigned int ix=0; ix<cellsX; ix++, i++)
-      {
-        (*_partCoords)(i, 0) = ix;
-        (*_partCoords)(i, 1) = iy;
-      }
-    }
+    _grid[y][_cellsX].tsd    = NAN;
+    _grid[y][_cellsX].weight = 0.0;
   }
+  for(unsigned int x=0; x<_cellsX; x++)
+  {
+    _grid[_cellsY][x].tsd    = NAN;
+    _grid[_cellsY][x].weight = 0.0;
+  }
+}
 
-  _edgeCoordsHom = new Matrix(4, 3);
-  (*_edgeCoordsHom)(0, 0) = ((double)x + 0.5) * _cellSize;
-  (*_edgeCoordsHom)(0, 1) = ((double)y + 0.5) * _cellSize;
+void TsdGridPartition::relocate(const unsigned int x, const unsigned int y, const obfloat* origin)
+{
+  _x = x;
+  _y = y;
+
+  obfloat o[2] = {0.0, 0.0};
+  if(origin)
+  {
+    o[0] = origin[0];
+    o[1] = origin[1];
+  }
+
+  (*_edgeCoordsHom)(0, 0) = ((double)x + 0.5) * _cellSize + o[0];
+  (*_edgeCoordsHom)(0, 1) = ((double)y + 0.5) * _cellSize + o[1];
   (*_edgeCoordsHom)(0, 2) = 1.0;
 
-  (*_edgeCoordsHom)(1, 0) = ((double)(x+cellsX) + 0.5) * _cellSize;
-  (*_edgeCoordsHom)(1, 1) = ((double)y + 0.5) * _cellSize;
+  (*_edgeCoordsHom)(1, 0) = ((double)(x+_cellsX) + 0.5) * _cellSize + o[0];
+  (*_edgeCoordsHom)(1, 1) = ((double)y + 0.5) * _cellSize + o[1];
   (*_edgeCoordsHom)(1, 2) = 1.0;
 
-  (*_edgeCoordsHom)(2, 0) = ((double)x + 0.5) * _cellSize;
-  (*_edgeCoordsHom)(2, 1) = ((double)(y+cellsY) + 0.5) * _cellSize;
+  (*_edgeCoordsHom)(2, 0) = ((double)x + 0.5) * _cellSize + o[0];
+  (*_edgeCoordsHom)(2, 1) = ((double)(y+_cellsY) + 0.5) * _cellSize + o[1];
   (*_edgeCoordsHom)(2, 2) = 1.0;
 
-  (*_edgeCoordsHom)(3, 0) = ((double)(x+cellsX) + 0.5) * _cellSize;
-  (*_edgeCoordsHom)(3, 1) = ((double)(y+cellsY) + 0.5) * _cellSize;
+  (*_edgeCoordsHom)(3, 0) = ((double)(x+_cellsX) + 0.5) * _cellSize + o[0];
+  (*_edgeCoordsHom)(3, 1) = ((double)(y+_cellsY) + 0.5) * _cellSize + o[1];
   (*_edgeCoordsHom)(3, 2) = 1.0;
 
   _centroid[0] = ((*_edgeCoordsHom)(0, 0) + (*_edgeCoordsHom)(1, 0) + (*_edgeCoordsHom)(2, 0) + (*_edgeCoordsHom)(3, 0)) / 4.0;
@@ -68,21 +92,6 @@ TsdGridPartition::TsdGridPartition(const unsigned int x,
   obfloat dx = ((*_edgeCoordsHom)(3, 0)-(*_edgeCoordsHom)(0, 0));
   obfloat dy = ((*_edgeCoordsHom)(3, 1)-(*_edgeCoordsHom)(0, 1));
   _circumradius = sqrt(dx*dx + dy*dy) * 0.5;
-
-  _cellsX = cellsX;
-  _cellsY = cellsY;
-}
-
-TsdGridPartition::~TsdGridPartition()
-{
-  if(_grid) System<TsdCell>::deallocate(_grid);
-  if(_cellCoordsHom) delete [] _cellCoordsHom;
-  delete [] _edgeCoordsHom;
-  if(_partCoords)
-  {
-    delete [] _partCoords;
-    _partCoords = NULL;
-  }
 }
 
 void TsdGridPartition::init(obfloat maxTruncation)
@@ -118,18 +127,6 @@ void TsdGridPartition::init(obfloat maxTruncation)
     }
   }
 
-  _cellCoordsHom = new Matrix(_cellsX*_cellsY, 3);
-  unsigned int i=0;
-  for(unsigned int iy=_y; iy<_y+_cellsY; iy++)
-  {
-    for(unsigned int ix=_x; ix<_x+_cellsX; ix++, i++)
-    {
-      (*_cellCoordsHom)(i,0) = ((double)ix + 0.5) * _cellSize;
-      (*_cellCoordsHom)(i,1) = ((double)iy + 0.5) * _cellSize;
-      (*_cellCoordsHom)(i,2) = 1.0;
-    }
-  }
-
   _initialized = true;
 }
 
@@ -163,4 +160,103 @@ void TsdGridPartition::increaseEmptiness()
   }
 }
 
+void TsdGridPartition::reset()
+{
+  if(_grid) System<TsdCell>::deallocate(_grid);
+  _grid = NULL;
+  _initialized = false;
+  _initWeight = 0.0;
+}
+
+void TsdGridPartition::setEmpty(const obfloat weight)
+{
+  reset();
+  _initWeight = min(weight, TSDGRIDMAXWEIGHT);
+}
+
+/**
+ * Cell quantized to 16 bit per value, tsd is within [-1, 1] and weight within [0, TSDGRIDMAXWEIGHT]
+ */
+struct TsdCellQuantized
+{
+  int16_t tsd;
+  uint16_t weight;
+};
+
+void TsdGridPartition::serialize(vector<unsigned char> &buf, const bool quantize) const
+{
+  buf.clear();
+  if(!_initialized) return;
+
+  const size_t cellSize = quantize ? sizeof(TsdCellQuantized) : sizeof(TsdCell);
+  const unsigned int cells = _cellsX*_cellsY;
+  unsigned int i = 0;
+  while(i<cells)
+  {
+    unsigned int run[2];
+    unsigned int start = i;
+    while(i<cells && isnan(_grid[i/_cellsX][i%_cellsX].tsd)) i++;
+    run[0] = i-start;
+
+    start = i;
+    while(i<cells && !isnan(_grid[i/_cellsX][i%_cellsX].tsd)) i++;
+    run[1] = i-start;
+
+    size_t pos = buf.size();
+    buf.resize(pos + sizeof(run) + run[1]*cellSize);
+    unsigned char* dst = &buf[pos];
+    memcpy(dst, run, sizeof(run));
+    dst += sizeof(run);
+    for(unsigned int j=start; j<start+run[1]; j++, dst+=cellSize)
+    {
+      const TsdCell& cell = _grid[j/_cellsX][j%_cellsX];
+      if(quantize)
+      {
+        TsdCellQuantized q;
+        q.tsd    = (int16_t)floor(max(min(cell.tsd, TSDINC), -TSDINC) * 32767.0 + 0.5);
+        q.weight = (uint16_t)floor(max(min(cell.weight, TSDGRIDMAXWEIGHT), 0.0) / TSDGRIDMAXWEIGHT * 65535.0 + 0.5);
+        memcpy(dst, &q, sizeof(q));
+      }
+      else
+        memcpy(dst, &cell, sizeof(TsdCell));
+    }
+  }
+}
+
+bool TsdGridPartition::load(const unsigned char* buf, const size_t size, const obfloat maxTruncation, const bool quantized)
+{
+  init(maxTruncation);
+
+  const size_t cellSize = quantized ? sizeof(TsdCellQuantized) : sizeof(TsdCell);
+  const unsigned int cells = _cellsX*_cellsY;
+  size_t pos = 0;
+  unsigned int i = 0;
+  while(pos<size)
+  {
+    unsigned int run[2];
+    if(size-pos < sizeof(run)) return false;
+    memcpy(run, &buf[pos], sizeof(run));
+    pos += sizeof(run);
+
+    if(run[0] > cells-i) return false;
+    i += run[0];
+    if(run[1] > cells-i || (size-pos)/cellSize < run[1]) return false;
+
+    for(unsigned int j=0; j<run[1]; j++, i++, pos+=cellSize)
+    {
+      TsdCell& cell = _grid[i/_cellsX][i%_cellsX];
+      if(quantized)
+      {
+        TsdCellQuantized q;
+        memcpy(&q, &buf[pos], sizeof(q));
+        cell.tsd    = (obfloat)q.tsd / 32767.0;
+        cell.weight = (obfloat)q.weight / 65535.0 * TSDGRIDMAXWEIGHT;
+      }
+      else
+        memcpy(&cell, &buf[pos], sizeof(TsdCell));
+    }
+  }
+  return true;
+}
+
 }
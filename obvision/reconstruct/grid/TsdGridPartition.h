@@ -27,6 +27,7 @@ struct TsdCell
 class TsdGridPartition : public TsdGridComponent
 {
   friend class TsdGrid;
+  friend class TsdGridOccupancy;
 public:
 
   /**
@@ -38,8 +39,9 @@ public:
    * @param[in] dimX Number of cells in x-dimension
    * @param[in] dimY Number of cells in y-dimension
    * @param[in] cellSize Size of cell in meters
+   * @param[in] origin world coordinates of cell index (0, 0), NULL for the coordinate origin
    */
-  TsdGridPartition(const unsigned int x, const unsigned int y, const unsigned int dimX, const unsigned int dimY, const obfloat cellSize);
+  TsdGridPartition(const unsigned int x, const unsigned int y, const unsigned int dimX, const unsigned int dimY, const obfloat cellSize, const obfloat* origin=NULL);
 
   /**
    * Destructor
@@ -84,16 +86,16 @@ public:
   unsigned int getY() const { return _y; }
 
   /**
-   * Get homogeneous cell coordinates
-   * @return cell coordinate matrix of partition
+   * Get number of the push, in which the partition has been within range of the sensor for the last time
+   * @return push number, see TsdGrid::releasePartitions
    */
-  Matrix* getCellCoordsHom() const { return _cellCoordsHom; }
+  unsigned int getLastPush() const { return _lastPush; }
 
   /**
-   * Get partition coordinates
-   * @return partition coordinates matrix
+   * Get revision of grid, in which cells of the partition have been modified for the last time
+   * @return revision, see TsdGrid::getRevision
    */
-  Matrix* getPartitionCoords() const { return _partCoords; }
+  unsigned int getRevision() const { return _revision; }
 
   /**
    * Get width, i.e., number of cells in x-dimension
@@ -127,6 +129,30 @@ public:
    */
   virtual void increaseEmptiness();
 
+  /**
+   * Release cells, the partition is uninitialized afterwards
+   */
+  void reset();
+
+  /**
+   * Invalidate border cells, which are copies of neighboring partitions
+   */
+  void clearBorders();
+
+  /**
+   * Move partition to other indices, e.g., when recycling partitions of a rolling grid. Cells are kept.
+   * @param[in] x start index in x-dimension
+   * @param[in] y start index in y-dimension
+   * @param[in] origin world coordinates of cell index (0, 0), NULL for the coordinate origin
+   */
+  void relocate(const unsigned int x, const unsigned int y, const obfloat* origin);
+
+  /**
+   * Release cells and mark whole partition as empty
+   * @param weight emptiness weight
+   */
+  void setEmpty(const obfloat weight);
+
   /**
    * Interpolate bilinear within cell
    * @param x x-index
@@ -137,16 +163,30 @@ public:
    */
   obfloat interpolateBilinear(int x, int y, obfloat dx, obfloat dy);
 
-private:
+  /**
+   * Encode cells in binary format, borders are not included. Runs of uninitialized cells are skipped, i.e., the data consists
+   * of runs (number of skipped cells, number of cells) followed by the tsd and weight values of the run.
+   * @param[out] buf encoded data
+   * @param[in] quantize store tsd and weight values with 16 bit each instead of their full precision
+   */
+  void serialize(vector<unsigned char> &buf, const bool quantize=false) const;
+
+  /**
+   * Decode cells in binary format, the partition is initialized
+   * @param[in] buf encoded data
+   * @param[in] size number of bytes
+   * @param[in] maxTruncation maximum truncation radius
+   * @param[in] quantized values have been quantized while encoding
+   * @return false, if data is corrupted
+   */
+  bool load(const unsigned char* buf, const size_t size, const obfloat maxTruncation, const bool quantized=false);
 
-  static Matrix* _partCoords;
+private:
 
   TsdCell** _grid;
 
   obfloat _cellSize;
 
-  Matrix* _cellCoordsHom;
-
   unsigned int _cellsX;
 
   unsigned int _cellsY;
@@ -165,6 +205,10 @@ private:
 
   obfloat _eps;
 
+  unsigned int _lastPush;
+
+  unsigned int _revision;
+
 };
 
 inline void TsdGridPartition::addTsd(const unsigned int x, const unsigned int y, const obfloat sd, const obfloat weight)
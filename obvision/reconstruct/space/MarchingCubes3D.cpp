@@ -0,0 +1,698 @@
+#include "MarchingCubes3D.h"
+#include "obcore/base/Logger.h"
+#include "obcore/base/Timer.h"
+#include "obvision/reconstruct/reconstruct_defs.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <set>
+
+namespace obvious
+{
+
+// Corners of a cube are enumerated by their offsets, i.e., corner c = dx + 2*dy + 4*dz.
+// Edges 0-3 are parallel to the x-axis, 4-7 to the y-axis and 8-11 to the z-axis, the first corner is the lower one.
+static const unsigned int _edgeCorners[12][2] = {{0, 1}, {2, 3}, {4, 5}, {6, 7},
+                                                 {0, 2}, {1, 3}, {4, 6}, {5, 7},
+                                                 {0, 4}, {1, 5}, {2, 6}, {3, 7}};
+
+// Triangles of each cube configuration (bit c is set, if corner c lies behind the surface), terminated with -1.
+// Ambiguous faces separate corners behind the surface, so that neighboring cubes always agree and the mesh is closed.
+static const int _triTable[256][16] = {
+  {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 9,  5,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  9,  4,  9,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  8,  0, 10,  0,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  1,  9,  5,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  8,  9, 10,  9,  5, 10,  5,  1, -1, -1, -1, -1, -1, -1, -1},
+  { 5, 11,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  0,  5, 11,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 9, 11,  1,  9,  1,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  9,  4,  9, 11,  4, 11,  1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  5, 10,  5, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  8,  0, 10,  0,  5, 10,  5, 11, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  0, 10,  0,  9, 10,  9, 11, -1, -1, -1, -1, -1, -1, -1},
+  {10,  8,  9, 10,  9, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  6,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  6,  2,  4,  2,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  6,  2,  9,  5,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  6,  2,  4,  2,  9,  4,  9,  5, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  1,  8,  6,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  6,  2, 10,  2,  0, 10,  0,  1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  1,  8,  6,  2,  9,  5,  0, -1, -1, -1, -1, -1, -1, -1},
+  {10,  6,  2, 10,  2,  9, 10,  9,  5, 10,  5,  1, -1, -1, -1, -1},
+  { 8,  6,  2,  5, 11,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  6,  2,  4,  2,  0,  5, 11,  1, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  6,  2,  9, 11,  1,  9,  1,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  6,  2,  4,  2,  9,  4,  9, 11,  4, 11,  1, -1, -1, -1, -1},
+  {10,  4,  5, 10,  5, 11,  8,  6,  2, -1, -1, -1, -1, -1, -1, -1},
+  {10,  6,  2, 10,  2,  0, 10,  0,  5, 10,  5, 11, -1, -1, -1, -1},
+  {10,  4,  0, 10,  0,  9, 10,  9, 11,  8,  6,  2, -1, -1, -1, -1},
+  {10,  6,  2, 10,  2,  9, 10,  9, 11, -1, -1, -1, -1, -1, -1, -1},
+  { 7,  9,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  0,  7,  9,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 7,  5,  0,  7,  0,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  2,  4,  2,  7,  4,  7,  5, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  1,  7,  9,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  8,  0, 10,  0,  1,  7,  9,  2, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  1,  7,  5,  0,  7,  0,  2, -1, -1, -1, -1, -1, -1, -1},
+  {10,  8,  2, 10,  2,  7, 10,  7,  5, 10,  5,  1, -1, -1, -1, -1},
+  { 5, 11,  1,  7,  9,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  0,  5, 11,  1,  7,  9,  2, -1, -1, -1, -1, -1, -1, -1},
+  { 7, 11,  1,  7,  1,  0,  7,  0,  2, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  2,  4,  2,  7,  4,  7, 11,  4, 11,  1, -1, -1, -1, -1},
+  {10,  4,  5, 10,  5, 11,  7,  9,  2, -1, -1, -1, -1, -1, -1, -1},
+  {10,  8,  0, 10,  0,  5, 10,  5, 11,  7,  9,  2, -1, -1, -1, -1},
+  {10,  4,  0, 10,  0,  2, 10,  2,  7, 10,  7, 11, -1, -1, -1, -1},
+  {10,  8,  2, 10,  2,  7, 10,  7, 11, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  6,  7,  8,  7,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  6,  7,  4,  7,  9,  4,  9,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  6,  7,  8,  7,  5,  8,  5,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  6,  7,  4,  7,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  1,  8,  6,  7,  8,  7,  9, -1, -1, -1, -1, -1, -1, -1},
+  {10,  6,  7, 10,  7,  9, 10,  9,  0, 10,  0,  1, -1, -1, -1, -1},
+  {10,  4,  1,  8,  6,  7,  8,  7,  5,  8,  5,  0, -1, -1, -1, -1},
+  {10,  6,  7, 10,  7,  5, 10,  5,  1, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  6,  7,  8,  7,  9,  5, 11,  1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  6,  7,  4,  7,  9,  4,  9,  0,  5, 11,  1, -1, -1, -1, -1},
+  { 8,  6,  7,  8,  7, 11,  8, 11,  1,  8,  1,  0, -1, -1, -1, -1},
+  { 4,  6,  7,  4,  7, 11,  4, 11,  1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  5, 10,  5, 11,  8,  6,  7,  8,  7,  9, -1, -1, -1, -1},
+  {10,  6,  7, 10,  7,  9, 10,  9,  0, 10,  0,  5, 10,  5, 11, -1},
+  {10,  4,  0, 10,  0,  8, 10,  8,  6, 10,  6,  7, 10,  7, 11, -1},
+  {10,  6,  7, 10,  7, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  3,  4,  8,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  3,  9,  5,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  3,  4,  8,  9,  4,  9,  5, -1, -1, -1, -1, -1, -1, -1},
+  { 6,  4,  1,  6,  1,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 6,  8,  0,  6,  0,  1,  6,  1,  3, -1, -1, -1, -1, -1, -1, -1},
+  { 6,  4,  1,  6,  1,  3,  9,  5,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 6,  8,  9,  6,  9,  5,  6,  5,  1,  6,  1,  3, -1, -1, -1, -1},
+  { 6, 10,  3,  5, 11,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  3,  4,  8,  0,  5, 11,  1, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  3,  9, 11,  1,  9,  1,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  3,  4,  8,  9,  4,  9, 11,  4, 11,  1, -1, -1, -1, -1},
+  { 6,  4,  5,  6,  5, 11,  6, 11,  3, -1, -1, -1, -1, -1, -1, -1},
+  { 6,  8,  0,  6,  0,  5,  6,  5, 11,  6, 11,  3, -1, -1, -1, -1},
+  { 6,  4,  0,  6,  0,  9,  6,  9, 11,  6, 11,  3, -1, -1, -1, -1},
+  { 6,  8,  9,  6,  9, 11,  6, 11,  3, -1, -1, -1, -1, -1, -1, -1},
+  { 8, 10,  3,  8,  3,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4, 10,  3,  4,  3,  2,  4,  2,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 8, 10,  3,  8,  3,  2,  9,  5,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 4, 10,  3,  4,  3,  2,  4,  2,  9,  4,  9,  5, -1, -1, -1, -1},
+  { 8,  4,  1,  8,  1,  3,  8,  3,  2, -1, -1, -1, -1, -1, -1, -1},
+  { 2,  0,  1,  2,  1,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  4,  1,  8,  1,  3,  8,  3,  2,  9,  5,  0, -1, -1, -1, -1},
+  { 9,  5,  1,  9,  1,  3,  9,  3,  2, -1, -1, -1, -1, -1, -1, -1},
+  { 8, 10,  3,  8,  3,  2,  5, 11,  1, -1, -1, -1, -1, -1, -1, -1},
+  { 4, 10,  3,  4,  3,  2,  4,  2,  0,  5, 11,  1, -1, -1, -1, -1},
+  { 8, 10,  3,  8,  3,  2,  9, 11,  1,  9,  1,  0, -1, -1, -1, -1},
+  { 4, 10,  3,  4,  3,  2,  4,  2,  9,  4,  9, 11,  4, 11,  1, -1},
+  { 8,  4,  5,  8,  5, 11,  8, 11,  3,  8,  3,  2, -1, -1, -1, -1},
+  { 5, 11,  3,  5,  3,  2,  5,  2,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  4,  0,  8,  0,  9,  8,  9, 11,  8, 11,  3,  8,  3,  2, -1},
+  { 9, 11,  3,  9,  3,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  3,  7,  9,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  3,  4,  8,  0,  7,  9,  2, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  3,  7,  5,  0,  7,  0,  2, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  3,  4,  8,  2,  4,  2,  7,  4,  7,  5, -1, -1, -1, -1},
+  { 6,  4,  1,  6,  1,  3,  7,  9,  2, -1, -1, -1, -1, -1, -1, -1},
+  { 6,  8,  0,  6,  0,  1,  6,  1,  3,  7,  9,  2, -1, -1, -1, -1},
+  { 6,  4,  1,  6,  1,  3,  7,  5,  0,  7,  0,  2, -1, -1, -1, -1},
+  { 6,  8,  2,  6,  2,  7,  6,  7,  5,  6,  5,  1,  6,  1,  3, -1},
+  { 6, 10,  3,  5, 11,  1,  7,  9,  2, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  3,  4,  8,  0,  5, 11,  1,  7,  9,  2, -1, -1, -1, -1},
+  { 6, 10,  3,  7, 11,  1,  7,  1,  0,  7,  0,  2, -1, -1, -1, -1},
+  { 6, 10,  3,  4,  8,  2,  4,  2,  7,  4,  7, 11,  4, 11,  1, -1},
+  { 6,  4,  5,  6,  5, 11,  6, 11,  3,  7,  9,  2, -1, -1, -1, -1},
+  { 6,  8,  0,  6,  0,  5,  6,  5, 11,  6, 11,  3,  7,  9,  2, -1},
+  { 6,  4,  0,  6,  0,  2,  6,  2,  7,  6,  7, 11,  6, 11,  3, -1},
+  { 6,  8,  2,  6,  2,  7,  6,  7, 11,  6, 11,  3, -1, -1, -1, -1},
+  { 8, 10,  3,  8,  3,  7,  8,  7,  9, -1, -1, -1, -1, -1, -1, -1},
+  { 4, 10,  3,  4,  3,  7,  4,  7,  9,  4,  9,  0, -1, -1, -1, -1},
+  { 8, 10,  3,  8,  3,  7,  8,  7,  5,  8,  5,  0, -1, -1, -1, -1},
+  { 4, 10,  3,  4,  3,  7,  4,  7,  5, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  4,  1,  8,  1,  3,  8,  3,  7,  8,  7,  9, -1, -1, -1, -1},
+  { 7,  9,  0,  7,  0,  1,  7,  1,  3, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  4,  1,  8,  1,  3,  8,  3,  7,  8,  7,  5,  8,  5,  0, -1},
+  { 7,  5,  1,  7,  1,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 8, 10,  3,  8,  3,  7,  8,  7,  9,  5, 11,  1, -1, -1, -1, -1},
+  { 4, 10,  3,  4,  3,  7,  4,  7,  9,  4,  9,  0,  5, 11,  1, -1},
+  { 8, 10,  3,  8,  3,  7,  8,  7, 11,  8, 11,  1,  8,  1,  0, -1},
+  { 4, 10,  3,  4,  3,  7,  4,  7, 11,  4, 11,  1, -1, -1, -1, -1},
+  { 8,  4,  5,  8,  5, 11,  8, 11,  3,  8,  3,  7,  8,  7,  9, -1},
+  { 5, 11,  3,  5,  3,  7,  5,  7,  9,  5,  9,  0, -1, -1, -1, -1},
+  { 8,  4,  0,  7, 11,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 7, 11,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {11,  7,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  0, 11,  7,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {11,  7,  3,  9,  5,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  9,  4,  9,  5, 11,  7,  3, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  1, 11,  7,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  8,  0, 10,  0,  1, 11,  7,  3, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  1, 11,  7,  3,  9,  5,  0, -1, -1, -1, -1, -1, -1, -1},
+  {10,  8,  9, 10,  9,  5, 10,  5,  1, 11,  7,  3, -1, -1, -1, -1},
+  { 5,  7,  3,  5,  3,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  0,  5,  7,  3,  5,  3,  1, -1, -1, -1, -1, -1, -1, -1},
+  { 9,  7,  3,  9,  3,  1,  9,  1,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  9,  4,  9,  7,  4,  7,  3,  4,  3,  1, -1, -1, -1, -1},
+  {10,  4,  5, 10,  5,  7, 10,  7,  3, -1, -1, -1, -1, -1, -1, -1},
+  {10,  8,  0, 10,  0,  5, 10,  5,  7, 10,  7,  3, -1, -1, -1, -1},
+  {10,  4,  0, 10,  0,  9, 10,  9,  7, 10,  7,  3, -1, -1, -1, -1},
+  {10,  8,  9, 10,  9,  7, 10,  7,  3, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  6,  2, 11,  7,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  6,  2,  4,  2,  0, 11,  7,  3, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  6,  2, 11,  7,  3,  9,  5,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  6,  2,  4,  2,  9,  4,  9,  5, 11,  7,  3, -1, -1, -1, -1},
+  {10,  4,  1,  8,  6,  2, 11,  7,  3, -1, -1, -1, -1, -1, -1, -1},
+  {10,  6,  2, 10,  2,  0, 10,  0,  1, 11,  7,  3, -1, -1, -1, -1},
+  {10,  4,  1,  8,  6,  2, 11,  7,  3,  9,  5,  0, -1, -1, -1, -1},
+  {10,  6,  2, 10,  2,  9, 10,  9,  5, 10,  5,  1, 11,  7,  3, -1},
+  { 8,  6,  2,  5,  7,  3,  5,  3,  1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  6,  2,  4,  2,  0,  5,  7,  3,  5,  3,  1, -1, -1, -1, -1},
+  { 8,  6,  2,  9,  7,  3,  9,  3,  1,  9,  1,  0, -1, -1, -1, -1},
+  { 4,  6,  2,  4,  2,  9,  4,  9,  7,  4,  7,  3,  4,  3,  1, -1},
+  {10,  4,  5, 10,  5,  7, 10,  7,  3,  8,  6,  2, -1, -1, -1, -1},
+  {10,  6,  2, 10,  2,  0, 10,  0,  5, 10,  5,  7, 10,  7,  3, -1},
+  {10,  4,  0, 10,  0,  9, 10,  9,  7, 10,  7,  3,  8,  6,  2, -1},
+  {10,  6,  2, 10,  2,  9, 10,  9,  7, 10,  7,  3, -1, -1, -1, -1},
+  {11,  9,  2, 11,  2,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  0, 11,  9,  2, 11,  2,  3, -1, -1, -1, -1, -1, -1, -1},
+  {11,  5,  0, 11,  0,  2, 11,  2,  3, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  2,  4,  2,  3,  4,  3, 11,  4, 11,  5, -1, -1, -1, -1},
+  {10,  4,  1, 11,  9,  2, 11,  2,  3, -1, -1, -1, -1, -1, -1, -1},
+  {10,  8,  0, 10,  0,  1, 11,  9,  2, 11,  2,  3, -1, -1, -1, -1},
+  {10,  4,  1, 11,  5,  0, 11,  0,  2, 11,  2,  3, -1, -1, -1, -1},
+  {10,  8,  2, 10,  2,  3, 10,  3, 11, 10, 11,  5, 10,  5,  1, -1},
+  { 5,  9,  2,  5,  2,  3,  5,  3,  1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  0,  5,  9,  2,  5,  2,  3,  5,  3,  1, -1, -1, -1, -1},
+  { 0,  2,  3,  0,  3,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  8,  2,  4,  2,  3,  4,  3,  1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  5, 10,  5,  9, 10,  9,  2, 10,  2,  3, -1, -1, -1, -1},
+  {10,  8,  0, 10,  0,  5, 10,  5,  9, 10,  9,  2, 10,  2,  3, -1},
+  {10,  4,  0, 10,  0,  2, 10,  2,  3, -1, -1, -1, -1, -1, -1, -1},
+  {10,  8,  2, 10,  2,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  6,  3,  8,  3, 11,  8, 11,  9, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  6,  3,  4,  3, 11,  4, 11,  9,  4,  9,  0, -1, -1, -1, -1},
+  { 8,  6,  3,  8,  3, 11,  8, 11,  5,  8,  5,  0, -1, -1, -1, -1},
+  { 4,  6,  3,  4,  3, 11,  4, 11,  5, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  1,  8,  6,  3,  8,  3, 11,  8, 11,  9, -1, -1, -1, -1},
+  {10,  6,  3, 10,  3, 11, 10, 11,  9, 10,  9,  0, 10,  0,  1, -1},
+  {10,  4,  1,  8,  6,  3,  8,  3, 11,  8, 11,  5,  8,  5,  0, -1},
+  {10,  6,  3, 10,  3, 11, 10, 11,  5, 10,  5,  1, -1, -1, -1, -1},
+  { 8,  6,  3,  8,  3,  1,  8,  1,  5,  8,  5,  9, -1, -1, -1, -1},
+  { 4,  6,  3,  4,  3,  1,  4,  1,  5,  4,  5,  9,  4,  9,  0, -1},
+  { 8,  6,  3,  8,  3,  1,  8,  1,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 4,  6,  3,  4,  3,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  5, 10,  5,  9, 10,  9,  8, 10,  8,  6, 10,  6,  3, -1},
+  {10,  6,  3,  5,  9,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {10,  4,  0, 10,  0,  8, 10,  8,  6, 10,  6,  3, -1, -1, -1, -1},
+  {10,  6,  3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10, 11,  6, 11,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10, 11,  6, 11,  7,  4,  8,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10, 11,  6, 11,  7,  9,  5,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10, 11,  6, 11,  7,  4,  8,  9,  4,  9,  5, -1, -1, -1, -1},
+  { 6,  4,  1,  6,  1, 11,  6, 11,  7, -1, -1, -1, -1, -1, -1, -1},
+  { 6,  8,  0,  6,  0,  1,  6,  1, 11,  6, 11,  7, -1, -1, -1, -1},
+  { 6,  4,  1,  6,  1, 11,  6, 11,  7,  9,  5,  0, -1, -1, -1, -1},
+  { 6,  8,  9,  6,  9,  5,  6,  5,  1,  6,  1, 11,  6, 11,  7, -1},
+  { 6, 10,  1,  6,  1,  5,  6,  5,  7, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  1,  6,  1,  5,  6,  5,  7,  4,  8,  0, -1, -1, -1, -1},
+  { 6, 10,  1,  6,  1,  0,  6,  0,  9,  6,  9,  7, -1, -1, -1, -1},
+  { 6, 10,  1,  6,  1,  4,  6,  4,  8,  6,  8,  9,  6,  9,  7, -1},
+  { 6,  4,  5,  6,  5,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 6,  8,  0,  6,  0,  5,  6,  5,  7, -1, -1, -1, -1, -1, -1, -1},
+  { 6,  4,  0,  6,  0,  9,  6,  9,  7, -1, -1, -1, -1, -1, -1, -1},
+  { 6,  8,  9,  6,  9,  7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 8, 10, 11,  8, 11,  7,  8,  7,  2, -1, -1, -1, -1, -1, -1, -1},
+  { 4, 10, 11,  4, 11,  7,  4,  7,  2,  4,  2,  0, -1, -1, -1, -1},
+  { 8, 10, 11,  8, 11,  7,  8,  7,  2,  9,  5,  0, -1, -1, -1, -1},
+  { 4, 10, 11,  4, 11,  7,  4,  7,  2,  4,  2,  9,  4,  9,  5, -1},
+  { 8,  4,  1,  8,  1, 11,  8, 11,  7,  8,  7,  2, -1, -1, -1, -1},
+  {11,  7,  2, 11,  2,  0, 11,  0,  1, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  4,  1,  8,  1, 11,  8, 11,  7,  8,  7,  2,  9,  5,  0, -1},
+  {11,  7,  2, 11,  2,  9, 11,  9,  5, 11,  5,  1, -1, -1, -1, -1},
+  { 8, 10,  1,  8,  1,  5,  8,  5,  7,  8,  7,  2, -1, -1, -1, -1},
+  { 4, 10,  1,  4,  1,  5,  4,  5,  7,  4,  7,  2,  4,  2,  0, -1},
+  { 8, 10,  1,  8,  1,  0,  8,  0,  9,  8,  9,  7,  8,  7,  2, -1},
+  { 4, 10,  1,  9,  7,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  4,  5,  8,  5,  7,  8,  7,  2, -1, -1, -1, -1, -1, -1, -1},
+  { 5,  7,  2,  5,  2,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  4,  0,  8,  0,  9,  8,  9,  7,  8,  7,  2, -1, -1, -1, -1},
+  { 9,  7,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10, 11,  6, 11,  9,  6,  9,  2, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10, 11,  6, 11,  9,  6,  9,  2,  4,  8,  0, -1, -1, -1, -1},
+  { 6, 10, 11,  6, 11,  5,  6,  5,  0,  6,  0,  2, -1, -1, -1, -1},
+  { 6, 10, 11,  6, 11,  5,  6,  5,  4,  6,  4,  8,  6,  8,  2, -1},
+  { 6,  4,  1,  6,  1, 11,  6, 11,  9,  6,  9,  2, -1, -1, -1, -1},
+  { 6,  8,  0,  6,  0,  1,  6,  1, 11,  6, 11,  9,  6,  9,  2, -1},
+  { 6,  4,  1,  6,  1, 11,  6, 11,  5,  6,  5,  0,  6,  0,  2, -1},
+  { 6,  8,  2, 11,  5,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  1,  6,  1,  5,  6,  5,  9,  6,  9,  2, -1, -1, -1, -1},
+  { 6, 10,  1,  6,  1,  5,  6,  5,  9,  6,  9,  2,  4,  8,  0, -1},
+  { 6, 10,  1,  6,  1,  0,  6,  0,  2, -1, -1, -1, -1, -1, -1, -1},
+  { 6, 10,  1,  6,  1,  4,  6,  4,  8,  6,  8,  2, -1, -1, -1, -1},
+  { 6,  4,  5,  6,  5,  9,  6,  9,  2, -1, -1, -1, -1, -1, -1, -1},
+  { 6,  8,  0,  6,  0,  5,  6,  5,  9,  6,  9,  2, -1, -1, -1, -1},
+  { 6,  4,  0,  6,  0,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 6,  8,  2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 8, 10, 11,  8, 11,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4, 10, 11,  4, 11,  9,  4,  9,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 8, 10, 11,  8, 11,  5,  8,  5,  0, -1, -1, -1, -1, -1, -1, -1},
+  { 4, 10, 11,  4, 11,  5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  4,  1,  8,  1, 11,  8, 11,  9, -1, -1, -1, -1, -1, -1, -1},
+  {11,  9,  0, 11,  0,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  4,  1,  8,  1, 11,  8, 11,  5,  8,  5,  0, -1, -1, -1, -1},
+  {11,  5,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 8, 10,  1,  8,  1,  5,  8,  5,  9, -1, -1, -1, -1, -1, -1, -1},
+  { 4, 10,  1,  4,  1,  5,  4,  5,  9,  4,  9,  0, -1, -1, -1, -1},
+  { 8, 10,  1,  8,  1,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 4, 10,  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  4,  5,  8,  5,  9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 5,  9,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  { 8,  4,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+  {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}
+};
+
+MarchingCubes3D::MarchingCubes3D()
+{
+  _space = NULL;
+}
+
+MarchingCubes3D::~MarchingCubes3D()
+{
+  clear();
+}
+
+void MarchingCubes3D::clear()
+{
+  for(std::map<unsigned int, MeshChunk*>::iterator it=_chunks.begin(); it!=_chunks.end(); ++it)
+    delete it->second;
+  _chunks.clear();
+}
+
+void MarchingCubes3D::extract(TsdSpace* space)
+{
+  clear();
+  _space = NULL;
+  update(space);
+}
+
+unsigned int MarchingCubes3D::update(TsdSpace* space)
+{
+  Timer t;
+  t.start();
+
+  if(space!=_space)
+  {
+    clear();
+    _space = space;
+  }
+
+  unsigned int dimPartition = space->getPartitionSize();
+  unsigned int partitionsInX = space->getXDimension() / dimPartition;
+  unsigned int partitionsInY = space->getYDimension() / dimPartition;
+
+  space->lockRead();
+
+  vector<TsdSpacePartition*> partitions;
+  space->getAllocatedPartitions(partitions);
+
+  // Determine outdated partitions, chunks are created here, so that partitions can be meshed concurrently
+  std::set<unsigned int> keys;
+  vector<TsdSpacePartition*> outdated;
+  vector<MeshChunk*> chunks;
+  for(unsigned int i=0; i<partitions.size(); i++)
+  {
+    TsdSpacePartition* part = partitions[i];
+    if(!part->isInitialized() || !part->hasSurface()) continue;
+
+    unsigned int key = ((part->getZ()/dimPartition)*partitionsInY + part->getY()/dimPartition)*partitionsInX + part->getX()/dimPartition;
+    keys.insert(key);
+
+    MeshChunk*& chunk = _chunks[key];
+    if(chunk && !isOutdated(part, chunk)) continue;
+    if(!chunk) chunk = new MeshChunk;
+    outdated.push_back(part);
+    chunks.push_back(chunk);
+  }
+
+  // Discard meshes of partitions, which have been released or do not contain a surface anymore
+  for(std::map<unsigned int, MeshChunk*>::iterator it=_chunks.begin(); it!=_chunks.end();)
+  {
+    if(keys.find(it->first)==keys.end())
+    {
+      delete it->second;
+      _chunks.erase(it++);
+    }
+    else
+      ++it;
+  }
+
+#pragma omp parallel
+  {
+    vector<obfloat> values;
+    vector<int> edgeCache;
+#pragma omp for schedule(dynamic)
+    for(int i=0; i<(int)outdated.size(); i++)
+      meshPartition(outdated[i], values, edgeCache, chunks[i]);
+  }
+
+  space->unlockRead();
+
+  LOGMSG(DBG_DEBUG, "Meshed " << outdated.size() << " partitions in " << t.elapsed() << "s, " << getNumberOfTriangles() << " triangles");
+
+  return outdated.size();
+}
+
+bool MarchingCubes3D::isOutdated(TsdSpacePartition* part, const MeshChunk* chunk) const
+{
+  if(part->isModified() || part->getStamp()!=chunk->stamp || part->getLevel()!=chunk->level) return true;
+  if(part->getX()!=chunk->x || part->getY()!=chunk->y || part->getZ()!=chunk->z) return true;
+
+  // Partitions of a rolling window are moved along with the origin
+  obfloat offset[3];
+  part->getCellCoordsOffset(offset);
+  return (offset[0]!=chunk->offset[0] || offset[1]!=chunk->offset[1] || offset[2]!=chunk->offset[2]);
+}
+
+void MarchingCubes3D::meshPartition(TsdSpacePartition* part, vector<obfloat> &values, vector<int> &edgeCache, MeshChunk* chunk)
+{
+  chunk->stamp = part->getStamp();
+  chunk->level = part->getLevel();
+  chunk->x     = part->getX();
+  chunk->y     = part->getY();
+  chunk->z     = part->getZ();
+  chunk->color = part->hasColor();
+  part->getCellCoordsOffset(chunk->offset);
+  chunk->coords.clear();
+  chunk->normals.clear();
+  chunk->rgb.clear();
+  chunk->indices.clear();
+  chunk->seamVertices.clear();
+  chunk->seamKeys.clear();
+
+  // Cube edges are identified globally within the grid of the level
+  const uint64_t gridX = _space->getXDimension() + 1;
+  const uint64_t gridY = _space->getYDimension() + 1;
+  const uint64_t gridZ = _space->getZDimension() + 1;
+
+  const obfloat size = _space->getVoxelSize() * (obfloat)(1 << chunk->level);
+
+  // Voxels of the current level including the border layer, i.e., corners of all cubes
+  const unsigned int nx = part->getLevelWidth() + 1;
+  const unsigned int ny = part->getLevelHeight() + 1;
+  const unsigned int nz = part->getLevelDepth() + 1;
+  values.resize(nx*ny*nz);
+  edgeCache.assign(nx*ny*nz*3, -1);
+  unsigned int i = 0;
+  for(unsigned int z=0; z<nz; z++)
+    for(unsigned int y=0; y<ny; y++)
+      for(unsigned int x=0; x<nx; x++, i++)
+        values[i] = part->getTsd(part->getIndex(z, y, x));
+
+  const unsigned int cornerOffset[8] = {0, 1, nx, nx+1, nx*ny, nx*ny+1, nx*ny+nx, nx*ny+nx+1};
+
+  for(unsigned int z=0; z<nz-1; z++)
+  {
+    for(unsigned int y=0; y<ny-1; y++)
+    {
+      for(unsigned int x=0; x<nx-1; x++)
+      {
+        const unsigned int base = (z*ny+y)*nx+x;
+
+        // Skip cubes with unobserved corners and cubes far from any surface, i.e., sign changes between truncated voxels
+        obfloat v[8];
+        unsigned int config = 0;
+        bool valid = true;
+        bool near = false;
+        for(unsigned int c=0; c<8; c++)
+        {
+          v[c] = values[base + cornerOffset[c]];
+          if(isnan(v[c])) valid = false;
+          if(fabs(v[c]) < TSDINC) near = true;
+          if(v[c] < 0.0) config |= (1 << c);
+        }
+        if(!valid || !near || config==0 || config==255) continue;
+
+        const int* tri = _triTable[config];
+        for(unsigned int k=0; tri[k]>=0; k++)
+        {
+          const unsigned int e    = tri[k];
+          const unsigned int c0   = _edgeCorners[e][0];
+          const unsigned int c1   = _edgeCorners[e][1];
+          const unsigned int axis = e / 4;
+          int& vertex = edgeCache[(base + cornerOffset[c0])*3 + axis];
+          if(vertex<0)
+          {
+            vertex = chunk->coords.size() / 3;
+
+            // Interpolate zero crossing between voxel centers
+            obfloat s = v[c0] / (v[c0] - v[c1]);
+            obfloat coord[3];
+            coord[0] = chunk->offset[0] + ((obfloat)(x + (c0&1)) + 0.5) * size;
+            coord[1] = chunk->offset[1] + ((obfloat)(y + ((c0>>1)&1)) + 0.5) * size;
+            coord[2] = chunk->offset[2] + ((obfloat)(z + ((c0>>2)&1)) + 0.5) * size;
+            coord[axis] += s * size;
+            chunk->coords.insert(chunk->coords.end(), coord, coord+3);
+
+            // Normals are taken from the gradient of the tsd, within the cube, if neighbors are not available
+            obfloat normal[3];
+            if(!_space->interpolateNormal(coord, normal))
+            {
+              obfloat f[3] = {(obfloat)(c0&1), (obfloat)((c0>>1)&1), (obfloat)((c0>>2)&1)};
+              f[axis] += s;
+              normal[0] = (1-f[1])*(1-f[2])*(v[1]-v[0]) + f[1]*(1-f[2])*(v[3]-v[2]) + (1-f[1])*f[2]*(v[5]-v[4]) + f[1]*f[2]*(v[7]-v[6]);
+              normal[1] = (1-f[0])*(1-f[2])*(v[2]-v[0]) + f[0]*(1-f[2])*(v[3]-v[1]) + (1-f[0])*f[2]*(v[6]-v[4]) + f[0]*f[2]*(v[7]-v[5]);
+              normal[2] = (1-f[0])*(1-f[1])*(v[4]-v[0]) + f[0]*(1-f[1])*(v[5]-v[1]) + (1-f[0])*f[1]*(v[6]-v[2]) + f[0]*f[1]*(v[7]-v[3]);
+              obfloat len = sqrt(normal[0]*normal[0] + normal[1]*normal[1] + normal[2]*normal[2]);
+              if(len>0.0)
+              {
+                normal[0] /= len;
+                normal[1] /= len;
+                normal[2] /= len;
+              }
+            }
+            chunk->normals.insert(chunk->normals.end(), normal, normal+3);
+
+            unsigned char rgb[3] = {0, 0, 0};
+            if(chunk->color) _space->interpolateTrilinearRGB(coord, rgb);
+            chunk->rgb.insert(chunk->rgb.end(), rgb, rgb+3);
+
+            const unsigned int cx = x + (c0&1);
+            const unsigned int cy = y + ((c0>>1)&1);
+            const unsigned int cz = z + ((c0>>2)&1);
+            if(cx==0 || cy==0 || cz==0 || cx==nx-1 || cy==ny-1 || cz==nz-1)
+            {
+              const uint64_t gx = (chunk->x >> chunk->level) + cx;
+              const uint64_t gy = (chunk->y >> chunk->level) + cy;
+              const uint64_t gz = (chunk->z >> chunk->level) + cz;
+              chunk->seamVertices.push_back(vertex);
+              chunk->seamKeys.push_back(((((uint64_t)chunk->level*gridZ + gz)*gridY + gy)*gridX + gx)*3 + axis);
+            }
+          }
+          chunk->indices.push_back(vertex);
+        }
+      }
+    }
+  }
+}
+
+unsigned int MarchingCubes3D::mergeVertices(vector<unsigned int> &map, vector<bool> &first) const
+{
+  std::map<uint64_t, unsigned int> seams;
+  unsigned int vertices = 0;
+  map.clear();
+  first.clear();
+  for(std::map<unsigned int, MeshChunk*>::const_iterator it=_chunks.begin(); it!=_chunks.end(); ++it)
+  {
+    const MeshChunk* chunk = it->second;
+    const unsigned int base = map.size();
+    map.resize(base + chunk->coords.size()/3);
+    first.resize(map.size(), true);
+
+    // Vertices on faces might have been created by a neighbor before
+    for(unsigned int i=0; i<chunk->seamKeys.size(); i++)
+    {
+      std::map<uint64_t, unsigned int>::const_iterator seam = seams.find(chunk->seamKeys[i]);
+      if(seam==seams.end()) continue;
+      map[base + chunk->seamVertices[i]]   = seam->second;
+      first[base + chunk->seamVertices[i]] = false;
+    }
+
+    for(unsigned int i=base; i<map.size(); i++)
+      if(first[i]) map[i] = vertices++;
+
+    for(unsigned int i=0; i<chunk->seamKeys.size(); i++)
+      if(first[base + chunk->seamVertices[i]])
+        seams[chunk->seamKeys[i]] = map[base + chunk->seamVertices[i]];
+  }
+  return vertices;
+}
+
+unsigned int MarchingCubes3D::getNumberOfVertices() const
+{
+  vector<unsigned int> map;
+  vector<bool> first;
+  return mergeVertices(map, first);
+}
+
+unsigned int MarchingCubes3D::getNumberOfTriangles() const
+{
+  unsigned int triangles = 0;
+  for(std::map<unsigned int, MeshChunk*>::const_iterator it=_chunks.begin(); it!=_chunks.end(); ++it)
+    triangles += it->second->indices.size() / 3;
+  return triangles;
+}
+
+bool MarchingCubes3D::hasColor() const
+{
+  for(std::map<unsigned int, MeshChunk*>::const_iterator it=_chunks.begin(); it!=_chunks.end(); ++it)
+    if(it->second->color) return true;
+  return false;
+}
+
+void MarchingCubes3D::getMesh(obfloat* coords, obfloat* normals, unsigned char* rgb, unsigned int* indices) const
+{
+  vector<unsigned int> map;
+  vector<bool> first;
+  mergeVertices(map, first);
+
+  unsigned int base = 0;
+  unsigned int cnt = 0;
+  for(std::map<unsigned int, MeshChunk*>::const_iterator it=_chunks.begin(); it!=_chunks.end(); ++it)
+  {
+    const MeshChunk* chunk = it->second;
+    for(unsigned int i=0; i<chunk->coords.size()/3; i++)
+    {
+      if(!first[base+i]) continue;
+      const unsigned int j = map[base+i];
+      memcpy(&coords[3*j], &chunk->coords[3*i], 3*sizeof(obfloat));
+      if(normals) memcpy(&normals[3*j], &chunk->normals[3*i], 3*sizeof(obfloat));
+      if(rgb) memcpy(&rgb[3*j], &chunk->rgb[3*i], 3*sizeof(unsigned char));
+    }
+    for(unsigned int i=0; i<chunk->indices.size(); i++)
+      indices[cnt++] = map[base + chunk->indices[i]];
+    base += chunk->coords.size() / 3;
+  }
+}
+
+bool MarchingCubes3D::serializePLY(const char* filename) const
+{
+  ofstream f(filename, ios::out | ios::binary);
+  if(!f.is_open())
+  {
+    LOGMSG(DBG_ERROR, "Could not open file " << filename);
+    return false;
+  }
+
+  vector<unsigned int> map;
+  vector<bool> first;
+  const unsigned int vertices = mergeVertices(map, first);
+
+  const bool color = hasColor();
+  f << "ply" << endl;
+  f << "format binary_little_endian 1.0" << endl;
+  f << "element vertex " << vertices << endl;
+  f << "property float x" << endl << "property float y" << endl << "property float z" << endl;
+  f << "property float nx" << endl << "property float ny" << endl << "property float nz" << endl;
+  if(color)
+    f << "property uchar red" << endl << "property uchar green" << endl << "property uchar blue" << endl;
+  f << "element face " << getNumberOfTriangles() << endl;
+  f << "property list uchar int vertex_indices" << endl;
+  f << "end_header" << endl;
+
+  // Vertices are written in order of output indices, i.e., first occurrences in chunk order
+  unsigned int base = 0;
+  for(std::map<unsigned int, MeshChunk*>::const_iterator it=_chunks.begin(); it!=_chunks.end(); ++it)
+  {
+    const MeshChunk* chunk = it->second;
+    for(unsigned int i=0; i<chunk->coords.size(); i+=3, base++)
+    {
+      if(!first[base]) continue;
+      float vertex[6] = {(float)chunk->coords[i],  (float)chunk->coords[i+1],  (float)chunk->coords[i+2],
+                         (float)chunk->normals[i], (float)chunk->normals[i+1], (float)chunk->normals[i+2]};
+      f.write((const char*)vertex, sizeof(vertex));
+      if(color) f.write((const char*)&chunk->rgb[i], 3);
+    }
+  }
+
+  base = 0;
+  for(std::map<unsigned int, MeshChunk*>::const_iterator it=_chunks.begin(); it!=_chunks.end(); ++it)
+  {
+    const MeshChunk* chunk = it->second;
+    for(unsigned int i=0; i<chunk->indices.size(); i+=3)
+    {
+      unsigned char n = 3;
+      int face[3] = {(int)map[base + chunk->indices[i]], (int)map[base + chunk->indices[i+1]], (int)map[base + chunk->indices[i+2]]};
+      f.write((const char*)&n, 1);
+      f.write((const char*)face, sizeof(face));
+    }
+    base += chunk->coords.size() / 3;
+  }
+
+  if(!f.good())
+  {
+    LOGMSG(DBG_ERROR, "Failed writing mesh to " << filename);
+    return false;
+  }
+  return true;
+}
+
+bool MarchingCubes3D::serializeSTL(const char* filename) const
+{
+  ofstream f(filename, ios::out | ios::binary);
+  if(!f.is_open())
+  {
+    LOGMSG(DBG_ERROR, "Could not open file " << filename);
+    return false;
+  }
+
+  char header[80];
+  memset(header, 0, sizeof(header));
+  strncpy(header, "obviously TsdSpace mesh", sizeof(header)-1);
+  f.write(header, sizeof(header));
+  unsigned int triangles = getNumberOfTriangles();
+  f.write((const char*)&triangles, 4);
+
+  for(std::map<unsigned int, MeshChunk*>::const_iterator it=_chunks.begin(); it!=_chunks.end(); ++it)
+  {
+    const MeshChunk* chunk = it->second;
+    for(unsigned int i=0; i<chunk->indices.size(); i+=3)
+    {
+      const obfloat* p0 = &chunk->coords[3*chunk->indices[i]];
+      const obfloat* p1 = &chunk->coords[3*chunk->indices[i+1]];
+      const obfloat* p2 = &chunk->coords[3*chunk->indices[i+2]];
+      obfloat u[3] = {p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2]};
+      obfloat v[3] = {p2[0]-p0[0], p2[1]-p0[1], p2[2]-p0[2]};
+      obfloat n[3] = {u[1]*v[2]-u[2]*v[1], u[2]*v[0]-u[0]*v[2], u[0]*v[1]-u[1]*v[0]};
+      obfloat len = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+      if(len>0.0)
+      {
+        n[0] /= len;
+        n[1] /= len;
+        n[2] /= len;
+      }
+      float facet[12] = {(float)n[0],  (float)n[1],  (float)n[2],
+                         (float)p0[0], (float)p0[1], (float)p0[2],
+                         (float)p1[0], (float)p1[1], (float)p1[2],
+                         (float)p2[0], (float)p2[1], (float)p2[2]};
+      unsigned short attributes = 0;
+      f.write((const char*)facet, sizeof(facet));
+      f.write((const char*)&attributes, 2);
+    }
+  }
+
+  if(!f.good())
+  {
+    LOGMSG(DBG_ERROR, "Failed writing mesh to " << filename);
+    return false;
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,144 @@
+#ifndef MARCHINGCUBES3D_H_
+#define MARCHINGCUBES3D_H_
+
+#include "obvision/reconstruct/space/TsdSpace.h"
+#include <map>
+#include <stdint.h>
+
+namespace obvious
+{
+
+/**
+ * @class MarchingCubes3D
+ * @brief Extraction of triangle meshes from TsdSpace by marching cubes
+ *
+ * Partitions are meshed concurrently at their current level of detail. Cubes between the last voxel layer and the border layer
+ * of a partition are covered by its border, i.e., the mesh is closed across partitions. Vertices are shared via cube edges within
+ * a partition and merged on output across faces of neighboring partitions with the same level. Meshes of partitions are kept,
+ * so that only partitions changed by pushing or loading need to be meshed again.
+ * @author Stefan May
+ */
+class MarchingCubes3D
+{
+public:
+
+  /**
+   * Constructor
+   */
+  MarchingCubes3D();
+
+  /**
+   * Destructor
+   */
+  virtual ~MarchingCubes3D();
+
+  /**
+   * Mesh all partitions of a space
+   * @param space space
+   */
+  void extract(TsdSpace* space);
+
+  /**
+   * Mesh partitions changed since the last call of extract or update. Passing another space meshes all partitions.
+   * @param space space
+   * @return number of meshed partitions
+   */
+  unsigned int update(TsdSpace* space);
+
+  /**
+   * Get number of vertices of the mesh
+   * @return number of vertices
+   */
+  unsigned int getNumberOfVertices() const;
+
+  /**
+   * Get number of triangles of the mesh
+   * @return number of triangles
+   */
+  unsigned int getNumberOfTriangles() const;
+
+  /**
+   * Determine whether color has been fused into any meshed partition
+   */
+  bool hasColor() const;
+
+  /**
+   * Copy mesh into arrays
+   * @param[out] coords vertex coordinates (size: 3*getNumberOfVertices())
+   * @param[out] normals vertex normals pointing towards free space, may be NULL (size: 3*getNumberOfVertices())
+   * @param[out] rgb vertex colors, may be NULL (size: 3*getNumberOfVertices())
+   * @param[out] indices vertex indices of triangles, counter-clockwise seen from free space (size: 3*getNumberOfTriangles())
+   */
+  void getMesh(obfloat* coords, obfloat* normals, unsigned char* rgb, unsigned int* indices) const;
+
+  /**
+   * Write mesh in binary PLY format with normals and, if available, colors
+   * @param filename file name
+   * @return success
+   */
+  bool serializePLY(const char* filename) const;
+
+  /**
+   * Write mesh in binary STL format
+   * @param filename file name
+   * @return success
+   */
+  bool serializeSTL(const char* filename) const;
+
+private:
+
+  /**
+   * @struct MeshChunk
+   * @brief Mesh of a single partition along with the state of the partition it was extracted from
+   */
+  struct MeshChunk
+  {
+    unsigned int stamp;
+    unsigned int level;
+    unsigned int x;
+    unsigned int y;
+    unsigned int z;
+    obfloat offset[3];
+    bool color;
+    vector<obfloat> coords;
+    vector<obfloat> normals;
+    vector<unsigned char> rgb;
+    vector<unsigned int> indices;
+    // vertices on faces of the partition, which might be shared with neighbors, along with keys of their cube edges
+    vector<unsigned int> seamVertices;
+    vector<uint64_t> seamKeys;
+  };
+
+  void clear();
+
+  /**
+   * Check whether a partition needs to be meshed again
+   */
+  bool isOutdated(TsdSpacePartition* part, const MeshChunk* chunk) const;
+
+  /**
+   * Mesh a single partition
+   * @param[in] part partition
+   * @param[in,out] values buffer for tsd values of partition including border layer
+   * @param[in,out] edgeCache buffer for vertex indices of cube edges
+   * @param[out] chunk mesh of partition
+   */
+  void meshPartition(TsdSpacePartition* part, vector<obfloat> &values, vector<int> &edgeCache, MeshChunk* chunk);
+
+  /**
+   * Assign output indices to vertices of all chunks, shared vertices of neighboring partitions are merged
+   * @param[out] map output index of each vertex in chunk order
+   * @param[out] first flag, whether the vertex is the first one with its output index
+   * @return number of output vertices
+   */
+  unsigned int mergeVertices(vector<unsigned int> &map, vector<bool> &first) const;
+
+  TsdSpace* _space;
+
+  // Meshes of partitions, ordered by partition index
+  std::map<unsigned int, MeshChunk*> _chunks;
+};
+
+}
+
+#endif
@@ -1,6 +1,7 @@
 #include "RayCast3D.h"
 
 #include <string.h>
+#include <algorithm>
 
 #include "obcore/base/System.h"
 #include "obcore/math/mathbase.h"
@@ -22,57 +23,138 @@ unsigned int _traversed = 0;
 
 RayCast3D::RayCast3D()
 {
-  _xmin   = NAN;
-  _ymin   = NAN;
-  _zmin   = NAN;
-
-  _xmax   = NAN;
-  _ymax   = NAN;
-  _zmax   = NAN;
+  _idxMin = 0.0;
+  _idxMax = 0.0;
+
+  _capacity = 0;
+  _coords   = NULL;
+  _normals  = NULL;
+  _rgb      = NULL;
+  _mask     = NULL;
+
+  _incremental   = false;
+  _margin        = 4.0;
+  _checkModified = true;
+  _prevSpace     = NULL;
+  _prevCount     = 0;
+  _prevPushes    = 0;
+  _prevWorld     = NULL;
+  _prevValid     = NULL;
+  _seeds         = NULL;
 }
 
 RayCast3D::~RayCast3D()
 {
+  delete [] _coords;
+  delete [] _normals;
+  delete [] _rgb;
+  delete [] _mask;
+  delete [] _prevWorld;
+  delete [] _prevValid;
+  delete [] _seeds;
+}
+
+void RayCast3D::setIncremental(const bool enable, const obfloat margin, const bool checkModified)
+{
+  _incremental   = enable;
+  _margin        = margin;
+  _checkModified = checkModified;
 
+  // Predictions of former frames are discarded
+  _prevSpace = NULL;
+  _prevCount = 0;
+}
+
+void RayCast3D::reserve(const unsigned int count)
+{
+  if(_capacity >= count) return;
+
+  delete [] _coords;
+  delete [] _normals;
+  delete [] _rgb;
+  delete [] _mask;
+  delete [] _prevWorld;
+  delete [] _prevValid;
+  delete [] _seeds;
+  _coords    = new double[count*3];
+  _normals   = new double[count*3];
+  _rgb       = new unsigned char[count*3];
+  _mask      = new bool[count];
+  _prevWorld = new obfloat[count*3];
+  _prevValid = new bool[count];
+  _seeds     = new obfloat[count];
+  _capacity  = count;
+  _prevCount = 0;
 }
 
 void RayCast3D::calcCoordsFromCurrentPose(TsdSpace* space, Sensor* sensor, double* coords, double* normals, unsigned char* rgb, unsigned int* size)
 {
   Timer t;
   t.start();
+
+  unsigned int count = sensor->getWidth() * sensor->getHeight();
+
+  // Organized buffers are kept between calls
+  reserve(count);
+
+  castRays(space, sensor, _coords, _normals, rgb ? _rgb : NULL, _mask);
+
+  // Compact valid pixels in row-major order
   *size = 0;
+  for(unsigned int i=0; i<count; i++)
+  {
+    if(!_mask[i]) continue;
+    memcpy(&coords[*size],  &_coords[3*i],  3*sizeof(double));
+    memcpy(&normals[*size], &_normals[3*i], 3*sizeof(double));
+    if(rgb) memcpy(&rgb[*size], &_rgb[3*i], 3*sizeof(unsigned char));
+    *size += 3;
+  }
+
+  LOGMSG(DBG_DEBUG, "Elapsed TSDF projection: " << t.elapsed() << "s");
+  LOGMSG(DBG_DEBUG, "Raycasting finished! Found " << *size << " coordinates");
+
+#if PRINTSTATISTICS
+  LOGMSG(DBG_DEBUG, "Traversed: " << _traversed << ", skipped: " << _skipped);
+#endif
+}
 
+void RayCast3D::calcCoordsFromCurrentPoseMask(TsdSpace* space, Sensor* sensor, double* coords, double* normals, unsigned char* rgb, bool* mask, unsigned int* size)
+{
+  Timer t;
+  t.start();
+
+  unsigned int valid = castRays(space, sensor, coords, normals, rgb, mask);
+  *size = sensor->getWidth() * sensor->getHeight() * 3;
+
+  LOGMSG(DBG_DEBUG, "Elapsed TSDF projection: " << t.elapsed() << "ms");
+  LOGMSG(DBG_DEBUG, "Raycasting finished! Found " << valid*3 << " coordinates");
+
+#if PRINTSTATISTICS
+  LOGMSG(DBG_DEBUG, "Traversed: " << _traversed << ", skipped: " << _skipped);
+#endif
+}
+
+unsigned int RayCast3D::castRays(TsdSpace* space, Sensor* sensor, double* coords, double* normals, unsigned char* rgb, bool* mask)
+{
   Matrix Tinv = sensor->getTransformation();
   Tinv.invert();
 
+  // Rigid transformation into the sensor coordinate system (3x4, row-major), applied inline per ray
+  double T[12];
+  for(unsigned int r=0; r<3; r++)
+    for(unsigned int c=0; c<4; c++)
+      T[4*r+c] = Tinv(r, c);
+
   obfloat tr[3];
   sensor->getPosition(tr);
 
   Matrix* R = sensor->getNormalizedRayMap(space->getVoxelSize());
   unsigned int count = sensor->getWidth() * sensor->getHeight();
 
-  if(space->isInsideSpace(sensor))
-  {
-    _xmin   = 0.0;
-    _ymin   = 0.0;
-    _zmin   = 0.0;
+  // Pushing concurrently is either deferred or staged, see TsdSpace::setConcurrentAccess
+  space->lockRead();
 
-    _xmax   = 10e9;
-    _ymax   = 10e9;
-    _zmax   = 10e9;
-  }
-  else
-  {
-    // prevent rays to be casted parallel to a plane outside of space
-    // if we are outside, we might loose some reprojections
-    _xmin   = 10e9;
-    _ymin   = 10e9;
-    _zmin   = 10e9;
-
-    _xmax   = 0.0;
-    _ymax   = 0.0;
-    _zmax   = 0.0;
-  }
+  bool inside = space->isInsideSpace(sensor);
 
 #if PRINTSTATISTICS
   _skipped = 0;
@@ -82,193 +164,273 @@ void RayCast3D::calcCoordsFromCurrentPose(TsdSpace* space, Sensor* sensor, doubl
   _idxMin = sensor->getMinimumRange() / space->getVoxelSize();
   _idxMax = sensor->getMaximumRange() / space->getVoxelSize();
 
+  bool seeded = false;
+  bool checkModified = false;
+  if(_incremental)
+  {
+    reserve(count);
+    seeded = predictSeeds(space, sensor);
+    // Without any push since the previous frame, nothing can have appeared in front of the predicted surface
+    checkModified = _checkModified && (space->getPushCount() != _prevPushes);
+  }
+
+  unsigned int valid = 0;
 
-#pragma omp parallel
+#pragma omp parallel for schedule(dynamic, 64) reduction(+:valid)
+  for(int i=0; i<(int)count; i++)
   {
     obfloat depth = 0.0;
     obfloat c[3];
     obfloat n[3];
-    unsigned char color[3]   = {255, 255, 255};
-    double* c_tmp            = new double[count*3];
-    double* n_tmp            = new double[count*3];
-    unsigned char* color_tmp = new unsigned char[count*3];
-    unsigned int size_tmp     = 0;
-    Matrix M(4,1);
-    Matrix N(4,1);
-    M(3,0) = 1.0;
-    N(3,0) = 0.0; // no translation for normals
-
-#pragma omp for schedule(dynamic)
-    for(unsigned int i=0; i<count; i++)
+    unsigned char color[3] = {255, 255, 255};
+
+    obfloat ray[3];
+    ray[0] = (*R)(0, i);
+    ray[1] = (*R)(1, i);
+    ray[2] = (*R)(2, i);
+
+    double* coord = &coords[3*i];
+    double* normal = normals ? &normals[3*i] : NULL;
+
+    // Search around the surface predicted from the previous frame first, unless the map changed in front of it
+    bool hit = false;
+    if(seeded && _seeds[i] > 0.0)
     {
-      obfloat ray[3];
-      ray[0] = (*R)(0, i);
-      ray[1] = (*R)(1, i);
-      ray[2] = (*R)(2, i);
+      // Start marching at the first surface changed by the last push, if it lies in front of the search interval
+      obfloat from = max(_seeds[i] - _margin, _idxMin);
+      if(checkModified) from = findModified(space, tr, ray, from);
+      hit = rayCastFromSensorPose(space, tr, ray, c, n, rgb ? color : NULL, &depth, inside, from, min(_seeds[i] + _margin, _idxMax));
+    }
+
+    // Raycast returns with coordinates in world coordinate system
+    if(!hit)
+      hit = rayCastFromSensorPose(space, tr, ray, c, n, rgb ? color : NULL, &depth, inside, _idxMin, _idxMax);
 
-      // Raycast returns with coordinates in world coordinate system
-      if(rayCastFromSensorPose(space, tr, ray, c, n, color, &depth)) // Ray returned with coordinates
+    if(_incremental)
+    {
+      _prevValid[i] = hit;
+      if(hit) memcpy(&_prevWorld[3*i], c, 3*sizeof(obfloat));
+    }
+
+    if(hit)
+    {
+      // Transform data to sensor coordinate system, no translation for normals
+      for(unsigned int r=0; r<3; r++)
       {
-        M(0,0) = c[0];
-        M(1,0) = c[1];
-        M(2,0) = c[2];
-        N(0,0) = n[0];
-        N(1,0) = n[1];
-        N(2,0) = n[2];
-        // Transform data to sensor coordinate system
-        M = Tinv * M;
-        N = Tinv * N;
-        for (unsigned int i = 0; i < 3; i++)
-        {
-          c_tmp[size_tmp]      = M(i,0);
-          color_tmp[size_tmp]  = color[i];
-          n_tmp[size_tmp++]    = N(i,0);
-        }
+        coord[r] = T[4*r]*c[0] + T[4*r+1]*c[1] + T[4*r+2]*c[2] + T[4*r+3];
+        if(normal) normal[r] = T[4*r]*n[0] + T[4*r+1]*n[1] + T[4*r+2]*n[2];
       }
+      if(rgb) memcpy(&rgb[3*i], color, 3*sizeof(unsigned char));
+      mask[i] = true;
+      valid++;
     }
-#pragma omp critical
+    else
     {
-      memcpy(&coords[*size],  c_tmp,     size_tmp*sizeof(double));
-      memcpy(&normals[*size], n_tmp,     size_tmp*sizeof(double));
-      if(rgb) memcpy(&rgb[*size],     color_tmp, size_tmp*sizeof(unsigned char));
-      *size += size_tmp;
+      coord[0] = coord[1] = coord[2] = 0.0;
+      if(normal) normal[0] = normal[1] = normal[2] = 0.0;
+      if(rgb) rgb[3*i] = rgb[3*i+1] = rgb[3*i+2] = 0;
+      mask[i] = false;
     }
-    delete[] c_tmp;     c_tmp = NULL;
-    delete[] n_tmp;     n_tmp = NULL;
-    delete[] color_tmp; color_tmp = NULL;
   }
 
-  LOGMSG(DBG_DEBUG, "Elapsed TSDF projection: " << t.elapsed() << "s");
-  LOGMSG(DBG_DEBUG, "Raycasting finished! Found " << *size << " coordinates");
+  if(_incremental)
+  {
+    _prevSpace  = space;
+    _prevCount  = count;
+    _prevPushes = space->getPushCount();
+  }
 
-#if PRINTSTATISTICS
-  LOGMSG(DBG_DEBUG, "Traversed: " << _traversed << ", skipped: " << _skipped);
-#endif
+  space->unlockRead();
+
+  return valid;
 }
 
-void RayCast3D::calcCoordsFromCurrentPoseMask(TsdSpace* space, Sensor* sensor, double* coords, double* normals, unsigned char* rgb, bool* mask, unsigned int* size)
+unsigned int RayCast3D::renderViews(TsdSpace* space, Sensor** sensors, const unsigned int views, double* depth, double* normals)
 {
-  Timer t;
-  t.start();
+  return renderViews(space, sensors, NULL, views, depth, normals);
+}
 
-  Matrix Tinv = sensor->getTransformation();
-  Tinv.invert();
+unsigned int RayCast3D::renderViews(TsdSpace* space, Sensor* sensor, Matrix** poses, const unsigned int views, double* depth, double* normals)
+{
+  vector<Sensor*> sensors(views, sensor);
+  return renderViews(space, &sensors[0], poses, views, depth, normals);
+}
 
-  obfloat tr[3];
-  sensor->getPosition(tr);
-  unsigned int ctr = 0;
+unsigned int RayCast3D::renderViews(TsdSpace* space, Sensor** sensors, Matrix** poses, const unsigned int views, double* depth, double* normals)
+{
+  Timer t;
+  t.start();
 
-  unsigned int width = sensor->getWidth();
-  unsigned int height = sensor->getHeight();
+  if(views==0) return 0;
 
-  Matrix* R = sensor->getNormalizedRayMap(space->getVoxelSize());
-  unsigned int count = sensor->getWidth() * sensor->getHeight();
+  const obfloat voxelSize = space->getVoxelSize();
 
-  if(space->isInsideSpace(sensor))
+  // Setup of views: rotation of rays from the current sensor pose, transformation into the view, position and working range
+  vector<double> rotRays(9*views);
+  vector<double> T(12*views);
+  vector<obfloat> tr(3*views);
+  vector<obfloat> idxMin(views);
+  vector<obfloat> idxMax(views);
+  vector<char> inside(views);
+  vector<unsigned int> offsets(views+1);
+  offsets[0] = 0;
+  for(unsigned int v=0; v<views; v++)
   {
-    _xmin   = 0.0;
-    _ymin   = 0.0;
-    _zmin   = 0.0;
+    Sensor* sensor = sensors[v];
+    Matrix P = sensor->getTransformation();
+    if(poses)
+    {
+      // Rays are given in world coordinates, i.e., rotated with the current pose: R_view = R_pose * R_sensor^T
+      Matrix Q = *poses[v];
+      for(unsigned int r=0; r<3; r++)
+        for(unsigned int c=0; c<3; c++)
+          rotRays[9*v+3*r+c] = Q(r, 0)*P(c, 0) + Q(r, 1)*P(c, 1) + Q(r, 2)*P(c, 2);
+      P = Q;
+    }
+    else
+    {
+      for(unsigned int r=0; r<3; r++)
+        for(unsigned int c=0; c<3; c++)
+          rotRays[9*v+3*r+c] = (r==c) ? 1.0 : 0.0;
+    }
 
-    _xmax   = 10e9;
-    _ymax   = 10e9;
-    _zmax   = 10e9;
-  }
-  else
-  {
-    // prevent rays to be casted parallel to a plane outside of space
-    // if we are outside, we might loose some reprojections
-    _xmin   = 10e9;
-    _ymin   = 10e9;
-    _zmin   = 10e9;
-
-    _xmax   = 0.0;
-    _ymax   = 0.0;
-    _zmax   = 0.0;
+    for(unsigned int r=0; r<3; r++)
+      tr[3*v+r] = P(r, 3);
+    Matrix Pinv = P;
+    Pinv.invert();
+    for(unsigned int r=0; r<3; r++)
+      for(unsigned int c=0; c<4; c++)
+        T[12*v+4*r+c] = Pinv(r, c);
+
+    inside[v] = space->isInsideSpace(&tr[3*v]);
+    idxMin[v] = sensor->getMinimumRange() / voxelSize;
+    idxMax[v] = sensor->getMaximumRange() / voxelSize;
+
+    // Ray maps are scaled once before rays are casted concurrently
+    sensor->getNormalizedRayMap(voxelSize);
+    offsets[v+1] = offsets[v] + sensor->getWidth() * sensor->getHeight();
   }
 
-#if PRINTSTATISTICS
-  _skipped = 0;
-  _traversed = 0;
-#endif
+  const unsigned int count = offsets[views];
+  unsigned int valid = 0;
 
-  _idxMin = sensor->getMinimumRange() / space->getVoxelSize();
-  _idxMax = sensor->getMaximumRange() / space->getVoxelSize();
+  space->lockRead();
 
-#pragma omp parallel
+  // Rays of all views are processed in one loop, so that views of different costs are balanced among threads
+#pragma omp parallel for schedule(dynamic, 64) reduction(+:valid)
+  for(int k=0; k<(int)count; k++)
   {
-    obfloat depth = 0.0;
+    const unsigned int v = (upper_bound(offsets.begin(), offsets.end(), (unsigned int)k) - offsets.begin()) - 1;
+    const unsigned int i = k - offsets[v];
+    Matrix* R = sensors[v]->getNormalizedRayMap(voxelSize);
+    const double* M = &rotRays[9*v];
+
+    obfloat ray[3];
+    for(unsigned int r=0; r<3; r++)
+      ray[r] = M[3*r]*(*R)(0, i) + M[3*r+1]*(*R)(1, i) + M[3*r+2]*(*R)(2, i);
+
     obfloat c[3];
     obfloat n[3];
-    unsigned char color[3]   = {255, 255, 255};
-    double* c_tmp            = new double[width*height*3];
-    double* n_tmp            = new double[width*height*3];
-    unsigned char* color_tmp = new unsigned char[width*height*3];
-    bool* mask_tmp           = new bool[width*height];
-    Matrix M(4,1);
-    Matrix N(4,1);
-    M(3,0) = 1.0;
-    N(3,0) = 0.0; // no translation for normals
-    unsigned int cnt_tmp = 0;
-
-#pragma omp for schedule(dynamic)
-    for (unsigned int i=0; i<count; i++)
+    obfloat d;
+    double* normal = normals ? &normals[3*k] : NULL;
+    if(rayCastFromSensorPose(space, &tr[3*v], ray, c, n, NULL, &d, inside[v], idxMin[v], idxMax[v]))
     {
-      obfloat ray[3];
-      ray[0] = (*R)(0, i);
-      ray[1] = (*R)(1, i);
-      ray[2] = (*R)(2, i);
-
-      if(rayCastFromSensorPose(space, tr, ray, c, n, color, &depth)) // Ray returned with coordinates
-      {
-        M(0,0) = c[0];
-        M(1,0) = c[1];
-        M(2,0) = c[2];
-        N(0,0) = n[0];
-        N(1,0) = n[1];
-        N(2,0) = n[2];
-        M       = Tinv * M;
-        N       = Tinv * N;
-        mask_tmp[cnt_tmp/3] = true;
-        for (unsigned int i = 0; i < 3; i++)
-        {
-          c_tmp[cnt_tmp]      = M(i,0);
-          color_tmp[cnt_tmp]  = color[i];
-          n_tmp[cnt_tmp++]    = N(i,0);
-        }
-      }
-      else
+      depth[k] = d;
+      if(normal)
       {
-        mask_tmp[cnt_tmp/3] = false;
-        for (unsigned int i = 0; i < 3; i++)
-        {
-          c_tmp[cnt_tmp]      = 0;
-          color_tmp[cnt_tmp]  = 0;
-          n_tmp[cnt_tmp++]    = 0;
-        }
+        const double* Tv = &T[12*v];
+        for(unsigned int r=0; r<3; r++)
+          normal[r] = Tv[4*r]*n[0] + Tv[4*r+1]*n[1] + Tv[4*r+2]*n[2];
       }
+      valid++;
     }
-#pragma omp critical
+    else
     {
-      memcpy(&coords[ctr],  c_tmp,     cnt_tmp*sizeof(double));
-      memcpy(&normals[ctr], n_tmp,     cnt_tmp*sizeof(double));
-      memcpy(&rgb[ctr],     color_tmp, cnt_tmp*sizeof(unsigned char));
-      memcpy(&mask[ctr/3],  mask_tmp,  cnt_tmp/3*sizeof(bool));
-      ctr += cnt_tmp;
+      depth[k] = NAN;
+      if(normal) normal[0] = normal[1] = normal[2] = 0.0;
     }
-    delete[] c_tmp;
-    delete[] n_tmp;
-    delete[] color_tmp;
-    delete[] mask_tmp;
   }
 
-  *size = ctr;
-  LOGMSG(DBG_DEBUG, "Elapsed TSDF projection: " << t.elapsed() << "ms");
-  LOGMSG(DBG_DEBUG, "Raycasting finished! Found " << ctr << " coordinates");
+  space->unlockRead();
 
-#if PRINTSTATISTICS
-  LOGMSG(DBG_DEBUG, "Traversed: " << _traversed << ", skipped: " << _skipped);
-#endif
+  LOGMSG(DBG_DEBUG, "Rendered " << views << " views in " << t.elapsed() << "s, " << valid << " of " << count << " pixels with surface");
+
+  return valid;
+}
+
+bool RayCast3D::predictSeeds(TsdSpace* space, Sensor* sensor)
+{
+  unsigned int count = sensor->getWidth() * sensor->getHeight();
+  if(_prevSpace!=space || _prevCount!=count) return false;
+
+  unsigned int points = 0;
+  for(unsigned int i=0; i<count; i++)
+    if(_prevValid[i]) points++;
+  if(points==0) return false;
+
+  // Reproject surface points of the previous frame into the current view
+  Matrix M(points, 4);
+  unsigned int k = 0;
+  for(unsigned int i=0; i<count; i++)
+  {
+    if(!_prevValid[i]) continue;
+    M(k, 0) = _prevWorld[3*i];
+    M(k, 1) = _prevWorld[3*i+1];
+    M(k, 2) = _prevWorld[3*i+2];
+    M(k, 3) = 1.0;
+    k++;
+  }
+  int* indices = new int[points];
+  sensor->backProject(&M, indices);
+
+  obfloat tr[3];
+  sensor->getPosition(tr);
+  obfloat invVoxelSize = 1.0 / space->getVoxelSize();
+
+  // Seeds are given in steps along the ray, the closest point wins for pixels hit several times
+  for(unsigned int i=0; i<count; i++)
+    _seeds[i] = NAN;
+  for(k=0; k<points; k++)
+  {
+    int idx = indices[k];
+    if(idx<0) continue;
+    obfloat p[3] = {M(k, 0), M(k, 1), M(k, 2)};
+    obfloat depth = euklideanDistance<obfloat>(tr, p, 3) * invVoxelSize;
+    if(!(_seeds[idx] <= depth)) _seeds[idx] = depth;
+  }
+
+  delete [] indices;
+  return true;
+}
+
+obfloat RayCast3D::findModified(TsdSpace* space, obfloat pos[3], obfloat ray[3], obfloat idxTo)
+{
+  obfloat position[3];
+  obfloat regionMin[3];
+  obfloat regionMax[3];
+  obfloat i = _idxMin;
+  while(i<idxTo)
+  {
+    position[0] = pos[0] + i * ray[0];
+    position[1] = pos[1] + i * ray[1];
+    position[2] = pos[2] + i * ray[2];
+    if(space->isSurfaceModified(position, regionMin, regionMax)) return i;
+    i += stepsToLeave(position, ray, regionMin, regionMax);
+  }
+  return idxTo;
+}
+
+obfloat RayCast3D::stepsToLeave(const obfloat position[3], const obfloat ray[3], const obfloat regionMin[3], const obfloat regionMax[3])
+{
+  obfloat exit = 0.0;
+  for(unsigned int a=0; a<3; a++)
+  {
+    obfloat e = 10e9;
+    if(ray[a] > 10e-6)       e = (regionMax[a] - position[a]) / ray[a];
+    else if(ray[a] < -10e-6) e = (regionMin[a] - position[a]) / ray[a];
+    if(a==0 || e<exit) exit = e;
+  }
+  return max(ceil(exit), 1.0);
 }
 
 /*bool RayCast3D::calcCoordsFromCurrentPose(TsdSpace* space, Sensor* sensor, double* coords, double* normals, unsigned char* rgb, const std::vector<TsdSpace*>& spaces,
@@ -343,7 +505,8 @@ void RayCast3D::calcCoordsFromCurrentPoseMask(TsdSpace* space, Sensor* sensor, d
   return(true);
 }*/
 
-bool RayCast3D::rayCastFromSensorPose(TsdSpace* space, obfloat pos[3], obfloat ray[3], obfloat coordinates[3], obfloat normal[3], unsigned char rgb[3], obfloat* depth)
+bool RayCast3D::rayCastFromSensorPose(TsdSpace* space, obfloat pos[3], obfloat ray[3], obfloat coordinates[3], obfloat normal[3], unsigned char rgb[3], obfloat* depth,
+                                      bool inside, obfloat idxFrom, obfloat idxTo)
 {
   obfloat position[3];
 
@@ -353,50 +516,58 @@ bool RayCast3D::rayCastFromSensorPose(TsdSpace* space, obfloat pos[3], obfloat r
   // Interpolation weight
   obfloat interp;
 
-  obfloat xmin   = _xmin;
-  obfloat ymin   = _ymin;
-  obfloat zmin   = _zmin;
+  // prevent rays to be casted parallel to a plane outside of space
+  // if we are outside, we might loose some reprojections
+  obfloat xmin   = inside ? 0.0 : 10e9;
+  obfloat ymin   = xmin;
+  obfloat zmin   = xmin;
 
-  obfloat xmax   = _xmax;
-  obfloat ymax   = _ymax;
-  obfloat zmax   = _zmax;
+  obfloat xmax   = inside ? 10e9 : 0.0;
+  obfloat ymax   = xmax;
+  obfloat zmax   = xmax;
 
   // Leave out outmost cells in order to prevent access to invalid neighbors
-  obfloat minSpaceCoord = 1.5*voxelSize;
-  obfloat maxSpaceCoord = (((obfloat)xDim)-1.5)*voxelSize;
+  obfloat minSpaceCoord[3];
+  obfloat maxSpaceCoord[3];
+  minSpaceCoord[0] = space->getMinX() + 1.5*voxelSize;
+  minSpaceCoord[1] = space->getMinY() + 1.5*voxelSize;
+  minSpaceCoord[2] = space->getMinZ() + 1.5*voxelSize;
+  maxSpaceCoord[0] = space->getMinX() + (((obfloat)xDim)-1.5)*voxelSize;
+  maxSpaceCoord[1] = space->getMinY() + (((obfloat)xDim)-1.5)*voxelSize;
+  maxSpaceCoord[2] = space->getMinZ() + (((obfloat)xDim)-1.5)*voxelSize;
 
   // Calculate minimum number of steps to reach bounds in each dimension
   if(ray[0]>10e-6)
   {
-    xmin = (minSpaceCoord - pos[0]) / ray[0];
-    xmax = (maxSpaceCoord - pos[0]) / ray[0];
+    xmin = (minSpaceCoord[0] - pos[0]) / ray[0];
+    xmax = (maxSpaceCoord[0] - pos[0]) / ray[0];
   }
   else if(ray[0]<-10e-6)
   {
-    xmin = (maxSpaceCoord - pos[0]) / ray[0];
-    xmax = (minSpaceCoord - pos[0]) / ray[0];
+    xmin = (maxSpaceCoord[0] - pos[0]) / ray[0];
+    xmax = (minSpaceCoord[0] - pos[0]) / ray[0];
   }
 
   if(ray[1]>10e-6)
   {
-    ymin = (minSpaceCoord - pos[1]) / ray[1];
-    ymax = (maxSpaceCoord - pos[1]) / ray[1];
+    ymin = (minSpaceCoord[1] - pos[1]) / ray[1];
+    ymax = (maxSpaceCoord[1] - pos[1]) / ray[1];
   }
   else if(ray[1]<-10e-6)
   {
-    ymin = (maxSpaceCoord - pos[1]) / ray[1];
-    ymax = (minSpaceCoord - pos[1]) / ray[1];
+    ymin = (maxSpaceCoord[1] - pos[1]) / ray[1];
+    ymax = (minSpaceCoord[1] - pos[1]) / ray[1];
   }
 
   if(ray[2]>10e-6)
   {
-    zmin = (minSpaceCoord - pos[2]) / ray[2];
-    zmax = (maxSpaceCoord - pos[2]) / ray[2];
+    zmin = (minSpaceCoord[2] - pos[2]) / ray[2];
+    zmax = (maxSpaceCoord[2] - pos[2]) / ray[2];
   }
   else if(ray[2]<-10e-6)
   {
-    zmin = (maxSpaceCoord - pos[2]) / ray[2];
-    zmax = (minSpaceCoord - pos[2]) / ray[2];
+    zmin = (maxSpaceCoord[2] - pos[2]) / ray[2];
+    zmax = (minSpaceCoord[2] - pos[2]) / ray[2];
   }
 
   // At least the entry bounds of each dimension needs to be crossed
@@ -407,73 +578,78 @@ bool RayCast3D::rayCastFromSensorPose(TsdSpace* space, obfloat pos[3], obfloat r
   obfloat idxMax = min(min(xmax, ymax), zmax);
   idxMax = floor(idxMax);
 
-  // clip steps to sensor modalities, i.e., the working range
-  idxMin = max(idxMin, _idxMin);
-  idxMax = min(idxMax, _idxMax);
+  // clip steps to sensor modalities, i.e., the working range, or to the requested search interval
+  idxMin = max(idxMin, ceil(idxFrom));
+  idxMax = min(idxMax, idxTo);
 
   if (idxMin >= idxMax)
     return false;
 
-#if PRINTSTATISTICS
-  int idxMinTmp = idxMin;
-#endif
+  // Truncation radius in steps, the tsd of a voxel bounds the distance to the closest surface
+  obfloat truncationSteps = space->getMaxTruncation() / voxelSize;
 
-  // Traverse partitions roughly to clip minimum index
-  obfloat partitionSize = space->getPartitionSize();
-  for(obfloat i=idxMin; i<idxMax; i+=partitionSize)
-  {
-    position[0] = pos[0] + i * ray[0];
-    position[1] = pos[1] + i * ray[1];
-    position[2] = pos[2] + i * ray[2];
-    if(space->isPartitionInitialized(position))
-    {
-      break;
-    }
-    else
-      idxMin = i+1.0;
-  }
+  obfloat tsd_prev = NAN;
+
+  // Previous sample needs to be evaluated, after empty space has been skipped
+  bool resync = false;
+
+  // Region of partition possibly containing a surface, which is traversed currently
+  bool inRegion = false;
+  obfloat regionMin[3];
+  obfloat regionMax[3];
+
+  bool found = false;
+
+  // Length of last step, i.e., distance of previous sample
+  obfloat stepPrev = 1.0;
+
+  double i = idxMin;
 
-  // Traverse in single steps with quick test
-  for(double i=idxMin; i<idxMax; i+=1.0)
+  while(i<idxMax)
   {
     position[0] = pos[0] + i * ray[0];
     position[1] = pos[1] + i * ray[1];
     position[2] = pos[2] + i * ray[2];
-    obfloat tsd;
-    EnumTsdSpaceInterpolate retval = space->getTsd(position, &tsd);
-    if(retval==INTERPOLATE_SUCCESS && fabs(tsd)<1.0)
-      break;
-    else
-      idxMin++;
-  }
 
+    // Skip regions without surface, no sign change can occur in there
+    if(!inRegion || position[0]<regionMin[0] || position[0]>=regionMax[0] || position[1]<regionMin[1] || position[1]>=regionMax[1]
+                 || position[2]<regionMin[2] || position[2]>=regionMax[2])
+    {
+      inRegion = false;
+      if(space->getEmptyRegion(position, regionMin, regionMax))
+      {
+        obfloat steps = stepsToLeave(position, ray, regionMin, regionMax);
 #if PRINTSTATISTICS
 #pragma omp critical
 {
-  if((int)idxMin != idxMinTmp)
-    _skipped += (idxMin-idxMinTmp);
+        _skipped += (unsigned int)steps;
 }
 #endif
+        i += steps;
+        resync = true;
+        continue;
+      }
+      inRegion = true;
+    }
 
-obfloat tsd_prev;
-
-  if(space->interpolateTrilinear(position, &tsd_prev)!=INTERPOLATE_SUCCESS)
-    tsd_prev = NAN;
-
-  bool found = false;
-
-  double i;
+    if(resync)
+    {
+      obfloat prev[3];
+      prev[0] = position[0] - ray[0];
+      prev[1] = position[1] - ray[1];
+      prev[2] = position[2] - ray[2];
+      if(space->interpolateTrilinear(prev, &tsd_prev)!=INTERPOLATE_SUCCESS)
+        tsd_prev = NAN;
+      stepPrev = 1.0;
+      resync = false;
+    }
 
-  for(i=idxMin; i<idxMax; i+=1.0)
-  {
     obfloat tsd;
     EnumTsdSpaceInterpolate retval = space->interpolateTrilinear(position, &tsd);
     if (retval!=INTERPOLATE_SUCCESS)
     {
       tsd_prev = NAN;
-      position[0] += ray[0];
-      position[1] += ray[1];
-      position[2] += ray[2];
+      i += 1.0;
       continue;
     }
 
@@ -486,30 +662,37 @@ obfloat tsd_prev;
       break;
     }
 
-    position[0] += ray[0];
-    position[1] += ray[1];
-    position[2] += ray[2];
-    tsd_prev = tsd;
-  }
+    // Samples in front of the surface may step over the distance bounded by the tsd
+    obfloat steps = 1.0;
+    if(tsd > 0)
+      steps = max(floor(tsd * truncationSteps), 1.0);
 
 #if PRINTSTATISTICS
 #pragma omp critical
 {
-  _traversed += i-idxMin;
+    _traversed++;
+    _skipped += (unsigned int)steps - 1;
 }
 #endif
 
+    i += steps;
+    stepPrev = steps;
+    tsd_prev = tsd;
+  }
+
   if(!found) return false;
 
   // interpolate between voxels when sign changes
-  coordinates[0] = position[0] + ray[0] * (interp-1.0);
-  coordinates[1] = position[1] + ray[1] * (interp-1.0);
-  coordinates[2] = position[2] + ray[2] * (interp-1.0);
+  coordinates[0] = position[0] + ray[0] * stepPrev * (interp-1.0);
+  coordinates[1] = position[1] + ray[1] * stepPrev * (interp-1.0);
+  coordinates[2] = position[2] + ray[2] * stepPrev * (interp-1.0);
 
   if(!space->interpolateNormal(coordinates, normal))
     return false;
 
-  space->interpolateTrilinearRGB(coordinates, rgb);
+  if(rgb) space->interpolateTrilinearRGB(coordinates, rgb);
+
+  if(depth) *depth = (i + stepPrev * (interp-1.0)) * voxelSize;
 
   return true;
 }
@@ -35,28 +35,67 @@ public:
 	virtual ~RayCast3D();
 
 	/**
-	 *
-	 * @param space
-	 * @param sensor
-	 * @param coords
-	 * @param normals
-	 * @param rgb
-	 * @param size
+	 * Cast rays of all sensor pixels and gather surface points in row-major pixel order.
+	 * Coordinates and normals are given in the sensor coordinate system.
+	 * @param space space to be ray casted
+	 * @param sensor sensor providing pose and ray directions
+	 * @param coords found coordinates, up to 3*width*height values
+	 * @param normals normals of found coordinates, same size as coords
+	 * @param rgb colors of found coordinates, may be NULL
+	 * @param size number of values written to coords, i.e., 3 times the number of points
 	 */
 	virtual void calcCoordsFromCurrentPose(TsdSpace* space, Sensor* sensor, double* coords, double* normals, unsigned char* rgb, unsigned int* size);
 
 	/**
-	 *
-	 * @param space
-	 * @param sensor
-	 * @param coords
-	 * @param normals
-	 * @param rgb
-	 * @param mask
-	 * @param size
+	 * Cast rays of all sensor pixels into organized buffers, i.e., pixel i=row*width+col occupies coords[3*i], coords[3*i+1]
+	 * and coords[3*i+2]. Pixels without surface are set to zero and masked out. The output is deterministic and can be used for
+	 * projective data association. Buffers are provided by the caller, no memory is allocated per ray.
+	 * @param space space to be ray casted
+	 * @param sensor sensor providing pose and ray directions
+	 * @param coords coordinates in sensor coordinate system, 3*width*height values
+	 * @param normals normals in sensor coordinate system, 3*width*height values, may be NULL
+	 * @param rgb colors, 3*width*height values, may be NULL
+	 * @param mask validity mask, width*height values
+	 * @param size number of values written to coords, i.e., 3*width*height
 	 */
   virtual void calcCoordsFromCurrentPoseMask(TsdSpace* space, Sensor* sensor, double* coords, double* normals, unsigned char* rgb, bool* mask, unsigned int* size);
 
+  /**
+   * Enable incremental model prediction for consecutive frames of a moving sensor. Surface points of the previous frame are
+   * reprojected into the current view and each ray is searched in a small interval around the predicted depth first.
+   * Rays fall back to full marching, if no surface is found there.
+   * @param enable enable flag
+   * @param margin half length of search interval in voxels
+   * @param checkModified extend search interval towards the sensor up to surfaces changed by the last push, otherwise
+   * surfaces appearing in front of the prediction are not found
+   */
+  void setIncremental(const bool enable, const obfloat margin=4.0, const bool checkModified=true);
+
+  /**
+   * Render depth and normal images of several sensors in one parallel pass, e.g., for view planning or place recognition.
+   * Rays of all views are scheduled together. Sensors need not to provide measurements.
+   * Partition lookups are not shared among rays.
+   * @param space space to be ray casted
+   * @param sensors sensors providing pose, ray directions and working range
+   * @param views number of sensors
+   * @param depth distances along rays, width*height values per view in order of sensors, NAN for pixels without surface
+   * @param normals normals in sensor coordinate system, 3*width*height values per view, may be NULL
+   * @return number of pixels with surface
+   */
+  unsigned int renderViews(TsdSpace* space, Sensor** sensors, const unsigned int views, double* depth, double* normals);
+
+  /**
+   * Render depth and normal images of a single sensor from several poses, see renderViews above
+   * @param space space to be ray casted
+   * @param sensor sensor providing ray directions and working range, its pose is not changed
+   * @param poses sensor poses, i.e., transformations from sensor to world coordinate system (4x4)
+   * @param views number of poses
+   * @param depth distances along rays, width*height values per view, NAN for pixels without surface
+   * @param normals normals in sensor coordinate system, 3*width*height values per view, may be NULL
+   * @return number of pixels with surface
+   */
+  unsigned int renderViews(TsdSpace* space, Sensor* sensor, Matrix** poses, const unsigned int views, double* depth, double* normals);
+
 	/**
 	 * Overloaded method to cast a single ray trough several spaces. The method returns in case of a found coordinate or at
 	 * the end of the TsdSpace input vector.
@@ -76,18 +115,65 @@ public:
 
 private:
 
-  bool rayCastFromSensorPose(TsdSpace* space, obfloat pos[3], obfloat ray[3], obfloat coordinates[3], obfloat normal[3], unsigned char rgb[3], obfloat* depth);
+  /**
+   * Cast rays of all pixels into organized buffers, see calcCoordsFromCurrentPoseMask
+   * @return number of valid pixels
+   */
+  unsigned int castRays(TsdSpace* space, Sensor* sensor, double* coords, double* normals, unsigned char* rgb, bool* mask);
+
+  /**
+   * Render views, see renderViews
+   * @param poses poses of views, NULL for the current poses of sensors
+   */
+  unsigned int renderViews(TsdSpace* space, Sensor** sensors, Matrix** poses, const unsigned int views, double* depth, double* normals);
+
+  void reserve(const unsigned int count);
+
+  /**
+   * Determine depth of rays (in steps) from surface points of the previous frame
+   * @return true, if a prediction is available
+   */
+  bool predictSeeds(TsdSpace* space, Sensor* sensor);
 
-  obfloat _xmin;
-  obfloat _ymin;
-  obfloat _zmin;
+  /**
+   * Find first step of a ray passing a surface, which has been changed by the last push
+   * @return step within region of changed surface, idxTo if none is passed before
+   */
+  obfloat findModified(TsdSpace* space, obfloat pos[3], obfloat ray[3], obfloat idxTo);
+
+  static obfloat stepsToLeave(const obfloat position[3], const obfloat ray[3], const obfloat regionMin[3], const obfloat regionMax[3]);
 
-  obfloat _xmax;
-  obfloat _ymax;
-  obfloat _zmax;
+  /**
+   * Cast a single ray
+   * @param inside sensor is located inside of space
+   * @param idxFrom first step, e.g., minimum range of sensor
+   * @param idxTo last step, e.g., maximum range of sensor
+   * @param rgb color of surface, may be NULL
+   * @param depth distance of surface, may be NULL
+   */
+  bool rayCastFromSensorPose(TsdSpace* space, obfloat pos[3], obfloat ray[3], obfloat coordinates[3], obfloat normal[3], unsigned char rgb[3], obfloat* depth,
+                             bool inside, obfloat idxFrom, obfloat idxTo);
 
   obfloat _idxMin;
   obfloat _idxMax;
+
+  // Organized buffers of calcCoordsFromCurrentPose, reused between calls
+  unsigned int _capacity;
+  double* _coords;
+  double* _normals;
+  unsigned char* _rgb;
+  bool* _mask;
+
+  // Incremental model prediction
+  bool _incremental;
+  obfloat _margin;
+  bool _checkModified;
+  TsdSpace* _prevSpace;
+  unsigned int _prevCount;
+  unsigned int _prevPushes;
+  obfloat* _prevWorld;
+  bool* _prevValid;
+  obfloat* _seeds;
 };
 
 }
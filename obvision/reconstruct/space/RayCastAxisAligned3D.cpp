@@ -3,6 +3,8 @@
 #include "obcore/base/System.h"
 
 #include <string.h>
+#include <algorithm>
+#include <omp.h>
 
 namespace obvious {
 
@@ -17,206 +19,227 @@ RayCastAxisAligned3D::~RayCastAxisAligned3D() {
 void RayCastAxisAligned3D::calcCoords(TsdSpace* space, obfloat* coords, obfloat* normals, unsigned char* rgb, unsigned int* cnt)
 {
   Timer t;
+  t.start();
 
+  space->lockRead();
+  extract(space, false, coords, normals, rgb, cnt);
+  space->unlockRead();
+
+  LOGMSG(DBG_DEBUG, "Elapsed TSDF projection: " << t.elapsed() << "s");
+  LOGMSG(DBG_DEBUG, "Raycasting finished! Found " << *cnt << " coordinates");
+}
+
+void RayCastAxisAligned3D::calcCoordsRoughly(TsdSpace* space, obfloat* coords, obfloat* normals, unsigned int* cnt)
+{
+  Timer t;
+  t.start();
+
+  space->lockRead();
+  extract(space, true, coords, normals, NULL, cnt);
+  space->unlockRead();
+
+  LOGMSG(DBG_DEBUG, "Elapsed TSDF projection: " << t.elapsed() << "s");
+  LOGMSG(DBG_DEBUG, "Raycasting finished! Found " << *cnt << " coordinates");
+}
+
+void RayCastAxisAligned3D::extract(TsdSpace* space, bool roughly, obfloat* coords, obfloat* normals, unsigned char* rgb, unsigned int* cnt)
+{
   unsigned int partitionSize = space->getPartitionSize();
   unsigned int partitionsInX = space->getXDimension() / partitionSize;
   unsigned int partitionsInY = space->getYDimension() / partitionSize;
   unsigned int partitionsInZ = space->getZDimension() / partitionSize;
-  obfloat cellSize = space->getVoxelSize();
 
   *cnt = 0;
 
-  TsdSpacePartition**** partitions = space->getPartitions();
+  // Leave out outmost partitions, since the triangulation of normals needs access to neighboring partitions. Candidates are
+  // sorted by index, which keeps the output in partition order for any storage.
+  vector<TsdSpacePartition*> allocated;
+  space->getAllocatedPartitions(allocated);
+  vector<unsigned int> candidates;
+  for(unsigned int i=0; i<allocated.size(); i++)
+  {
+    TsdSpacePartition* p = allocated[i];
+    if(!p->isInitialized() || (!roughly && p->isEmpty())) continue;
+    unsigned int x = p->getX() / partitionSize;
+    unsigned int y = p->getY() / partitionSize;
+    unsigned int z = p->getZ() / partitionSize;
+    if(x==0 || y==0 || z==0 || x>=partitionsInX-1 || y>=partitionsInY-1 || z>=partitionsInZ-1) continue;
+    candidates.push_back((z*partitionsInY+y)*partitionsInX+x);
+  }
+  sort(candidates.begin(), candidates.end());
 
-  // buffer for registration of zero crossings: in each cell, only one zero crossing should be detected
-  bool*** zeroCrossing;
-  System<bool>::allocate(partitionSize, partitionSize, partitionSize, zeroCrossing);
+  int partitions = candidates.size();
+  if(partitions==0) return;
 
-#pragma omp parallel for
-  // Leave out outmost partitions, since the triangulation of normals needs access to neighboring partitions
-  for(unsigned int z=1; z<partitionsInZ-1; z++)
+  // Each thread collects coordinates in its own chunk, the position of each partition's output is recorded for compaction
+  vector< vector<obfloat> > chunks(omp_get_max_threads());
+  vector<unsigned int> chunkOf(partitions);
+  vector<unsigned int> chunkBegin(partitions);
+  vector<unsigned int> offsets(partitions+1);
+
+#pragma omp parallel
   {
-    for(unsigned int y=1; y<partitionsInY-1; y++)
+    vector<obfloat>& chunk = chunks[omp_get_thread_num()];
+
+    // buffer for registration of zero crossings: in each cell, only one zero crossing should be detected
+    bool*** zeroCrossing = NULL;
+    if(!roughly) System<bool>::allocate(partitionSize, partitionSize, partitionSize, zeroCrossing);
+
+#pragma omp for schedule(dynamic)
+    for(int i=0; i<partitions; i++)
     {
-      for(unsigned int x=1; x<partitionsInX-1; x++)
-      {
-        TsdSpacePartition* p = partitions[z][y][x];
-        if(p->isInitialized())
-        {
-          if(!(p->isEmpty()))
-          {
-            // Traverse in x-direction
-            TsdSpacePartition* p_prev = partitions[z][y][x-1];
-            for(unsigned int pz=0; pz<p->getDepth(); pz++)
-            {
-              memset(zeroCrossing[pz][0], 0, (partitionSize)*(partitionSize)*sizeof(bool));
-              for(unsigned int py=0; py<p->getHeight(); py++)
-              {
-                obfloat tsd_prev = NAN;
-                if(p_prev->isInitialized() && !(p_prev->isEmpty())) tsd_prev = (*p_prev)(pz, py, p_prev->getWidth()-1);
-                obfloat interp = 0.0;
-                for(unsigned int px=0; px<p->getWidth(); px++)
-                {
-                  obfloat tsd = (*p)(pz, py, px);
-                  // Check sign change
-                  if(tsd_prev * tsd < 0)
-                  {
-                    interp = tsd_prev / (tsd_prev - tsd);
-#pragma omp critical
-{
-                    coords[*cnt]     = px*cellSize + (x * p->getWidth()) * cellSize + cellSize * (interp-1.0) ;
-                    coords[(*cnt)+1] = py*cellSize + (y * p->getHeight()) * cellSize;
-                    coords[(*cnt)+2] = pz*cellSize + (z * p->getDepth()) * cellSize;
-                    if(normals)
-                      space->interpolateNormal(&coords[*cnt], &(normals[*cnt]));
-                    if(rgb)
-                      space->interpolateTrilinearRGB(&coords[*cnt], &(rgb[*cnt]));
-                    (*cnt)+=3;
-                    zeroCrossing[pz][py][px] = true;
-}
-                  }
-                  tsd_prev = tsd;
-                }
-              }
-            }
-
-            // Traverse in y-direction
-            p_prev = partitions[z][y-1][x];
-            for(unsigned int pz=0; pz<p->getDepth(); pz++)
-            {
-              for(unsigned int px=0; px<p->getWidth(); px++)
-              {
-                obfloat tsd_prev = NAN;
-                if(p_prev->isInitialized() && !(p_prev->isEmpty())) tsd_prev = (*p_prev)(pz, p_prev->getHeight()-1, px);
-                obfloat interp = 0.0;
-                for(unsigned int py=0; py<p->getHeight(); py++)
-                {
-                  obfloat tsd = (*p)(pz, py, px);
-                  // Check sign change
-                  if((!zeroCrossing[pz][py][px]) && (tsd_prev * tsd < 0))
-                  {
-                    interp = tsd_prev / (tsd_prev - tsd);
-#pragma omp critical
-{
-                    coords[*cnt]     = px*cellSize + (x * p->getWidth()) * cellSize;
-                    coords[(*cnt)+1] = py*cellSize + (y * p->getHeight()) * cellSize + cellSize * (interp-1.0);
-                    coords[(*cnt)+2] = pz*cellSize + (z * p->getDepth()) * cellSize;
-                    if(normals)
-                      space->interpolateNormal(&coords[*cnt], &(normals[*cnt]));
-                    if(rgb)
-                      space->interpolateTrilinearRGB(&coords[*cnt], &(rgb[*cnt]));
-                    (*cnt)+=3;
-                    zeroCrossing[pz][py][px] = true;
+      unsigned int x = candidates[i] % partitionsInX;
+      unsigned int y = (candidates[i] / partitionsInX) % partitionsInY;
+      unsigned int z = candidates[i] / (partitionsInX*partitionsInY);
+      chunkOf[i]    = omp_get_thread_num();
+      chunkBegin[i] = chunk.size();
+      if(roughly)
+        extractNearSurface(space, x, y, z, chunk);
+      else
+        extractZeroCrossings(space, x, y, z, zeroCrossing, chunk);
+      offsets[i+1] = chunk.size() - chunkBegin[i];
+    }
+
+    if(zeroCrossing) System<bool>::deallocate(zeroCrossing);
+  }
+
+  // Prefix sum over partitions keeps the output in partition order, independent of thread scheduling
+  offsets[0] = 0;
+  for(int i=0; i<partitions; i++)
+    offsets[i+1] += offsets[i];
+  *cnt = offsets[partitions];
+
+#pragma omp parallel for schedule(dynamic)
+  for(int i=0; i<partitions; i++)
+  {
+    unsigned int size = offsets[i+1] - offsets[i];
+    if(size==0) continue;
+    memcpy(&coords[offsets[i]], &chunks[chunkOf[i]][chunkBegin[i]], size*sizeof(obfloat));
+    for(unsigned int j=offsets[i]; j<offsets[i+1]; j+=3)
+    {
+      if(normals)
+        space->interpolateNormal(&coords[j], &(normals[j]));
+      if(rgb)
+        space->interpolateTrilinearRGB(&coords[j], &(rgb[j]));
+    }
+  }
 }
-                  }
-                  tsd_prev = tsd;
-                }
-              }
-            }
-
-            // Traverse in z-direction
-            p_prev = partitions[z-1][y][x];
-            for(unsigned int px=0; px<p->getWidth(); px++)
-            {
-              for(unsigned int py=0; py<p->getHeight(); py++)
-              {
-                obfloat tsd_prev = NAN;
-                if(p_prev->isInitialized() && !(p_prev->isEmpty())) tsd_prev = (*p_prev)(p->getDepth()-1, py, px);
-                obfloat interp = 0.0;
-                for(unsigned int pz=0; pz<p->getDepth(); pz++)
-                {
-                  obfloat tsd = (*p)(pz, py, px);
-                  // Check sign change
-                  if((!zeroCrossing[pz][py][px]) && (tsd_prev * tsd < 0))
-                  {
-                    interp = tsd_prev / (tsd_prev - tsd);
-#pragma omp critical
+
+void RayCastAxisAligned3D::extractZeroCrossings(TsdSpace* space, unsigned int x, unsigned int y, unsigned int z, bool*** zeroCrossing, vector<obfloat>& chunk)
 {
-                    coords[*cnt]     = px*cellSize + (x * p->getWidth()) * cellSize;
-                    coords[(*cnt)+1] = py*cellSize + (y * p->getHeight()) * cellSize;
-                    coords[(*cnt)+2] = pz*cellSize + (z * p->getDepth()) * cellSize + cellSize * (interp-1.0);
-                    if(normals)
-                      space->interpolateNormal(&coords[*cnt], &(normals[*cnt]));
-                    if(rgb)
-                      space->interpolateTrilinearRGB(&coords[*cnt], &(rgb[*cnt]));
-                    (*cnt)+=3;
-}
-                  }
-                  tsd_prev = tsd;
-                }
-              }
-            }
-          }
+  obfloat cellSize = space->getVoxelSize();
+  unsigned int partitionSize = space->getPartitionSize();
+  TsdSpacePartition* p = space->getPartition(x, y, z);
+
+  obfloat offset[3];
+  p->getCellCoordsOffset(offset);
+
+  // Traverse in x-direction
+  TsdSpacePartition* p_prev = space->getPartition(x-1, y, z);
+  for(unsigned int pz=0; pz<p->getDepth(); pz++)
+  {
+    memset(zeroCrossing[pz][0], 0, (partitionSize)*(partitionSize)*sizeof(bool));
+    for(unsigned int py=0; py<p->getHeight(); py++)
+    {
+      obfloat tsd_prev = NAN;
+      if(p_prev && p_prev->isInitialized() && !(p_prev->isEmpty())) tsd_prev = (*p_prev)(pz, py, p_prev->getWidth()-1);
+      obfloat interp = 0.0;
+      for(unsigned int px=0; px<p->getWidth(); px++)
+      {
+        obfloat tsd = (*p)(pz, py, px);
+        // Check sign change
+        if(tsd_prev * tsd < 0)
+        {
+          interp = tsd_prev / (tsd_prev - tsd);
+          chunk.push_back(px*cellSize + offset[0] + cellSize * (interp-1.0));
+          chunk.push_back(py*cellSize + offset[1]);
+          chunk.push_back(pz*cellSize + offset[2]);
+          zeroCrossing[pz][py][px] = true;
         }
+        tsd_prev = tsd;
       }
     }
   }
 
-  System<bool>::deallocate(zeroCrossing);
+  // Traverse in y-direction
+  p_prev = space->getPartition(x, y-1, z);
+  for(unsigned int pz=0; pz<p->getDepth(); pz++)
+  {
+    for(unsigned int px=0; px<p->getWidth(); px++)
+    {
+      obfloat tsd_prev = NAN;
+      if(p_prev && p_prev->isInitialized() && !(p_prev->isEmpty())) tsd_prev = (*p_prev)(pz, p_prev->getHeight()-1, px);
+      obfloat interp = 0.0;
+      for(unsigned int py=0; py<p->getHeight(); py++)
+      {
+        obfloat tsd = (*p)(pz, py, px);
+        // Check sign change
+        if((!zeroCrossing[pz][py][px]) && (tsd_prev * tsd < 0))
+        {
+          interp = tsd_prev / (tsd_prev - tsd);
+          chunk.push_back(px*cellSize + offset[0]);
+          chunk.push_back(py*cellSize + offset[1] + cellSize * (interp-1.0));
+          chunk.push_back(pz*cellSize + offset[2]);
+          zeroCrossing[pz][py][px] = true;
+        }
+        tsd_prev = tsd;
+      }
+    }
+  }
 
-  LOGMSG(DBG_DEBUG, "Elapsed TSDF projection: " << t.elapsed() << "ms");
-  LOGMSG(DBG_DEBUG, "Raycasting finished! Found " << *cnt << " coordinates");
+  // Traverse in z-direction
+  p_prev = space->getPartition(x, y, z-1);
+  for(unsigned int px=0; px<p->getWidth(); px++)
+  {
+    for(unsigned int py=0; py<p->getHeight(); py++)
+    {
+      obfloat tsd_prev = NAN;
+      if(p_prev && p_prev->isInitialized() && !(p_prev->isEmpty())) tsd_prev = (*p_prev)(p->getDepth()-1, py, px);
+      obfloat interp = 0.0;
+      for(unsigned int pz=0; pz<p->getDepth(); pz++)
+      {
+        obfloat tsd = (*p)(pz, py, px);
+        // Check sign change
+        if((!zeroCrossing[pz][py][px]) && (tsd_prev * tsd < 0))
+        {
+          interp = tsd_prev / (tsd_prev - tsd);
+          chunk.push_back(px*cellSize + offset[0]);
+          chunk.push_back(py*cellSize + offset[1]);
+          chunk.push_back(pz*cellSize + offset[2] + cellSize * (interp-1.0));
+        }
+        tsd_prev = tsd;
+      }
+    }
+  }
 }
 
-void RayCastAxisAligned3D::calcCoordsRoughly(TsdSpace* space, obfloat* coords, obfloat* normals, unsigned int* cnt)
+void RayCastAxisAligned3D::extractNearSurface(TsdSpace* space, unsigned int x, unsigned int y, unsigned int z, vector<obfloat>& chunk)
 {
-  Timer t;
-
-  unsigned int partitionsInX = space->getXDimension() / space->getPartitionSize();
-  unsigned int partitionsInY = space->getYDimension() / space->getPartitionSize();
-  unsigned int partitionsInZ = space->getZDimension() / space->getPartitionSize();
-  obfloat cellSize = space->getVoxelSize();
-
-  *cnt = 0;
-
-  TsdSpacePartition**** partitions = space->getPartitions();
+  obfloat thresh = space->getVoxelSize() / space->getMaxTruncation();
+  TsdSpacePartition* p = space->getPartition(x, y, z);
   Matrix* C = TsdSpacePartition::getCellCoordsHom();
 
-  obfloat thresh = cellSize / space->getMaxTruncation();
+  obfloat offset[3];
+  p->getCellCoordsOffset(offset);
 
-#pragma omp parallel for
-  for(unsigned int z=1; z<partitionsInZ-1; z++)
+  unsigned int i = 0;
+  for(unsigned int pz=0; pz<p->getDepth(); pz++)
   {
-    for(unsigned int y=1; y<partitionsInY-1; y++)
+    for(unsigned int py=0; py<p->getHeight(); py++)
     {
-      for(unsigned int x=1; x<partitionsInX-1; x++)
+      for(unsigned int px=0; px<p->getWidth(); px++, i++)
       {
-        TsdSpacePartition* p = partitions[z][y][x];
-        if(p->isInitialized())
+        obfloat tsd = (*p)(pz, py, px);
+        // Check sign change
+        if(tsd < thresh && tsd>0)
         {
-          obfloat offset[3];
-          p->getCellCoordsOffset(offset);
-
-          unsigned int i = 0;
-          for(unsigned int pz=0; pz<p->getDepth(); pz++)
-          {
-            for(unsigned int py=0; py<p->getHeight(); py++)
-            {
-              for(unsigned int px=0; px<p->getWidth(); px++, i++)
-              {
-                obfloat tsd = (*p)(pz, py, px);
-                // Check sign change
-                if(tsd < thresh && tsd>0)
-                {
-#pragma omp critical
-{
-                  coords[*cnt]     = (*C)(i, 0) + offset[0];
-                  coords[(*cnt)+1] = (*C)(i, 1) + offset[1];
-                  coords[(*cnt)+2] = (*C)(i, 2) + offset[2];
-                  if(normals)
-                    space->interpolateNormal(&coords[*cnt], &(normals[*cnt]));
-                  (*cnt)+=3;
-}
-                }
-              }
-            }
-          }
+          chunk.push_back((*C)(i, 0) + offset[0]);
+          chunk.push_back((*C)(i, 1) + offset[1]);
+          chunk.push_back((*C)(i, 2) + offset[2]);
         }
       }
     }
   }
-  LOGMSG(DBG_DEBUG, "Elapsed TSDF projection: " << t.elapsed() << "ms");
-  LOGMSG(DBG_DEBUG, "Raycasting finished! Found " << *cnt << " coordinates");
 }
 
 }
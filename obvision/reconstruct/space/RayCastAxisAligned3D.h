@@ -14,6 +14,18 @@ public:
   void calcCoords(TsdSpace* space, obfloat* coords, obfloat* normals, unsigned char* rgb, unsigned int* cnt);
 
   void calcCoordsRoughly(TsdSpace* space, obfloat* coords, obfloat* normals, unsigned int* cnt);
+
+private:
+
+  /**
+   * Extract coordinates of all partitions in parallel, normals and colors are determined after compaction
+   * @param roughly take centers of cells close to the surface instead of interpolated zero crossings
+   */
+  void extract(TsdSpace* space, bool roughly, obfloat* coords, obfloat* normals, unsigned char* rgb, unsigned int* cnt);
+
+  void extractZeroCrossings(TsdSpace* space, unsigned int x, unsigned int y, unsigned int z, bool*** zeroCrossing, vector<obfloat>& chunk);
+
+  void extractNearSurface(TsdSpace* space, unsigned int x, unsigned int y, unsigned int z, vector<obfloat>& chunk);
 };
 
 }
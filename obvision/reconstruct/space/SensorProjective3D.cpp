@@ -3,6 +3,8 @@
 #include "obcore/base/System.h"
 #include "obcore/math/mathbase.h"
 
+#include <cstring>
+
 namespace obvious
 {
 
@@ -49,6 +51,8 @@ void SensorProjective3D::init(unsigned int cols, unsigned int rows, double PData
 
   _raysLocal = new Matrix(3, _size);
   *_raysLocal = *_rays;
+
+  updateProjection();
 }
 
 SensorProjective3D::~SensorProjective3D()
@@ -77,35 +81,79 @@ void SensorProjective3D::project2Space(const unsigned int col, const unsigned in
   (*coord)(2, 0) = depth;
 }
 
-void SensorProjective3D::backProject(Matrix* M, int* indices, Matrix* T)
+void SensorProjective3D::transform(Matrix* T)
+{
+  Sensor::transform(T);
+  updateProjection();
+}
+
+void SensorProjective3D::translate(double* tr)
+{
+  Sensor::translate(tr);
+  updateProjection();
+}
+
+void SensorProjective3D::setTransformation(Matrix T)
 {
-  //Matrix PoseInv = (*_Pose);
-  Matrix PoseInv = getTransformation();
+  Sensor::setTransformation(T);
+  updateProjection();
+}
+
+void SensorProjective3D::resetTransformation()
+{
+  Sensor::resetTransformation();
+  updateProjection();
+}
+
+void SensorProjective3D::updateProjection()
+{
+  Matrix PoseInv = *_T;
   PoseInv.invert();
 
-  // Provide temporary transformation of voxelCoords, i.e. shift of coordinate system (partitioning)
-  if(T)
-    PoseInv *= *T;
+  Matrix Pgen = (*_P) * PoseInv;
+  Pgen.getData(_PWorld);
+}
 
-  Matrix Pgen(3, 4);
-  Pgen = (*_P) * PoseInv;
+void SensorProjective3D::getProjectionMatrix(double PWorld[12])
+{
+  memcpy(PWorld, _PWorld, 12*sizeof(*PWorld));
+}
 
-  // coords2D = P * Tinv * Ttmp * voxelCoords
-  Matrix coords2D = Matrix::multiply(Pgen, *M, false, true);
+void SensorProjective3D::backProject(Matrix* M, int* indices, Matrix* T)
+{
+  // Provide temporary transformation of voxelCoords, i.e. shift of coordinate system (partitioning)
+  // Pgen = P * Tinv * Ttmp
+  double PT[12];
+  const double* Pgen = _PWorld;
+  if(T)
+  {
+    for(unsigned int r=0; r<3; r++)
+      for(unsigned int c=0; c<4; c++)
+        PT[r*4+c] = _PWorld[r*4] * (*T)(0,c) + _PWorld[r*4+1] * (*T)(1,c) + _PWorld[r*4+2] * (*T)(2,c) + _PWorld[r*4+3] * (*T)(3,c);
+    Pgen = PT;
+  }
 
+  const double width = (double)_width;
+  const double height = (double)_height;
   for(unsigned int i=0; i<M->getRows(); i++)
   {
     indices[i] = -1;
-    if(coords2D(2,i) > 0.0)
+
+    const double x = (*M)(i,0);
+    const double y = (*M)(i,1);
+    const double z = (*M)(i,2);
+    const double w = (*M)(i,3);
+    const double dw = Pgen[8]*x + Pgen[9]*y + Pgen[10]*z + Pgen[11]*w;
+    if(dw > 0.0)
     {
-      const double inv_dw = 1.0 / coords2D(2,i);
-      const unsigned int u = static_cast<unsigned int>(coords2D(0,i)*inv_dw + 0.5);
-      const unsigned int v = static_cast<unsigned int>(coords2D(1,i)*inv_dw + 0.5);
+      const double inv_dw = 1.0 / dw;
+      const double u = (Pgen[0]*x + Pgen[1]*y + Pgen[2]*z + Pgen[3]*w) * inv_dw + 0.5;
+      const double v = (Pgen[4]*x + Pgen[5]*y + Pgen[6]*z + Pgen[7]*w) * inv_dw + 0.5;
 
-      if(u < _width && v < _height && _mask[((_height - 1) - v) * _width + u])
+      if(u >= 0.0 && u < width && v >= 0.0 && v < height)
       {
-        unsigned int idx = ((_height - 1) - v) * _width + u;
-        indices[i] = idx;
+        unsigned int idx = ((_height - 1) - (unsigned int)v) * _width + (unsigned int)u;
+        if(_mask[idx]) indices[i] = idx;
       }
     }
   }
@@ -46,19 +46,53 @@ public:
   void project2Space(const unsigned int col, const unsigned int row, const double depth, Matrix* coord);
 
   /**
-   * Parallel version of back projection
+   * Transform current sensor pose in his own coordinate system
+   * @param[in] T transformation matrix
+   */
+  void transform(Matrix* T);
+
+  /**
+   * Translate current sensor pose
+   * @param[in] tr translation vector
+   */
+  void translate(double* tr);
+
+  /**
+   * Set transformation matrix
+   * @param T transformation matrix
+   */
+  void setTransformation(Matrix T);
+
+  /**
+   * Reset sensor pose to identity
+   */
+  void resetTransformation();
+
+  /**
+   * Parallel version of back projection, no memory is allocated
    * @param[in] M matrix of homogeneous 3D coordinates
    * @param[out] indices vector of beam indices
    * @param[in] T temporary transformation matrix of coordinates
    */
   void backProject(Matrix* M, int* indices, Matrix* T=NULL);
 
+  /**
+   * Get projection of homogeneous world coordinates to homogeneous image coordinates for the current pose
+   * @param[out] PWorld 3x4 projection matrix (row-major), i.e., P * T^-1
+   */
+  void getProjectionMatrix(double PWorld[12]);
+
 private:
 
   void init(unsigned int cols, unsigned int rows, double PData[12]);
 
+  void updateProjection();
+
   Matrix* _P;
 
+  // Projection of world coordinates for the current pose, updated with every change of the pose
+  double _PWorld[12];
+
 };
 
 }
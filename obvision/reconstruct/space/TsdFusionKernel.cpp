@@ -0,0 +1,371 @@
+#include "TsdFusionKernel.h"
+
+#include <cmath>
+#include <algorithm>
+
+// Intrinsics are compiled with function-level target attributes, i.e., no global instruction set flags are needed.
+#if _OBVIOUS_DOUBLE_PRECISION_ && defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && (defined(__x86_64__) || defined(__i386__))
+#define TSDFUSION_SIMD 1
+#include <immintrin.h>
+#else
+#define TSDFUSION_SIMD 0
+#endif
+
+namespace obvious
+{
+
+EnumTsdFusionKernel TsdFusionKernel::_kernel = TsdFusionKernel::detect();
+
+EnumTsdFusionKernel TsdFusionKernel::detect()
+{
+#if TSDFUSION_SIMD
+  // Might be called before static constructors of the runtime library
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) return FUSIONKERNEL_AVX2;
+  if(__builtin_cpu_supports("sse2")) return FUSIONKERNEL_SSE2;
+#endif
+  return FUSIONKERNEL_SCALAR;
+}
+
+EnumTsdFusionKernel TsdFusionKernel::getKernel()
+{
+  return _kernel;
+}
+
+void TsdFusionKernel::setKernel(const EnumTsdFusionKernel kernel)
+{
+  _kernel = std::min(kernel, detect());
+}
+
+/**
+ * Determine measurement index of homogeneous image coordinates
+ * @return index or -1, if point is not in front of the sensor or outside of the image
+ */
+static inline int imageIndex(const TsdFusionFrame& frame, const double h0, const double h1, const double h2)
+{
+  if(!(h2 > 0.0)) return -1;
+  const double invW = 1.0 / h2;
+  const double u = h0 * invW + 0.5;
+  const double v = h1 * invW + 0.5;
+  if(!(u >= 0.0 && u < (double)frame.width && v >= 0.0 && v < (double)frame.height)) return -1;
+  return ((frame.height - 1) - (unsigned int)v) * frame.width + (unsigned int)u;
+}
+
+/**
+ * Look up measurements of projected voxels, indices and distances are replaced by measurement indices and truncated signed distances
+ * @return number of voxels to be updated
+ */
+static inline unsigned int truncateRow(const TsdFusionFrame& frame, const unsigned int n, int* indices, obfloat* tsd)
+{
+  unsigned int cnt = 0;
+  for(unsigned int i=0; i<n; i++)
+  {
+    const int index = indices[i];
+    if(index<0) continue;
+    const obfloat sd = frame.data[index] - tsd[i];
+    if(frame.mask[index] && sd >= -frame.maxTruncation)
+    {
+      tsd[i] = std::min(sd / frame.maxTruncation, TSDINC);
+      cnt++;
+    }
+    else
+    {
+      indices[i] = -1;
+    }
+  }
+  return cnt;
+}
+
+static unsigned int projectRowScalar(const TsdFusionFrame& frame, const obfloat coord[3], const obfloat step, const unsigned int n, int* indices, obfloat* tsd)
+{
+  const double* P = frame.P;
+
+  // Contribution of y- and z-coordinates is constant along the row
+  const double b0 = P[1]*coord[1] + P[2]*coord[2] + P[3];
+  const double b1 = P[5]*coord[1] + P[6]*coord[2] + P[7];
+  const double b2 = P[9]*coord[1] + P[10]*coord[2] + P[11];
+  const obfloat dy = coord[1] - frame.pos[1];
+  const obfloat dz = coord[2] - frame.pos[2];
+  const obfloat dyz = dy*dy + dz*dz;
+
+  for(unsigned int i=0; i<n; i++)
+  {
+    const obfloat x = ((obfloat)i + 0.5) * step + coord[0];
+    indices[i] = imageIndex(frame, P[0]*x + b0, P[4]*x + b1, P[8]*x + b2);
+    const obfloat dx = x - frame.pos[0];
+    tsd[i] = sqrt(dx*dx + dyz);
+  }
+
+  return truncateRow(frame, n, indices, tsd);
+}
+
+static void fuseRowScalar(obfloat* voxelTsd, obfloat* voxelWeight, const int* indices, const obfloat* tsd, const obfloat* weights,
+                          const unsigned int n, const obfloat decay, const obfloat maxWeight)
+{
+  for(unsigned int i=0; i<n; i++)
+  {
+    if(indices[i]<0) continue;
+    const obfloat inc = weights ? weights[i] : TSDINC;
+    obfloat weight = voxelWeight[i] * decay + inc;
+    if(isnan(voxelTsd[i]))
+    {
+      voxelTsd[i] = tsd[i];
+    }
+    else
+    {
+      weight = std::min(weight, maxWeight);
+      voxelTsd[i] = (voxelTsd[i] * (weight - inc) + inc * tsd[i]) / weight;
+    }
+    voxelWeight[i] = weight;
+  }
+}
+
+#if TSDFUSION_SIMD
+
+__attribute__((target("sse2")))
+static unsigned int projectRowSSE2(const TsdFusionFrame& frame, const obfloat coord[3], const obfloat step, const unsigned int n, int* indices, obfloat* tsd)
+{
+  const double* P = frame.P;
+  const double b0 = P[1]*coord[1] + P[2]*coord[2] + P[3];
+  const double b1 = P[5]*coord[1] + P[6]*coord[2] + P[7];
+  const double b2 = P[9]*coord[1] + P[10]*coord[2] + P[11];
+  const obfloat dy = coord[1] - frame.pos[1];
+  const obfloat dz = coord[2] - frame.pos[2];
+  const obfloat dyz = dy*dy + dz*dz;
+
+  const __m128d vP0 = _mm_set1_pd(P[0]);
+  const __m128d vP4 = _mm_set1_pd(P[4]);
+  const __m128d vP8 = _mm_set1_pd(P[8]);
+  const __m128d vb0 = _mm_set1_pd(b0);
+  const __m128d vb1 = _mm_set1_pd(b1);
+  const __m128d vb2 = _mm_set1_pd(b2);
+  const __m128d vStep = _mm_set1_pd(step);
+  const __m128d vOrigin = _mm_set1_pd(coord[0]);
+  const __m128d vPos = _mm_set1_pd(frame.pos[0]);
+  const __m128d vDyz = _mm_set1_pd(dyz);
+  const __m128d vHalf = _mm_set1_pd(0.5);
+  const __m128d vZero = _mm_setzero_pd();
+  const __m128d vOne = _mm_set1_pd(1.0);
+  const __m128d vWidth = _mm_set1_pd((double)frame.width);
+  const __m128d vHeight = _mm_set1_pd((double)frame.height);
+  const __m128d vInc = _mm_set1_pd(2.0);
+  __m128d vi = _mm_set_pd(1.5, 0.5);
+
+  unsigned int i=0;
+  for(; i+2<=n; i+=2)
+  {
+    const __m128d x = _mm_add_pd(_mm_mul_pd(vi, vStep), vOrigin);
+    const __m128d h0 = _mm_add_pd(_mm_mul_pd(vP0, x), vb0);
+    const __m128d h1 = _mm_add_pd(_mm_mul_pd(vP4, x), vb1);
+    const __m128d h2 = _mm_add_pd(_mm_mul_pd(vP8, x), vb2);
+    const __m128d invW = _mm_div_pd(vOne, h2);
+    const __m128d u = _mm_add_pd(_mm_mul_pd(h0, invW), vHalf);
+    const __m128d v = _mm_add_pd(_mm_mul_pd(h1, invW), vHalf);
+
+    // Comparisons with NaN evaluate to false
+    __m128d valid = _mm_cmpgt_pd(h2, vZero);
+    valid = _mm_and_pd(valid, _mm_and_pd(_mm_cmpge_pd(u, vZero), _mm_cmplt_pd(u, vWidth)));
+    valid = _mm_and_pd(valid, _mm_and_pd(_mm_cmpge_pd(v, vZero), _mm_cmplt_pd(v, vHeight)));
+    const int m = _mm_movemask_pd(valid);
+
+    const __m128d dx = _mm_sub_pd(x, vPos);
+    _mm_storeu_pd(&tsd[i], _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx, dx), vDyz)));
+
+    int iu[4];
+    int iv[4];
+    _mm_storeu_si128((__m128i*)iu, _mm_cvttpd_epi32(u));
+    _mm_storeu_si128((__m128i*)iv, _mm_cvttpd_epi32(v));
+    indices[i]   = (m & 1) ? ((frame.height - 1) - iv[0]) * frame.width + iu[0] : -1;
+    indices[i+1] = (m & 2) ? ((frame.height - 1) - iv[1]) * frame.width + iu[1] : -1;
+
+    vi = _mm_add_pd(vi, vInc);
+  }
+
+  for(; i<n; i++)
+  {
+    const obfloat x = ((obfloat)i + 0.5) * step + coord[0];
+    indices[i] = imageIndex(frame, P[0]*x + b0, P[4]*x + b1, P[8]*x + b2);
+    const obfloat dx = x - frame.pos[0];
+    tsd[i] = sqrt(dx*dx + dyz);
+  }
+
+  return truncateRow(frame, n, indices, tsd);
+}
+
+__attribute__((target("sse2")))
+static inline __m128d blendSSE2(const __m128d mask, const __m128d a, const __m128d b)
+{
+  // a where mask is set, b otherwise
+  return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+__attribute__((target("sse2")))
+static void fuseRowSSE2(obfloat* voxelTsd, obfloat* voxelWeight, const int* indices, const obfloat* tsd, const obfloat* weights,
+                        const unsigned int n, const obfloat decay, const obfloat maxWeight)
+{
+  const __m128d vInc = _mm_set1_pd(TSDINC);
+  const __m128d vDecay = _mm_set1_pd(decay);
+  const __m128d vMax = _mm_set1_pd(maxWeight);
+
+  unsigned int i=0;
+  for(; i+2<=n; i+=2)
+  {
+    if(indices[i]<0 && indices[i+1]<0) continue;
+    const __m128d active = _mm_castsi128_pd(_mm_set_epi32(-(indices[i+1]>=0), -(indices[i+1]>=0), -(indices[i]>=0), -(indices[i]>=0)));
+
+    const __m128d tsdPrev = _mm_loadu_pd(&voxelTsd[i]);
+    const __m128d weightPrev = _mm_loadu_pd(&voxelWeight[i]);
+    const __m128d t = _mm_loadu_pd(&tsd[i]);
+    const __m128d inc = weights ? _mm_loadu_pd(&weights[i]) : vInc;
+
+    // Uninitialized voxels take over the measurement, the weight is not limited in this case
+    const __m128d isNan = _mm_cmpunord_pd(tsdPrev, tsdPrev);
+    const __m128d weight = _mm_add_pd(_mm_mul_pd(weightPrev, vDecay), inc);
+    const __m128d weightMax = _mm_min_pd(weight, vMax);
+    const __m128d avg = _mm_div_pd(_mm_add_pd(_mm_mul_pd(tsdPrev, _mm_sub_pd(weightMax, inc)), _mm_mul_pd(inc, t)), weightMax);
+
+    _mm_storeu_pd(&voxelTsd[i], blendSSE2(active, blendSSE2(isNan, t, avg), tsdPrev));
+    _mm_storeu_pd(&voxelWeight[i], blendSSE2(active, blendSSE2(isNan, weight, weightMax), weightPrev));
+  }
+
+  fuseRowScalar(&voxelTsd[i], &voxelWeight[i], &indices[i], &tsd[i], weights ? &weights[i] : NULL, n-i, decay, maxWeight);
+}
+
+__attribute__((target("avx2")))
+static unsigned int projectRowAVX2(const TsdFusionFrame& frame, const obfloat coord[3], const obfloat step, const unsigned int n, int* indices, obfloat* tsd)
+{
+  const double* P = frame.P;
+  const double b0 = P[1]*coord[1] + P[2]*coord[2] + P[3];
+  const double b1 = P[5]*coord[1] + P[6]*coord[2] + P[7];
+  const double b2 = P[9]*coord[1] + P[10]*coord[2] + P[11];
+  const obfloat dy = coord[1] - frame.pos[1];
+  const obfloat dz = coord[2] - frame.pos[2];
+  const obfloat dyz = dy*dy + dz*dz;
+
+  const __m256d vP0 = _mm256_set1_pd(P[0]);
+  const __m256d vP4 = _mm256_set1_pd(P[4]);
+  const __m256d vP8 = _mm256_set1_pd(P[8]);
+  const __m256d vb0 = _mm256_set1_pd(b0);
+  const __m256d vb1 = _mm256_set1_pd(b1);
+  const __m256d vb2 = _mm256_set1_pd(b2);
+  const __m256d vStep = _mm256_set1_pd(step);
+  const __m256d vOrigin = _mm256_set1_pd(coord[0]);
+  const __m256d vPos = _mm256_set1_pd(frame.pos[0]);
+  const __m256d vDyz = _mm256_set1_pd(dyz);
+  const __m256d vHalf = _mm256_set1_pd(0.5);
+  const __m256d vZero = _mm256_setzero_pd();
+  const __m256d vOne = _mm256_set1_pd(1.0);
+  const __m256d vWidth = _mm256_set1_pd((double)frame.width);
+  const __m256d vHeight = _mm256_set1_pd((double)frame.height);
+  const __m256d vInc = _mm256_set1_pd(4.0);
+  const __m128i vRowMax = _mm_set1_epi32(frame.height - 1);
+  const __m128i vCols = _mm_set1_epi32(frame.width);
+  const __m128i vInvalid = _mm_set1_epi32(-1);
+  const __m256i vNarrow = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  __m256d vi = _mm256_set_pd(3.5, 2.5, 1.5, 0.5);
+
+  unsigned int i=0;
+  for(; i+4<=n; i+=4)
+  {
+    const __m256d x = _mm256_add_pd(_mm256_mul_pd(vi, vStep), vOrigin);
+    const __m256d h0 = _mm256_add_pd(_mm256_mul_pd(vP0, x), vb0);
+    const __m256d h1 = _mm256_add_pd(_mm256_mul_pd(vP4, x), vb1);
+    const __m256d h2 = _mm256_add_pd(_mm256_mul_pd(vP8, x), vb2);
+    const __m256d invW = _mm256_div_pd(vOne, h2);
+    const __m256d u = _mm256_add_pd(_mm256_mul_pd(h0, invW), vHalf);
+    const __m256d v = _mm256_add_pd(_mm256_mul_pd(h1, invW), vHalf);
+
+    // Ordered, non-signaling comparisons evaluate to false for NaN
+    __m256d valid = _mm256_cmp_pd(h2, vZero, _CMP_GT_OQ);
+    valid = _mm256_and_pd(valid, _mm256_and_pd(_mm256_cmp_pd(u, vZero, _CMP_GE_OQ), _mm256_cmp_pd(u, vWidth, _CMP_LT_OQ)));
+    valid = _mm256_and_pd(valid, _mm256_and_pd(_mm256_cmp_pd(v, vZero, _CMP_GE_OQ), _mm256_cmp_pd(v, vHeight, _CMP_LT_OQ)));
+
+    // Narrow 64 bit lane masks to the 32 bit lanes of the index vector
+    const __m128i isValid = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(valid), vNarrow));
+
+    const __m128i iu = _mm256_cvttpd_epi32(u);
+    const __m128i iv = _mm256_cvttpd_epi32(v);
+    const __m128i idx = _mm_add_epi32(_mm_mullo_epi32(_mm_sub_epi32(vRowMax, iv), vCols), iu);
+    _mm_storeu_si128((__m128i*)&indices[i], _mm_blendv_epi8(vInvalid, idx, isValid));
+
+    const __m256d dx = _mm256_sub_pd(x, vPos);
+    _mm256_storeu_pd(&tsd[i], _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), vDyz)));
+
+    vi = _mm256_add_pd(vi, vInc);
+  }
+
+  for(; i<n; i++)
+  {
+    const obfloat x = ((obfloat)i + 0.5) * step + coord[0];
+    indices[i] = imageIndex(frame, P[0]*x + b0, P[4]*x + b1, P[8]*x + b2);
+    const obfloat dx = x - frame.pos[0];
+    tsd[i] = sqrt(dx*dx + dyz);
+  }
+
+  return truncateRow(frame, n, indices, tsd);
+}
+
+__attribute__((target("avx2")))
+static void fuseRowAVX2(obfloat* voxelTsd, obfloat* voxelWeight, const int* indices, const obfloat* tsd, const obfloat* weights,
+                        const unsigned int n, const obfloat decay, const obfloat maxWeight)
+{
+  const __m256d vInc = _mm256_set1_pd(TSDINC);
+  const __m256d vDecay = _mm256_set1_pd(decay);
+  const __m256d vMax = _mm256_set1_pd(maxWeight);
+  const __m128i vInvalid = _mm_set1_epi32(-1);
+
+  unsigned int i=0;
+  for(; i+4<=n; i+=4)
+  {
+    const __m128i act32 = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)&indices[i]), vInvalid);
+    if(_mm_movemask_epi8(act32)==0) continue;
+    const __m256d active = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(act32));
+
+    const __m256d tsdPrev = _mm256_loadu_pd(&voxelTsd[i]);
+    const __m256d weightPrev = _mm256_loadu_pd(&voxelWeight[i]);
+    const __m256d t = _mm256_loadu_pd(&tsd[i]);
+    const __m256d inc = weights ? _mm256_loadu_pd(&weights[i]) : vInc;
+
+    // Uninitialized voxels take over the measurement, the weight is not limited in this case
+    const __m256d isNan = _mm256_cmp_pd(tsdPrev, tsdPrev, _CMP_UNORD_Q);
+    const __m256d weight = _mm256_add_pd(_mm256_mul_pd(weightPrev, vDecay), inc);
+    const __m256d weightMax = _mm256_min_pd(weight, vMax);
+    const __m256d avg = _mm256_div_pd(_mm256_add_pd(_mm256_mul_pd(tsdPrev, _mm256_sub_pd(weightMax, inc)), _mm256_mul_pd(inc, t)), weightMax);
+
+    _mm256_storeu_pd(&voxelTsd[i], _mm256_blendv_pd(tsdPrev, _mm256_blendv_pd(avg, t, isNan), active));
+    _mm256_storeu_pd(&voxelWeight[i], _mm256_blendv_pd(weightPrev, _mm256_blendv_pd(weightMax, weight, isNan), active));
+  }
+
+  fuseRowScalar(&voxelTsd[i], &voxelWeight[i], &indices[i], &tsd[i], weights ? &weights[i] : NULL, n-i, decay, maxWeight);
+}
+
+#endif
+
+unsigned int TsdFusionKernel::projectRow(const TsdFusionFrame& frame, const obfloat coord[3], const obfloat step, const unsigned int n, int* indices, obfloat* tsd)
+{
+#if TSDFUSION_SIMD
+  if(_kernel==FUSIONKERNEL_AVX2) return projectRowAVX2(frame, coord, step, n, indices, tsd);
+  if(_kernel==FUSIONKERNEL_SSE2) return projectRowSSE2(frame, coord, step, n, indices, tsd);
+#endif
+  return projectRowScalar(frame, coord, step, n, indices, tsd);
+}
+
+void TsdFusionKernel::fuseRow(obfloat* voxelTsd, obfloat* voxelWeight, const int* indices, const obfloat* tsd, const obfloat* weights,
+                              const unsigned int n, const obfloat decay, const obfloat maxWeight)
+{
+#if TSDFUSION_SIMD
+  if(_kernel==FUSIONKERNEL_AVX2)
+  {
+    fuseRowAVX2(voxelTsd, voxelWeight, indices, tsd, weights, n, decay, maxWeight);
+    return;
+  }
+  if(_kernel==FUSIONKERNEL_SSE2)
+  {
+    fuseRowSSE2(voxelTsd, voxelWeight, indices, tsd, weights, n, decay, maxWeight);
+    return;
+  }
+#endif
+  fuseRowScalar(voxelTsd, voxelWeight, indices, tsd, weights, n, decay, maxWeight);
+}
+
+}
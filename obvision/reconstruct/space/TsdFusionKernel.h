@@ -0,0 +1,95 @@
+#ifndef TSDFUSIONKERNEL_H
+#define TSDFUSIONKERNEL_H
+
+#include "obvision/reconstruct/reconstruct_defs.h"
+
+namespace obvious
+{
+
+enum EnumTsdFusionKernel { FUSIONKERNEL_SCALAR=0,
+  FUSIONKERNEL_SSE2=1,
+  FUSIONKERNEL_AVX2=2};
+
+/**
+ * @struct TsdFusionFrame
+ * @brief Per-frame constants of projective data fusion
+ */
+struct TsdFusionFrame
+{
+  // 3x4 projection (row-major) of homogeneous world coordinates to homogeneous image coordinates, i.e., P * T^-1
+  double P[12];
+
+  // sensor position
+  obfloat pos[3];
+
+  double* data;
+
+  bool* mask;
+
+  unsigned char* rgb;
+
+  unsigned int width;
+
+  unsigned int height;
+
+  obfloat maxTruncation;
+};
+
+/**
+ * @class TsdFusionKernel
+ * @brief Vectorized row kernels for integrating projective measurements into partitions.
+ * The instruction set is determined once at runtime (AVX2, SSE2 or scalar code).
+ * @author Stefan May
+ */
+class TsdFusionKernel
+{
+public:
+
+  /**
+   * Get active kernel
+   * @return instruction set used
+   */
+  static EnumTsdFusionKernel getKernel();
+
+  /**
+   * Select kernel, e.g., for benchmarking. Instruction sets not supported by the CPU are replaced by the best available one.
+   * @param[in] kernel instruction set
+   */
+  static void setKernel(const EnumTsdFusionKernel kernel);
+
+  /**
+   * Project row of voxels to image and determine truncated signed distances
+   * @param[in] frame frame constants
+   * @param[in] coord world coordinates of row origin, voxel i is centered at (coord[0]+(i+0.5)*step, coord[1], coord[2])
+   * @param[in] step voxel size
+   * @param[in] n number of voxels
+   * @param[out] indices measurement index per voxel, -1 if voxel is not to be updated
+   * @param[out] tsd truncated signed distance per voxel (valid for indices>=0)
+   * @return number of voxels to be updated
+   */
+  static unsigned int projectRow(const TsdFusionFrame& frame, const obfloat coord[3], const obfloat step, const unsigned int n, int* indices, obfloat* tsd);
+
+  /**
+   * Weighted running average of full precision voxels, see TsdFusionPolicy
+   * @param[in,out] voxelTsd tsd values of row
+   * @param[in,out] voxelWeight weights of row
+   * @param[in] indices voxels with negative indices are left untouched
+   * @param[in] tsd truncated signed distances to be integrated
+   * @param[in] weights weights of measurements, NULL for constant weights of TSDINC
+   * @param[in] n number of voxels
+   * @param[in] decay factor applied to voxel weights before integration
+   * @param[in] maxWeight maximum weight of voxels
+   */
+  static void fuseRow(obfloat* voxelTsd, obfloat* voxelWeight, const int* indices, const obfloat* tsd, const obfloat* weights,
+                      const unsigned int n, const obfloat decay, const obfloat maxWeight);
+
+private:
+
+  static EnumTsdFusionKernel detect();
+
+  static EnumTsdFusionKernel _kernel;
+};
+
+}
+
+#endif
@@ -0,0 +1,631 @@
+#include "TsdFusionPipeline.h"
+#include "obcore/base/Logger.h"
+#include "obcore/base/Timer.h"
+#include "obcore/math/mathbase.h"
+
+#include <cstring>
+#include <deque>
+#include <algorithm>
+
+namespace obvious
+{
+
+/**
+ * @struct TsdFusionPipeline::Frame
+ * @brief Data of a frame passed through the stages
+ */
+struct TsdFusionPipeline::Frame
+{
+  Frame(const unsigned int size)
+  {
+    coords       = new double[3*size];
+    mask         = new bool[size];
+    rgb          = new unsigned char[3*size];
+    dist         = new double[size];
+    normals      = new double[3*size];
+    scene        = new double[3*size];
+    sceneNormals = new double[3*size];
+    hasRGB       = false;
+    hasNormals   = false;
+    sceneSize    = 0;
+    id           = 0;
+  }
+
+  ~Frame()
+  {
+    delete [] coords;
+    delete [] mask;
+    delete [] rgb;
+    delete [] dist;
+    delete [] normals;
+    delete [] scene;
+    delete [] sceneNormals;
+  }
+
+  unsigned int id;
+
+  // Measures latency since the frame has been added
+  Timer timer;
+
+  // Organized data in sensor coordinates
+  double* coords;
+
+  bool* mask;
+
+  unsigned char* rgb;
+
+  bool hasRGB;
+
+  double* dist;
+
+  double* normals;
+
+  // Valid points and normals for registration
+  double* scene;
+
+  double* sceneNormals;
+
+  bool hasNormals;
+
+  unsigned int sceneSize;
+
+  // Pose determined by tracking
+  double pose[16];
+};
+
+/**
+ * @class TsdFusionPipeline::FrameQueue
+ * @brief Bounded queue between stages
+ */
+class TsdFusionPipeline::FrameQueue
+{
+public:
+
+  FrameQueue(const unsigned int capacity, const EnumTsdPipelineDrop policy)
+  {
+    _capacity = std::max(capacity, 1u);
+    _policy   = policy;
+    _closed   = false;
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_notEmpty, NULL);
+    pthread_cond_init(&_notFull, NULL);
+  }
+
+  ~FrameQueue()
+  {
+    pthread_cond_destroy(&_notFull);
+    pthread_cond_destroy(&_notEmpty);
+    pthread_mutex_destroy(&_mutex);
+  }
+
+  /**
+   * Append frame, a full queue blocks or drops a frame depending on the policy
+   * @return dropped frame, either the oldest one of the queue or the passed frame itself, NULL if none
+   */
+  Frame* push(Frame* frame)
+  {
+    Frame* dropped = NULL;
+    pthread_mutex_lock(&_mutex);
+    if(_policy==PIPELINE_BLOCK)
+    {
+      while(_frames.size()>=_capacity && !_closed)
+        pthread_cond_wait(&_notFull, &_mutex);
+    }
+    else if(_frames.size()>=_capacity)
+    {
+      if(_policy==PIPELINE_DROP_NEWEST)
+      {
+        dropped = frame;
+      }
+      else
+      {
+        dropped = _frames.front();
+        _frames.pop_front();
+      }
+    }
+    if(dropped!=frame)
+    {
+      _frames.push_back(frame);
+      pthread_cond_signal(&_notEmpty);
+    }
+    pthread_mutex_unlock(&_mutex);
+    return dropped;
+  }
+
+  /**
+   * Remove oldest frame, waits for frames while the queue is open
+   * @return frame, NULL if the queue has been closed and is empty
+   */
+  Frame* pop()
+  {
+    Frame* frame = NULL;
+    pthread_mutex_lock(&_mutex);
+    while(_frames.empty() && !_closed)
+      pthread_cond_wait(&_notEmpty, &_mutex);
+    if(!_frames.empty())
+    {
+      frame = _frames.front();
+      _frames.pop_front();
+      pthread_cond_signal(&_notFull);
+    }
+    pthread_mutex_unlock(&_mutex);
+    return frame;
+  }
+
+  void open()
+  {
+    pthread_mutex_lock(&_mutex);
+    _closed = false;
+    pthread_mutex_unlock(&_mutex);
+  }
+
+  void close()
+  {
+    pthread_mutex_lock(&_mutex);
+    _closed = true;
+    pthread_cond_broadcast(&_notEmpty);
+    pthread_cond_broadcast(&_notFull);
+    pthread_mutex_unlock(&_mutex);
+  }
+
+private:
+
+  std::deque<Frame*> _frames;
+
+  unsigned int _capacity;
+
+  EnumTsdPipelineDrop _policy;
+
+  bool _closed;
+
+  pthread_mutex_t _mutex;
+
+  pthread_cond_t _notEmpty;
+
+  pthread_cond_t _notFull;
+};
+
+/**
+ * Move sensor to pose. Rays are rotated along with the pose, which is only done by relative transformations.
+ */
+static void moveSensor(SensorProjective3D* sensor, const double pose[16])
+{
+  Matrix P(4, 4);
+  P.setData((double*)pose);
+  Matrix T = sensor->getTransformation();
+  T.invert();
+  T = Matrix::multiply(T, P, false, false);
+  sensor->transform(&T);
+}
+
+TsdFusionPipeline::TsdFusionPipeline(TsdSpace* space, SensorProjective3D* sensor, Icp* icp, const unsigned int capacity,
+                                     const EnumTsdPipelineDrop dropInput, const EnumTsdPipelineDrop dropPush)
+{
+  _space  = space;
+  _icp    = icp;
+  _width  = sensor->getWidth();
+  _height = sensor->getHeight();
+
+  Matrix T = sensor->getTransformation();
+  T.getData(_pose);
+  _sensorPush    = new SensorProjective3D(sensor);
+  _sensorRaycast = new SensorProjective3D(sensor);
+  moveSensor(_sensorPush, _pose);
+  moveSensor(_sensorRaycast, _pose);
+
+  _estimateNormals  = false;
+  _maxRMS           = 0.1;
+  _probabilityModel = 1.0;
+  _probabilityScene = 1.0;
+  _running          = false;
+  _frameId          = 0;
+  _tracked          = 0;
+
+  _queues[PIPELINE_DECODE]   = new FrameQueue(capacity, dropInput);
+  _queues[PIPELINE_NORMALS]  = new FrameQueue(capacity, PIPELINE_BLOCK);
+  _queues[PIPELINE_TRACKING] = new FrameQueue(capacity, PIPELINE_BLOCK);
+  _queues[PIPELINE_PUSH]     = new FrameQueue(capacity, dropPush);
+
+  const unsigned int size = _width*_height;
+  _modelCoords    = new double[3*size];
+  _modelNormals   = new double[3*size];
+  _raycastCoords  = new double[3*size];
+  _raycastNormals = new double[3*size];
+  _modelSize      = 0;
+  _models         = 0;
+  memcpy(_modelPose, _pose, 16*sizeof(double));
+  _icpModel       = 0;
+  _icpModelSize   = 0;
+  memcpy(_icpModelPose, _pose, 16*sizeof(double));
+
+  _raycastPending = false;
+  _stopping       = false;
+
+  memset(_stats, 0, PIPELINE_STAGES*sizeof(TsdPipelineStatistics));
+
+  pthread_mutex_init(&_framesMutex, NULL);
+  pthread_mutex_init(&_poseMutex, NULL);
+  pthread_mutex_init(&_modelMutex, NULL);
+  pthread_cond_init(&_modelCond, NULL);
+  pthread_mutex_init(&_raycastMutex, NULL);
+  pthread_cond_init(&_raycastCond, NULL);
+  pthread_mutex_init(&_statsMutex, NULL);
+}
+
+TsdFusionPipeline::~TsdFusionPipeline()
+{
+  stop();
+
+  for(unsigned int i=0; i<PIPELINE_RAYCAST; i++)
+    delete _queues[i];
+  for(unsigned int i=0; i<_frames.size(); i++)
+    delete _frames[i];
+
+  delete [] _modelCoords;
+  delete [] _modelNormals;
+  delete [] _raycastCoords;
+  delete [] _raycastNormals;
+  delete _sensorPush;
+  delete _sensorRaycast;
+
+  pthread_mutex_destroy(&_statsMutex);
+  pthread_cond_destroy(&_raycastCond);
+  pthread_mutex_destroy(&_raycastMutex);
+  pthread_cond_destroy(&_modelCond);
+  pthread_mutex_destroy(&_modelMutex);
+  pthread_mutex_destroy(&_poseMutex);
+  pthread_mutex_destroy(&_framesMutex);
+}
+
+void TsdFusionPipeline::start()
+{
+  if(_running) return;
+
+  // Ray casting must not wait for pushes
+  _space->setConcurrentAccess(true);
+
+  _stopping       = false;
+  _raycastPending = false;
+  for(unsigned int i=0; i<PIPELINE_RAYCAST; i++)
+    _queues[i]->open();
+
+  for(unsigned int i=0; i<PIPELINE_STAGES; i++)
+  {
+    _contexts[i].pipeline = this;
+    _contexts[i].stage    = (EnumTsdPipelineStage)i;
+    if(pthread_create(&_threads[i], NULL, runStage, &_contexts[i]) != 0)
+      LOGMSG(DBG_ERROR, "Thread of stage " << i << " could not be created");
+  }
+  _running = true;
+}
+
+void TsdFusionPipeline::stop()
+{
+  if(!_running) return;
+
+  // Closing the input queue lets each stage close the queue of its successor after processing the remaining frames
+  _queues[PIPELINE_DECODE]->close();
+  for(unsigned int i=0; i<PIPELINE_RAYCAST; i++)
+    pthread_join(_threads[i], NULL);
+
+  pthread_mutex_lock(&_raycastMutex);
+  _stopping = true;
+  pthread_cond_signal(&_raycastCond);
+  pthread_mutex_unlock(&_raycastMutex);
+  pthread_join(_threads[PIPELINE_RAYCAST], NULL);
+
+  _running = false;
+
+  for(unsigned int i=0; i<PIPELINE_STAGES; i++)
+  {
+    const TsdPipelineStatistics& s = _stats[i];
+    LOGMSG(DBG_DEBUG, "Stage " << i << ": " << s.frames << " frames, " << s.dropped << " dropped, " << s.rejected << " rejected, time "
+           << s.meanTime << " s (max " << s.maxTime << " s), latency " << s.meanLatency << " s (max " << s.maxLatency << " s)");
+  }
+}
+
+bool TsdFusionPipeline::addFrame(const double* coords, const bool* mask, const unsigned char* rgb)
+{
+  if(!_running)
+  {
+    LOGMSG(DBG_WARN, "Pipeline not started, frame is ignored");
+    return false;
+  }
+
+  Frame* frame = acquireFrame();
+  frame->timer.start();
+  frame->id = _frameId++;
+  const unsigned int size = _width*_height;
+  memcpy(frame->coords, coords, 3*size*sizeof(*coords));
+  memcpy(frame->mask, mask, size*sizeof(*mask));
+  frame->hasRGB = (rgb!=NULL);
+  if(rgb) memcpy(frame->rgb, rgb, 3*size*sizeof(*rgb));
+
+  return enqueue(PIPELINE_DECODE, frame);
+}
+
+unsigned int TsdFusionPipeline::getPose(Matrix* T)
+{
+  pthread_mutex_lock(&_poseMutex);
+  T->setData(_pose);
+  const unsigned int tracked = _tracked;
+  pthread_mutex_unlock(&_poseMutex);
+  return tracked;
+}
+
+void TsdFusionPipeline::getStatistics(const EnumTsdPipelineStage stage, TsdPipelineStatistics* stats)
+{
+  pthread_mutex_lock(&_statsMutex);
+  *stats = _stats[stage];
+  pthread_mutex_unlock(&_statsMutex);
+}
+
+void* TsdFusionPipeline::runStage(void* context)
+{
+  StageContext* c = (StageContext*)context;
+  if(c->stage==PIPELINE_RAYCAST)
+    c->pipeline->processRaycasts();
+  else
+    c->pipeline->processFrames(c->stage);
+  return NULL;
+}
+
+void TsdFusionPipeline::processFrames(const EnumTsdPipelineStage stage)
+{
+  Timer t;
+  while(Frame* frame = _queues[stage]->pop())
+  {
+    t.start();
+    bool accepted = true;
+    switch(stage)
+    {
+    case PIPELINE_DECODE:
+      decode(frame);
+      break;
+    case PIPELINE_NORMALS:
+      estimateNormals(frame);
+      break;
+    case PIPELINE_TRACKING:
+      accepted = track(frame);
+      break;
+    default:
+      push(frame);
+      break;
+    }
+    record(stage, t.elapsed(), frame->timer.elapsed(), !accepted);
+
+    if(accepted && stage<PIPELINE_PUSH)
+      enqueue((EnumTsdPipelineStage)(stage+1), frame);
+    else
+      releaseFrame(frame);
+  }
+
+  if(stage<PIPELINE_PUSH)
+    _queues[stage+1]->close();
+}
+
+void TsdFusionPipeline::processRaycasts()
+{
+  Timer t;
+  while(true)
+  {
+    pthread_mutex_lock(&_raycastMutex);
+    while(!_raycastPending && !_stopping)
+      pthread_cond_wait(&_raycastCond, &_raycastMutex);
+    const bool pending = _raycastPending;
+    _raycastPending = false;
+    pthread_mutex_unlock(&_raycastMutex);
+    if(!pending) break;
+
+    t.start();
+
+    // The model is casted from the most recent pose, which is closest to frames to be tracked next
+    double pose[16];
+    pthread_mutex_lock(&_poseMutex);
+    memcpy(pose, _pose, 16*sizeof(double));
+    pthread_mutex_unlock(&_poseMutex);
+    moveSensor(_sensorRaycast, pose);
+
+    unsigned int size = 0;
+    _rayCaster.calcCoordsFromCurrentPose(_space, _sensorRaycast, _raycastCoords, _raycastNormals, NULL, &size);
+
+    pthread_mutex_lock(&_modelMutex);
+    std::swap(_modelCoords, _raycastCoords);
+    std::swap(_modelNormals, _raycastNormals);
+    _modelSize = size/3;
+    memcpy(_modelPose, pose, 16*sizeof(double));
+    _models++;
+    pthread_cond_broadcast(&_modelCond);
+    pthread_mutex_unlock(&_modelMutex);
+
+    const double elapsed = t.elapsed();
+    record(PIPELINE_RAYCAST, elapsed, elapsed, false);
+  }
+}
+
+void TsdFusionPipeline::decode(Frame* frame)
+{
+  const unsigned int size = _width*_height;
+  unsigned int idx = 0;
+  for(unsigned int i=0; i<size; i++)
+  {
+    frame->dist[i] = abs3D(&frame->coords[3*i]);
+    if(frame->mask[i])
+    {
+      frame->scene[3*idx]   = frame->coords[3*i];
+      frame->scene[3*idx+1] = frame->coords[3*i+1];
+      frame->scene[3*idx+2] = frame->coords[3*i+2];
+      idx++;
+    }
+  }
+  frame->sceneSize  = idx;
+  frame->hasNormals = false;
+}
+
+void TsdFusionPipeline::estimateNormals(Frame* frame)
+{
+  if(!_estimateNormals) return;
+
+  _normalsEstimator.estimateNormals3DGrid(_width, _height, frame->coords, frame->mask, frame->normals);
+
+  const unsigned int size = _width*_height;
+  unsigned int idx = 0;
+  for(unsigned int i=0; i<size; i++)
+  {
+    if(frame->mask[i])
+    {
+      frame->sceneNormals[3*idx]   = frame->normals[3*i];
+      frame->sceneNormals[3*idx+1] = frame->normals[3*i+1];
+      frame->sceneNormals[3*idx+2] = frame->normals[3*i+2];
+      idx++;
+    }
+  }
+  frame->hasNormals = true;
+}
+
+bool TsdFusionPipeline::track(Frame* frame)
+{
+  double lastPose[16];
+  pthread_mutex_lock(&_poseMutex);
+  memcpy(lastPose, _pose, 16*sizeof(double));
+  const unsigned int tracked = _tracked;
+  pthread_mutex_unlock(&_poseMutex);
+
+  // The first model is awaited, frames are not tracked against an empty space. The registration keeps its model
+  // (including the search structure), until the ray casting stage delivers a new one.
+  pthread_mutex_lock(&_modelMutex);
+  while(_models==0 && tracked>0)
+    pthread_cond_wait(&_modelCond, &_modelMutex);
+  if(_models!=_icpModel)
+  {
+    _icpModel = _models;
+    _icpModelSize = _modelSize;
+    if(_modelSize>0) _icp->setModel(_modelCoords, _modelNormals, _modelSize, _probabilityModel);
+    memcpy(_icpModelPose, _modelPose, 16*sizeof(double));
+  }
+  pthread_mutex_unlock(&_modelMutex);
+  const unsigned int modelSize = _icpModelSize;
+  double* modelPose = _icpModelPose;
+
+  if(modelSize==0)
+  {
+    // Without model, frames are fused at the last pose
+    memcpy(frame->pose, lastPose, 16*sizeof(double));
+  }
+  else
+  {
+    if(frame->sceneSize==0)
+    {
+      LOGMSG(DBG_DEBUG, "Frame " << frame->id << ": invalid scene");
+      return false;
+    }
+
+    // Assignment filters are reset per frame, the model is kept
+    _icp->reset();
+    _icp->setScene(frame->scene, frame->hasNormals ? frame->sceneNormals : NULL, frame->sceneSize, _probabilityScene);
+
+    // The model might have been casted from an older pose, the motion since then serves as initial guess
+    Matrix Pm(4, 4);
+    Pm.setData(modelPose);
+    Matrix Pl(4, 4);
+    Pl.setData(lastPose);
+    Matrix PmInv = Pm;
+    PmInv.invert();
+    Matrix Tinit = Matrix::multiply(PmInv, Pl, false, false);
+
+    double rms = 0.0;
+    unsigned int pairs = 0;
+    unsigned int iterations = 0;
+    EnumIcpState state = _icp->iterate(&rms, &pairs, &iterations, &Tinit);
+    if(!((state == ICP_SUCCESS || state == ICP_MAXITERATIONS) && rms < _maxRMS))
+    {
+      LOGMSG(DBG_DEBUG, "Frame " << frame->id << ": registration failed, state " << state << ", RMS " << rms);
+      return false;
+    }
+
+    Matrix T = _icp->getFinalTransformation();
+    Matrix P = Matrix::multiply(Pm, T, false, false);
+    P.getData(frame->pose);
+  }
+
+  pthread_mutex_lock(&_poseMutex);
+  memcpy(_pose, frame->pose, 16*sizeof(double));
+  _tracked++;
+  pthread_mutex_unlock(&_poseMutex);
+  return true;
+}
+
+void TsdFusionPipeline::push(Frame* frame)
+{
+  moveSensor(_sensorPush, frame->pose);
+  _sensorPush->setRealMeasurementData(frame->dist);
+  _sensorPush->setRealMeasurementMask(frame->mask);
+  // Frames without color must not be fused with colors of former frames
+  _sensorPush->setRealMeasurementRGB(frame->hasRGB ? frame->rgb : NULL);
+  _space->push(_sensorPush);
+
+  pthread_mutex_lock(&_raycastMutex);
+  _raycastPending = true;
+  pthread_cond_signal(&_raycastCond);
+  pthread_mutex_unlock(&_raycastMutex);
+}
+
+bool TsdFusionPipeline::enqueue(const EnumTsdPipelineStage stage, Frame* frame)
+{
+  Frame* dropped = _queues[stage]->push(frame);
+  if(dropped)
+  {
+    pthread_mutex_lock(&_statsMutex);
+    _stats[stage].dropped++;
+    pthread_mutex_unlock(&_statsMutex);
+    releaseFrame(dropped);
+  }
+  return (dropped!=frame);
+}
+
+TsdFusionPipeline::Frame* TsdFusionPipeline::acquireFrame()
+{
+  Frame* frame = NULL;
+  pthread_mutex_lock(&_framesMutex);
+  if(_freeFrames.empty())
+  {
+    frame = new Frame(_width*_height);
+    _frames.push_back(frame);
+  }
+  else
+  {
+    frame = _freeFrames.back();
+    _freeFrames.pop_back();
+  }
+  pthread_mutex_unlock(&_framesMutex);
+  return frame;
+}
+
+void TsdFusionPipeline::releaseFrame(Frame* frame)
+{
+  pthread_mutex_lock(&_framesMutex);
+  _freeFrames.push_back(frame);
+  pthread_mutex_unlock(&_framesMutex);
+}
+
+void TsdFusionPipeline::record(const EnumTsdPipelineStage stage, const double time, const double latency, const bool rejected)
+{
+  pthread_mutex_lock(&_statsMutex);
+  TsdPipelineStatistics& s = _stats[stage];
+  s.meanTime = (s.meanTime*s.frames + time) / (s.frames+1);
+  s.maxTime  = std::max(s.maxTime, time);
+  s.frames++;
+  if(rejected)
+  {
+    s.rejected++;
+  }
+  else
+  {
+    const unsigned int accepted = s.frames - s.rejected;
+    s.meanLatency = (s.meanLatency*(accepted-1) + latency) / accepted;
+    s.maxLatency  = std::max(s.maxLatency, latency);
+  }
+  pthread_mutex_unlock(&_statsMutex);
+}
+
+}
@@ -0,0 +1,281 @@
+#ifndef TSDFUSIONPIPELINE_H
+#define TSDFUSIONPIPELINE_H
+
+#include "obvision/reconstruct/space/TsdSpace.h"
+#include "obvision/reconstruct/space/SensorProjective3D.h"
+#include "obvision/reconstruct/space/RayCast3D.h"
+#include "obvision/registration/icp/Icp.h"
+#include "obvision/normals/NormalsEstimator.h"
+
+#include <pthread.h>
+
+namespace obvious
+{
+
+enum EnumTsdPipelineStage { PIPELINE_DECODE=0,
+  PIPELINE_NORMALS=1,
+  PIPELINE_TRACKING=2,
+  PIPELINE_PUSH=3,
+  PIPELINE_RAYCAST=4,
+  PIPELINE_STAGES=5};
+
+enum EnumTsdPipelineDrop { PIPELINE_BLOCK=0,
+  PIPELINE_DROP_OLDEST=1,
+  PIPELINE_DROP_NEWEST=2};
+
+/**
+ * @struct TsdPipelineStatistics
+ * @brief Timing of a pipeline stage
+ */
+struct TsdPipelineStatistics
+{
+  // number of processed frames
+  unsigned int frames;
+
+  // number of frames dropped in front of the stage
+  unsigned int dropped;
+
+  // number of frames rejected by the stage, i.e., frames not tracked
+  unsigned int rejected;
+
+  // processing time in seconds
+  double meanTime;
+
+  double maxTime;
+
+  // time in seconds from adding a frame to the pipeline until the stage finished it, rejected frames are not considered
+  double meanLatency;
+
+  double maxLatency;
+};
+
+/**
+ * @class TsdFusionPipeline
+ * @brief Concurrent volumetric fusion of a stream of organized point clouds, e.g., grabbed or recorded by a depth camera.
+ * Stages run on separate threads connected by bounded queues: decoding of distances, estimation of normals, ICP tracking
+ * against a model ray casted from the space, pushing to the space and ray casting of the model for tracking the next
+ * frames. Tracking does not wait for pushing or ray casting, but uses the most recent model. Frames are dropped in front of
+ * the pipeline or of pushing, if a stage cannot keep up. Ray casting takes place concurrently with pushing, i.e., the space
+ * is switched to concurrent access (see TsdSpace::setConcurrentAccess).
+ * @author Stefan May
+ */
+class TsdFusionPipeline
+{
+public:
+
+  /**
+   * Constructor
+   * @param[in] space space to be fused into
+   * @param[in] sensor sensor providing image size, projection, working range and initial pose, it is not modified
+   * @param[in] icp configured registration instance, used exclusively by the tracking stage while running
+   * @param[in] capacity number of frames in each queue, latency is bounded by the total capacity times the time of the slowest stage
+   * @param[in] dropInput behavior, if frames are added faster than they are processed
+   * @param[in] dropPush behavior, if frames are tracked faster than they are pushed
+   */
+  TsdFusionPipeline(TsdSpace* space, SensorProjective3D* sensor, Icp* icp, const unsigned int capacity=2,
+                    const EnumTsdPipelineDrop dropInput=PIPELINE_DROP_OLDEST, const EnumTsdPipelineDrop dropPush=PIPELINE_DROP_OLDEST);
+
+  /**
+   * Destructor, pending frames are processed
+   */
+  virtual ~TsdFusionPipeline();
+
+  /**
+   * Enable estimation of scene normals, e.g., for registration filters relying on them (default: disabled)
+   * @param[in] enable enable flag
+   */
+  void setNormalEstimation(const bool enable) { _estimateNormals = enable; }
+
+  /**
+   * Set acceptance threshold of registration, frames with larger residuals are neither tracked nor pushed
+   * @param[in] rms maximum root mean square error (default: 0.1)
+   */
+  void setMaxRMS(const double rms) { _maxRMS = rms; }
+
+  /**
+   * Set probabilities of subsampling model and scene for registration (default: 1.0)
+   * @param[in] model probability of model points
+   * @param[in] scene probability of scene points
+   */
+  void setSubsampling(const double model, const double scene) { _probabilityModel = model; _probabilityScene = scene; }
+
+  /**
+   * Start threads of stages
+   */
+  void start();
+
+  /**
+   * Process frames added so far and stop threads
+   */
+  void stop();
+
+  /**
+   * Add frame to pipeline, data is copied
+   * @param[in] coords organized point cloud in sensor coordinates (size: 3*width*height)
+   * @param[in] mask validity of points (size: width*height)
+   * @param[in] rgb colors, may be NULL (size: 3*width*height)
+   * @return false, if the frame has been dropped
+   */
+  bool addFrame(const double* coords, const bool* mask, const unsigned char* rgb=NULL);
+
+  /**
+   * Get pose of the most recently tracked frame
+   * @param[out] T transformation from sensor to world coordinate system (4x4)
+   * @return number of tracked frames
+   */
+  unsigned int getPose(Matrix* T);
+
+  /**
+   * Get timing of a stage
+   * @param[in] stage pipeline stage
+   * @param[out] stats statistics since start
+   */
+  void getStatistics(const EnumTsdPipelineStage stage, TsdPipelineStatistics* stats);
+
+private:
+
+  struct Frame;
+
+  class FrameQueue;
+
+  /**
+   * @struct StageContext
+   * @brief Argument of stage threads
+   */
+  struct StageContext
+  {
+    TsdFusionPipeline* pipeline;
+    EnumTsdPipelineStage stage;
+  };
+
+  static void* runStage(void* context);
+
+  /**
+   * Process frames of a stage until its queue is closed, frames are handed over to the next stage
+   */
+  void processFrames(const EnumTsdPipelineStage stage);
+
+  /**
+   * Cast model for tracking from the most recent pose, whenever data has been pushed
+   */
+  void processRaycasts();
+
+  void decode(Frame* frame);
+
+  void estimateNormals(Frame* frame);
+
+  /**
+   * Register scene of frame to the most recent model
+   * @return success, i.e., the pose of the frame has been determined
+   */
+  bool track(Frame* frame);
+
+  void push(Frame* frame);
+
+  /**
+   * Hand over frame to queue of a stage, frames dropped by the queue are recycled
+   * @return false, if the frame itself has been dropped
+   */
+  bool enqueue(const EnumTsdPipelineStage stage, Frame* frame);
+
+  Frame* acquireFrame();
+
+  void releaseFrame(Frame* frame);
+
+  void record(const EnumTsdPipelineStage stage, const double time, const double latency, const bool rejected);
+
+  TsdSpace* _space;
+
+  Icp* _icp;
+
+  unsigned int _width;
+
+  unsigned int _height;
+
+  // Sensors of push and ray casting stages, which run concurrently
+  SensorProjective3D* _sensorPush;
+
+  SensorProjective3D* _sensorRaycast;
+
+  RayCast3D _rayCaster;
+
+  NormalsEstimator _normalsEstimator;
+
+  bool _estimateNormals;
+
+  double _maxRMS;
+
+  double _probabilityModel;
+
+  double _probabilityScene;
+
+  bool _running;
+
+  unsigned int _frameId;
+
+  // Input queues of stages, ray casting is triggered by pushing
+  FrameQueue* _queues[PIPELINE_RAYCAST];
+
+  pthread_t _threads[PIPELINE_STAGES];
+
+  StageContext _contexts[PIPELINE_STAGES];
+
+  // Frames are recycled
+  vector<Frame*> _frames;
+
+  vector<Frame*> _freeFrames;
+
+  pthread_mutex_t _framesMutex;
+
+  // Pose of the most recently tracked frame
+  double _pose[16];
+
+  unsigned int _tracked;
+
+  pthread_mutex_t _poseMutex;
+
+  // Model for tracking in sensor coordinates of the pose it has been casted from
+  double* _modelCoords;
+
+  double* _modelNormals;
+
+  unsigned int _modelSize;
+
+  double _modelPose[16];
+
+  unsigned int _models;
+
+  pthread_mutex_t _modelMutex;
+
+  pthread_cond_t _modelCond;
+
+  // Model set up in the registration, identified by the number of models casted so far (tracking stage only)
+  unsigned int _icpModel;
+
+  unsigned int _icpModelSize;
+
+  double _icpModelPose[16];
+
+  // Buffers of the ray casting stage, which are exchanged with the model
+  double* _raycastCoords;
+
+  double* _raycastNormals;
+
+  // Ray casting is requested after each push
+  bool _raycastPending;
+
+  bool _stopping;
+
+  pthread_mutex_t _raycastMutex;
+
+  pthread_cond_t _raycastCond;
+
+  // Accumulated timing of stages
+  TsdPipelineStatistics _stats[PIPELINE_STAGES];
+
+  pthread_mutex_t _statsMutex;
+};
+
+}
+
+#endif
@@ -0,0 +1,44 @@
+#include "TsdFusionPolicy.h"
+
+namespace obvious
+{
+
+TsdFusionPolicy::TsdFusionPolicy(const EnumTsdWeighting weighting, const obfloat maxWeight, const obfloat decay)
+{
+  _weighting = weighting;
+  _referenceDistance = 1.0;
+  _colorBand = 0.0;
+  setMaxWeight(maxWeight);
+  setDecay(decay);
+}
+
+void TsdFusionPolicy::setMaxWeight(const obfloat maxWeight)
+{
+  // Averaging requires the weight of a single measurement to fit into a voxel
+  _maxWeight = (maxWeight < TSDINC) ? TSDINC : maxWeight;
+}
+
+void TsdFusionPolicy::setDecay(const obfloat decay)
+{
+  _decay = decay;
+  if(!(_decay > 0.0)) _decay = 1e-3;
+  if(_decay > 1.0) _decay = 1.0;
+}
+
+void TsdFusionPolicy::setColorBand(const obfloat band)
+{
+  _colorBand = band;
+  if(!(_colorBand > 0.0)) _colorBand = 0.0;
+  if(_colorBand > 1.0) _colorBand = 1.0;
+}
+
+void TsdFusionPolicy::weightRow(const int* indices, const obfloat* tsd, const double* data, const unsigned int n, obfloat* weights) const
+{
+  for(unsigned int i=0; i<n; i++)
+  {
+    if(indices[i]<0) continue;
+    weights[i] = getWeight(tsd[i], data[indices[i]]);
+  }
+}
+
+}
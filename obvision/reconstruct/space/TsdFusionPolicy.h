@@ -0,0 +1,165 @@
+#ifndef TSDFUSIONPOLICY_H
+#define TSDFUSIONPOLICY_H
+
+#include "obvision/reconstruct/reconstruct_defs.h"
+
+#include <cmath>
+
+namespace obvious
+{
+
+enum EnumTsdWeighting { WEIGHTING_CONSTANT=0,
+  WEIGHTING_DISTANCE=1,
+  WEIGHTING_EXPONENTIAL=2};
+
+/**
+ * @class TsdFusionPolicy
+ * @brief Weighting scheme for the integration of measurements into voxels.
+ * The weight of a new measurement is determined by the selected weighting function. Before integration, the weights of
+ * all voxels updated in the current frame are multiplied with a decay factor, i.e., old measurements are forgotten
+ * exponentially and moving objects are erased from the map after a few frames. Weights are limited by a maximum weight.
+ * The default policy (constant weighting, no decay) corresponds to a plain running average.
+ * @author Stefan May
+ */
+class TsdFusionPolicy
+{
+public:
+
+  /**
+   * Constructor
+   * @param[in] weighting weighting function
+   * @param[in] maxWeight maximum weight of voxels
+   * @param[in] decay decay factor applied to weights of updated voxels per frame
+   */
+  TsdFusionPolicy(const EnumTsdWeighting weighting=WEIGHTING_CONSTANT, const obfloat maxWeight=TSDSPACEMAXWEIGHT, const obfloat decay=1.0);
+
+  /**
+   * Set weighting function
+   * WEIGHTING_CONSTANT: each measurement has the same weight
+   * WEIGHTING_DISTANCE: weights decrease quadratically with the measured distance beyond the reference distance
+   * WEIGHTING_EXPONENTIAL: weights decrease exponentially behind the surface, proposed by
+   * E. Bylow, J. Sturm, C. Kerl, F. Kahl, and D. Cremers.
+   * Real-time camera tracking and 3d reconstruction using signed distance functions.
+   * In Robotics: Science and Systems Conference (RSS), June 2013.
+   * @param[in] weighting weighting function
+   */
+  void setWeighting(const EnumTsdWeighting weighting) { _weighting = weighting; }
+
+  /**
+   * Get weighting function
+   * @return weighting function
+   */
+  EnumTsdWeighting getWeighting() const { return _weighting; }
+
+  /**
+   * Set maximum weight of voxels. The lower the maximum weight, the faster the map adapts to changes.
+   * @param[in] maxWeight maximum weight, at least TSDINC
+   */
+  void setMaxWeight(const obfloat maxWeight);
+
+  /**
+   * Get maximum weight of voxels
+   * @return maximum weight
+   */
+  obfloat getMaxWeight() const { return _maxWeight; }
+
+  /**
+   * Set decay of voxel weights per frame
+   * @param[in] decay factor in ]0; 1], 1 disables forgetting
+   */
+  void setDecay(const obfloat decay);
+
+  /**
+   * Get decay of voxel weights per frame
+   * @return decay factor
+   */
+  obfloat getDecay() const { return _decay; }
+
+  /**
+   * Set reference distance of distance-dependent weighting, closer measurements obtain the full weight
+   * @param[in] distance reference distance in meters
+   */
+  void setReferenceDistance(const obfloat distance) { _referenceDistance = distance; }
+
+  /**
+   * Get reference distance of distance-dependent weighting
+   * @return reference distance in meters
+   */
+  obfloat getReferenceDistance() const { return _referenceDistance; }
+
+  /**
+   * Check whether all measurements have the same weight TSDINC
+   * @return true for constant weighting
+   */
+  bool isConstant() const { return _weighting==WEIGHTING_CONSTANT; }
+
+  /**
+   * Set band of separate color fusion. Colors are fused with their own weights into voxels closer to the surface than the band,
+   * voxels farther away keep their color. A band of 0 disables separate color fusion, i.e., colors are averaged with the weights of
+   * the geometry in all updated voxels (default).
+   * @param[in] band fraction of the truncation radius in [0; 1]
+   */
+  void setColorBand(const obfloat band);
+
+  /**
+   * Get band of separate color fusion
+   * @return fraction of the truncation radius, 0 if colors are averaged with the weights of the geometry
+   */
+  obfloat getColorBand() const { return _colorBand; }
+
+  /**
+   * Check whether colors are fused separately from the geometry, see setColorBand
+   * @return true for separate color fusion
+   */
+  bool isColorSeparate() const { return _colorBand > 0.0; }
+
+  /**
+   * Determine weight of a measurement
+   * @param[in] tsd truncated signed distance in [-1; 1]
+   * @param[in] distance measured distance
+   * @return weight in ]0; TSDINC]
+   */
+  inline obfloat getWeight(const obfloat tsd, const obfloat distance) const
+  {
+    if(_weighting==WEIGHTING_DISTANCE)
+    {
+      if(distance <= _referenceDistance) return TSDINC;
+      const obfloat r = _referenceDistance / distance;
+      return TSDINC * r * r;
+    }
+    else if(_weighting==WEIGHTING_EXPONENTIAL)
+    {
+      // eps = -1/4 and span = -1 - eps of the truncation radius, i.e., sigma = 3/span^2
+      if(tsd > -0.25) return TSDINC;
+      const obfloat d = tsd + 0.25;
+      return TSDINC * exp(-(16.0/3.0) * d * d);
+    }
+    return TSDINC;
+  }
+
+  /**
+   * Determine weights of a row of measurements, see TsdFusionKernel::projectRow
+   * @param[in] indices measurement index per voxel, voxels with negative indices are skipped
+   * @param[in] tsd truncated signed distance per voxel
+   * @param[in] data measured distances
+   * @param[in] n number of voxels
+   * @param[out] weights weight per voxel
+   */
+  void weightRow(const int* indices, const obfloat* tsd, const double* data, const unsigned int n, obfloat* weights) const;
+
+private:
+
+  EnumTsdWeighting _weighting;
+
+  obfloat _maxWeight;
+
+  obfloat _decay;
+
+  obfloat _referenceDistance;
+
+  obfloat _colorBand;
+};
+
+}
+
+#endif
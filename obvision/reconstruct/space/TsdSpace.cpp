@@ -5,9 +5,14 @@
 #include "TsdSpace.h"
 #include "TsdSpaceBranch.h"
 #include "SensorProjective3D.h"
+#include "TsdSpacePartitionPool.h"
 
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
 #include <cmath>
+#include <sstream>
+#include <algorithm>
 #include <omp.h>
 
 namespace obvious
@@ -27,13 +32,49 @@ static int _distancesPushed = 0;
 #endif
 #define RGB_MAX 255
 
-TsdSpace::TsdSpace(const double voxelSize, const EnumTsdSpaceLayout layoutPartition, const EnumTsdSpaceLayout layoutSpace)
+// Edge length of blocks of partitions used for empty space skipping (in partitions)
+#define TSDSPACE_SURFACEBLOCK 4
+
+TsdSpace::TsdSpace(const double voxelSize, const EnumTsdSpaceLayout layoutPartition, const EnumTsdSpaceLayout layoutSpace, const EnumTsdSpaceStorage storage,
+                   const EnumTsdVoxelLayout voxelLayout)
 {
   _voxelSize = voxelSize;
   _invVoxelSize = 1.0 / _voxelSize;
 
   _layoutPartition = layoutPartition;
   _layoutSpace = layoutSpace;
+  _storage = storage;
+  _voxelLayout = voxelLayout;
+
+  _tree = NULL;
+  _partitions = NULL;
+  _hash = NULL;
+  _file = NULL;
+  _lutIndex2Partition = NULL;
+  _lutIndex2Cell = NULL;
+
+  _surfaceBlocksValid = false;
+  _pushes = 0;
+  _blocksInX = 0;
+  _blocksInY = 0;
+  _blocksInZ = 0;
+
+  _concurrent = false;
+  _staging = false;
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+  // Readers following each other closely must not delay pushing indefinitely
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  pthread_rwlock_init(&_lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+
+  _rolling = false;
+  _rollingThreshold = 1;
+  _windowIndex[0] = 0;
+  _windowIndex[1] = 0;
+  _windowIndex[2] = 0;
 
   // determine number of voxels in each dimension
   _cellsX = 1u << layoutSpace;
@@ -41,6 +82,7 @@ TsdSpace::TsdSpace(const double voxelSize, const EnumTsdSpaceLayout layoutPartit
   _cellsZ = _cellsX;
 
   unsigned int dimPartition = 1u << layoutPartition;
+  _dimPartition = dimPartition;
 
   if(dimPartition > _cellsX)
   {
@@ -49,10 +91,21 @@ TsdSpace::TsdSpace(const double voxelSize, const EnumTsdSpaceLayout layoutPartit
     return;
   }
 
+  // Dense storage allocates all partitions in advance, hashed storage keys partitions by 32 bit indices
+  if(layoutSpace > LAYOUT_1024x1024x1024 && (storage!=STORAGE_HASHED || layoutSpace-layoutPartition > 10))
+  {
+    LOGMSG(DBG_ERROR, _cellsX << "x" << _cellsY << "x" << _cellsZ << " space requires hashed storage with at most 1024x1024x1024 partitions");
+    return;
+  }
+
   _partitionsInX = _cellsX/dimPartition;
   _partitionsInY = _cellsY/dimPartition;
   _partitionsInZ = _cellsZ/dimPartition;
 
+  _blocksInX = (_partitionsInX + TSDSPACE_SURFACEBLOCK - 1) / TSDSPACE_SURFACEBLOCK;
+  _blocksInY = (_partitionsInY + TSDSPACE_SURFACEBLOCK - 1) / TSDSPACE_SURFACEBLOCK;
+  _blocksInZ = (_partitionsInZ + TSDSPACE_SURFACEBLOCK - 1) / TSDSPACE_SURFACEBLOCK;
+
   _lutIndex2Partition = new int[_cellsX];
   _lutIndex2Cell = new int[_cellsX];
   for(unsigned int i=0; i<_cellsX; i++)
@@ -62,6 +115,7 @@ TsdSpace::TsdSpace(const double voxelSize, const EnumTsdSpaceLayout layoutPartit
   }
 
   _maxTruncation = 2.0*voxelSize;
+  _lodDistance = 0.0;
 
   LOGMSG(DBG_DEBUG, "Dimensions are (x/y/z) (" << _cellsX << "/" << _cellsY << "/" << _cellsZ << ")");
   LOGMSG(DBG_DEBUG, "Creating TsdVoxel Space...");
@@ -73,8 +127,18 @@ TsdSpace::TsdSpace(const double voxelSize, const EnumTsdSpaceLayout layoutPartit
   _minZ = 0.0;
   _maxZ = ((obfloat)_cellsZ + 0.5) * _voxelSize;
 
-  LOGMSG(DBG_DEBUG, "Allocating " << _partitionsInX << "x" << _partitionsInY << "x" << _partitionsInZ << " partitions");
   LOGMSG(DBG_DEBUG, "Spanning area: " << _maxX << " " << _maxY << " " << _maxZ << endl;)
+
+  if(_storage==STORAGE_HASHED)
+  {
+    // Partitions are created on demand while pushing data, the octree is not available
+    LOGMSG(DBG_DEBUG, "Hashing up to " << _partitionsInX << "x" << _partitionsInY << "x" << _partitionsInZ << " partitions");
+    TsdSpacePartition::initCoordinates(dimPartition, dimPartition, dimPartition, voxelSize);
+    _hash = new PartitionHash<TsdSpacePartition>();
+    return;
+  }
+
+  LOGMSG(DBG_DEBUG, "Allocating " << _partitionsInX << "x" << _partitionsInY << "x" << _partitionsInZ << " partitions");
   System<TsdSpacePartition*>::allocate(_partitionsInZ, _partitionsInY, _partitionsInX, _partitions);
 
   for(int pz=0; pz<_partitionsInZ; pz++)
@@ -83,12 +147,45 @@ TsdSpace::TsdSpace(const double voxelSize, const EnumTsdSpaceLayout layoutPartit
     {
       for(int px=0; px<_partitionsInX; px++)
       {
-        _partitions[pz][py][px] = new TsdSpacePartition(px*dimPartition, py*dimPartition, pz*dimPartition, dimPartition, dimPartition, dimPartition, voxelSize);
+        _partitions[pz][py][px] = new TsdSpacePartition(px*dimPartition, py*dimPartition, pz*dimPartition, dimPartition, dimPartition, dimPartition, voxelSize, NULL, _voxelLayout);
       }
     }
   }
 
-  int depthTree = layoutSpace-layoutPartition;
+  buildTree();
+}
+
+TsdSpace::~TsdSpace(void)
+{
+  // Leafs of the octree are deleted with the partitions
+  if(_tree && !_tree->isLeaf()) delete _tree;
+
+  vector<TsdSpacePartition*> partitions;
+  getAllocatedPartitions(partitions);
+  for(unsigned int i=0; i<partitions.size(); i++)
+    delete partitions[i];
+
+  for(unsigned int i=0; i<_recycled.size(); i++)
+    delete _recycled[i];
+
+  if(_partitions) System<TsdSpacePartition*>::deallocate(_partitions);
+  delete _hash;
+  delete _file;
+  delete [] _lutIndex2Partition;
+  delete [] _lutIndex2Cell;
+
+  pthread_rwlock_destroy(&_lock);
+
+  // Give memory of unused voxel blocks back to the system
+  TsdSpacePartitionPool::trimAll();
+}
+
+void TsdSpace::buildTree()
+{
+  // Leafs of the octree are owned by the partition array
+  if(_tree && !_tree->isLeaf()) delete _tree;
+
+  int depthTree = _layoutSpace-_layoutPartition;
   if(depthTree == 0)
   {
     _tree = _partitions[0][0][0];
@@ -100,16 +197,25 @@ TsdSpace::TsdSpace(const double voxelSize, const EnumTsdSpaceLayout layoutPartit
   }
 }
 
-TsdSpace::~TsdSpace(void)
-{
-  delete _tree;
-  System<TsdSpacePartition*>::deallocate(_partitions);
-  delete [] _lutIndex2Partition;
-  delete [] _lutIndex2Cell;
-}
-
 void TsdSpace::reset()
 {
+  pthread_rwlock_wrlock(&_lock);
+
+  delete _file;
+  _file = NULL;
+  _surfaceBlocksValid = false;
+
+  if(_storage==STORAGE_HASHED)
+  {
+    vector<TsdSpacePartition*> partitions;
+    _hash->getPartitions(partitions);
+    for(unsigned int i=0; i<partitions.size(); i++)
+      delete partitions[i];
+    _hash->clear();
+    pthread_rwlock_unlock(&_lock);
+    return;
+  }
+
   for(int pz=0; pz<_partitionsInZ; pz++)
   {
     for(int py=0; py<_partitionsInY; py++)
@@ -120,11 +226,34 @@ void TsdSpace::reset()
       }
     }
   }
+
+  pthread_rwlock_unlock(&_lock);
+}
+
+void TsdSpace::reserve(const unsigned int partitions)
+{
+  TsdSpacePartition::reserve(_dimPartition, _dimPartition, _dimPartition, _voxelLayout, partitions);
 }
 
 unsigned int TsdSpace::getPartitionSize()
 {
-  return _partitions[0][0][0]->getWidth();
+  return _dimPartition;
+}
+
+void TsdSpace::getAllocatedPartitions(vector<TsdSpacePartition*> &partitions) const
+{
+  if(_storage==STORAGE_HASHED)
+  {
+    if(_hash) _hash->getPartitions(partitions);
+    return;
+  }
+
+  if(!_partitions) return;
+
+  for(int pz=0; pz<_partitionsInZ; pz++)
+    for(int py=0; py<_partitionsInY; py++)
+      for(int px=0; px<_partitionsInX; px++)
+        partitions.push_back(_partitions[pz][py][px]);
 }
 
 void TsdSpace::getCentroid(obfloat centroid[3])
@@ -158,14 +287,14 @@ bool TsdSpace::isPartitionInitialized(obfloat coord[3])
   return _partitions[pz][py][px]->isInitialized();*/
 
   // Get cell indices
-  obfloat dxIdx = floor(coord[0] * _invVoxelSize);
-  obfloat dyIdx = floor(coord[1] * _invVoxelSize);
-  obfloat dzIdx = floor(coord[2] * _invVoxelSize);
+  obfloat dxIdx = floor((coord[0]-_minX) * _invVoxelSize);
+  obfloat dyIdx = floor((coord[1]-_minY) * _invVoxelSize);
+  obfloat dzIdx = floor((coord[2]-_minZ) * _invVoxelSize);
 
   // Get center point of current cell
-  obfloat dx = (dxIdx + 0.5) * _voxelSize;
-  obfloat dy = (dyIdx + 0.5) * _voxelSize;
-  obfloat dz = (dzIdx + 0.5) * _voxelSize;
+  obfloat dx = _minX + (dxIdx + 0.5) * _voxelSize;
+  obfloat dy = _minY + (dyIdx + 0.5) * _voxelSize;
+  obfloat dz = _minZ + (dzIdx + 0.5) * _voxelSize;
 
   int x = (int)dxIdx;
   int y = (int)dyIdx;
@@ -185,342 +314,1123 @@ bool TsdSpace::isPartitionInitialized(obfloat coord[3])
   int py = _lutIndex2Partition[y];
   int pz = _lutIndex2Partition[z];
 
-  return _partitions[pz][py][px]->isInitialized();
+  TsdSpacePartition* part = getPartition(px, py, pz);
+  return (part && part->isInitialized());
+}
+
+TsdSpacePartition* TsdSpace::findRegion(const obfloat coord[3], obfloat regionMin[3], obfloat regionMax[3], bool* empty) const
+{
+  *empty = true;
+
+  // Lower neighbor of query point, see coord2Index
+  int idx[3];
+  idx[0] = (int)floor((coord[0]-_minX) * _invVoxelSize - 0.5);
+  idx[1] = (int)floor((coord[1]-_minY) * _invVoxelSize - 0.5);
+  idx[2] = (int)floor((coord[2]-_minZ) * _invVoxelSize - 0.5);
+
+  if(idx[0]<0 || idx[0]>=(int)_cellsX || idx[1]<0 || idx[1]>=(int)_cellsY || idx[2]<0 || idx[2]>=(int)_cellsZ)
+  {
+    for(unsigned int i=0; i<3; i++)
+      regionMin[i] = regionMax[i] = coord[i];
+    return NULL;
+  }
+
+  int p[3];
+  for(unsigned int i=0; i<3; i++)
+    p[i] = _lutIndex2Partition[idx[i]];
+
+  // Regions are shifted by half a voxel, since interpolation starts from voxel centers
+  const obfloat minCoord[3] = {_minX, _minY, _minZ};
+
+  if(_surfaceBlocksValid)
+  {
+    int b[3];
+    for(unsigned int i=0; i<3; i++)
+      b[i] = p[i] / TSDSPACE_SURFACEBLOCK;
+    if(!_surfaceBlocks[(b[2]*_blocksInY+b[1])*_blocksInX+b[0]])
+    {
+      for(unsigned int i=0; i<3; i++)
+      {
+        regionMin[i] = minCoord[i] + ((obfloat)(b[i]*TSDSPACE_SURFACEBLOCK*_dimPartition) + 0.5) * _voxelSize;
+        regionMax[i] = regionMin[i] + (obfloat)(TSDSPACE_SURFACEBLOCK*_dimPartition) * _voxelSize;
+      }
+      return NULL;
+    }
+  }
+
+  for(unsigned int i=0; i<3; i++)
+  {
+    regionMin[i] = minCoord[i] + ((obfloat)(p[i]*_dimPartition) + 0.5) * _voxelSize;
+    regionMax[i] = regionMin[i] + (obfloat)_dimPartition * _voxelSize;
+  }
+
+  TsdSpacePartition* part = getPartition(p[0], p[1], p[2]);
+  *empty = !(part && part->isInitialized() && part->hasSurface());
+  return part;
+}
+
+bool TsdSpace::getEmptyRegion(const obfloat coord[3], obfloat regionMin[3], obfloat regionMax[3]) const
+{
+  bool empty;
+  findRegion(coord, regionMin, regionMax, &empty);
+  return empty;
+}
+
+bool TsdSpace::isSurfaceModified(const obfloat coord[3], obfloat regionMin[3], obfloat regionMax[3]) const
+{
+  bool empty;
+  TsdSpacePartition* part = findRegion(coord, regionMin, regionMax, &empty);
+  if(empty) return false;
+  return (part->isModified() || part->getStamp()==_pushes);
+}
+
+void TsdSpace::updateSurfaceBlocks()
+{
+  _surfaceBlocks.assign(_blocksInX*_blocksInY*_blocksInZ, 0);
+
+  vector<TsdSpacePartition*> partitions;
+  getAllocatedPartitions(partitions);
+  for(unsigned int i=0; i<partitions.size(); i++)
+  {
+    TsdSpacePartition* part = partitions[i];
+    if(!part->isInitialized() || !part->hasSurface()) continue;
+    int bx = part->getX() / _dimPartition / TSDSPACE_SURFACEBLOCK;
+    int by = part->getY() / _dimPartition / TSDSPACE_SURFACEBLOCK;
+    int bz = part->getZ() / _dimPartition / TSDSPACE_SURFACEBLOCK;
+    _surfaceBlocks[(bz*_blocksInY+by)*_blocksInX+bx] = 1;
+  }
+
+  _surfaceBlocksValid = true;
 }
 
 bool TsdSpace::isInsideSpace(Sensor* sensor)
 {
   obfloat coord[3];
   sensor->getPosition(coord);
+  return isInsideSpace(coord);
+}
+
+bool TsdSpace::isInsideSpace(const obfloat coord[3]) const
+{
   return (coord[0]>_minX && coord[0]<_maxX && coord[1]>_minY && coord[1]<_maxY && coord[2]>_minZ && coord[2]<_maxZ);
 }
 
+void TsdSpace::lockRead()
+{
+  pthread_rwlock_rdlock(&_lock);
+}
+
+void TsdSpace::unlockRead()
+{
+  pthread_rwlock_unlock(&_lock);
+}
+
+void TsdSpace::beginPush(Sensor* sensor, obfloat pos[3])
+{
+  pthread_rwlock_wrlock(&_lock);
+
+  if(_rolling) followSensor(pos);
+
+  // Frustum and depth pyramid are shared by all partitions of the frame, sensors other than projective ones are back projected
+  _frustum.init(sensor);
+
+  // Lazily loaded partitions are paged in while pushing, which is done in place
+  _staging = _concurrent && !_file;
+  if(_staging) pthread_rwlock_unlock(&_lock);
+}
+
+void TsdSpace::endPush()
+{
+  if(_staging) pthread_rwlock_wrlock(&_lock);
+
+  commitPartitions();
+  propagateBorders();
+  _staging = false;
+
+  pthread_rwlock_unlock(&_lock);
+}
+
+TsdSpacePartition* TsdSpace::stagePartition(TsdSpacePartition* part)
+{
+  // Shadows are taken from and returned to the pool of recycled partitions, memory is kept between pushes
+  TsdSpacePartition* shadow = acquirePartition(part->getX(), part->getY(), part->getZ());
+  shadow->cloneVoxels(part);
+#pragma omp critical(tsdspace_staged)
+  {
+    _staged.push_back(std::make_pair(part, shadow));
+  }
+  return shadow;
+}
+
+void TsdSpace::commitPartitions()
+{
+  // Shadows take over the previous voxel data, which is kept for the next push
+  for(unsigned int i=0; i<_staged.size(); i++)
+  {
+    _staged[i].first->swapVoxels(_staged[i].second);
+    releasePartition(_staged[i].second);
+  }
+  _staged.clear();
+
+  for(unsigned int i=0; i<_created.size(); i++)
+    _hash->insert(_created[i].first, _created[i].second);
+  _created.clear();
+}
+
+void TsdSpace::fusePartition(Sensor* sensor, obfloat pos[3], TsdSpacePartition* part, const EnumTsdSpaceRange range, int* idx, obfloat* buf,
+                             const TsdFusionFrame* frame)
+{
+  if(_staging) part = stagePartition(part);
+
+  if(range==RANGE_EMPTY)
+    part->increaseEmptiness(_policy);
+  else
+    pushPartition(sensor, pos, part, idx, buf, frame);
+}
+
 void TsdSpace::push(Sensor* sensor)
 {
   Timer timer;
   timer.start();
 
-  double* data = sensor->getRealMeasurementData();
-  bool* mask = sensor->getRealMeasurementMask();
-  unsigned char* rgb = sensor->getRealMeasurementRGB();
+  obfloat tr[3];
+  sensor->getPosition(tr);
+
+  beginPush(sensor, tr);
+
+  if(_storage==STORAGE_HASHED)
+  {
+    pushHashed(sensor, tr);
+  }
+  else
+  {
+    TsdFusionFrame frame;
+    TsdFusionFrame* pFrame = initFusionFrame(sensor, tr, &frame) ? &frame : NULL;
+
+#pragma omp parallel
+    {
+      int* idx = new int[_dimPartition*_dimPartition*_dimPartition];
+      obfloat* buf = new obfloat[2*_dimPartition];
+#pragma omp for schedule(dynamic)
+      for(int pz=0; pz<_partitionsInZ; pz++)
+      {
+        for(int py=0; py<_partitionsInY; py++)
+        {
+          for(int px=0; px<_partitionsInX; px++)
+          {
+            TsdSpacePartition* part = _partitions[pz][py][px];
+            if(_file) pageInVisible(part, tr, sensor);
+            EnumTsdSpaceRange range = part->getRange(tr, sensor, _maxTruncation, &_frustum);
+            if(range==RANGE_OUTSIDE) continue;
+            fusePartition(sensor, tr, part, range, idx, buf, pFrame);
+          }
+        }
+      }
+      delete [] idx;
+      delete [] buf;
+    }
+  }
+
+  endPush();
+
+#if PRINTSTATISTICS
+  LOGMSG(DBG_DEBUG, "Distances pushed: " << _distancesPushed);
+#endif
+
+  LOGMSG(DBG_DEBUG, "Elapsed push: " << timer.elapsed() << "s, Initialized partitions: " << TsdSpacePartition::getInitializedPartitionSize());
+}
+
+void TsdSpace::pushHashed(Sensor* sensor, obfloat pos[3])
+{
+  double* data = sensor->getRealMeasurementData();
+  bool* mask = sensor->getRealMeasurementMask();
+
+  // Only partitions within reach of the farthest valid measurement can receive data. Beams without echo carve free space
+  // up to the maximum range like in dense storage.
+  double range = 0.0;
+  unsigned int size = sensor->getWidth()*sensor->getHeight();
+  for(unsigned int i=0; i<size; i++)
+  {
+    if(!mask[i] || isnan(data[i])) continue;
+    double r = isinf(data[i]) ? sensor->getMaximumRange() : data[i];
+    if(r>range) range = r;
+  }
+  range = min(range, sensor->getMaximumRange()) + _maxTruncation;
+
+  int pMin[3];
+  int pMax[3];
+  int pCnt[3] = {_partitionsInX, _partitionsInY, _partitionsInZ};
+  obfloat origin[3] = {_minX, _minY, _minZ};
+  obfloat partitionSize = _dimPartition * _voxelSize;
+  for(int i=0; i<3; i++)
+  {
+    // Bounds are clamped before conversion, the range is infinite for sensors without maximum range
+    obfloat lower = floor((pos[i]-origin[i]-range) / partitionSize);
+    obfloat upper = floor((pos[i]-origin[i]+range) / partitionSize);
+    pMin[i] = (int)max(min(lower, (obfloat)pCnt[i]), (obfloat)0.0);
+    pMax[i] = (int)min(max(upper, (obfloat)-1.0), (obfloat)(pCnt[i]-1));
+    if(pMin[i]>pMax[i]) return;
+  }
+
+  // Determine candidates serially, since the hash table must not be modified during concurrent lookups
+  vector<unsigned int> keys;
+  vector<unsigned int> emptyKeys;
+  collectCandidates(sensor, pos, pMin, pMax, keys, emptyKeys);
+
+  if(_file)
+  {
+    pageInPartitions(keys);
+    pageInPartitions(emptyKeys);
+  }
+
+  vector<TsdSpacePartition*> candidates;
+  for(unsigned int i=0; i<keys.size(); i++)
+    candidates.push_back(_hash->find(keys[i]));
+
+  // Partitions in empty space are only created by surface data, existing ones take over the emptiness
+  for(unsigned int i=0; i<emptyKeys.size(); i++)
+  {
+    TsdSpacePartition* part = _hash->find(emptyKeys[i]);
+    if(!part) continue;
+    keys.push_back(emptyKeys[i]);
+    candidates.push_back(part);
+  }
+
+  vector<TsdSpacePartition*> created(candidates.size(), (TsdSpacePartition*)NULL);
+
+  TsdFusionFrame frame;
+  TsdFusionFrame* pFrame = initFusionFrame(sensor, pos, &frame) ? &frame : NULL;
+
+#pragma omp parallel
+  {
+    int* idx = new int[_dimPartition*_dimPartition*_dimPartition];
+    obfloat* buf = new obfloat[2*_dimPartition];
+    Matrix edgeCoordsHom(8, 4);
+#pragma omp for schedule(dynamic)
+    for(int i=0; i<(int)candidates.size(); i++)
+    {
+      TsdSpacePartition* part = candidates[i];
+      if(part)
+      {
+        EnumTsdSpaceRange range = part->getRange(pos, sensor, _maxTruncation, &_frustum);
+        if(range==RANGE_OUTSIDE) continue;
+        fusePartition(sensor, pos, part, range, idx, buf, pFrame);
+      }
+      else
+      {
+        unsigned int key = keys[i];
+        unsigned int x = (key % _partitionsInX) * _dimPartition;
+        unsigned int y = ((key / _partitionsInX) % _partitionsInY) * _dimPartition;
+        unsigned int z = (key / (_partitionsInX*_partitionsInY)) * _dimPartition;
+
+        // Test range before instantiation. Emptiness is not tracked for unallocated partitions.
+        obfloat centroid[3];
+        obfloat circumradius;
+        TsdSpacePartition::calcEdgeCoords(x, y, z, _dimPartition, _dimPartition, _dimPartition, _voxelSize, &edgeCoordsHom, centroid, &circumradius, origin);
+        if(TsdSpaceComponent::classifyRange(pos, sensor, _maxTruncation, centroid, circumradius, &edgeCoordsHom, true, &_frustum)!=RANGE_VISIBLE) continue;
+
+        part = acquirePartition(x, y, z);
+        pushPartition(sensor, pos, part, idx, buf, pFrame);
+
+        // Keep partition only if any voxel has been updated
+        if(part->isInitialized())
+          created[i] = part;
+        else
+          releasePartition(part);
+      }
+    }
+    delete [] idx;
+    delete [] buf;
+  }
+
+  // Partitions are inserted with the commit of the push
+  for(unsigned int i=0; i<created.size(); i++)
+  {
+    if(created[i]) _created.push_back(std::make_pair(keys[i], created[i]));
+  }
+}
+
+void TsdSpace::collectCandidates(Sensor* sensor, obfloat pos[3], const int pMin[3], const int pMax[3], vector<unsigned int> &keys, vector<unsigned int> &emptyKeys)
+{
+  const obfloat origin[3] = {_minX, _minY, _minZ};
+  const obfloat partitionSize = _dimPartition * _voxelSize;
+  const obfloat circumradius = sqrt(3.0) * 0.5 * partitionSize;
+  Matrix edgeCoordsHom(8, 4);
+
+  // Blocks of partitions (x, y, z ranges, inclusive) are subdivided like an octree, until they are culled, known to be empty or
+  // reduced to single partitions. Culling is conservative, i.e., it drops only partitions, which would be classified as outside.
+  vector<int> blocks(pMin, pMin+3);
+  blocks.insert(blocks.end(), pMax, pMax+3);
+  while(!blocks.empty())
+  {
+    int bMin[3];
+    int bMax[3];
+    for(int i=2; i>=0; i--)
+    {
+      bMax[i] = blocks.back(); blocks.pop_back();
+    }
+    for(int i=2; i>=0; i--)
+    {
+      bMin[i] = blocks.back(); blocks.pop_back();
+    }
+
+    // Distance bounds of all partitions in block, derived from the box spanned by their centroids
+    obfloat dMin = 0.0;
+    obfloat dMax = 0.0;
+    for(int i=0; i<3; i++)
+    {
+      const obfloat lower = origin[i] + ((obfloat)bMin[i] + 0.5) * partitionSize - pos[i];
+      const obfloat upper = origin[i] + ((obfloat)bMax[i] + 0.5) * partitionSize - pos[i];
+      const obfloat closest = (lower>0.0) ? lower : ((upper<0.0) ? -upper : 0.0);
+      const obfloat farthest = max(fabs(lower), fabs(upper));
+      dMin += closest*closest;
+      dMax += farthest*farthest;
+    }
+    const obfloat minDist = sqrt(dMin) - circumradius - _maxTruncation;
+    const obfloat maxDist = sqrt(dMax) + circumradius + _maxTruncation;
+    if(minDist > sensor->getMaximumRange() || maxDist < sensor->getMinimumRange()) continue;
+
+    const bool isLeaf = (bMin[0]==bMax[0] && bMin[1]==bMax[1] && bMin[2]==bMax[2]);
+    EnumTsdSpaceRange range = RANGE_VISIBLE;
+    if(!isLeaf && _frustum.isValid())
+    {
+      obfloat centroid[3];
+      obfloat radius;
+      TsdSpacePartition::calcEdgeCoords(bMin[0]*_dimPartition, bMin[1]*_dimPartition, bMin[2]*_dimPartition,
+                                        (bMax[0]-bMin[0]+1)*_dimPartition, (bMax[1]-bMin[1]+1)*_dimPartition, (bMax[2]-bMin[2]+1)*_dimPartition,
+                                        _voxelSize, &edgeCoordsHom, centroid, &radius, origin);
+      range = _frustum.classifyBox(&edgeCoordsHom, minDist, maxDist);
+      if(range==RANGE_OUTSIDE) continue;
+    }
+
+    // Without frustum, e.g., for non-projective sensors, blocks are enumerated completely
+    if(isLeaf || range==RANGE_EMPTY || !_frustum.isValid())
+    {
+      vector<unsigned int>& target = (range==RANGE_EMPTY) ? emptyKeys : keys;
+      for(int pz=bMin[2]; pz<=bMax[2]; pz++)
+        for(int py=bMin[1]; py<=bMax[1]; py++)
+          for(int px=bMin[0]; px<=bMax[0]; px++)
+            target.push_back((pz*_partitionsInY+py)*_partitionsInX+px);
+      continue;
+    }
+
+    // Split each dimension of more than one partition in halves
+    int split[3][3];
+    int parts[3];
+    for(int i=0; i<3; i++)
+    {
+      const int mid = (bMin[i]+bMax[i]) / 2;
+      split[i][0] = bMin[i];
+      split[i][1] = mid;
+      split[i][2] = bMax[i];
+      parts[i] = (bMin[i]<bMax[i]) ? 2 : 1;
+    }
+    for(int iz=0; iz<parts[2]; iz++)
+    {
+      for(int iy=0; iy<parts[1]; iy++)
+      {
+        for(int ix=0; ix<parts[0]; ix++)
+        {
+          const int idx[3] = {ix, iy, iz};
+          for(int i=0; i<3; i++)
+            blocks.push_back(parts[i]==1 ? split[i][0] : (idx[i]==0 ? split[i][0] : split[i][1]+1));
+          for(int i=0; i<3; i++)
+            blocks.push_back(parts[i]==1 ? split[i][2] : (idx[i]==0 ? split[i][1] : split[i][2]));
+        }
+      }
+    }
+  }
+}
+
+bool TsdSpace::initFusionFrame(Sensor* sensor, obfloat pos[3], TsdFusionFrame* frame)
+{
+  SensorProjective3D* projective = dynamic_cast<SensorProjective3D*>(sensor);
+  if(!projective) return false;
+
+  projective->getProjectionMatrix(frame->P);
+  frame->pos[0] = pos[0];
+  frame->pos[1] = pos[1];
+  frame->pos[2] = pos[2];
+  frame->data = sensor->getRealMeasurementData();
+  frame->mask = sensor->getRealMeasurementMask();
+  frame->rgb = sensor->getRealMeasurementRGB();
+  frame->width = sensor->getWidth();
+  frame->height = sensor->getHeight();
+  frame->maxTruncation = _maxTruncation;
+  return true;
+}
+
+void TsdSpace::pushPartition(Sensor* sensor, obfloat pos[3], TsdSpacePartition* part, int* idx, obfloat* buf, const TsdFusionFrame* frame)
+{
+  obfloat t[3];
+  part->getCellCoordsOffset(t);
+
+  // Choose resolution by distance of the closest point of the partition. Distant partitions are created coarse,
+  // partitions are refined when the sensor approaches, but never coarsened in order to preserve details.
+  unsigned int level = 0;
+  if(_lodDistance > 0.0)
+  {
+    obfloat minDist = euklideanDistance<obfloat>(pos, part->getCentroid(), 3) - part->getCircumradius();
+    if(minDist >= 2.0*_lodDistance)  level = 2;
+    else if(minDist >= _lodDistance) level = 1;
+  }
+  if(!part->isInitialized() || level < part->getLevel())
+    part->setLevel(level);
+  level = part->getLevel();
+  const obfloat voxelSize = _voxelSize * (obfloat)(1 << level);
+  const unsigned int width = part->getLevelWidth();
+
+  // The truncation radius grows with the voxel size, otherwise coarse voxels miss the band behind surfaces
+  const obfloat maxTruncation = _maxTruncation * (obfloat)(1 << level);
+
+  if(frame)
+  {
+    TsdFusionFrame levelFrame = *frame;
+    levelFrame.maxTruncation = maxTruncation;
+
+    // Row-wise vectorized fusion, idx and buf are used as row buffers, the second half of buf takes the weights of measurements
+    obfloat* weights = _policy.isConstant() ? NULL : &buf[width];
+    obfloat crd[3];
+    crd[0] = t[0];
+    for(unsigned int z=0; z<part->getLevelDepth(); z++)
+    {
+      crd[2] = ((obfloat)z + 0.5) * voxelSize + t[2];
+      for(unsigned int y=0; y<part->getLevelHeight(); y++)
+      {
+        crd[1] = ((obfloat)y + 0.5) * voxelSize + t[1];
+        unsigned int cnt = TsdFusionKernel::projectRow(levelFrame, crd, voxelSize, width, idx, buf);
+        if(cnt==0) continue;
+        if(weights) _policy.weightRow(idx, buf, frame->data, width, weights);
+        part->addTsdRow(y, z, idx, buf, frame->rgb, weights, _policy);
+
+#if PRINTSTATISTICS
+#pragma omp critical
+        {
+          _distancesPushed += cnt;
+        }
+#endif
+      }
+    }
+    return;
+  }
+
+  double* data = sensor->getRealMeasurementData();
+  bool* mask = sensor->getRealMeasurementMask();
+  unsigned char* rgb = sensor->getRealMeasurementRGB();
+
+  Matrix* partCoords = TsdSpacePartition::getPartitionCoords(level);
+  Matrix* cellCoordsHom = TsdSpacePartition::getCellCoordsHom(level);
+  unsigned int partSize = part->getLevelSize();
+
+  Matrix T = MatrixFactory::TranslationMatrix44(t[0], t[1], t[2]);
+  sensor->backProject(cellCoordsHom, idx, &T);
+
+  for(unsigned int c=0; c<partSize; c++)
+  {
+    // Measurement index
+    int index = idx[c];
+
+    if(index>=0)
+    {
+      if(mask[index])
+      {
+        // calculate distance of current cell to sensor
+        obfloat crd[3];
+        crd[0] = (*cellCoordsHom)(c,0) + t[0];
+        crd[1] = (*cellCoordsHom)(c,1) + t[1];
+        crd[2] = (*cellCoordsHom)(c,2) + t[2];
+        obfloat distance = euklideanDistance<obfloat>(pos, crd, 3);
+        obfloat sd = data[index] - distance;
+
+        unsigned char* color = NULL;
+        if(rgb) color = &(rgb[3*index]);
+        if(sd >= -maxTruncation)
+        {
+          part->init();
+          part->addTsd((*partCoords)(c, 0), (*partCoords)(c, 1), (*partCoords)(c, 2), sd, maxTruncation, color, data[index], _policy);
+
+#if PRINTSTATISTICS
+#pragma omp critical
+          {
+            _distancesPushed++;
+          }
+#endif
+        }
+      }
+    }
+  }
+}
+
+void TsdSpace::pushTree(Sensor* sensor)
+{
+  if(!_tree)
+  {
+    // Hashed storage provides no octree
+    push(sensor);
+    return;
+  }
+
+  Timer timer;
+  timer.start();
+
+  obfloat tr[3];
+  sensor->getPosition(tr);
+
+  beginPush(sensor, tr);
+
+  TsdSpaceComponent* comp = _tree;
+  vector<TsdSpacePartition*> partitionsToCheck;
+  vector<TsdSpacePartition*> partitionsEmpty;
+  pushRecursion(sensor, tr, comp, partitionsToCheck, partitionsEmpty);
+
+  LOGMSG(DBG_DEBUG, "Partitions to check: " << partitionsToCheck.size());
+
+  const int cntVisible = partitionsToCheck.size();
+  const int cnt = cntVisible + partitionsEmpty.size();
+
+  TsdFusionFrame frame;
+  TsdFusionFrame* pFrame = initFusionFrame(sensor, tr, &frame) ? &frame : NULL;
+
+#pragma omp parallel
+  {
+    int* idx = new int[_dimPartition*_dimPartition*_dimPartition];
+    obfloat* buf = new obfloat[2*_dimPartition];
+#pragma omp for schedule(dynamic)
+    for(int i=0; i<cnt; i++)
+    {
+      if(i<cntVisible)
+        fusePartition(sensor, tr, partitionsToCheck[i], RANGE_VISIBLE, idx, buf, pFrame);
+      else
+        fusePartition(sensor, tr, partitionsEmpty[i-cntVisible], RANGE_EMPTY, idx, buf, pFrame);
+    }
+    delete [] idx;
+    delete [] buf;
+  }
+
+  endPush();
+
+#if PRINTSTATISTICS
+  LOGMSG(DBG_DEBUG, "Distances pushed: " << _distancesPushed);
+#endif
+
+  LOGMSG(DBG_DEBUG, "Elapsed push: " << timer.elapsed() << "s, Initialized partitions: " << TsdSpacePartition::getInitializedPartitionSize());
+}
+
+void TsdSpace::pushRecursion(Sensor* sensor, obfloat pos[3], TsdSpaceComponent* comp, vector<TsdSpacePartition*> &partitionsToCheck,
+                             vector<TsdSpacePartition*> &partitionsEmpty)
+{
+  if(_file && comp->isLeaf()) pageInVisible((TsdSpacePartition*)comp, pos, sensor);
+
+  // Branches are classified by distance only, i.e., only leafs can be empty
+  EnumTsdSpaceRange range = comp->getRange(pos, sensor, _maxTruncation, &_frustum);
+  if(range==RANGE_EMPTY)
+  {
+    partitionsEmpty.push_back((TsdSpacePartition*)comp);
+  }
+  else if(range==RANGE_VISIBLE)
+  {
+    if(comp->isLeaf())
+      partitionsToCheck.push_back((TsdSpacePartition*)comp);
+    else
+    {
+      vector<TsdSpaceComponent*> children = ((TsdSpaceBranch*)comp)->getChildren();
+      for(unsigned int i=0; i<children.size(); i++)
+        pushRecursion(sensor, pos, children[i], partitionsToCheck, partitionsEmpty);
+    }
+  }
+}
+
+TsdSpacePartition* TsdSpace::acquirePartition(const unsigned int x, const unsigned int y, const unsigned int z)
+{
+  TsdSpacePartition* part = NULL;
+  obfloat origin[3] = {_minX, _minY, _minZ};
+
+#pragma omp critical(tsdspace_recycled)
+  {
+    if(!_recycled.empty())
+    {
+      part = _recycled.back();
+      _recycled.pop_back();
+    }
+  }
+
+  if(part)
+    part->relocate(x, y, z, origin);
+  else
+    part = new TsdSpacePartition(x, y, z, _dimPartition, _dimPartition, _dimPartition, _voxelSize, origin, _voxelLayout);
+
+  return part;
+}
+
+void TsdSpace::releasePartition(TsdSpacePartition* part)
+{
+  part->recycle();
+#pragma omp critical(tsdspace_recycled)
+  {
+    _recycled.push_back(part);
+  }
+}
+
+void TsdSpace::setRollingWindow(const bool enable, const unsigned int threshold)
+{
+  _rolling = enable;
+  _rollingThreshold = threshold;
+}
+
+void TsdSpace::setEvictionStore(const char* path)
+{
+  if(path)
+    _storePath = path;
+  else
+    _storePath.clear();
+}
+
+void TsdSpace::getWindowIndex(int idx[3]) const
+{
+  idx[0] = _windowIndex[0];
+  idx[1] = _windowIndex[1];
+  idx[2] = _windowIndex[2];
+}
+
+void TsdSpace::followSensor(obfloat pos[3])
+{
+  obfloat partitionSize = _dimPartition * _voxelSize;
+
+  // Displacement of sensor from central partition
+  int d[3];
+  d[0] = (int)floor((pos[0]-_minX) / partitionSize) - _partitionsInX/2;
+  d[1] = (int)floor((pos[1]-_minY) / partitionSize) - _partitionsInY/2;
+  d[2] = (int)floor((pos[2]-_minZ) / partitionSize) - _partitionsInZ/2;
+
+  for(int i=0; i<3; i++)
+    if(abs(d[i]) <= (int)_rollingThreshold) d[i] = 0;
+
+  shiftWindow(d[0], d[1], d[2]);
+}
+
+void TsdSpace::shiftWindow(const int dx, const int dy, const int dz)
+{
+  if(dx==0 && dy==0 && dz==0) return;
+
+  // Partitions are moved, blocks are refreshed with the next push
+  _surfaceBlocksValid = false;
+
+  Timer timer;
+  timer.start();
+
+  int d[3] = {dx, dy, dz};
+  int pCnt[3] = {_partitionsInX, _partitionsInY, _partitionsInZ};
+
+  // Partitions of a lazily loaded file are paged in before leaving the space
+  if(_file)
+  {
+    vector<unsigned int> pending;
+    getPendingKeys(pending);
+    vector<unsigned int> keys;
+    for(unsigned int i=0; i<pending.size(); i++)
+    {
+      int px = pending[i] % _partitionsInX;
+      int py = (pending[i] / _partitionsInX) % _partitionsInY;
+      int pz = pending[i] / (_partitionsInX*_partitionsInY);
+      if(px-dx>=0 && px-dx<_partitionsInX && py-dy>=0 && py-dy<_partitionsInY && pz-dz>=0 && pz-dz<_partitionsInZ) continue;
+      keys.push_back(pending[i]);
+    }
+    pageInPartitions(keys);
+  }
+
+  vector<TsdSpacePartition*> partitions;
+  getAllocatedPartitions(partitions);
+
+  // Separate partitions remaining in space from leaving ones
+  vector<TsdSpacePartition*> remaining;
+  vector<TsdSpacePartition*> evicted;
+  unsigned int stored = 0;
+  for(unsigned int i=0; i<partitions.size(); i++)
+  {
+    TsdSpacePartition* part = partitions[i];
+    int p[3];
+    p[0] = part->getX() / _dimPartition;
+    p[1] = part->getY() / _dimPartition;
+    p[2] = part->getZ() / _dimPartition;
+
+    bool inside = true;
+    for(int j=0; j<3; j++)
+      inside = inside && (p[j]-d[j]>=0) && (p[j]-d[j]<pCnt[j]);
+
+    if(inside)
+    {
+      remaining.push_back(part);
+    }
+    else
+    {
+      if(!_storePath.empty() && part->isInitialized())
+      {
+        storePartition(part, p[0]+_windowIndex[0], p[1]+_windowIndex[1], p[2]+_windowIndex[2]);
+        stored++;
+      }
+      part->recycle();
+      evicted.push_back(part);
+    }
+  }
 
-  obfloat tr[3];
-  sensor->getPosition(tr);
+  // Move origin of space
+  obfloat partitionSize = _dimPartition * _voxelSize;
+  for(int j=0; j<3; j++)
+    _windowIndex[j] += d[j];
+  _minX = ((obfloat)_windowIndex[0]) * partitionSize;
+  _minY = ((obfloat)_windowIndex[1]) * partitionSize;
+  _minZ = ((obfloat)_windowIndex[2]) * partitionSize;
+  _maxX = _minX + ((obfloat)_cellsX + 0.5) * _voxelSize;
+  _maxY = _minY + ((obfloat)_cellsY + 0.5) * _voxelSize;
+  _maxZ = _minZ + ((obfloat)_cellsZ + 0.5) * _voxelSize;
+  obfloat origin[3] = {_minX, _minY, _minZ};
+
+  // Remaining partitions keep their position in world coordinates, but get new indices
+  for(unsigned int i=0; i<remaining.size(); i++)
+  {
+    TsdSpacePartition* part = remaining[i];
+    part->relocate(part->getX()-dx*_dimPartition, part->getY()-dy*_dimPartition, part->getZ()-dz*_dimPartition, origin);
+  }
 
-  Matrix* partCoords = TsdSpacePartition::getPartitionCoords();
-  Matrix* cellCoordsHom = TsdSpacePartition::getCellCoordsHom();
+  unsigned int restored = 0;
+  if(_storage==STORAGE_HASHED)
+  {
+    _hash->clear();
+    for(unsigned int i=0; i<remaining.size(); i++)
+    {
+      TsdSpacePartition* part = remaining[i];
+      _hash->insert(((part->getZ()/_dimPartition)*_partitionsInY+part->getY()/_dimPartition)*_partitionsInX+part->getX()/_dimPartition, part);
+    }
+    for(unsigned int i=0; i<evicted.size(); i++)
+      _recycled.push_back(evicted[i]);
 
-#pragma omp parallel
+    // Restore stored partitions entering the space
+    vector<StoreIndex> entering;
+    for(std::set<StoreIndex>::iterator it=_stored.begin(); it!=_stored.end(); ++it)
+    {
+      int px = it->x - _windowIndex[0];
+      int py = it->y - _windowIndex[1];
+      int pz = it->z - _windowIndex[2];
+      if(px>=0 && px<_partitionsInX && py>=0 && py<_partitionsInY && pz>=0 && pz<_partitionsInZ)
+        entering.push_back(*it);
+    }
+    for(unsigned int i=0; i<entering.size(); i++)
+    {
+      int px = entering[i].x - _windowIndex[0];
+      int py = entering[i].y - _windowIndex[1];
+      int pz = entering[i].z - _windowIndex[2];
+      TsdSpacePartition* part = acquirePartition(px*_dimPartition, py*_dimPartition, pz*_dimPartition);
+      if(restorePartition(part, entering[i].x, entering[i].y, entering[i].z))
+      {
+        _hash->insert((pz*_partitionsInY+py)*_partitionsInX+px, part);
+        restored++;
+      }
+      else
+        releasePartition(part);
+    }
+  }
+  else
   {
-    unsigned int partSize = (_partitions[0][0][0])->getSize();
-    int* idx = new int[partSize];
-#pragma omp for schedule(dynamic)
+    for(int pz=0; pz<_partitionsInZ; pz++)
+      for(int py=0; py<_partitionsInY; py++)
+        for(int px=0; px<_partitionsInX; px++)
+          _partitions[pz][py][px] = NULL;
+
+    for(unsigned int i=0; i<remaining.size(); i++)
+    {
+      TsdSpacePartition* part = remaining[i];
+      _partitions[part->getZ()/_dimPartition][part->getY()/_dimPartition][part->getX()/_dimPartition] = part;
+    }
+
+    // Recycle evicted partitions for vacant slots, number of both is equal
+    unsigned int e = 0;
     for(int pz=0; pz<_partitionsInZ; pz++)
     {
       for(int py=0; py<_partitionsInY; py++)
       {
         for(int px=0; px<_partitionsInX; px++)
         {
-          TsdSpacePartition* part = _partitions[pz][py][px];
-          if(!part->isInRange(tr, sensor, _maxTruncation)) continue;
-
-          obfloat t[3];
-          part->getCellCoordsOffset(t);
-          Matrix T = MatrixFactory::TranslationMatrix44(t[0], t[1], t[2]);
-          sensor->backProject(cellCoordsHom, idx, &T);
-
-          for(unsigned int c=0; c<partSize; c++)
-          {
-            // Measurement index
-            int index = idx[c];
-
-            if(index>=0)
-            {
-              if(mask[index])
-              {
-                // calculate distance of current cell to sensor
-                obfloat crd[3];
-                crd[0] = (*cellCoordsHom)(c,0) + t[0];
-                crd[1] = (*cellCoordsHom)(c,1) + t[1];
-                crd[2] = (*cellCoordsHom)(c,2) + t[2];
-                obfloat distance = euklideanDistance<obfloat>(tr, crd, 3);
-                obfloat sd = data[index] - distance;
-
-                // Test with distance-related weighting
-                /*double weight = 1.0 - (10.0 - distance);
-              weight = max(weight, 0.1);*/
-
-                unsigned char* color = NULL;
-                if(rgb) color = &(rgb[3*index]);
-                if(sd >= -_maxTruncation)
-                {
-                  part->init();
-                  part->addTsd((*partCoords)(c, 0), (*partCoords)(c, 1), (*partCoords)(c, 2), sd, _maxTruncation, color);
-
-#if PRINTSTATISTICS
-#pragma omp critical
-                  {
-                    _distancesPushed++;
-                  }
-#endif
-                }
-              }
-            }
-          }
+          if(_partitions[pz][py][px]) continue;
+          TsdSpacePartition* part = evicted[e++];
+          part->relocate(px*_dimPartition, py*_dimPartition, pz*_dimPartition, origin);
+          _partitions[pz][py][px] = part;
+          if(!_stored.empty() && restorePartition(part, px+_windowIndex[0], py+_windowIndex[1], pz+_windowIndex[2]))
+            restored++;
         }
       }
     }
-    delete [] idx;
-  }
 
-  propagateBorders();
+    buildTree();
+  }
 
-#if PRINTSTATISTICS
-  LOGMSG(DBG_DEBUG, "Distances pushed: " << _distancesPushed);
-#endif
+  LOGMSG(DBG_DEBUG, "Shifted space by (" << dx << ", " << dy << ", " << dz << ") partitions in " << timer.elapsed() << "s, evicted: "
+      << evicted.size() << ", stored: " << stored << ", restored: " << restored);
+}
 
-  LOGMSG(DBG_DEBUG, "Elapsed push: " << timer.elapsed() << "s, Initialized partitions: " << TsdSpacePartition::getInitializedPartitionSize());
+std::string TsdSpace::getStoreFilename(const int gx, const int gy, const int gz) const
+{
+  std::stringstream s;
+  s << _storePath << "/partition_" << gx << "_" << gy << "_" << gz << ".tsd";
+  return s.str();
 }
 
-void TsdSpace::pushTree(Sensor* sensor)
+void TsdSpace::storePartition(TsdSpacePartition* part, const int gx, const int gy, const int gz)
 {
-  Timer timer;
-  timer.start();
+  std::string filename = getStoreFilename(gx, gy, gz);
 
-  double* data = sensor->getRealMeasurementData();
-  bool* mask = sensor->getRealMeasurementMask();
-  unsigned char* rgb = sensor->getRealMeasurementRGB();
+  // Partitions are stored as binary files with a single chunk
+  TsdSpaceFileHeader header;
+  getFileHeader(&header);
+  TsdSpaceFileWriter writer;
+  if(!writer.open(filename.c_str(), header))
+  {
+    LOGMSG(DBG_ERROR, "Could not store partition in " << filename);
+    return;
+  }
 
-  obfloat tr[3];
-  sensor->getPosition(tr);
+  vector<unsigned char> buf;
+  part->serialize(buf);
+  TsdSpaceChunk chunk;
+  memset(&chunk, 0, sizeof(chunk));
+  chunk.index[0] = gx;
+  chunk.index[1] = gy;
+  chunk.index[2] = gz;
+  chunk.flags = (part->isInitialized() ? CHUNK_INITIALIZED : 0) | (part->hasColor() ? CHUNK_COLOR : 0)
+                | (part->getLevel() << TSDSPACEFILE_LEVELSHIFT);
+  chunk.initWeight = part->getInitWeight();
+  chunk.size = buf.size();
+  writer.write(chunk, buf.empty() ? NULL : &buf[0]);
+  if(!writer.close())
+  {
+    LOGMSG(DBG_ERROR, "Could not store partition in " << filename);
+    return;
+  }
 
-  TsdSpaceComponent* comp = _tree;
-  vector<TsdSpacePartition*> partitionsToCheck;
-  pushRecursion(sensor, tr, comp, partitionsToCheck);
+  StoreIndex idx;
+  idx.x = gx;
+  idx.y = gy;
+  idx.z = gz;
+  _stored.insert(idx);
+}
 
-  LOGMSG(DBG_DEBUG, "Partitions to check: " << partitionsToCheck.size());
+bool TsdSpace::restorePartition(TsdSpacePartition* part, const int gx, const int gy, const int gz)
+{
+  StoreIndex idx;
+  idx.x = gx;
+  idx.y = gy;
+  idx.z = gz;
+  if(_stored.find(idx)==_stored.end()) return false;
+  _stored.erase(idx);
+
+  std::string filename = getStoreFilename(gx, gy, gz);
+  TsdSpaceFile file;
+  if(!file.open(filename.c_str()) || file.getChunkCount()!=1)
+  {
+    LOGMSG(DBG_ERROR, "Could not restore partition from " << filename);
+    return false;
+  }
+  bool success = decodeChunk(&file, 0, part);
+  remove(filename.c_str());
+
+  return success;
+}
 
-  Matrix* partCoords = TsdSpacePartition::getPartitionCoords();
-  Matrix* cellCoordsHom = TsdSpacePartition::getCellCoordsHom();
+void TsdSpace::getFileHeader(TsdSpaceFileHeader* header) const
+{
+  memset(header, 0, sizeof(*header));
+  header->voxelLayout = _voxelLayout;
+  header->voxelSize = _voxelSize;
+  header->maxTruncation = _maxTruncation;
+  header->layoutPartition = _layoutPartition;
+  header->layoutSpace = _layoutSpace;
+  for(int i=0; i<3; i++)
+    header->window[i] = _windowIndex[i];
+}
 
-#pragma omp parallel
+bool TsdSpace::decodeChunk(TsdSpaceFile* file, const unsigned int chunk, TsdSpacePartition* part)
+{
+  const TsdSpaceChunk& c = file->getChunk(chunk);
+  file->setPaged(chunk);
+  _surfaceBlocksValid = false;
+
+  if(!file->verifyChunk(chunk))
   {
-    unsigned int partSize = (_partitions[0][0][0])->getSize();
-    int* idx = new int[partSize];
-#pragma omp for schedule(dynamic)
-    for(unsigned int i=0; i<partitionsToCheck.size(); i++)
-    {
-      TsdSpacePartition* part = partitionsToCheck[i];
+    LOGMSG(DBG_ERROR, "Checksum mismatch of partition (" << c.index[0] << ", " << c.index[1] << ", " << c.index[2] << ")");
+    return false;
+  }
 
-      obfloat t[3];
-      part->getCellCoordsOffset(t);
-      Matrix T = MatrixFactory::TranslationMatrix44(t[0], t[1], t[2]);
-      sensor->backProject(cellCoordsHom, idx, &T);
+  part->setInitWeight(c.initWeight);
+  if(!(c.flags & CHUNK_INITIALIZED)) return true;
 
-      for(unsigned int c=0; c<partSize; c++)
-      {
-        // Measurement index
-        int index = idx[c];
+  const unsigned int level = c.flags >> TSDSPACEFILE_LEVELSHIFT;
+  if(level > part->getMaxLevel())
+  {
+    LOGMSG(DBG_ERROR, "Invalid level " << level << " of partition (" << c.index[0] << ", " << c.index[1] << ", " << c.index[2] << ")");
+    return false;
+  }
+  part->setLevel(level);
 
-        if(index>=0)
-        {
-          if(mask[index])
-          {
-            // calculate distance of current cell to sensor
-            obfloat crd[3];
-            crd[0] = (*cellCoordsHom)(c,0) + t[0];
-            crd[1] = (*cellCoordsHom)(c,1) + t[1];
-            crd[2] = (*cellCoordsHom)(c,2) + t[2];
-            obfloat distance = euklideanDistance<obfloat>(tr, crd, 3);
-            obfloat sd = data[index] - distance;
-
-            // Test with distance-related weighting
-            /*double weight = 1.0 - (10.0 - distance);
-          weight = max(weight, 0.1);*/
-
-            unsigned char* color = NULL;
-            if(rgb) color = &(rgb[3*index]);
-            if(sd >= -_maxTruncation)
-            {
-              part->init();
-              part->addTsd((*partCoords)(c, 0), (*partCoords)(c, 1), (*partCoords)(c, 2), sd, _maxTruncation, color);
+  if(!part->load(file->getChunkData(chunk), c.size, (c.flags & CHUNK_COLOR)!=0))
+  {
+    LOGMSG(DBG_ERROR, "Corrupted data of partition (" << c.index[0] << ", " << c.index[1] << ", " << c.index[2] << ")");
+    part->recycle();
+    return false;
+  }
+  return true;
+}
 
-#if PRINTSTATISTICS
-#pragma omp critical
-              {
-                _distancesPushed++;
-              }
-#endif
+void TsdSpace::pageInPartitions(const vector<unsigned int> &keys)
+{
+  if(!_file) return;
 
-            }
-          }
-        }
-      }
+  // Instantiation is serial, since the hash table must not be modified during concurrent access
+  vector<TsdSpacePartition*> parts;
+  vector<unsigned int> chunks;
+  for(unsigned int i=0; i<keys.size(); i++)
+  {
+    int px = keys[i] % _partitionsInX;
+    int py = (keys[i] / _partitionsInX) % _partitionsInY;
+    int pz = keys[i] / (_partitionsInX*_partitionsInY);
+    int c = _file->findPendingChunk(px+_windowIndex[0], py+_windowIndex[1], pz+_windowIndex[2]);
+    if(c<0) continue;
+
+    TsdSpacePartition* part = getPartition(px, py, pz);
+    if(!part)
+    {
+      part = acquirePartition(px*_dimPartition, py*_dimPartition, pz*_dimPartition);
+      _hash->insert(keys[i], part);
     }
-    delete [] idx;
+    parts.push_back(part);
+    chunks.push_back(c);
   }
 
-  propagateBorders();
+#pragma omp parallel for schedule(dynamic)
+  for(int i=0; i<(int)parts.size(); i++)
+    decodeChunk(_file, chunks[i], parts[i]);
+}
 
-#if PRINTSTATISTICS
-  LOGMSG(DBG_DEBUG, "Distances pushed: " << _distancesPushed);
-#endif
+void TsdSpace::getPendingKeys(vector<unsigned int> &keys) const
+{
+  if(!_file) return;
 
-  LOGMSG(DBG_DEBUG, "Elapsed push: " << timer.elapsed() << "s, Initialized partitions: " << TsdSpacePartition::getInitializedPartitionSize());
+  // Keys are taken from the index table, since large hashed spaces contain far more partitions than chunks
+  for(unsigned int i=0; i<_file->getChunkCount(); i++)
+  {
+    const int32_t* index = _file->getChunk(i).index;
+    int p[3];
+    for(int j=0; j<3; j++)
+      p[j] = index[j] - _windowIndex[j];
+    if(p[0]<0 || p[1]<0 || p[2]<0 || p[0]>=_partitionsInX || p[1]>=_partitionsInY || p[2]>=_partitionsInZ) continue;
+    if(_file->findPendingChunk(index[0], index[1], index[2])<0) continue;
+    keys.push_back((p[2]*_partitionsInY+p[1])*_partitionsInX+p[0]);
+  }
+}
+
+void TsdSpace::pageInVisible(TsdSpacePartition* part, obfloat pos[3], Sensor* sensor)
+{
+  int c = _file->findPendingChunk(part->getX()/_dimPartition+_windowIndex[0], part->getY()/_dimPartition+_windowIndex[1], part->getZ()/_dimPartition+_windowIndex[2]);
+  if(c<0) return;
+
+  // Partitions out of sight are kept on disk
+  if(TsdSpaceComponent::classifyRange(pos, sensor, _maxTruncation, part->getCentroid(), part->getCircumradius(), part->getEdgeCoordsHom(), true, &_frustum)==RANGE_OUTSIDE) return;
+
+  decodeChunk(_file, c, part);
 }
 
-void TsdSpace::pushRecursion(Sensor* sensor, obfloat pos[3], TsdSpaceComponent* comp, vector<TsdSpacePartition*> &partitionsToCheck)
+void TsdSpace::pageIn(const obfloat coordMin[3], const obfloat coordMax[3])
 {
-  if(comp->isInRange(pos, sensor, _maxTruncation))
+  if(!_file) return;
+
+  pthread_rwlock_wrlock(&_lock);
+
+  obfloat origin[3] = {_minX, _minY, _minZ};
+  int pCnt[3] = {_partitionsInX, _partitionsInY, _partitionsInZ};
+  obfloat partitionSize = _dimPartition * _voxelSize;
+  int pMin[3];
+  int pMax[3];
+  for(int i=0; i<3; i++)
   {
-    if(comp->isLeaf())
-      partitionsToCheck.push_back((TsdSpacePartition*)comp);
-    else
+    pMin[i] = max((int)floor((coordMin[i]-origin[i]) / partitionSize), 0);
+    pMax[i] = min((int)floor((coordMax[i]-origin[i]) / partitionSize), pCnt[i]-1);
+    if(pMin[i]>pMax[i])
     {
-      vector<TsdSpaceComponent*> children = ((TsdSpaceBranch*)comp)->getChildren();
-      for(unsigned int i=0; i<children.size(); i++)
-        pushRecursion(sensor, pos, children[i], partitionsToCheck);
+      pthread_rwlock_unlock(&_lock);
+      return;
     }
   }
+
+  vector<unsigned int> keys;
+  for(int pz=pMin[2]; pz<=pMax[2]; pz++)
+    for(int py=pMin[1]; py<=pMax[1]; py++)
+      for(int px=pMin[0]; px<=pMax[0]; px++)
+        keys.push_back((pz*_partitionsInY+py)*_partitionsInX+px);
+  pageInPartitions(keys);
+  updateSurfaceBlocks();
+
+  pthread_rwlock_unlock(&_lock);
 }
 
-void TsdSpace::propagateBorders()
+unsigned int TsdSpace::getPendingPartitions() const
 {
-  unsigned int width  = _partitions[0][0][0]->getWidth();
-  unsigned int height = _partitions[0][0][0]->getHeight();
-  unsigned int depth = _partitions[0][0][0]->getDepth();
+  if(!_file) return 0;
+  return _file->getPendingChunkCount();
+}
 
-  // Copy valid tsd values of neighbors to borders of each partition.
-  for(int pz=0; pz<_partitionsInZ; pz++)
-  {
-    for(int py=0; py<_partitionsInY; py++)
-    {
-      for(int px=0; px<_partitionsInX; px++)
-      {
-        TsdSpacePartition* partCur       = _partitions[pz][py][px];
+void TsdSpace::propagateBorders()
+{
+  // Offsets of neighbors covering the border layer: faces, edges and corner
+  static const unsigned int offsets[7][3] = {{1,0,0}, {0,1,0}, {0,0,1}, {1,0,1}, {1,1,0}, {0,1,1}, {1,1,1}};
 
-        if(!partCur->isInitialized()) continue;
+  // Borders are propagated once per push
+  _pushes++;
 
-        if(px<_partitionsInX-1)
-        {
-          TsdSpacePartition* partRight      = _partitions[pz][py][px+1];
-          if(partRight->isInitialized())
-          {
-            for(unsigned int d=0; d<depth; d++)
-            {
-              for(unsigned int h=0; h<height; h++)
-              {
-                partCur->_space[d][h][width].tsd = partRight->_space[d][h][0].tsd;
-                partCur->_space[d][h][width].weight = partRight->_space[d][h][0].weight;
-                partCur->_space[d][h][width].rgb[0] = partRight->_space[d][h][0].rgb[0];
-                partCur->_space[d][h][width].rgb[1] = partRight->_space[d][h][0].rgb[1];
-                partCur->_space[d][h][width].rgb[2] = partRight->_space[d][h][0].rgb[2];
-              }
-            }
-          }
-        }
+  vector<TsdSpacePartition*> partitions;
+  getAllocatedPartitions(partitions);
 
-        if(py<_partitionsInY-1)
-        {
-          TsdSpacePartition* partUp      = _partitions[pz][py+1][px];
-          if(partUp->isInitialized())
-          {
-            for(unsigned int d=0; d<depth; d++)
-            {
-              for(unsigned int w=0; w<width; w++)
-              {
-                partCur->_space[d][height][w].tsd = partUp->_space[d][0][w].tsd;
-                partCur->_space[d][height][w].weight = partUp->_space[d][0][w].weight;
-                partCur->_space[d][height][w].rgb[0] = partUp->_space[d][0][w].rgb[0];
-                partCur->_space[d][height][w].rgb[1] = partUp->_space[d][0][w].rgb[1];
-                partCur->_space[d][height][w].rgb[2] = partUp->_space[d][0][w].rgb[2];
-              }
-            }
-          }
-        }
+  // Copy valid tsd values of neighbors to borders of each partition.
+  // Partitions gather data from the interior of neighbors into their own borders, i.e., they can be processed concurrently.
+  // Only faces adjacent to modified partitions are refreshed.
+#pragma omp parallel for schedule(dynamic)
+  for(int i=0; i<(int)partitions.size(); i++)
+  {
+    TsdSpacePartition* partCur = partitions[i];
 
-        if(pz<_partitionsInZ-1)
-        {
-          TsdSpacePartition* partBack      = _partitions[pz+1][py][px];
-          if(partBack->isInitialized())
-          {
-            for(unsigned int h=0; h<height; h++)
-            {
-              for(unsigned int w=0; w<width; w++)
-              {
-                partCur->_space[depth][h][w].tsd = partBack->_space[0][h][w].tsd;
-                partCur->_space[depth][h][w].weight = partBack->_space[0][h][w].weight;
-                partCur->_space[depth][h][w].rgb[0] = partBack->_space[0][h][w].rgb[0];
-                partCur->_space[depth][h][w].rgb[1] = partBack->_space[0][h][w].rgb[1];
-                partCur->_space[depth][h][w].rgb[2] = partBack->_space[0][h][w].rgb[2];
-              }
-            }
-          }
-        }
+    if(!partCur->isInitialized()) continue;
 
-        if(px<_partitionsInX-1 && pz<_partitionsInZ-1)
-        {
-          TsdSpacePartition* partRightBack      = _partitions[pz+1][py][px+1];
-          if(partRightBack->isInitialized())
-          {
-            for(unsigned int h=0; h<height; h++)
-            {
-              partCur->_space[depth][h][width].tsd = partRightBack->_space[0][h][0].tsd;
-              partCur->_space[depth][h][width].weight = partRightBack->_space[0][h][0].weight;
-              partCur->_space[depth][h][width].rgb[0] = partRightBack->_space[0][h][0].rgb[0];
-              partCur->_space[depth][h][width].rgb[1] = partRightBack->_space[0][h][0].rgb[1];
-              partCur->_space[depth][h][width].rgb[2] = partRightBack->_space[0][h][0].rgb[2];
-            }
-          }
-        }
+    bool modified = partCur->isModified();
+    bool refreshed = modified;
 
-        if(px<_partitionsInX-1 && py<_partitionsInY-1)
-        {
-          TsdSpacePartition* partRightUp      = _partitions[pz][py+1][px+1];
-          if(partRightUp->isInitialized())
-          {
-            for(unsigned int d=0; d<depth; d++)
-            {
-              partCur->_space[d][height][width].tsd = partRightUp->_space[d][0][0].tsd;
-              partCur->_space[d][height][width].weight = partRightUp->_space[d][0][0].weight;
-              partCur->_space[d][height][width].rgb[0] = partRightUp->_space[d][0][0].rgb[0];
-              partCur->_space[d][height][width].rgb[1] = partRightUp->_space[d][0][0].rgb[1];
-              partCur->_space[d][height][width].rgb[2] = partRightUp->_space[d][0][0].rgb[2];
-            }
-          }
-        }
+    int px = partCur->getX() / _dimPartition;
+    int py = partCur->getY() / _dimPartition;
+    int pz = partCur->getZ() / _dimPartition;
 
-        if(py<_partitionsInY-1 && pz<_partitionsInZ-1)
-        {
-          TsdSpacePartition* partBackUp      = _partitions[pz+1][py+1][px];
-          if(partBackUp->isInitialized())
-          {
-            for(unsigned int w=0; w<width; w++)
-            {
-              partCur->_space[depth][height][w].tsd = partBackUp->_space[0][0][w].tsd;
-              partCur->_space[depth][height][w].weight = partBackUp->_space[0][0][w].weight;
-              partCur->_space[depth][height][w].rgb[0] = partBackUp->_space[0][0][w].rgb[0];
-              partCur->_space[depth][height][w].rgb[1] = partBackUp->_space[0][0][w].rgb[1];
-              partCur->_space[depth][height][w].rgb[2] = partBackUp->_space[0][0][w].rgb[2];
-            }
-          }
-        }
+    for(unsigned int n=0; n<7; n++)
+    {
+      const unsigned int ox = offsets[n][0];
+      const unsigned int oy = offsets[n][1];
+      const unsigned int oz = offsets[n][2];
+      if(px+(int)ox>=_partitionsInX || py+(int)oy>=_partitionsInY || pz+(int)oz>=_partitionsInZ) continue;
 
-        if(px<_partitionsInX-1 && py<_partitionsInY-1 && pz<_partitionsInZ-1 )
-        {
-          TsdSpacePartition* partBackRightUp      = _partitions[pz+1][py+1][px+1];
-          if(partBackRightUp->isInitialized())
-          {
-            partCur->_space[depth][height][width].tsd = partBackRightUp->_space[0][0][0].tsd;
-            partCur->_space[depth][height][width].weight = partBackRightUp->_space[0][0][0].weight;
-            partCur->_space[depth][height][width].rgb[0] = partBackRightUp->_space[0][0][0].rgb[0];
-            partCur->_space[depth][height][width].rgb[1] = partBackRightUp->_space[0][0][0].rgb[1];
-            partCur->_space[depth][height][width].rgb[2] = partBackRightUp->_space[0][0][0].rgb[2];
-          }
-        }
+      TsdSpacePartition* neighbor = getPartition(px+ox, py+oy, pz+oz);
+      if(neighbor && neighbor->isInitialized() && (modified || neighbor->isModified()))
+      {
+        partCur->copyBorder(neighbor, ox, oy, oz);
+        refreshed = true;
       }
     }
+
+    // Surface flags consider the border layer, since it takes part in the interpolation
+    if(refreshed)
+    {
+      partCur->updateSurface();
+      partCur->setStamp(_pushes);
+    }
   }
+
+  for(unsigned int i=0; i<partitions.size(); i++)
+    partitions[i]->resetModified();
+
+  updateSurfaceBlocks();
 }
 
 bool TsdSpace::interpolateNormal(const obfloat* coord, obfloat* normal)
@@ -588,14 +1498,14 @@ bool TsdSpace::interpolateNormal(const obfloat* coord, obfloat* normal)
 bool TsdSpace::coord2Index(obfloat coord[3], int* x, int* y, int* z, obfloat* dx, obfloat* dy, obfloat* dz)
 {
   // Get cell indices
-  obfloat dxIdx = floor(coord[0] * _invVoxelSize);
-  obfloat dyIdx = floor(coord[1] * _invVoxelSize);
-  obfloat dzIdx = floor(coord[2] * _invVoxelSize);
+  obfloat dxIdx = floor((coord[0]-_minX) * _invVoxelSize);
+  obfloat dyIdx = floor((coord[1]-_minY) * _invVoxelSize);
+  obfloat dzIdx = floor((coord[2]-_minZ) * _invVoxelSize);
 
   // Get center point of current cell
-  *dx = (dxIdx + 0.5) * _voxelSize;
-  *dy = (dyIdx + 0.5) * _voxelSize;
-  *dz = (dzIdx + 0.5) * _voxelSize;
+  *dx = _minX + (dxIdx + 0.5) * _voxelSize;
+  *dy = _minY + (dyIdx + 0.5) * _voxelSize;
+  *dz = _minZ + (dzIdx + 0.5) * _voxelSize;
 
   *x = (int)dxIdx;
   *y = (int)dyIdx;
@@ -618,16 +1528,9 @@ bool TsdSpace::coord2Index(obfloat coord[3], int* x, int* y, int* z, obfloat* dx
     (*dz) -= _voxelSize;
   }
 
-  // Check boundaries -> should never happen
-  /*if ((*x >= (int)_cellsX) || (*x < 0) || (*y >= (int)_cellsY) || (*y < 0) || (*z >= (int)_cellsZ) || *z < 0)
-  {
-#pragma omp critical
-{
-    cout << "coord not in space: " << coord[0] << " " << coord[1] << " " << coord[2] << " assigned: " << *x << " " << *y << " " << *z << endl;
-    //abort();
-}
+  // Check boundaries, queries may leave the space, e.g., after shifting the window
+  if ((*x >= (int)_cellsX) || (*x < 0) || (*y >= (int)_cellsY) || (*y < 0) || (*z >= (int)_cellsZ) || (*z < 0))
     return false;
-  }*/
 
   return true;
 }
@@ -647,8 +1550,8 @@ EnumTsdSpaceInterpolate TsdSpace::interpolateTrilinear(obfloat coord[3], obfloat
   int py = _lutIndex2Partition[yIdx];
   int pz = _lutIndex2Partition[zIdx];
 
-  TsdSpacePartition* part = _partitions[pz][py][px];
-  if(!part->isInitialized()) return INTERPOLATE_EMPTYPARTITION;
+  TsdSpacePartition* part = getPartition(px, py, pz);
+  if(!part || !part->isInitialized()) return INTERPOLATE_EMPTYPARTITION;
 
   int x = _lutIndex2Cell[xIdx];
   int y = _lutIndex2Cell[yIdx];
@@ -680,8 +1583,8 @@ EnumTsdSpaceInterpolate TsdSpace::getTsd(obfloat coord[3], obfloat* tsd)
   int py = _lutIndex2Partition[yIdx];
   int pz = _lutIndex2Partition[zIdx];
 
-  TsdSpacePartition* part = _partitions[pz][py][px];
-  if(!part->isInitialized()) return INTERPOLATE_EMPTYPARTITION;
+  TsdSpacePartition* part = getPartition(px, py, pz);
+  if(!part || !part->isInitialized()) return INTERPOLATE_EMPTYPARTITION;
 
   int x = _lutIndex2Cell[xIdx];
   int y = _lutIndex2Cell[yIdx];
@@ -709,45 +1612,18 @@ EnumTsdSpaceInterpolate TsdSpace::interpolateTrilinearRGB(obfloat coord[3], unsi
   int py = _lutIndex2Partition[yIdx];
   int pz = _lutIndex2Partition[zIdx];
 
-  TsdSpacePartition* part = _partitions[pz][py][px];
-  if(!part->isInitialized()) return INTERPOLATE_EMPTYPARTITION;
+  TsdSpacePartition* part = getPartition(px, py, pz);
+  if(!part || !part->isInitialized()) return INTERPOLATE_EMPTYPARTITION;
 
   int x = _lutIndex2Cell[xIdx];
   int y = _lutIndex2Cell[yIdx];
   int z = _lutIndex2Cell[zIdx];
 
-  double wx = fabs((coord[0] - dx) * _invVoxelSize);
-  double wy = fabs((coord[1] - dy) * _invVoxelSize);
-  double wz = fabs((coord[2] - dz) * _invVoxelSize);
-
-  unsigned char pRGB[8][3];
-
-  part->getRGB(z+0, y+0, x+0, pRGB[0]);
-  part->getRGB(z+1, y+0, x+0, pRGB[1]);
-  part->getRGB(z+0, y+1, x+0, pRGB[2]);
-  part->getRGB(z+1, y+1, x+0, pRGB[3]);
-  part->getRGB(z+0, y+0, x+1, pRGB[4]);
-  part->getRGB(z+1, y+0, x+1, pRGB[5]);
-  part->getRGB(z+0, y+1, x+1, pRGB[6]);
-  part->getRGB(z+1, y+1, x+1, pRGB[7]);
-
-  double pw[8];
-  pw[0] = (1. - wx) * (1. - wy) * (1. - wz);
-  pw[1] = (1. - wx) * (1. - wy) * wz;
-  pw[2] = (1. - wx) * wy * (1. - wz);
-  pw[3] = (1. - wx) * wy * wz;
-  pw[4] = wx * (1. - wy) * (1. - wz);
-  pw[5] = wx * (1. - wy) * wz;
-  pw[6] = wx * wy * (1. - wz);
-  pw[7] = wx * wy * wz;
+  obfloat wx = fabs((coord[0] - dx) * _invVoxelSize);
+  obfloat wy = fabs((coord[1] - dy) * _invVoxelSize);
+  obfloat wz = fabs((coord[2] - dz) * _invVoxelSize);
 
-  memset(rgb,0,3);
-  for(unsigned int i=0; i<8; i++)
-  {
-    rgb[0] += pRGB[i][0] * pw[i];
-    rgb[1] += pRGB[i][1] * pw[i];
-    rgb[2] += pRGB[i][2] * pw[i];
-  }
+  part->interpolateTrilinearRGB(x, y, z, wx, wy, wz, rgb);
 
   return INTERPOLATE_SUCCESS;
 }
@@ -803,12 +1679,34 @@ EnumTsdSpaceInterpolate TsdSpace::interpolateTrilinearRGB(obfloat coord[3], unsi
   return (true);
 }*/
 
-void TsdSpace::serialize(const char* filename)
+void TsdSpace::serialize(const char* filename, const EnumTsdSpaceFormat format)
 {
+  if(format==FORMAT_BINARY)
+  {
+    serializeBinary(filename);
+    return;
+  }
+
+  // One line per partition slot would be written, even for slots never allocated
+  if(_storage==STORAGE_HASHED)
+  {
+    LOGMSG(DBG_ERROR, "ASCII format is not supported for hashed storage, use FORMAT_BINARY instead");
+    return;
+  }
+
+  // Pending partitions of a lazily loaded file are needed in memory for ASCII output
+  if(_file)
+  {
+    vector<unsigned int> keys;
+    getPendingKeys(keys);
+    pageInPartitions(keys);
+  }
+
   ofstream f;
   f.open(filename);
 
-  f << _voxelSize << " " << (int)_layoutPartition << " " << (int)_layoutSpace << " " << _maxTruncation << endl;
+  f << _voxelSize << " " << (int)_layoutPartition << " " << (int)_layoutSpace << " " << _maxTruncation
+    << " " << _windowIndex[0] << " " << _windowIndex[1] << " " << _windowIndex[2] << " " << (int)_voxelLayout << endl;
 
   for(int pz=0; pz<_partitionsInZ; pz++)
   {
@@ -816,10 +1714,16 @@ void TsdSpace::serialize(const char* filename)
     {
       for(int px=0; px<_partitionsInX; px++)
       {
-        f << _partitions[pz][py][px]->getInitWeight() << endl;
-        bool initialized = _partitions[pz][py][px]->isInitialized();
+        TsdSpacePartition* part = getPartition(px, py, pz);
+        if(!part)
+        {
+          f << 0.0 << endl << false << endl;
+          continue;
+        }
+        f << part->getInitWeight() << endl;
+        bool initialized = part->isInitialized();
         f << initialized << endl;
-        if(initialized) _partitions[pz][py][px]->serialize(&f);
+        if(initialized) part->serialize(&f);
       }
     }
   }
@@ -828,8 +1732,147 @@ void TsdSpace::serialize(const char* filename)
   f.close();
 }
 
-TsdSpace* TsdSpace::load(const char* filename)
+void TsdSpace::serializeBinary(const char* filename)
+{
+  TsdSpaceFileHeader header;
+  getFileHeader(&header);
+
+  // A lazily loaded file might be replaced, so the output is moved to its destination when complete
+  std::string tmp = std::string(filename) + ".tmp";
+  TsdSpaceFileWriter writer;
+  if(!writer.open(tmp.c_str(), header)) return;
+
+  // Hashed storage writes allocated and pending partitions only, in the same order as dense storage
+  vector<unsigned int> keys;
+  if(_storage==STORAGE_HASHED)
+  {
+    vector<TsdSpacePartition*> partitions;
+    getAllocatedPartitions(partitions);
+    for(unsigned int i=0; i<partitions.size(); i++)
+    {
+      TsdSpacePartition* part = partitions[i];
+      keys.push_back(((part->getZ()/_dimPartition)*_partitionsInY+part->getY()/_dimPartition)*_partitionsInX+part->getX()/_dimPartition);
+    }
+    getPendingKeys(keys);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  }
+  else
+  {
+    for(int i=0; i<_partitionsInX*_partitionsInY*_partitionsInZ; i++)
+      keys.push_back(i);
+  }
+
+  // Encode partitions batch-wise in parallel, write chunks serially
+  const unsigned int slice = _partitionsInX*_partitionsInY;
+  vector< vector<unsigned char> > bufs(slice);
+  vector<TsdSpaceChunk> chunks(slice);
+  vector<int> pending(slice);
+  vector<char> keep(slice);
+  for(unsigned int start=0; start<keys.size(); start+=slice)
+  {
+    const int n = min(slice, (unsigned int)keys.size()-start);
+#pragma omp parallel for schedule(dynamic)
+    for(int i=0; i<n; i++)
+    {
+      const unsigned int key = keys[start+i];
+      int px = key % _partitionsInX;
+      int py = (key / _partitionsInX) % _partitionsInY;
+      int pz = key / (_partitionsInX*_partitionsInY);
+      TsdSpaceChunk& chunk = chunks[i];
+      memset(&chunk, 0, sizeof(chunk));
+      chunk.index[0] = px+_windowIndex[0];
+      chunk.index[1] = py+_windowIndex[1];
+      chunk.index[2] = pz+_windowIndex[2];
+      keep[i] = 1;
+
+      // Chunks not paged in so far are copied
+      pending[i] = _file ? _file->findPendingChunk(chunk.index[0], chunk.index[1], chunk.index[2]) : -1;
+      if(pending[i]>=0)
+      {
+        chunk = _file->getChunk(pending[i]);
+        continue;
+      }
+
+      // Partitions without any information are omitted
+      TsdSpacePartition* part = getPartition(px, py, pz);
+      if(!part || (!part->isInitialized() && part->getInitWeight()==0.0))
+      {
+        keep[i] = 0;
+        continue;
+      }
+      part->serialize(bufs[i]);
+      chunk.flags = (part->isInitialized() ? CHUNK_INITIALIZED : 0) | (part->hasColor() ? CHUNK_COLOR : 0)
+                    | (part->getLevel() << TSDSPACEFILE_LEVELSHIFT);
+      chunk.initWeight = part->getInitWeight();
+      chunk.size = bufs[i].size();
+    }
+
+    for(int i=0; i<n; i++)
+    {
+      if(pending[i]>=0)
+        writer.write(chunks[i], _file->getChunkData(pending[i]));
+      else if(keep[i])
+        writer.write(chunks[i], bufs[i].empty() ? NULL : &bufs[i][0]);
+    }
+  }
+
+  if(!writer.close() || rename(tmp.c_str(), filename)!=0)
+  {
+    LOGMSG(DBG_ERROR, "Could not write file " << filename);
+    remove(tmp.c_str());
+    return;
+  }
+
+  LOGMSG(DBG_WARN, "Saved file: " << filename);
+}
+
+TsdSpace* TsdSpace::loadBinary(const char* filename, const EnumTsdSpaceStorage storage, const bool lazy)
+{
+  TsdSpaceFile* file = new TsdSpaceFile();
+  if(!file->open(filename))
+  {
+    delete file;
+    return NULL;
+  }
+
+  const TsdSpaceFileHeader& h = file->getHeader();
+  if(h.layoutPartition<LAYOUT_1x1x1 || h.layoutPartition>h.layoutSpace || h.layoutSpace>LAYOUT_16384x16384x16384 || h.voxelLayout>VOXEL_COMPACT)
+  {
+    LOGMSG(DBG_ERROR, filename << " has an invalid layout");
+    delete file;
+    return NULL;
+  }
+
+  if(h.layoutSpace>LAYOUT_1024x1024x1024 && storage!=STORAGE_HASHED)
+  {
+    LOGMSG(DBG_ERROR, filename << " requires hashed storage");
+    delete file;
+    return NULL;
+  }
+
+  TsdSpace* space = new TsdSpace(h.voxelSize, (EnumTsdSpaceLayout)h.layoutPartition, (EnumTsdSpaceLayout)h.layoutSpace, storage, (EnumTsdVoxelLayout)h.voxelLayout);
+  space->setMaxTruncation(h.maxTruncation);
+  space->shiftWindow(h.window[0], h.window[1], h.window[2]);
+  space->_file = file;
+
+  if(!lazy)
+  {
+    vector<unsigned int> keys;
+    space->getPendingKeys(keys);
+    space->pageInPartitions(keys);
+    space->_file = NULL;
+    delete file;
+    space->updateSurfaceBlocks();
+  }
+
+  return space;
+}
+
+TsdSpace* TsdSpace::load(const char* filename, const EnumTsdSpaceStorage storage, const bool lazy)
 {
+  if(TsdSpaceFile::isBinary(filename)) return loadBinary(filename, storage, lazy);
+
   ifstream f;
   f.open(filename, ios_base::in);
 
@@ -845,13 +1888,21 @@ TsdSpace* TsdSpace::load(const char* filename)
   int lp, ls;
   double maxTruncation;
 
-  f >> voxelSize >> lp >> ls >> maxTruncation;
+  // Window index and voxel layout are optional for files written by former versions
+  int window[3] = {0, 0, 0};
+  int vl = VOXEL_FULL;
+  string header;
+  getline(f, header);
+  istringstream h(header);
+  h >> voxelSize >> lp >> ls >> maxTruncation;
+  h >> window[0] >> window[1] >> window[2] >> vl;
   layoutPartition = (EnumTsdSpaceLayout)lp;
   layoutSpace = (EnumTsdSpaceLayout)ls;
 
-  TsdSpace* space = new TsdSpace(voxelSize, layoutPartition, layoutSpace);
+  TsdSpace* space = new TsdSpace(voxelSize, layoutPartition, layoutSpace, storage, (EnumTsdVoxelLayout)vl);
   space->setMaxTruncation(maxTruncation);
-  TsdSpacePartition**** partitions = space->getPartitions();
+  space->shiftWindow(window[0], window[1], window[2]);
+  unsigned int dim = space->_dimPartition;
 
   for(int pz=0; pz<space->getPartitionsInZ(); pz++)
   {
@@ -861,16 +1912,27 @@ TsdSpace* TsdSpace::load(const char* filename)
       {
         double initWeight;
         f >> initWeight;
-        partitions[pz][py][px]->setInitWeight(initWeight);
         bool initialized;
         f >> initialized;
-        if(initialized) partitions[pz][py][px]->load(&f);
+
+        TsdSpacePartition* part = space->getPartition(px, py, pz);
+        if(!part)
+        {
+          // Hashed storage: instantiate only partitions carrying data
+          if(!initialized) continue;
+          part = space->acquirePartition(px*dim, py*dim, pz*dim);
+          space->_hash->insert((pz*space->_partitionsInY+py)*space->_partitionsInX+px, part);
+        }
+        part->setInitWeight(initWeight);
+        if(initialized) part->load(&f);
       }
     }
   }
 
   f.close();
 
+  space->updateSurfaceBlocks();
+
   return space;
 }
 
@@ -5,10 +5,24 @@
 #include "obvision/reconstruct/reconstruct_defs.h"
 #include "obvision/reconstruct/Sensor.h"
 #include "TsdSpacePartition.h"
+#include "obvision/reconstruct/PartitionHash.h"
+#include "TsdFusionKernel.h"
+#include "TsdFusionPolicy.h"
+#include "TsdSpaceFile.h"
+#include "TsdSpaceFrustum.h"
+
+#include <string>
+#include <set>
+#include <utility>
+#include <pthread.h>
 
 namespace obvious
 {
 
+/**
+ * Layouts up to LAYOUT_1024x1024x1024 are available for all storages. Larger layouts are restricted to hashed storage,
+ * where the number of partitions in each dimension must not exceed 1024, since partitions are keyed by 32 bit indices.
+ */
 enum EnumTsdSpaceLayout { LAYOUT_1x1x1=0,
 	LAYOUT_2x2x2=1,
 	LAYOUT_4x4x4=2,
@@ -19,7 +33,11 @@ enum EnumTsdSpaceLayout { LAYOUT_1x1x1=0,
 	LAYOUT_128x128x128=7,
 	LAYOUT_256x256x256=8,
 	LAYOUT_512x512x512=9,
-	LAYOUT_1024x1024x1024=10};
+	LAYOUT_1024x1024x1024=10,
+	LAYOUT_2048x2048x2048=11,
+	LAYOUT_4096x4096x4096=12,
+	LAYOUT_8192x8192x8192=13,
+	LAYOUT_16384x16384x16384=14};
 
 
 enum EnumTsdSpaceInterpolate { INTERPOLATE_SUCCESS=0,
@@ -27,6 +45,12 @@ enum EnumTsdSpaceInterpolate { INTERPOLATE_SUCCESS=0,
 	INTERPOLATE_EMPTYPARTITION=2,
 	INTERPOLATE_ISNAN=3};
 
+enum EnumTsdSpaceStorage { STORAGE_DENSE=0,
+	STORAGE_HASHED=1};
+
+enum EnumTsdSpaceFormat { FORMAT_ASCII=0,
+	FORMAT_BINARY=1};
+
 /**
  * @class TsdSpace
  * @brief Space representing a true signed distance function
@@ -41,8 +65,14 @@ enum EnumTsdSpaceInterpolate { INTERPOLATE_SUCCESS=0,
 	 * @param[in] voxelSize edge length of voxels in meters
 	 * @param[in] layoutPartition Partition layout, i.e., voxels in partition
 	 * @param[in] layoutSpace Space layout, i.e., partitions in space
+	 * @param[in] storage Partition storage: STORAGE_DENSE instantiates all partitions in advance,
+	 *                    STORAGE_HASHED creates partitions on demand where measurements produce surface data and supports layouts
+	 *                    beyond LAYOUT_1024x1024x1024, e.g., LAYOUT_8192x8192x8192 with 8x8x8 partitions covers 82m at 1cm voxels
+	 * @param[in] voxelLayout Memory layout of voxels: VOXEL_FULL stores tsd and weight in full precision,
+	 *                        VOXEL_COMPACT as 16 bit fixed-point numbers (4 instead of 16 bytes per voxel)
 	 */
-	TsdSpace(const double voxelSize, const EnumTsdSpaceLayout layoutPartition, const EnumTsdSpaceLayout layoutSpace);
+	TsdSpace(const double voxelSize, const EnumTsdSpaceLayout layoutPartition, const EnumTsdSpaceLayout layoutSpace, const EnumTsdSpaceStorage storage=STORAGE_DENSE,
+	         const EnumTsdVoxelLayout voxelLayout=VOXEL_FULL);
 
 	/**
 	 * Destructor
@@ -54,6 +84,12 @@ enum EnumTsdSpaceInterpolate { INTERPOLATE_SUCCESS=0,
 	 */
 	void reset();
 
+	/**
+	 * Preallocate voxel memory of partitions, e.g., to avoid heap allocations while fusing data during fast motion
+	 * @param[in] partitions number of partitions
+	 */
+	void reserve(const unsigned int partitions);
+
 	/**
 	 * Get number of voxels in x-direction
 	 */
@@ -150,12 +186,68 @@ enum EnumTsdSpaceInterpolate { INTERPOLATE_SUCCESS=0,
 	 */
 	double getMaxTruncation() const { return _maxTruncation; }
 
+	/**
+	 * Set weighting scheme of data fusion, e.g., to forget outdated measurements of dynamic scenes
+	 * @param[in] policy fusion policy
+	 */
+	void setFusionPolicy(const TsdFusionPolicy& policy) { _policy = policy; }
+
+	/**
+	 * Get weighting scheme of data fusion
+	 * @return fusion policy
+	 */
+	const TsdFusionPolicy& getFusionPolicy() const { return _policy; }
+
+	/**
+	 * Set distance for level of detail. Partitions closer than the given distance to the sensor are represented with full
+	 * resolution, partitions beyond with half and beyond twice the distance with quarter resolution.
+	 * @param[in] distance distance in meters, 0 disables level of detail (default)
+	 */
+	void setLevelOfDetail(const obfloat distance) { _lodDistance = distance; }
+
+	/**
+	 * Get distance for level of detail
+	 * @return distance in meters
+	 */
+	obfloat getLevelOfDetail() const { return _lodDistance; }
+
+	/**
+	 * Get partition storage type
+	 * @return storage type
+	 */
+	EnumTsdSpaceStorage getStorage() const { return _storage; }
+
+	/**
+	 * Get memory layout of voxels
+	 * @return voxel layout
+	 */
+	EnumTsdVoxelLayout getVoxelLayout() const { return _voxelLayout; }
+
 	/**
 	 * Get pointer to internal partition space
-	 * @return pointer to 3D partition space
+	 * @return pointer to 3D partition space, NULL for hashed storage (use getPartition instead)
 	 */
 	TsdSpacePartition**** getPartitions() const { return _partitions; }
 
+	/**
+	 * Get partition by partition index
+	 * @param[in] px partition index in x-dimension
+	 * @param[in] py partition index in y-dimension
+	 * @param[in] pz partition index in z-dimension
+	 * @return partition or NULL, if no partition has been allocated (hashed storage only)
+	 */
+	TsdSpacePartition* getPartition(const int px, const int py, const int pz) const
+	{
+	  if(_storage==STORAGE_DENSE) return _partitions[pz][py][px];
+	  return _hash->find((pz*_partitionsInY+py)*_partitionsInX+px);
+	}
+
+	/**
+	 * Get all allocated partitions
+	 * @param[out] partitions partition list
+	 */
+	void getAllocatedPartitions(vector<TsdSpacePartition*> &partitions) const;
+
 	/**
 	 * Check, if partition belonging to coordinate is initialized
 	 * @param coord query coordinate
@@ -163,12 +255,107 @@ enum EnumTsdSpaceInterpolate { INTERPOLATE_SUCCESS=0,
 	 */
 	bool isPartitionInitialized(obfloat coord[3]);
 
+	/**
+	 * Determine region around a coordinate, in which trilinear interpolation cannot yield a sign change, i.e., no surface
+	 * is contained. Ray casters can leave such regions in a single step. Regions are either blocks of partitions without
+	 * surface or single partitions, see updateSurfaceBlocks and TsdSpacePartition::hasSurface.
+	 * @param[in] coord query coordinate
+	 * @param[out] regionMin lower bound of region (inclusive)
+	 * @param[out] regionMax upper bound of region (exclusive), the region is empty for coordinates outside of the space
+	 * @return true, if the region contains no surface; otherwise the region of the partition interpolating the coordinate
+	 */
+	bool getEmptyRegion(const obfloat coord[3], obfloat regionMin[3], obfloat regionMax[3]) const;
+
+	/**
+	 * Refresh occupancy of blocks of partitions used for empty space skipping. This is done after pushing data or paging in,
+	 * so only needed after modifying partitions directly.
+	 */
+	void updateSurfaceBlocks();
+
+	/**
+	 * Check, whether a coordinate is interpolated from a partition containing a surface, which has been changed by the last
+	 * push or has been modified since, e.g., to validate results of a previous ray casting
+	 * @param[in] coord query coordinate
+	 * @param[out] regionMin lower bound of region sharing the result (inclusive)
+	 * @param[out] regionMax upper bound of region sharing the result (exclusive)
+	 * @return modification flag
+	 */
+	bool isSurfaceModified(const obfloat coord[3], obfloat regionMin[3], obfloat regionMax[3]) const;
+
+	/**
+	 * Get number of pushes, i.e., the stamp of partitions changed by the last push
+	 * @return number of pushes
+	 */
+	unsigned int getPushCount() const { return _pushes; }
+
 	/**
 	 * Determine whether sensor is inside space
 	 * @param sensor
 	 */
 	bool isInsideSpace(Sensor* sensor);
 
+	/**
+	 * Determine whether a point is inside space
+	 * @param coord coordinates
+	 */
+	bool isInsideSpace(const obfloat coord[3]) const;
+
+	/**
+	 * Enable rolling window mode: before data is pushed, the space is shifted in steps of whole partitions
+	 * in order to keep the sensor close to the centroid. Partitions leaving the space are evicted and their memory is reused
+	 * for partitions entering it.
+	 * @param[in] enable enable flag
+	 * @param[in] threshold tolerated displacement of the sensor from the central partition (in partitions) before shifting
+	 */
+	void setRollingWindow(const bool enable, const unsigned int threshold=1);
+
+	/**
+	 * Set directory for storing evicted partitions. Stored partitions are restored, when they re-enter the space.
+	 * @param[in] path existing directory, NULL disables storing (evicted partitions are discarded)
+	 */
+	void setEvictionStore(const char* path);
+
+	/**
+	 * Shift space by whole partitions
+	 * @param[in] dx shift in x-direction (in partitions)
+	 * @param[in] dy shift in y-direction (in partitions)
+	 * @param[in] dz shift in z-direction (in partitions)
+	 */
+	void shiftWindow(const int dx, const int dy, const int dz);
+
+	/**
+	 * Get partition index of space origin, i.e., the number of partitions the space has been shifted by
+	 * @param[out] idx partition index
+	 */
+	void getWindowIndex(int idx[3]) const;
+
+	/**
+	 * Enable concurrent reading while pushing, e.g., ray casting of the previous frame while the next one is fused.
+	 * Partitions reached by the measurement are fused into shadow copies, which replace the visible data in a short exclusive
+	 * commit. Otherwise readers are excluded during the whole push. Staging takes a second copy of all partitions within
+	 * reach of the sensor. Lazily loaded files are always fused in place.
+	 * @param[in] enable enable flag
+	 */
+	void setConcurrentAccess(const bool enable) { _concurrent = enable; }
+
+	/**
+	 * Get concurrent access flag
+	 * @return enable flag
+	 */
+	bool getConcurrentAccess() const { return _concurrent; }
+
+	/**
+	 * Acquire shared access for reading voxel data concurrently with push, pushTree, pageIn and reset. Ray casters and mesh
+	 * extraction lock internally, but direct access, e.g., by interpolateTrilinear, must be enclosed by lockRead and unlockRead.
+	 * Locks must not be nested. Other modifications, e.g., shiftWindow or load, must not be called concurrently.
+	 */
+	void lockRead();
+
+	/**
+	 * Release shared access, see lockRead
+	 */
+	void unlockRead();
+
 	/**
 	 * Push sensor data to space
 	 * @param[in] sensor abstract sensor instance holding current data
@@ -210,18 +397,113 @@ enum EnumTsdSpaceInterpolate { INTERPOLATE_SUCCESS=0,
 	/**
 	 * Method to store the content of the grid in a file
 	 * @param filename
+	 * @param format FORMAT_ASCII writes one line per voxel (dense storage only), FORMAT_BINARY writes compressed partition chunks and an index table (see TsdSpaceFile)
 	 */
-	void serialize(const char* filename);
+	void serialize(const char* filename, const EnumTsdSpaceFormat format=FORMAT_ASCII);
 
 	/**
-	 * Method to load values out of a file into the grid
+	 * Method to load values out of a file into the grid, the file format is detected automatically
 	 * @param filename
+	 * @param storage partition storage of created space
+	 * @param lazy keep binary files mapped and page in partitions on demand, i.e., when push reaches them or by calling pageIn
+	 * @return space instance, NULL if a binary file is corrupted
 	 */
-	static TsdSpace* load(const char* filename);
+	static TsdSpace* load(const char* filename, const EnumTsdSpaceStorage storage=STORAGE_DENSE, const bool lazy=false);
+
+	/**
+	 * Page in partitions of a lazily loaded file intersecting an axis-aligned box
+	 * @param[in] coordMin minimum coordinates of box
+	 * @param[in] coordMax maximum coordinates of box
+	 */
+	void pageIn(const obfloat coordMin[3], const obfloat coordMax[3]);
+
+	/**
+	 * Get number of partitions of a lazily loaded file, which have not been paged in so far
+	 * @return number of partitions
+	 */
+	unsigned int getPendingPartitions() const;
 
  private:
 
-	void pushRecursion(Sensor* sensor, obfloat pos[3], TsdSpaceComponent* comp, vector<TsdSpacePartition*> &partitionsToCheck);
+	void pushHashed(Sensor* sensor, obfloat pos[3]);
+
+	/**
+	 * Determine partitions of a range of partition indices, which may receive data from the current push
+	 * @param[in] sensor sensor instance
+	 * @param[in] pos sensor position
+	 * @param[in] pMin lower partition index (inclusive)
+	 * @param[in] pMax upper partition index (inclusive)
+	 * @param[out] keys partitions to be classified individually
+	 * @param[out] emptyKeys partitions, which can at most receive emptiness
+	 */
+	void collectCandidates(Sensor* sensor, obfloat pos[3], const int pMin[3], const int pMax[3], vector<unsigned int> &keys, vector<unsigned int> &emptyKeys);
+
+	void getFileHeader(TsdSpaceFileHeader* header) const;
+
+	void serializeBinary(const char* filename);
+
+	static TsdSpace* loadBinary(const char* filename, const EnumTsdSpaceStorage storage, const bool lazy);
+
+	bool decodeChunk(TsdSpaceFile* file, const unsigned int chunk, TsdSpacePartition* part);
+
+	void pageInPartitions(const vector<unsigned int> &keys);
+
+	/**
+	 * Get keys of partitions within the window, whose chunks have not been paged in so far
+	 * @param[out] keys partition keys (appended)
+	 */
+	void getPendingKeys(vector<unsigned int> &keys) const;
+
+	void pageInVisible(TsdSpacePartition* part, obfloat pos[3], Sensor* sensor);
+
+	void followSensor(obfloat pos[3]);
+
+	void buildTree();
+
+	TsdSpacePartition* acquirePartition(const unsigned int x, const unsigned int y, const unsigned int z);
+
+	void releasePartition(TsdSpacePartition* part);
+
+	std::string getStoreFilename(const int gx, const int gy, const int gz) const;
+
+	void storePartition(TsdSpacePartition* part, const int gx, const int gy, const int gz);
+
+	bool restorePartition(TsdSpacePartition* part, const int gx, const int gy, const int gz);
+
+	bool initFusionFrame(Sensor* sensor, obfloat pos[3], TsdFusionFrame* frame);
+
+	void pushPartition(Sensor* sensor, obfloat pos[3], TsdSpacePartition* part, int* idx, obfloat* buf, const TsdFusionFrame* frame);
+
+	void pushRecursion(Sensor* sensor, obfloat pos[3], TsdSpaceComponent* comp, vector<TsdSpacePartition*> &partitionsToCheck,
+	                   vector<TsdSpacePartition*> &partitionsEmpty);
+
+	/**
+	 * Fuse measurement into a partition classified as visible or empty, a shadow copy is modified while staging
+	 */
+	void fusePartition(Sensor* sensor, obfloat pos[3], TsdSpacePartition* part, const EnumTsdSpaceRange range, int* idx, obfloat* buf,
+	                   const TsdFusionFrame* frame);
+
+	/**
+	 * Create shadow copy of a partition, which replaces its voxel data with commitPartitions
+	 * @return shadow partition
+	 */
+	TsdSpacePartition* stagePartition(TsdSpacePartition* part);
+
+	/**
+	 * Swap in staged partitions and insert partitions created by pushHashed, the write lock must be held
+	 */
+	void commitPartitions();
+
+	/**
+	 * Begin push: shift rolling window, set up culling and determine, whether partitions are staged. The write lock is held
+	 * afterwards, unless partitions are staged.
+	 */
+	void beginPush(Sensor* sensor, obfloat pos[3]);
+
+	/**
+	 * End push: commit partitions, propagate borders and release the write lock
+	 */
+	void endPush();
 
 	void propagateBorders();
 
@@ -229,6 +511,8 @@ enum EnumTsdSpaceInterpolate { INTERPOLATE_SUCCESS=0,
 
 	bool coord2Index(obfloat coord[3], int* x, int* y, int* z, obfloat* dx, obfloat* dy, obfloat* dz);
 
+	TsdSpacePartition* findRegion(const obfloat coord[3], obfloat regionMin[3], obfloat regionMax[3], bool* empty) const;
+
 	TsdSpaceComponent* _tree;
 
 	unsigned int _cellsX;
@@ -243,6 +527,23 @@ enum EnumTsdSpaceInterpolate { INTERPOLATE_SUCCESS=0,
 
 	obfloat _maxTruncation;
 
+	TsdFusionPolicy _policy;
+
+	obfloat _lodDistance;
+
+	// Flags of blocks of partitions containing any surface, coarse level of empty space skipping
+	vector<unsigned char> _surfaceBlocks;
+
+	bool _surfaceBlocksValid;
+
+	unsigned int _pushes;
+
+	int _blocksInX;
+
+	int _blocksInY;
+
+	int _blocksInZ;
+
 	obfloat _minX;
 
 	obfloat _maxX;
@@ -257,6 +558,56 @@ enum EnumTsdSpaceInterpolate { INTERPOLATE_SUCCESS=0,
 
 	TsdSpacePartition**** _partitions;
 
+	PartitionHash<TsdSpacePartition>* _hash;
+
+	EnumTsdSpaceStorage _storage;
+
+	EnumTsdVoxelLayout _voxelLayout;
+
+	unsigned int _dimPartition;
+
+	vector<TsdSpacePartition*> _recycled;
+
+	bool _rolling;
+
+	unsigned int _rollingThreshold;
+
+	int _windowIndex[3];
+
+	std::string _storePath;
+
+	struct StoreIndex
+	{
+	  int x, y, z;
+	  bool operator<(const StoreIndex& i) const
+	  {
+	    if(z!=i.z) return z<i.z;
+	    if(y!=i.y) return y<i.y;
+	    return x<i.x;
+	  }
+	};
+
+	std::set<StoreIndex> _stored;
+
+	// lazily loaded binary file
+	TsdSpaceFile* _file;
+
+	// Readers share the lock, push holds it exclusively for committing or, if not staging, for the whole push
+	pthread_rwlock_t _lock;
+
+	bool _concurrent;
+
+	bool _staging;
+
+	// Partitions along with their shadow copies fused by the current push
+	vector<std::pair<TsdSpacePartition*, TsdSpacePartition*> > _staged;
+
+	// Partitions created by the current push along with their hash keys
+	vector<std::pair<unsigned int, TsdSpacePartition*> > _created;
+
+	// Culling of partitions for the current push
+	TsdSpaceFrustum _frustum;
+
 	int* _lutIndex2Partition;
 	int* _lutIndex2Cell;
 
@@ -55,6 +55,9 @@ TsdSpaceBranch::TsdSpaceBranch(TsdSpaceComponent**** leafs, int x, int y, int z,
   _children.push_back(branchUpBackRight);
 
   // Calculate mean of centroids
+  _centroid[0] = 0.0;
+  _centroid[1] = 0.0;
+  _centroid[2] = 0.0;
   for(unsigned int i=0; i<_children.size(); i++)
   {
     obfloat* c= _children[i]->getCentroid();
@@ -67,13 +70,13 @@ TsdSpaceBranch::TsdSpaceBranch(TsdSpaceComponent**** leafs, int x, int y, int z,
   _centroid[2] /= 8.0;
 
 
-  // Get outer bounds of leafs
+  // Get outer bounds of leafs: children are ordered like edges, i.e., edge i of the branch is edge i of child i
   for(unsigned int i=0; i<_children.size(); i++)
   {
-    (*_edgeCoordsHom)(i, 0) = (*(_children[i]->getEdgeCoordsHom()))(0,0);
-    (*_edgeCoordsHom)(i, 1) = (*(_children[i]->getEdgeCoordsHom()))(0,1);
-    (*_edgeCoordsHom)(i, 2) = (*(_children[i]->getEdgeCoordsHom()))(0,2);
-    (*_edgeCoordsHom)(i, 3) = (*(_children[i]->getEdgeCoordsHom()))(0,3);
+    (*_edgeCoordsHom)(i, 0) = (*(_children[i]->getEdgeCoordsHom()))(i,0);
+    (*_edgeCoordsHom)(i, 1) = (*(_children[i]->getEdgeCoordsHom()))(i,1);
+    (*_edgeCoordsHom)(i, 2) = (*(_children[i]->getEdgeCoordsHom()))(i,2);
+    (*_edgeCoordsHom)(i, 3) = (*(_children[i]->getEdgeCoordsHom()))(i,3);
   }
 
   _componentSize = 2.0 * branch->getComponentSize();
@@ -98,10 +101,10 @@ vector<TsdSpaceComponent*> TsdSpaceBranch::getChildren()
   return _children;
 }
 
-void TsdSpaceBranch::increaseEmptiness()
+void TsdSpaceBranch::increaseEmptiness(const TsdFusionPolicy& policy)
 {
   for(int i=0; i<8; i++)
-    _children[i]->increaseEmptiness();
+    _children[i]->increaseEmptiness(policy);
 }
 
 static int level = 0;
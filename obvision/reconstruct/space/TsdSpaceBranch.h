@@ -16,7 +16,7 @@ public:
 
   std::vector<TsdSpaceComponent*> getChildren();
 
-  virtual void increaseEmptiness();
+  virtual void increaseEmptiness(const TsdFusionPolicy& policy);
 
   void print();
 
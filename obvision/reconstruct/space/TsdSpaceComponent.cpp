@@ -1,4 +1,5 @@
 #include "TsdSpaceComponent.h"
+#include "TsdSpaceFrustum.h"
 #include "obcore/math/mathbase.h"
 #include <cmath>
 
@@ -15,24 +16,32 @@ TsdSpaceComponent::~TsdSpaceComponent()
 
 }
 
-bool TsdSpaceComponent::isInRange(obfloat pos[3], Sensor* sensor, obfloat maxTruncation)
+EnumTsdSpaceRange TsdSpaceComponent::getRange(obfloat pos[3], Sensor* sensor, obfloat maxTruncation, const TsdSpaceFrustum* frustum) const
+{
+  return classifyRange(pos, sensor, maxTruncation, _centroid, _circumradius, _edgeCoordsHom, _isLeaf, frustum);
+}
+
+EnumTsdSpaceRange TsdSpaceComponent::classifyRange(obfloat pos[3], Sensor* sensor, obfloat maxTruncation, const obfloat centroid[3], obfloat circumradius, Matrix* edgeCoordsHom, bool isLeaf,
+                                                   const TsdSpaceFrustum* frustum)
 {
   // Centroid-to-sensor distance
-  obfloat distance = euklideanDistance<obfloat>(pos, _centroid, 3);
+  obfloat distance = euklideanDistance<obfloat>(pos, (obfloat*)centroid, 3);
 
   // closest possible distance of any voxel in partition
-  obfloat minDist = distance - _circumradius - maxTruncation;
+  obfloat minDist = distance - circumradius - maxTruncation;
 
   // check if partition is out of range
-  if(minDist > sensor->getMaximumRange()) return false;
+  if(minDist > sensor->getMaximumRange()) return RANGE_OUTSIDE;
 
   // farthest possible distance of any voxel in partition
-  obfloat maxDist = distance + _circumradius + maxTruncation;
+  obfloat maxDist = distance + circumradius + maxTruncation;
 
   // check if partition is too close
-  if(maxDist < sensor->getMinimumRange()) return false;
+  if(maxDist < sensor->getMinimumRange()) return RANGE_OUTSIDE;
 
-  if(_isLeaf)
+  if(frustum && frustum->isValid()) return frustum->classify(edgeCoordsHom, minDist, maxDist, isLeaf);
+
+  if(isLeaf)
   {
     double* data = sensor->getRealMeasurementData();
     bool* mask = sensor->getRealMeasurementMask();
@@ -42,7 +51,7 @@ bool TsdSpaceComponent::isInRange(obfloat pos[3], Sensor* sensor, obfloat maxTru
 
     // Project back edges of partition
     int idxEdge[8];
-    sensor->backProject(_edgeCoordsHom, idxEdge);
+    sensor->backProject(edgeCoordsHom, idxEdge);
 
     // Determine outmost projection range
     int x_min = width-1;
@@ -65,7 +74,7 @@ bool TsdSpaceComponent::isInRange(obfloat pos[3], Sensor* sensor, obfloat maxTru
     }
 
     // Verify that at least one edge is in the field of view
-    if(validIndices==0) return false;
+    if(validIndices==0) return RANGE_OUTSIDE;
 
     // We might oversee some voxels, if validIndices < 8, but this should be negligible
     // Verify whether any measurement within the projection range is close enough for pushing data
@@ -85,7 +94,7 @@ bool TsdSpaceComponent::isInRange(obfloat pos[3], Sensor* sensor, obfloat maxTru
       }
     }
 
-    if(!isVisible) return false;
+    if(!isVisible) return RANGE_OUTSIDE;
 
     // TODO: verify the following if clause
     //if(validIndices==8)
@@ -100,14 +109,10 @@ bool TsdSpaceComponent::isInRange(obfloat pos[3], Sensor* sensor, obfloat maxTru
         }
       }
 
-      if(isEmpty)
-      {
-        increaseEmptiness();
-        return false;
-      }
+      if(isEmpty) return RANGE_EMPTY;
     }
   }
-  return true;
+  return RANGE_VISIBLE;
 }
 
 }
@@ -4,10 +4,17 @@
 #include "obvision/reconstruct/reconstruct_defs.h"
 #include "obcore/math/linalg/linalg.h"
 #include "obvision/reconstruct/Sensor.h"
+#include "obvision/reconstruct/space/TsdFusionPolicy.h"
 
 namespace obvious
 {
 
+class TsdSpaceFrustum;
+
+enum EnumTsdSpaceRange { RANGE_OUTSIDE=0,
+  RANGE_VISIBLE=1,
+  RANGE_EMPTY=2};
+
 /**
  * @class TsdSpaceComponent
  * @brief Abstract component for octree implementation
@@ -30,9 +37,33 @@ public:
 
   bool isLeaf() const { return _isLeaf; }
 
-  bool isInRange(obfloat pos[3], Sensor* sensor, obfloat maxTruncation);
-
-  virtual void increaseEmptiness() = 0;
+  /**
+   * Classify component with respect to the current measurement, see classifyRange. Emptiness is not increased,
+   * i.e., the component is not modified.
+   * @param[in] pos sensor position
+   * @param[in] sensor sensor instance
+   * @param[in] maxTruncation maximum truncation radius
+   * @param[in] frustum culling data of the current frame, may be NULL
+   * @return range classification
+   */
+  EnumTsdSpaceRange getRange(obfloat pos[3], Sensor* sensor, obfloat maxTruncation, const TsdSpaceFrustum* frustum=NULL) const;
+
+  /**
+   * Classify an axis-aligned box with respect to the current measurement, without modifying any component
+   * @param[in] pos sensor position
+   * @param[in] sensor sensor instance
+   * @param[in] maxTruncation maximum truncation radius
+   * @param[in] centroid centroid of box
+   * @param[in] circumradius circumradius of box
+   * @param[in] edgeCoordsHom homogeneous coordinates of the 8 box edges
+   * @param[in] isLeaf leafs are tested against the measurement image, branches only by distance and frustum
+   * @param[in] frustum culling data of the current frame, replaces back projection of edges if valid, may be NULL
+   * @return range classification
+   */
+  static EnumTsdSpaceRange classifyRange(obfloat pos[3], Sensor* sensor, obfloat maxTruncation, const obfloat centroid[3], obfloat circumradius, Matrix* edgeCoordsHom, bool isLeaf,
+                                         const TsdSpaceFrustum* frustum=NULL);
+
+  virtual void increaseEmptiness(const TsdFusionPolicy& policy) = 0;
 
 protected:
 
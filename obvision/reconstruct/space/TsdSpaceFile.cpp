@@ -0,0 +1,80 @@
+#include "TsdSpaceFile.h"
+
+#include <algorithm>
+
+namespace obvious
+{
+
+/**
+ * Order of chunks by global partition index
+ */
+struct TsdSpaceChunkOrder
+{
+  const TsdSpaceFile* file;
+
+  static bool less(const int32_t* a, const int32_t* b)
+  {
+    if(a[2]!=b[2]) return a[2]<b[2];
+    if(a[1]!=b[1]) return a[1]<b[1];
+    return a[0]<b[0];
+  }
+
+  bool operator()(const unsigned int a, const unsigned int b) const { return less(file->getChunk(a).index, file->getChunk(b).index); }
+};
+
+bool TsdSpaceFile::open(const char* filename)
+{
+  _sorted.clear();
+  _paged.clear();
+
+  if(!TsdChunkFile::open(filename)) return false;
+
+  _sorted.resize(getChunkCount());
+  for(unsigned int i=0; i<getChunkCount(); i++)
+    _sorted[i] = i;
+  TsdSpaceChunkOrder order;
+  order.file = this;
+  std::sort(_sorted.begin(), _sorted.end(), order);
+
+  _paged.assign(getChunkCount(), 0);
+
+  return true;
+}
+
+int TsdSpaceFile::findChunk(const int x, const int y, const int z) const
+{
+  const int32_t index[3] = {x, y, z};
+
+  // Binary search in sorted chunk list
+  unsigned int lo = 0;
+  unsigned int hi = _sorted.size();
+  while(lo<hi)
+  {
+    unsigned int mid = (lo+hi)/2;
+    if(TsdSpaceChunkOrder::less(getChunk(_sorted[mid]).index, index))
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  if(lo==_sorted.size()) return -1;
+  const int32_t* found = getChunk(_sorted[lo]).index;
+  if(found[0]!=x || found[1]!=y || found[2]!=z) return -1;
+  return _sorted[lo];
+}
+
+int TsdSpaceFile::findPendingChunk(const int x, const int y, const int z) const
+{
+  int i = findChunk(x, y, z);
+  if(i<0 || _paged[i]) return -1;
+  return i;
+}
+
+unsigned int TsdSpaceFile::getPendingChunkCount() const
+{
+  unsigned int cnt = 0;
+  for(unsigned int i=0; i<_paged.size(); i++)
+    if(!_paged[i]) cnt++;
+  return cnt;
+}
+
+}
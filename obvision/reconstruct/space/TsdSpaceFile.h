@@ -0,0 +1,161 @@
+#ifndef TSDSPACEFILE_H
+#define TSDSPACEFILE_H
+
+#include "obvision/reconstruct/TsdChunkFile.h"
+
+namespace obvious
+{
+
+#define TSDSPACEFILE_MAGIC "OBTSDSP"
+#define TSDSPACEFILE_VERSION 2
+
+enum EnumTsdSpaceChunkFlags { CHUNK_INITIALIZED=1,
+  CHUNK_COLOR=2};
+
+// resolution level of partition is stored in the chunk flags starting at this bit
+#define TSDSPACEFILE_LEVELSHIFT 8
+
+/**
+ * @struct TsdSpaceFileHeader
+ * @brief Header of binary TSD space files
+ */
+struct TsdSpaceFileHeader : public TsdChunkFileHeader
+{
+  uint32_t voxelLayout;
+
+  double voxelSize;
+
+  double maxTruncation;
+
+  int32_t layoutPartition;
+
+  int32_t layoutSpace;
+
+  // partition index of space origin (rolling window)
+  int32_t window[3];
+};
+
+/**
+ * @struct TsdSpaceChunk
+ * @brief Entry of chunk index table
+ */
+struct TsdSpaceChunk : public TsdChunk
+{
+  // global partition index, i.e., including the window offset
+  int32_t index[3];
+};
+
+/**
+ * @class TsdSpaceFile
+ * @brief Memory-mapped binary TSD space file, partition chunks are compressed by TsdSpacePartition::serialize.
+ * Chunks can be decoded independently, i.e., partitions can be paged in on demand.
+ * @author Stefan May
+ */
+class TsdSpaceFile : public TsdChunkFile
+{
+public:
+
+  /**
+   * Constructor
+   */
+  TsdSpaceFile() : TsdChunkFile(TSDSPACEFILE_MAGIC, TSDSPACEFILE_VERSION, sizeof(TsdSpaceFileHeader), sizeof(TsdSpaceChunk)) { }
+
+  /**
+   * Check for binary file format
+   * @param[in] filename file name
+   * @return true, if file starts with the binary magic number
+   */
+  static bool isBinary(const char* filename) { return hasMagic(filename, TSDSPACEFILE_MAGIC); }
+
+  /**
+   * Map file into memory, validate header and index table and prepare lookup of chunks
+   * @param[in] filename file name
+   * @return success
+   */
+  bool open(const char* filename);
+
+  /**
+   * Get file header
+   * @return header
+   */
+  const TsdSpaceFileHeader& getHeader() const { return *(const TsdSpaceFileHeader*)_data; }
+
+  /**
+   * Get entry of index table
+   * @param[in] i chunk number
+   * @return index entry
+   */
+  const TsdSpaceChunk& getChunk(const unsigned int i) const { return ((const TsdSpaceChunk*)_index)[i]; }
+
+  /**
+   * Find chunk of partition
+   * @param[in] x global partition index in x-direction
+   * @param[in] y global partition index in y-direction
+   * @param[in] z global partition index in z-direction
+   * @return chunk number or -1, if partition is not stored
+   */
+  int findChunk(const int x, const int y, const int z) const;
+
+  /**
+   * Find chunk of partition, which has not been paged in yet
+   * @param[in] x global partition index in x-direction
+   * @param[in] y global partition index in y-direction
+   * @param[in] z global partition index in z-direction
+   * @return chunk number or -1
+   */
+  int findPendingChunk(const int x, const int y, const int z) const;
+
+  /**
+   * Mark chunk as paged in. Different chunks may be marked concurrently.
+   * @param[in] i chunk number
+   */
+  void setPaged(const unsigned int i) { _paged[i] = 1; }
+
+  /**
+   * Get number of chunks not paged in so far
+   * @return number of chunks
+   */
+  unsigned int getPendingChunkCount() const;
+
+private:
+
+  // chunk numbers sorted by partition index for lookup
+  std::vector<unsigned int> _sorted;
+
+  std::vector<unsigned char> _paged;
+};
+
+/**
+ * @class TsdSpaceFileWriter
+ * @brief Writer of binary TSD space files
+ * @author Stefan May
+ */
+class TsdSpaceFileWriter : public TsdChunkFileWriter
+{
+public:
+
+  /**
+   * Constructor
+   */
+  TsdSpaceFileWriter() : TsdChunkFileWriter(TSDSPACEFILE_MAGIC, TSDSPACEFILE_VERSION, sizeof(TsdSpaceFileHeader), sizeof(TsdSpaceChunk)) { }
+
+  /**
+   * Create file
+   * @param[in] filename file name
+   * @param[in] header file header, magic, version, checksums, chunk number and index offset are set by the writer
+   * @return success
+   */
+  bool open(const char* filename, const TsdSpaceFileHeader& header) { return TsdChunkFileWriter::open(filename, &header); }
+
+  /**
+   * Append chunk
+   * @param[in] chunk index entry, offset and checksum are determined by the writer
+   * @param[in] data encoded partition data of chunk.size bytes
+   * @return success
+   */
+  bool write(const TsdSpaceChunk& chunk, const unsigned char* data) { return TsdChunkFileWriter::write(&chunk, data); }
+};
+
+}
+
+#endif
@@ -0,0 +1,249 @@
+#include "TsdSpaceFrustum.h"
+#include "SensorProjective3D.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace obvious
+{
+
+TsdSpaceFrustum::TsdSpaceFrustum()
+{
+  _valid = false;
+  _width = 0;
+  _height = 0;
+  _mask = NULL;
+}
+
+bool TsdSpaceFrustum::init(Sensor* sensor)
+{
+  _valid = false;
+
+  SensorProjective3D* projective = dynamic_cast<SensorProjective3D*>(sensor);
+  if(!projective) return false;
+
+  projective->getProjectionMatrix(_P);
+  _width = sensor->getWidth();
+  _height = sensor->getHeight();
+  _mask = sensor->getRealMeasurementMask();
+  const double* data = sensor->getRealMeasurementData();
+
+  // Points project into the image, if w>0, 0<=u/w+0.5<width and 0<=v/w+0.5<height for (u, v, w) = P * x
+  for(unsigned int c=0; c<4; c++)
+  {
+    _planes[0][c] = _P[8+c];
+    _planes[1][c] = _P[c] + 0.5*_P[8+c];
+    _planes[2][c] = (_width-0.5)*_P[8+c] - _P[c];
+    _planes[3][c] = _P[4+c] + 0.5*_P[8+c];
+    _planes[4][c] = (_height-0.5)*_P[8+c] - _P[4+c];
+  }
+
+  // Each level halves the resolution up to a single cell, buffers are kept between frames
+  unsigned int levels = 1;
+  while(((_width-1)>>(levels-1))>0 || ((_height-1)>>(levels-1))>0)
+    levels++;
+  _min.resize(levels);
+  _max.resize(levels);
+  _levelWidth.resize(levels);
+  _levelHeight.resize(levels);
+
+  const double invalid = -std::numeric_limits<double>::infinity();
+  _levelWidth[0] = _width;
+  _levelHeight[0] = _height;
+  _min[0].resize(_width*_height);
+  _max[0].resize(_width*_height);
+  for(unsigned int i=0; i<_width*_height; i++)
+  {
+    const double d = (_mask[i] && !isnan(data[i])) ? data[i] : invalid;
+    _min[0][i] = d;
+    _max[0][i] = d;
+  }
+
+  for(unsigned int l=1; l<levels; l++)
+  {
+    const unsigned int wPrev = _levelWidth[l-1];
+    const unsigned int hPrev = _levelHeight[l-1];
+    const unsigned int w = (wPrev+1)/2;
+    const unsigned int h = (hPrev+1)/2;
+    _levelWidth[l] = w;
+    _levelHeight[l] = h;
+    _min[l].resize(w*h);
+    _max[l].resize(w*h);
+    const double* minPrev = &_min[l-1][0];
+    const double* maxPrev = &_max[l-1][0];
+    for(unsigned int y=0; y<h; y++)
+    {
+      for(unsigned int x=0; x<w; x++)
+      {
+        const unsigned int x0 = 2*x;
+        const unsigned int y0 = 2*y;
+        const unsigned int x1 = std::min(x0+1, wPrev-1);
+        const unsigned int y1 = std::min(y0+1, hPrev-1);
+        const unsigned int i00 = y0*wPrev+x0;
+        const unsigned int i01 = y0*wPrev+x1;
+        const unsigned int i10 = y1*wPrev+x0;
+        const unsigned int i11 = y1*wPrev+x1;
+        _min[l][y*w+x] = std::min(std::min(minPrev[i00], minPrev[i01]), std::min(minPrev[i10], minPrev[i11]));
+        _max[l][y*w+x] = std::max(std::max(maxPrev[i00], maxPrev[i01]), std::max(maxPrev[i10], maxPrev[i11]));
+      }
+    }
+  }
+
+  _valid = true;
+  return true;
+}
+
+bool TsdSpaceFrustum::isOutside(Matrix* edgeCoordsHom) const
+{
+  const Matrix& E = *edgeCoordsHom;
+  for(unsigned int p=0; p<5; p++)
+  {
+    const double* plane = _planes[p];
+    bool outside = true;
+    for(unsigned int i=0; i<8 && outside; i++)
+    {
+      const double t0 = plane[0]*E(i,0);
+      const double t1 = plane[1]*E(i,1);
+      const double t2 = plane[2]*E(i,2);
+      const double t3 = plane[3]*E(i,3);
+
+      // Tolerance avoids culling edges on the border, which are projected into the image by SensorProjective3D::backProject
+      const double tolerance = 1e-9 * (fabs(t0)+fabs(t1)+fabs(t2)+fabs(t3));
+      if(t0+t1+t2+t3 >= -tolerance) outside = false;
+    }
+    if(outside) return true;
+  }
+  return false;
+}
+
+EnumTsdSpaceRange TsdSpaceFrustum::classify(Matrix* edgeCoordsHom, const obfloat minDist, const obfloat maxDist, const bool isLeaf) const
+{
+  if(isOutside(edgeCoordsHom)) return RANGE_OUTSIDE;
+
+  if(!isLeaf) return RANGE_VISIBLE;
+
+  // Image region spanned by edges, edges projected to invalid measurements are skipped like in back projection
+  const Matrix& E = *edgeCoordsHom;
+  const double width = (double)_width;
+  const double height = (double)_height;
+  int region[4] = {(int)_width-1, (int)_height-1, -1, -1};
+  unsigned int validIndices = 0;
+  for(unsigned int i=0; i<8; i++)
+  {
+    const double x = E(i,0);
+    const double y = E(i,1);
+    const double z = E(i,2);
+    const double w = E(i,3);
+    const double dw = _P[8]*x + _P[9]*y + _P[10]*z + _P[11]*w;
+    if(dw <= 0.0) continue;
+
+    const double inv_dw = 1.0 / dw;
+    const double u = (_P[0]*x + _P[1]*y + _P[2]*z + _P[3]*w) * inv_dw + 0.5;
+    const double v = (_P[4]*x + _P[5]*y + _P[6]*z + _P[7]*w) * inv_dw + 0.5;
+    if(u < 0.0 || u >= width || v < 0.0 || v >= height) continue;
+
+    const int col = (int)u;
+    const int row = (int)((_height - 1) - (unsigned int)v);
+    if(!_mask[row*_width+col]) continue;
+
+    region[0] = std::min(region[0], col);
+    region[1] = std::min(region[1], row);
+    region[2] = std::max(region[2], col);
+    region[3] = std::max(region[3], row);
+    validIndices++;
+  }
+
+  if(validIndices==0) return RANGE_OUTSIDE;
+
+  bool visible = false;
+  bool occupied = false;
+  search(_min.size()-1, 0, 0, region, minDist, maxDist, &visible, &occupied);
+
+  if(!visible) return RANGE_OUTSIDE;
+  if(!occupied) return RANGE_EMPTY;
+  return RANGE_VISIBLE;
+}
+
+EnumTsdSpaceRange TsdSpaceFrustum::classifyBox(Matrix* edgeCoordsHom, const obfloat minDist, const obfloat maxDist) const
+{
+  if(isOutside(edgeCoordsHom)) return RANGE_OUTSIDE;
+
+  // The projection of a box in front of the sensor lies within the bounding rectangle of its projected edges, which contains
+  // the image regions of all leafs inside. Edges projected to invalid measurements are kept in contrast to the test of leafs.
+  const Matrix& E = *edgeCoordsHom;
+  double uMin = std::numeric_limits<double>::infinity();
+  double vMin = uMin;
+  double uMax = -uMin;
+  double vMax = -uMin;
+  for(unsigned int i=0; i<8; i++)
+  {
+    const double x = E(i,0);
+    const double y = E(i,1);
+    const double z = E(i,2);
+    const double w = E(i,3);
+    const double dw = _P[8]*x + _P[9]*y + _P[10]*z + _P[11]*w;
+    if(dw <= 0.0) return RANGE_VISIBLE;
+
+    const double inv_dw = 1.0 / dw;
+    const double u = (_P[0]*x + _P[1]*y + _P[2]*z + _P[3]*w) * inv_dw + 0.5;
+    const double v = (_P[4]*x + _P[5]*y + _P[6]*z + _P[7]*w) * inv_dw + 0.5;
+    uMin = std::min(uMin, u);
+    uMax = std::max(uMax, u);
+    vMin = std::min(vMin, v);
+    vMax = std::max(vMax, v);
+  }
+
+  if(uMax < 0.0 || uMin >= _width || vMax < 0.0 || vMin >= _height) return RANGE_OUTSIDE;
+
+  int region[4];
+  region[0] = (int)std::max(uMin, 0.0);
+  region[2] = (int)std::min(uMax, _width - 0.5);
+  region[1] = (int)((_height - 1) - (unsigned int)std::min(vMax, _height - 0.5));
+  region[3] = (int)((_height - 1) - (unsigned int)std::max(vMin, 0.0));
+
+  bool visible = false;
+  bool occupied = false;
+  search(_min.size()-1, 0, 0, region, minDist, maxDist, &visible, &occupied);
+
+  if(!visible) return RANGE_OUTSIDE;
+  if(!occupied) return RANGE_EMPTY;
+  return RANGE_VISIBLE;
+}
+
+void TsdSpaceFrustum::search(const unsigned int level, const unsigned int cx, const unsigned int cy, const int region[4], const obfloat minDist, const obfloat maxDist,
+                             bool* visible, bool* occupied) const
+{
+  const int x0 = cx << level;
+  const int y0 = cy << level;
+  const int x1 = std::min(x0 + (1 << level), (int)_width) - 1;
+  const int y1 = std::min(y0 + (1 << level), (int)_height) - 1;
+  if(x1 < region[0] || x0 > region[2] || y1 < region[1] || y0 > region[3]) return;
+
+  // Cells, whose extrema do not change any flag, need not to be refined
+  const unsigned int i = cy*_levelWidth[level] + cx;
+  const bool addVisible = !*visible && _max[level][i] > minDist;
+  const bool addOccupied = !*occupied && !(_min[level][i] > maxDist);
+  if(!addVisible && !addOccupied) return;
+
+  if(x0 >= region[0] && x1 <= region[2] && y0 >= region[1] && y1 <= region[3])
+  {
+    if(addVisible) *visible = true;
+    if(addOccupied) *occupied = true;
+    return;
+  }
+
+  for(unsigned int dy=0; dy<2; dy++)
+  {
+    for(unsigned int dx=0; dx<2; dx++)
+    {
+      const unsigned int nx = 2*cx + dx;
+      const unsigned int ny = 2*cy + dy;
+      if(nx >= _levelWidth[level-1] || ny >= _levelHeight[level-1]) continue;
+      search(level-1, nx, ny, region, minDist, maxDist, visible, occupied);
+      if(*visible && *occupied) return;
+    }
+  }
+}
+
+}
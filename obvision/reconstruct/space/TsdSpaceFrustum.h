@@ -0,0 +1,108 @@
+#ifndef TSDSPACEFRUSTUM_H
+#define TSDSPACEFRUSTUM_H
+
+#include "obvision/reconstruct/space/TsdSpaceComponent.h"
+
+#include <vector>
+
+namespace obvious
+{
+
+/**
+ * @class TsdSpaceFrustum
+ * @brief Per-frame culling of components for projective sensors.
+ * The view frustum is tested against the edges of components, leafs are additionally tested against a pyramid of minimum
+ * and maximum depths of the measurement image. The result equals the classification by back projection of edges and
+ * scanning of the covered image region, see TsdSpaceComponent::classifyRange.
+ * @author Stefan May
+ */
+class TsdSpaceFrustum
+{
+public:
+
+  /**
+   * Constructor
+   */
+  TsdSpaceFrustum();
+
+  /**
+   * Setup frustum and depth pyramid for the current pose and measurement of a sensor
+   * @param[in] sensor sensor instance
+   * @return false, if the sensor is not projective, i.e., components are classified by back projection
+   */
+  bool init(Sensor* sensor);
+
+  /**
+   * Determine whether the frustum has been set up
+   */
+  bool isValid() const { return _valid; }
+
+  /**
+   * Classify component within working range of the sensor
+   * @param[in] edgeCoordsHom homogeneous coordinates of the 8 box edges
+   * @param[in] minDist closest possible distance of any voxel in the component
+   * @param[in] maxDist farthest possible distance of any voxel in the component
+   * @param[in] isLeaf leafs are tested against the measurement image, branches only against the frustum
+   * @return range classification
+   */
+  EnumTsdSpaceRange classify(Matrix* edgeCoordsHom, const obfloat minDist, const obfloat maxDist, const bool isLeaf) const;
+
+  /**
+   * Classify box of arbitrary size conservatively, e.g., a block of partitions. No leaf within a box classified as RANGE_OUTSIDE
+   * is within range, leafs within a box classified as RANGE_EMPTY are at most empty. Boxes crossing the image plane are RANGE_VISIBLE.
+   * @param[in] edgeCoordsHom homogeneous coordinates of the 8 box edges
+   * @param[in] minDist lower bound of the closest possible distance of leafs within the box
+   * @param[in] maxDist upper bound of the farthest possible distance of leafs within the box
+   * @return range classification
+   */
+  EnumTsdSpaceRange classifyBox(Matrix* edgeCoordsHom, const obfloat minDist, const obfloat maxDist) const;
+
+private:
+
+  /**
+   * Check, whether all edges are on the outer side of any frustum plane
+   */
+  bool isOutside(Matrix* edgeCoordsHom) const;
+
+  /**
+   * Search image region for measurements in front of maxDist or behind minDist. Cells of the pyramid lying completely inside
+   * the region are represented by their extrema, cells crossing its border are refined. The search stops, when both flags are set.
+   * @param[in] level pyramid level
+   * @param[in] cx cell index in x-direction
+   * @param[in] cy cell index in y-direction
+   * @param[in] region pixel bounds (x_min, y_min, x_max, y_max), inclusive
+   * @param[in] minDist closest possible distance
+   * @param[in] maxDist farthest possible distance
+   * @param[in,out] visible any valid measurement is farther than minDist
+   * @param[in,out] occupied any measurement is invalid or not farther than maxDist
+   */
+  void search(const unsigned int level, const unsigned int cx, const unsigned int cy, const int region[4], const obfloat minDist, const obfloat maxDist,
+              bool* visible, bool* occupied) const;
+
+  bool _valid;
+
+  // Projection of world coordinates to homogeneous image coordinates (row-major), see SensorProjective3D::getProjectionMatrix
+  double _P[12];
+
+  // Planes bounding the frustum (near, left, right, bottom, top), points inside have positive distances
+  double _planes[5][4];
+
+  unsigned int _width;
+
+  unsigned int _height;
+
+  const bool* _mask;
+
+  // Extrema of depth per pyramid level, invalid measurements are represented by -inf
+  std::vector< std::vector<double> > _min;
+
+  std::vector< std::vector<double> > _max;
+
+  std::vector<unsigned int> _levelWidth;
+
+  std::vector<unsigned int> _levelHeight;
+};
+
+}
+
+#endif
@@ -3,138 +3,291 @@
 #include "obcore/base/Timer.h"
 #include "obcore/math/mathbase.h"
 #include "TsdSpacePartition.h"
+#include "TsdFusionKernel.h"
+#include "TsdSpacePartitionPool.h"
 
 #include <cstring>
 #include <cmath>
+#include <algorithm>
 
 namespace obvious
 {
 
-Matrix* TsdSpacePartition::_partCoords = NULL;
-Matrix* TsdSpacePartition::_cellCoordsHom = NULL;
+Matrix* TsdSpacePartition::_partCoords[TSDSPACEPARTITION_LEVELS] = {NULL, NULL, NULL};
+Matrix* TsdSpacePartition::_cellCoordsHom[TSDSPACEPARTITION_LEVELS] = {NULL, NULL, NULL};
 
 static int _initializedPartitions = 0;
 
+/**
+ * Initialize separately fused colors to unobserved white
+ */
+static void clearColors(TsdColor* color, const unsigned int voxels)
+{
+  TsdColor white;
+  white.rgb[0] = TsdColor::encodeChannel(255.0);
+  white.rgb[1] = white.rgb[0];
+  white.rgb[2] = white.rgb[0];
+  white.weight = 0;
+  std::fill(color, color+voxels, white);
+}
+
 TsdSpacePartition::TsdSpacePartition(const unsigned int x,
     const unsigned int y,
     const unsigned int z,
     const unsigned int cellsX,
     const unsigned int cellsY,
     const unsigned int cellsZ,
-    const obfloat cellSize) : TsdSpaceComponent(true)
+    const obfloat cellSize,
+    const obfloat* origin,
+    const EnumTsdVoxelLayout layout) : TsdSpaceComponent(true)
 {
   _x = x;
   _y = y;
   _z = z;
 
-  _space = NULL;
+  _layout = layout;
+  _tsd = NULL;
+  _weight = NULL;
+  _rgb = NULL;
+  _color = NULL;
+  _initialized = false;
+  _modified = false;
+  _surface = false;
+  _stamp = 0;
 
   _cellSize = cellSize;
   _componentSize = cellSize * (obfloat)cellsX;
 
   _initWeight = 0.0;
 
-  _edgeCoordsHom = new Matrix(8, 4);
-  (*_edgeCoordsHom)(0, 0) = ((double)x) * _cellSize;
-  (*_edgeCoordsHom)(0, 1) = ((double)y) * _cellSize;
-  (*_edgeCoordsHom)(0, 2) = ((double)z) * _cellSize;
-  (*_edgeCoordsHom)(0, 3) = 1.0;
-
-  (*_edgeCoordsHom)(1, 0) = ((double)(x+cellsX)) * _cellSize;
-  (*_edgeCoordsHom)(1, 1) = ((double)y) * _cellSize;
-  (*_edgeCoordsHom)(1, 2) = ((double)z) * _cellSize;
-  (*_edgeCoordsHom)(1, 3) = 1.0;
-
-  (*_edgeCoordsHom)(2, 0) = ((double)x) * _cellSize;
-  (*_edgeCoordsHom)(2, 1) = ((double)(y+cellsY)) * _cellSize;
-  (*_edgeCoordsHom)(2, 2) = ((double)z) * _cellSize;
-  (*_edgeCoordsHom)(2, 3) = 1.0;
-
-  (*_edgeCoordsHom)(3, 0) = ((double)(x+cellsX)) * _cellSize;
-  (*_edgeCoordsHom)(3, 1) = ((double)(y+cellsY)) * _cellSize;
-  (*_edgeCoordsHom)(3, 2) = ((double)z) * _cellSize;
-  (*_edgeCoordsHom)(3, 3) = 1.0;
-
-  (*_edgeCoordsHom)(4, 0) = ((double)x) * _cellSize;
-  (*_edgeCoordsHom)(4, 1) = ((double)y) * _cellSize;
-  (*_edgeCoordsHom)(4, 2) = ((double)(z+cellsZ)) * _cellSize;
-  (*_edgeCoordsHom)(4, 3) = 1.0;
-
-  (*_edgeCoordsHom)(5, 0) = ((double)(x+cellsX)) * _cellSize;
-  (*_edgeCoordsHom)(5, 1) = ((double)y) * _cellSize;
-  (*_edgeCoordsHom)(5, 2) = ((double)(z+cellsZ)) * _cellSize;
-  (*_edgeCoordsHom)(5, 3) = 1.0;
-
-  (*_edgeCoordsHom)(6, 0) = ((double)x) * _cellSize;
-  (*_edgeCoordsHom)(6, 1) = ((double)(y+cellsY)) * _cellSize;
-  (*_edgeCoordsHom)(6, 2) = ((double)(z+cellsZ)) * _cellSize;
-  (*_edgeCoordsHom)(6, 3) = 1.0;
-
-  (*_edgeCoordsHom)(7, 0) = ((double)(x+cellsX)) * _cellSize;
-  (*_edgeCoordsHom)(7, 1) = ((double)(y+cellsY)) * _cellSize;
-  (*_edgeCoordsHom)(7, 2) = ((double)(z+cellsZ)) * _cellSize;
-  (*_edgeCoordsHom)(7, 3) = 1.0;
-
-  _centroid[0] = ((*_edgeCoordsHom)(7, 0)+(*_edgeCoordsHom)(0, 0)) * 0.5;
-  _centroid[1] = ((*_edgeCoordsHom)(7, 1)+(*_edgeCoordsHom)(0, 1)) * 0.5;
-  _centroid[2] = ((*_edgeCoordsHom)(7, 2)+(*_edgeCoordsHom)(0, 2)) * 0.5;
-
-  obfloat dx = ((*_edgeCoordsHom)(7, 0)-(*_edgeCoordsHom)(0, 0));
-  obfloat dy = ((*_edgeCoordsHom)(7, 1)-(*_edgeCoordsHom)(0, 1));
-  obfloat dz = ((*_edgeCoordsHom)(7, 2)-(*_edgeCoordsHom)(0, 2));
-  _circumradius = sqrt(dx*dx + dy*dy + dz*dz) * 0.5;
-
   _cellsX = cellsX;
   _cellsY = cellsY;
   _cellsZ = cellsZ;
 
-  if(!_partCoords)
+  initLevel(0);
+
+  _edgeCoordsHom = new Matrix(8, 4);
+  relocate(x, y, z, origin);
+
+  initCoordinates(cellsX, cellsY, cellsZ, cellSize);
+}
+
+TsdSpacePartitionPool* TsdSpacePartition::getPool(const unsigned int voxels, const EnumTsdVoxelLayout layout, size_t* offsetWeight)
+{
+  // Tsd and weight planes share one pooled block, the weight plane starts at an 8 byte boundary
+  size_t sizeTsd = voxels * ((layout==VOXEL_COMPACT) ? sizeof(TsdVoxelCompact::TsdType) : sizeof(TsdVoxelFull::TsdType));
+  size_t sizeWeight = voxels * ((layout==VOXEL_COMPACT) ? sizeof(TsdVoxelCompact::WeightType) : sizeof(TsdVoxelFull::WeightType));
+  *offsetWeight = (sizeTsd + 7) / 8 * 8;
+  return TsdSpacePartitionPool::getPool(*offsetWeight + sizeWeight);
+}
+
+void TsdSpacePartition::initLevel(const unsigned int level)
+{
+  _level = level;
+  _resX = _cellsX >> level;
+  _resY = _cellsY >> level;
+  _resZ = _cellsZ >> level;
+
+  // Voxel arrays include a border layer, which is filled with the content of neighboring partitions
+  _strideY = _resX+1;
+  _strideZ = _strideY*(_resY+1);
+  _voxels  = _strideZ*(_resZ+1);
+
+  _pool = getPool(_voxels, _layout, &_offsetWeight);
+  _poolColor = TsdSpacePartitionPool::getPool(3*_voxels);
+  _poolColorSeparate = TsdSpacePartitionPool::getPool(sizeof(TsdColor)*_voxels);
+}
+
+unsigned int TsdSpacePartition::getMaxLevel() const
+{
+  // At least two voxels per dimension are kept
+  unsigned int level = 0;
+  while(level+1<TSDSPACEPARTITION_LEVELS && (_cellsX>>(level+1))>=2 && (_cellsY>>(level+1))>=2 && (_cellsZ>>(level+1))>=2)
+    level++;
+  return level;
+}
+
+void TsdSpacePartition::setLevel(unsigned int level)
+{
+  level = min(level, getMaxLevel());
+  if(level==_level) return;
+
+  if(!_initialized)
   {
-    _partCoords = new Matrix(cellsX*cellsY*cellsZ, 3);
-    unsigned int i=0;
-    for(unsigned int iz=0; iz<cellsZ; iz++)
+    // Memory blocks of the previous level do not fit
+    _pool->release(_tsd);
+    _poolColor->release(_rgb);
+    _poolColorSeparate->release(_color);
+    _tsd = NULL;
+    _weight = NULL;
+    _rgb = NULL;
+    _color = NULL;
+    initLevel(level);
+    return;
+  }
+
+  // Hand over previous voxel data to a temporary partition for resampling, memory is released with it
+  TsdSpacePartition prev(_x, _y, _z, _cellsX, _cellsY, _cellsZ, _cellSize, NULL, _layout);
+  prev.initLevel(_level);
+  prev._tsd = _tsd;
+  prev._weight = _weight;
+  prev._rgb = _rgb;
+  prev._color = _color;
+  _tsd = NULL;
+  _weight = NULL;
+  _rgb = NULL;
+  _color = NULL;
+  initLevel(level);
+
+  if(_layout==VOXEL_COMPACT)
+    initVoxels<TsdVoxelCompact>();
+  else
+    initVoxels<TsdVoxelFull>();
+  if(prev.hasColor()) prepareColor(prev._color!=NULL);
+
+  const unsigned int scale = 1 << _level;
+  for(unsigned int z=0; z<=_resZ; z++)
+  {
+    for(unsigned int y=0; y<=_resY; y++)
     {
-      for(unsigned int iy=0; iy<cellsY; iy++)
+      for(unsigned int x=0; x<=_resX; x++)
       {
-        for(unsigned int ix=0; ix<cellsX; ix++, i++)
-        {
-          (*_partCoords)(i, 0) = ix;
-          (*_partCoords)(i, 1) = iy;
-          (*_partCoords)(i, 2) = iz;
-        }
+        // Voxel centers in units of full resolution cells
+        obfloat p[3] = {((obfloat)x+0.5)*scale, ((obfloat)y+0.5)*scale, ((obfloat)z+0.5)*scale};
+        unsigned int i = getIndex(z, y, x);
+        unsigned int iPrev = prev.getNearestIndex(p);
+        obfloat tsd = prev.interpolateTrilinearLevel(p);
+        if(isnan(tsd)) tsd = prev.getTsd(iPrev);
+        setVoxel(i, tsd, prev.getWeight(iPrev));
+        if(prev.hasColor()) copyColor(i, &prev, iPrev);
       }
     }
   }
 
-  _cellCoordsOffset[0] = ((obfloat)_x) * _cellSize;
-  _cellCoordsOffset[1] = ((obfloat)_y) * _cellSize;
-  _cellCoordsOffset[2] = ((obfloat)_z) * _cellSize;
+  _modified = true;
+}
+
+unsigned int TsdSpacePartition::getNearestIndex(const obfloat p[3]) const
+{
+  const obfloat invScale = 1.0 / (obfloat)(1 << _level);
+  unsigned int x = (unsigned int)max(p[0] * invScale, 0.0);
+  unsigned int y = (unsigned int)max(p[1] * invScale, 0.0);
+  unsigned int z = (unsigned int)max(p[2] * invScale, 0.0);
+  return getIndex(min(z, _resZ), min(y, _resY), min(x, _resX));
+}
+
+obfloat TsdSpacePartition::interpolateTrilinearLevel(const obfloat p[3]) const
+{
+  // Coordinates of voxel centers in resolution of level, queries beyond the outmost voxel centers are clamped
+  const obfloat invScale = 1.0 / (obfloat)(1 << _level);
+  const unsigned int res[3] = {_resX, _resY, _resZ};
+  unsigned int idx[3];
+  obfloat w[3];
+  for(unsigned int j=0; j<3; j++)
+  {
+    obfloat q = p[j] * invScale - 0.5;
+    q = max(q, 0.0);
+    q = min(q, (obfloat)res[j]);
+    idx[j] = min((unsigned int)q, res[j]-1);
+    w[j] = min(q - (obfloat)idx[j], 1.0);
+  }
+  if(_layout==VOXEL_COMPACT)
+    return interpolateTrilinearVoxels<TsdVoxelCompact>(getIndex(idx[2], idx[1], idx[0]), w[0], w[1], w[2]);
+  return interpolateTrilinearVoxels<TsdVoxelFull>(getIndex(idx[2], idx[1], idx[0]), w[0], w[1], w[2]);
+}
+
+void TsdSpacePartition::reserve(const unsigned int cellsX, const unsigned int cellsY, const unsigned int cellsZ, const EnumTsdVoxelLayout layout, const unsigned int partitions)
+{
+  size_t offsetWeight;
+  getPool((cellsX+1)*(cellsY+1)*(cellsZ+1), layout, &offsetWeight)->reserve(partitions);
+}
 
-  if(!_cellCoordsHom)
+void TsdSpacePartition::initCoordinates(const unsigned int cellsX, const unsigned int cellsY, const unsigned int cellsZ, const obfloat cellSize)
+{
+  for(unsigned int level=0; level<TSDSPACEPARTITION_LEVELS; level++)
   {
-    _cellCoordsHom = new Matrix(_cellsX*_cellsY*_cellsZ, 4);
-    unsigned int i=0;
-    for(unsigned int iz=0; iz<_cellsZ; iz++)
+    const unsigned int resX = cellsX >> level;
+    const unsigned int resY = cellsY >> level;
+    const unsigned int resZ = cellsZ >> level;
+    const obfloat size = cellSize * (obfloat)(1 << level);
+    if(resX*resY*resZ==0) break;
+
+    if(!_partCoords[level])
     {
-      for(unsigned int iy=0; iy<_cellsY; iy++)
+      _partCoords[level] = new Matrix(resX*resY*resZ, 3);
+      unsigned int i=0;
+      for(unsigned int iz=0; iz<resZ; iz++)
       {
-        for(unsigned int ix=0; ix<_cellsX; ix++, i++)
+        for(unsigned int iy=0; iy<resY; iy++)
         {
-          (*_cellCoordsHom)(i,0) = ((double)ix + 0.5) * _cellSize;
-          (*_cellCoordsHom)(i,1) = ((double)iy + 0.5) * _cellSize;
-          (*_cellCoordsHom)(i,2) = ((double)iz + 0.5) * _cellSize;
-          (*_cellCoordsHom)(i,3) = 1.0;
+          for(unsigned int ix=0; ix<resX; ix++, i++)
+          {
+            (*_partCoords[level])(i, 0) = ix;
+            (*_partCoords[level])(i, 1) = iy;
+            (*_partCoords[level])(i, 2) = iz;
+          }
+        }
+      }
+    }
+
+    if(!_cellCoordsHom[level])
+    {
+      _cellCoordsHom[level] = new Matrix(resX*resY*resZ, 4);
+      unsigned int i=0;
+      for(unsigned int iz=0; iz<resZ; iz++)
+      {
+        for(unsigned int iy=0; iy<resY; iy++)
+        {
+          for(unsigned int ix=0; ix<resX; ix++, i++)
+          {
+            (*_cellCoordsHom[level])(i,0) = ((double)ix + 0.5) * size;
+            (*_cellCoordsHom[level])(i,1) = ((double)iy + 0.5) * size;
+            (*_cellCoordsHom[level])(i,2) = ((double)iz + 0.5) * size;
+            (*_cellCoordsHom[level])(i,3) = 1.0;
+          }
         }
       }
     }
   }
 }
 
+void TsdSpacePartition::calcEdgeCoords(const unsigned int x, const unsigned int y, const unsigned int z,
+    const unsigned int cellsX, const unsigned int cellsY, const unsigned int cellsZ, const obfloat cellSize,
+    Matrix* edgeCoordsHom, obfloat centroid[3], obfloat* circumradius, const obfloat* origin)
+{
+  obfloat o[3] = {0.0, 0.0, 0.0};
+  if(origin)
+  {
+    o[0] = origin[0];
+    o[1] = origin[1];
+    o[2] = origin[2];
+  }
+
+  Matrix& E = *edgeCoordsHom;
+  for(unsigned int i=0; i<8; i++)
+  {
+    // bit 0: x-, bit 1: y-, bit 2: z-direction
+    E(i, 0) = o[0] + ((double)(x + ((i&1) ? cellsX : 0))) * cellSize;
+    E(i, 1) = o[1] + ((double)(y + ((i&2) ? cellsY : 0))) * cellSize;
+    E(i, 2) = o[2] + ((double)(z + ((i&4) ? cellsZ : 0))) * cellSize;
+    E(i, 3) = 1.0;
+  }
+
+  centroid[0] = (E(7, 0)+E(0, 0)) * 0.5;
+  centroid[1] = (E(7, 1)+E(0, 1)) * 0.5;
+  centroid[2] = (E(7, 2)+E(0, 2)) * 0.5;
+
+  obfloat dx = (E(7, 0)-E(0, 0));
+  obfloat dy = (E(7, 1)-E(0, 1));
+  obfloat dz = (E(7, 2)-E(0, 2));
+  *circumradius = sqrt(dx*dx + dy*dy + dz*dz) * 0.5;
+}
+
 TsdSpacePartition::~TsdSpacePartition()
 {
   reset();
 
-  delete [] _edgeCoordsHom; _edgeCoordsHom = NULL;
+  delete _edgeCoordsHom; _edgeCoordsHom = NULL;
 }
 
 int TsdSpacePartition::getInitializedPartitionSize()
@@ -144,50 +297,488 @@ int TsdSpacePartition::getInitializedPartitionSize()
 
 void TsdSpacePartition::reset()
 {
-  if(_space)
+  if(_initialized)
+  {
+#pragma omp atomic
+    _initializedPartitions--;
+  }
+  _initialized = false;
+
+  _pool->release(_tsd);
+  _poolColor->release(_rgb);
+  _poolColorSeparate->release(_color);
+  _tsd = NULL;
+  _weight = NULL;
+  _rgb = NULL;
+  _color = NULL;
+}
+
+void TsdSpacePartition::recycle()
+{
+  if(_initialized)
   {
-    System<TsdVoxel>::deallocate(_space); _space = NULL;
+#pragma omp atomic
+    _initializedPartitions--;
   }
+  _initialized = false;
+  _modified = false;
+  _surface = false;
+  _initWeight = 0.0;
+
+  // Colors are allocated again, when the partition is fused with colored measurements
+  _poolColor->release(_rgb);
+  _poolColorSeparate->release(_color);
+  _rgb = NULL;
+  _color = NULL;
+
+  // Voxel memory is kept for the finest level only, which partitions are created with
+  if(_level!=0)
+  {
+    _pool->release(_tsd);
+    _tsd = NULL;
+    _weight = NULL;
+    initLevel(0);
+  }
+}
+
+void TsdSpacePartition::relocate(const unsigned int x, const unsigned int y, const unsigned int z, const obfloat* origin)
+{
+  _x = x;
+  _y = y;
+  _z = z;
+
+  calcEdgeCoords(x, y, z, _cellsX, _cellsY, _cellsZ, _cellSize, _edgeCoordsHom, _centroid, &_circumradius, origin);
+
+  _cellCoordsOffset[0] = (*_edgeCoordsHom)(0, 0);
+  _cellCoordsOffset[1] = (*_edgeCoordsHom)(0, 1);
+  _cellCoordsOffset[2] = (*_edgeCoordsHom)(0, 2);
+}
+
+void TsdSpacePartition::cloneVoxels(const TsdSpacePartition* src)
+{
+  if(_level!=src->_level)
+  {
+    // Memory blocks of the previous level do not fit
+    _pool->release(_tsd);
+    _poolColor->release(_rgb);
+    _poolColorSeparate->release(_color);
+    _tsd = NULL;
+    _weight = NULL;
+    _rgb = NULL;
+    _color = NULL;
+    initLevel(src->_level);
+  }
+
+  if(src->_initialized)
+  {
+    if(!_tsd)
+    {
+      _tsd    = _pool->allocate();
+      _weight = (unsigned char*)_tsd + _offsetWeight;
+    }
+    memcpy(_tsd, src->_tsd, _pool->getBlockSize());
+  }
+
+  // Otherwise the color plane would be reinitialized with the first measurement
+  if(src->_rgb && src->_initialized)
+  {
+    if(!_rgb) _rgb = (unsigned char*)_poolColor->allocate();
+    memcpy(_rgb, src->_rgb, 3*_voxels);
+  }
+  else
+  {
+    _poolColor->release(_rgb);
+    _rgb = NULL;
+  }
+
+  if(src->_color && src->_initialized)
+  {
+    if(!_color) _color = (TsdColor*)_poolColorSeparate->allocate();
+    memcpy(_color, src->_color, sizeof(TsdColor)*_voxels);
+  }
+  else
+  {
+    _poolColorSeparate->release(_color);
+    _color = NULL;
+  }
+
+  if(_initialized!=src->_initialized)
+  {
+    if(src->_initialized)
+    {
+#pragma omp atomic
+      _initializedPartitions++;
+    }
+    else
+    {
+#pragma omp atomic
+      _initializedPartitions--;
+    }
+  }
+
+  _initialized = src->_initialized;
+  _modified    = src->_modified;
+  _surface     = src->_surface;
+  _initWeight  = src->_initWeight;
+}
+
+void TsdSpacePartition::swapVoxels(TsdSpacePartition* other)
+{
+  std::swap(_tsd, other->_tsd);
+  std::swap(_weight, other->_weight);
+  std::swap(_rgb, other->_rgb);
+  std::swap(_color, other->_color);
+  std::swap(_pool, other->_pool);
+  std::swap(_poolColor, other->_poolColor);
+  std::swap(_poolColorSeparate, other->_poolColorSeparate);
+  std::swap(_offsetWeight, other->_offsetWeight);
+  std::swap(_level, other->_level);
+  std::swap(_resX, other->_resX);
+  std::swap(_resY, other->_resY);
+  std::swap(_resZ, other->_resZ);
+  std::swap(_strideY, other->_strideY);
+  std::swap(_strideZ, other->_strideZ);
+  std::swap(_voxels, other->_voxels);
+  std::swap(_initialized, other->_initialized);
+  std::swap(_modified, other->_modified);
+  std::swap(_surface, other->_surface);
+  std::swap(_initWeight, other->_initWeight);
 }
 
 void TsdSpacePartition::getRGB(unsigned int z, unsigned int y, unsigned int x, unsigned char rgb[3])
 {
-  rgb[0] = _space[z][y][x].rgb[0];
-  rgb[1] = _space[z][y][x].rgb[1];
-  rgb[2] = _space[z][y][x].rgb[2];
+  if(_color)
+  {
+    const TsdColor& c = _color[getCellIndex(z, y, x)];
+    rgb[0] = TsdColor::decodeChannel(c.rgb[0]);
+    rgb[1] = TsdColor::decodeChannel(c.rgb[1]);
+    rgb[2] = TsdColor::decodeChannel(c.rgb[2]);
+    return;
+  }
+  if(!_rgb)
+  {
+    rgb[0] = 255;
+    rgb[1] = 255;
+    rgb[2] = 255;
+    return;
+  }
+  unsigned char* c = &_rgb[3*getCellIndex(z, y, x)];
+  rgb[0] = c[0];
+  rgb[1] = c[1];
+  rgb[2] = c[2];
 }
 
-void TsdSpacePartition::init()
+void TsdSpacePartition::interpolateTrilinearRGB(int x, int y, int z, obfloat dx, obfloat dy, obfloat dz, unsigned char rgb[3]) const
 {
-  if(_space) return;
+  if(!hasColor())
+  {
+    rgb[0] = 255;
+    rgb[1] = 255;
+    rgb[2] = 255;
+    return;
+  }
 
-  _initializedPartitions++;
+  // Voxels of coarser levels cover several cells, neighbors are addressed by strides at full resolution
+  unsigned int idx[8];
+  if(_level)
+  {
+    idx[0] = getCellIndex(z,   y,   x);
+    idx[1] = getCellIndex(z+1, y,   x);
+    idx[2] = getCellIndex(z,   y+1, x);
+    idx[3] = getCellIndex(z+1, y+1, x);
+    idx[4] = getCellIndex(z,   y,   x+1);
+    idx[5] = getCellIndex(z+1, y,   x+1);
+    idx[6] = getCellIndex(z,   y+1, x+1);
+    idx[7] = getCellIndex(z+1, y+1, x+1);
+  }
+  else
+  {
+    const unsigned int i = getIndex(z, y, x);
+    idx[0] = i;
+    idx[1] = i + _strideZ;
+    idx[2] = i + _strideY;
+    idx[3] = i + _strideZ + _strideY;
+    idx[4] = i + 1;
+    idx[5] = i + _strideZ + 1;
+    idx[6] = i + _strideY + 1;
+    idx[7] = i + _strideZ + _strideY + 1;
+  }
+
+  obfloat w[8];
+  w[0] = (1. - dx) * (1. - dy) * (1. - dz);
+  w[1] = (1. - dx) * (1. - dy) * dz;
+  w[2] = (1. - dx) * dy * (1. - dz);
+  w[3] = (1. - dx) * dy * dz;
+  w[4] = dx * (1. - dy) * (1. - dz);
+  w[5] = dx * (1. - dy) * dz;
+  w[6] = dx * dy * (1. - dz);
+  w[7] = dx * dy * dz;
+
+  // Channels are accumulated in floating point and rounded once
+  obfloat c[3] = {0.0, 0.0, 0.0};
+  obfloat scale = 1.0;
+  if(_color)
+  {
+    obfloat sum = 0.0;
+    for(unsigned int j=0; j<8; j++)
+    {
+      const TsdColor& v = _color[idx[j]];
+      if(v.weight==0) continue;
+      c[0] += w[j] * v.rgb[0];
+      c[1] += w[j] * v.rgb[1];
+      c[2] += w[j] * v.rgb[2];
+      sum  += w[j];
+    }
+    if(!(sum > 0.0))
+    {
+      rgb[0] = 255;
+      rgb[1] = 255;
+      rgb[2] = 255;
+      return;
+    }
+    scale = 1.0 / (256.0 * sum);
+  }
+  else
+  {
+    for(unsigned int j=0; j<8; j++)
+    {
+      const unsigned char* v = &_rgb[3*idx[j]];
+      c[0] += w[j] * v[0];
+      c[1] += w[j] * v[1];
+      c[2] += w[j] * v[2];
+    }
+  }
+
+  rgb[0] = (unsigned char)min(c[0] * scale + 0.5, 255.0);
+  rgb[1] = (unsigned char)min(c[1] * scale + 0.5, 255.0);
+  rgb[2] = (unsigned char)min(c[2] * scale + 0.5, 255.0);
+}
+
+void TsdSpacePartition::copyColor(const unsigned int i, const TsdSpacePartition* src, const unsigned int iSrc)
+{
+  // The representation of the destination is kept, e.g., for neighbors fused before changing the fusion policy
+  if(!hasColor()) prepareColor(src->_color!=NULL);
+
+  if(_color)
+  {
+    if(src->_color)
+    {
+      _color[i] = src->_color[iSrc];
+    }
+    else
+    {
+      TsdColor& c = _color[i];
+      c.rgb[0] = TsdColor::encodeChannel(src->_rgb[3*iSrc]);
+      c.rgb[1] = TsdColor::encodeChannel(src->_rgb[3*iSrc+1]);
+      c.rgb[2] = TsdColor::encodeChannel(src->_rgb[3*iSrc+2]);
+      c.weight = TsdVoxelCompact::encodeWeight(isnan(src->getTsd(iSrc)) ? 0.0 : src->getWeight(iSrc));
+    }
+  }
+  else
+  {
+    if(src->_rgb)
+    {
+      _rgb[3*i]   = src->_rgb[3*iSrc];
+      _rgb[3*i+1] = src->_rgb[3*iSrc+1];
+      _rgb[3*i+2] = src->_rgb[3*iSrc+2];
+    }
+    else
+    {
+      const TsdColor& c = src->_color[iSrc];
+      _rgb[3*i]   = TsdColor::decodeChannel(c.rgb[0]);
+      _rgb[3*i+1] = TsdColor::decodeChannel(c.rgb[1]);
+      _rgb[3*i+2] = TsdColor::decodeChannel(c.rgb[2]);
+    }
+  }
+}
+
+void TsdSpacePartition::copyVoxel(unsigned int i, const TsdSpacePartition* src, unsigned int iSrc)
+{
+  if(_layout==VOXEL_COMPACT)
+  {
+    ((TsdVoxelCompact::TsdType*)_tsd)[i]       = ((TsdVoxelCompact::TsdType*)src->_tsd)[iSrc];
+    ((TsdVoxelCompact::WeightType*)_weight)[i] = ((TsdVoxelCompact::WeightType*)src->_weight)[iSrc];
+  }
+  else
+  {
+    ((TsdVoxelFull::TsdType*)_tsd)[i]       = ((TsdVoxelFull::TsdType*)src->_tsd)[iSrc];
+    ((TsdVoxelFull::WeightType*)_weight)[i] = ((TsdVoxelFull::WeightType*)src->_weight)[iSrc];
+  }
+
+  if(src->hasColor()) copyColor(i, src, iSrc);
+}
+
+/**
+ * Determine voxel of neighbor corresponding to a border voxel along one axis
+ * @param[in] i voxel index of border
+ * @param[in] o 1, if the neighbor is located in positive direction of the axis, 0 if it is aligned
+ * @return voxel index of neighbor
+ */
+static inline unsigned int borderSource(const unsigned int i, const unsigned int o, const unsigned int cells, const unsigned int scale,
+                                        const unsigned int scaleNeighbor, const unsigned int resNeighbor)
+{
+  // Doubled voxel center in units of full resolution cells relative to neighbor
+  const unsigned int center = (2*i+1)*scale - (o ? 2*cells : 0);
+  return min(center / (2*scaleNeighbor), resNeighbor-1);
+}
+
+void TsdSpacePartition::copyBorder(const TsdSpacePartition* neighbor, const unsigned int ox, const unsigned int oy, const unsigned int oz)
+{
+  // Partitions of different levels are connected by sampling the nearest voxel of the neighbor
+  const unsigned int scale = 1 << _level;
+  const unsigned int scaleNeighbor = 1 << neighbor->_level;
+  const unsigned int x0 = ox ? _resX : 0;
+  const unsigned int y0 = oy ? _resY : 0;
+  const unsigned int z0 = oz ? _resZ : 0;
+  const unsigned int x1 = ox ? _resX : _resX-1;
+  const unsigned int y1 = oy ? _resY : _resY-1;
+  const unsigned int z1 = oz ? _resZ : _resZ-1;
 
-  System<TsdVoxel>::allocate(_cellsZ+1, _cellsY+1, _cellsX+1, _space);
-  for (unsigned int iz = 0; iz < _cellsZ+1; iz++)
+  for(unsigned int z=z0; z<=z1; z++)
   {
-    for (unsigned int iy = 0; iy < _cellsY+1; iy++)
+    unsigned int zSrc = borderSource(z, oz, _cellsZ, scale, scaleNeighbor, neighbor->_resZ);
+    for(unsigned int y=y0; y<=y1; y++)
     {
-      for (unsigned int ix = 0; ix < _cellsX+1; ix++)
+      unsigned int ySrc = borderSource(y, oy, _cellsY, scale, scaleNeighbor, neighbor->_resY);
+      for(unsigned int x=x0; x<=x1; x++)
       {
-        _space[iz][iy][ix].tsd    = NAN;
-        _space[iz][iy][ix].weight = _initWeight;
-        _space[iz][iy][ix].rgb[0] = 255;
-        _space[iz][iy][ix].rgb[1] = 255;
-        _space[iz][iy][ix].rgb[2] = 255;
+        unsigned int xSrc = borderSource(x, ox, _cellsX, scale, scaleNeighbor, neighbor->_resX);
+        copyVoxel(getIndex(z, y, x), neighbor, neighbor->getIndex(zSrc, ySrc, xSrc));
       }
     }
   }
 }
 
+unsigned int TsdSpacePartition::getVoxelMemory() const
+{
+  unsigned int bytes = 0;
+  if(_tsd)
+  {
+    if(_layout==VOXEL_COMPACT)
+      bytes += _voxels * (sizeof(TsdVoxelCompact::TsdType) + sizeof(TsdVoxelCompact::WeightType));
+    else
+      bytes += _voxels * (sizeof(TsdVoxelFull::TsdType) + sizeof(TsdVoxelFull::WeightType));
+  }
+  if(_rgb) bytes += 3*_voxels;
+  if(_color) bytes += sizeof(TsdColor)*_voxels;
+  return bytes;
+}
+
+template<class L>
+void TsdSpacePartition::initVoxels()
+{
+  // Memory of recycled partitions is reused
+  if(!_tsd)
+  {
+    _tsd    = _pool->allocate();
+    _weight = (unsigned char*)_tsd + _offsetWeight;
+  }
+
+  // Planes are filled separately, which lets the compiler emit vectorized stores
+  typename L::TsdType* tsd = (typename L::TsdType*)_tsd;
+  typename L::WeightType* weight = (typename L::WeightType*)_weight;
+  std::fill(tsd, tsd+_voxels, L::encodeTsd(NAN));
+  std::fill(weight, weight+_voxels, L::encodeWeight(_initWeight));
+
+  if(_rgb) memset(_rgb, 255, 3*_voxels);
+  if(_color) clearColors(_color, _voxels);
+}
+
+void TsdSpacePartition::init()
+{
+  if(_initialized) return;
+
+#pragma omp atomic
+  _initializedPartitions++;
+
+  if(_layout==VOXEL_COMPACT)
+    initVoxels<TsdVoxelCompact>();
+  else
+    initVoxels<TsdVoxelFull>();
+
+  _initialized = true;
+  _modified = true;
+}
+
+void TsdSpacePartition::initColor()
+{
+  _rgb = (unsigned char*)_poolColor->allocate();
+  memset(_rgb, 255, 3*_voxels);
+}
+
+void TsdSpacePartition::prepareColor(const bool separate)
+{
+  if(separate)
+  {
+    if(_color) return;
+    _color = (TsdColor*)_poolColorSeparate->allocate();
+    if(!_rgb)
+    {
+      clearColors(_color, _voxels);
+      return;
+    }
+
+    // Colors have been averaged with the weights of the geometry so far
+    for(unsigned int i=0; i<_voxels; i++)
+    {
+      TsdColor& c = _color[i];
+      c.rgb[0] = TsdColor::encodeChannel(_rgb[3*i]);
+      c.rgb[1] = TsdColor::encodeChannel(_rgb[3*i+1]);
+      c.rgb[2] = TsdColor::encodeChannel(_rgb[3*i+2]);
+      c.weight = TsdVoxelCompact::encodeWeight((!_initialized || isnan(getTsd(i))) ? 0.0 : getWeight(i));
+    }
+    _poolColor->release(_rgb);
+    _rgb = NULL;
+  }
+  else
+  {
+    if(_rgb) return;
+    initColor();
+    if(!_color) return;
+
+    for(unsigned int i=0; i<_voxels; i++)
+    {
+      const TsdColor& c = _color[i];
+      _rgb[3*i]   = TsdColor::decodeChannel(c.rgb[0]);
+      _rgb[3*i+1] = TsdColor::decodeChannel(c.rgb[1]);
+      _rgb[3*i+2] = TsdColor::decodeChannel(c.rgb[2]);
+    }
+    _poolColorSeparate->release(_color);
+    _color = NULL;
+  }
+}
+
 bool TsdSpacePartition::isInitialized()
 {
-  return _space!=NULL;
+  return _initialized;
 }
 
 bool TsdSpacePartition::isEmpty()
 {
-  return (_space==NULL && _initWeight > 0.0);
+  return (!_initialized && _initWeight > 0.0);
+}
+
+template<class L>
+bool TsdSpacePartition::hasSurfaceVoxels() const
+{
+  const typename L::TsdType* tsd = (const typename L::TsdType*)_tsd;
+  for(unsigned int i=0; i<_voxels; i++)
+  {
+    // Free space is truncated to TSDINC, unobserved voxels (NaN) fail the test as well.
+    // Voxels at -TSDINC count as well, since they produce a sign change next to free space.
+    if(L::decodeTsd(tsd[i]) < TSDINC) return true;
+  }
+  return false;
+}
+
+void TsdSpacePartition::updateSurface()
+{
+  if(!_initialized)
+    _surface = false;
+  else if(_layout==VOXEL_COMPACT)
+    _surface = hasSurfaceVoxels<TsdVoxelCompact>();
+  else
+    _surface = hasSurfaceVoxels<TsdVoxelFull>();
 }
 
 void TsdSpacePartition::getCellCoordsOffset(obfloat offset[3])
@@ -197,107 +788,257 @@ void TsdSpacePartition::getCellCoordsOffset(obfloat offset[3])
   offset[2] = _cellCoordsOffset[2];
 }
 
-void TsdSpacePartition::addTsd(const unsigned int x, const unsigned int y, const unsigned int z, const obfloat sd, const obfloat maxTruncation, const unsigned char rgb[3])
+template<class L>
+void TsdSpacePartition::addTsdVoxel(const unsigned int i, const obfloat tsd, const obfloat inc, const obfloat decay, const obfloat maxWeight, const unsigned char rgb[3])
 {
-  // already checked int TsdSpace
-  //if(sd >= -maxTruncation)
+  typename L::TsdType* voxelTsd = &((typename L::TsdType*)_tsd)[i];
+  typename L::WeightType* voxelWeight = &((typename L::WeightType*)_weight)[i];
+
+  // Weighting of measurements is determined by the fusion policy, see TsdFusionPolicy
+  obfloat weight = L::decodeWeight(*voxelWeight) * decay + inc;
+  obfloat tsdPrev = L::decodeTsd(*voxelTsd);
+
+  if(isnan(tsdPrev))
+  {
+    *voxelTsd = L::encodeTsd(tsd);
+    if(rgb)
+    {
+      _rgb[3*i]   = rgb[0];
+      _rgb[3*i+1] = rgb[1];
+      _rgb[3*i+2] = rgb[2];
+    }
+  }
+  else
   {
-    TsdVoxel* voxel = &_space[z][y][x];
-
-    obfloat tsd = min(sd / maxTruncation, TSDINC);
-
-    /** The following lines were proposed by
-     *  E. Bylow, J. Sturm, C. Kerl, F. Kahl, and D. Cremers.
-     *  Real-time camera tracking and 3d reconstruction using signed distance functions.
-     *  In Robotics: Science and Systems Conference (RSS), June 2013.
-     *
-     *  SM: Improvements in tracking need to be verified, for the moment this is commented due to runtime improvements
-     */
-    /*
-    obfloat w = 1.0;
-    const obfloat eps = -_maxTruncation/4.0;
-    if(sd <= eps)
+    weight = min(weight, maxWeight);
+    *voxelTsd = L::encodeTsd((tsdPrev * (weight - inc) + inc * tsd) / weight);
+    if(rgb)
     {
-      const obfloat span = -_maxTruncation - eps;
-      const obfloat sigma = 3.0/(span*span);
-      w = exp(-sigma*(sd-eps)*(sd-eps));
+      _rgb[3*i]   = (_rgb[3*i]   * (weight - inc) + inc * rgb[0]) / weight;
+      _rgb[3*i+1] = (_rgb[3*i+1] * (weight - inc) + inc * rgb[1]) / weight;
+      _rgb[3*i+2] = (_rgb[3*i+2] * (weight - inc) + inc * rgb[2]) / weight;
     }
-    voxel->weight += w;*/
+  }
+  *voxelWeight = L::encodeWeight(weight);
+}
+
+void TsdSpacePartition::addTsd(const unsigned int x, const unsigned int y, const unsigned int z, const obfloat sd, const obfloat maxTruncation, const unsigned char rgb[3],
+                               const obfloat distance, const TsdFusionPolicy& policy)
+{
+  // already checked int TsdSpace
+  //if(sd >= -maxTruncation)
+  obfloat tsd = min(sd / maxTruncation, TSDINC);
+
+  const bool separate = policy.isColorSeparate();
+  if(rgb) prepareColor(separate);
+
+  _modified = true;
+
+  obfloat inc = policy.getWeight(tsd, distance);
+
+  const unsigned int i = getIndex(z, y, x);
+  if(_layout==VOXEL_COMPACT)
+    addTsdVoxel<TsdVoxelCompact>(i, tsd, inc, policy.getDecay(), policy.getMaxWeight(), separate ? NULL : rgb);
+  else
+    addTsdVoxel<TsdVoxelFull>(i, tsd, inc, policy.getDecay(), policy.getMaxWeight(), separate ? NULL : rgb);
+
+  if(rgb && separate && fabs(tsd) < policy.getColorBand())
+    addColorVoxel(i, rgb, inc, policy.getDecay(), policy.getMaxWeight());
+}
+
+void TsdSpacePartition::addColorVoxel(const unsigned int i, const unsigned char rgb[3], const obfloat inc, const obfloat decay, const obfloat maxWeight)
+{
+  // The first color is taken as is, since the weight of unobserved colors is 0
+  TsdColor& c = _color[i];
+  const obfloat weight = min(TsdVoxelCompact::decodeWeight(c.weight) * decay + inc, maxWeight);
+  const obfloat f = inc / weight;
+  for(unsigned int k=0; k<3; k++)
+  {
+    const obfloat prev = (obfloat)c.rgb[k];
+    c.rgb[k] = (unsigned short)(prev + f * ((obfloat)rgb[k] * 256.0 - prev) + 0.5);
+  }
+  c.weight = TsdVoxelCompact::encodeWeight(weight);
+}
 
-    voxel->weight += TSDINC;
+void TsdSpacePartition::addColorRowSeparate(const unsigned int i, const int* indices, const obfloat* tsd, const unsigned char* rgb, const obfloat* weights,
+                                            const TsdFusionPolicy& policy)
+{
+  const obfloat band = policy.getColorBand();
+  const obfloat decay = policy.getDecay();
+  const obfloat maxWeight = policy.getMaxWeight();
+  for(unsigned int x=0; x<_resX; x++)
+  {
+    if(indices[x]<0 || !(fabs(tsd[x]) < band)) continue;
+    addColorVoxel(i+x, &rgb[3*indices[x]], weights ? weights[x] : TSDINC, decay, maxWeight);
+  }
+}
 
-    if(isnan(voxel->tsd))
+template<class L>
+void TsdSpacePartition::addColorRow(const unsigned int i, const int* indices, const unsigned char* rgb, const obfloat* weights, const TsdFusionPolicy& policy)
+{
+  typename L::TsdType* voxelTsd = &((typename L::TsdType*)_tsd)[i];
+  typename L::WeightType* voxelWeight = &((typename L::WeightType*)_weight)[i];
+  unsigned char* voxelRGB = &_rgb[3*i];
+  const obfloat decay = policy.getDecay();
+  const obfloat maxWeight = policy.getMaxWeight();
+
+  // Colors are averaged with the weights of the subsequent tsd update, see addTsdVoxel
+  for(unsigned int x=0; x<_resX; x++)
+  {
+    if(indices[x]<0) continue;
+    const unsigned char* color = &rgb[3*indices[x]];
+    if(isnan(L::decodeTsd(voxelTsd[x])))
     {
-      voxel->tsd = tsd;
-      if(rgb)
-      {
-        voxel->rgb[0] = rgb[0];
-        voxel->rgb[1] = rgb[1];
-        voxel->rgb[2] = rgb[2];
-      }
+      voxelRGB[3*x]   = color[0];
+      voxelRGB[3*x+1] = color[1];
+      voxelRGB[3*x+2] = color[2];
     }
     else
     {
-      voxel->weight = min(voxel->weight, TSDSPACEMAXWEIGHT);
-      voxel->tsd   = (voxel->tsd * (voxel->weight - TSDINC) + tsd) / voxel->weight;
-      if(rgb)
-      {
-        voxel->rgb[0] = (voxel->rgb[0] * (voxel->weight - TSDINC) + rgb[0]) / voxel->weight;
-        voxel->rgb[1] = (voxel->rgb[1] * (voxel->weight - TSDINC) + rgb[1]) / voxel->weight;
-        voxel->rgb[2] = (voxel->rgb[2] * (voxel->weight - TSDINC) + rgb[2]) / voxel->weight;
-      }
+      const obfloat inc = weights ? weights[x] : TSDINC;
+      obfloat weight = min(L::decodeWeight(voxelWeight[x]) * decay + inc, maxWeight);
+      voxelRGB[3*x]   = (voxelRGB[3*x]   * (weight - inc) + inc * color[0]) / weight;
+      voxelRGB[3*x+1] = (voxelRGB[3*x+1] * (weight - inc) + inc * color[1]) / weight;
+      voxelRGB[3*x+2] = (voxelRGB[3*x+2] * (weight - inc) + inc * color[2]) / weight;
     }
   }
 }
 
-void TsdSpacePartition::increaseEmptiness()
+void TsdSpacePartition::addTsdRow(const unsigned int y, const unsigned int z, const int* indices, const obfloat* tsd, const unsigned char* rgb,
+                                  const obfloat* weights, const TsdFusionPolicy& policy)
+{
+  init();
+  _modified = true;
+
+  const unsigned int i = getIndex(z, y, 0);
+
+  if(rgb && policy.isColorSeparate())
+  {
+    prepareColor(true);
+    addColorRowSeparate(i, indices, tsd, rgb, weights, policy);
+  }
+  else if(rgb)
+  {
+    prepareColor(false);
+    if(_layout==VOXEL_COMPACT)
+      addColorRow<TsdVoxelCompact>(i, indices, rgb, weights, policy);
+    else
+      addColorRow<TsdVoxelFull>(i, indices, rgb, weights, policy);
+  }
+
+  const obfloat decay = policy.getDecay();
+  const obfloat maxWeight = policy.getMaxWeight();
+  if(_layout==VOXEL_COMPACT)
+  {
+    for(unsigned int x=0; x<_resX; x++)
+      if(indices[x]>=0) addTsdVoxel<TsdVoxelCompact>(i+x, tsd[x], weights ? weights[x] : TSDINC, decay, maxWeight, NULL);
+  }
+  else
+  {
+    TsdFusionKernel::fuseRow(&((obfloat*)_tsd)[i], &((obfloat*)_weight)[i], indices, tsd, weights, _resX, decay, maxWeight);
+  }
+}
+
+template<class L>
+void TsdSpacePartition::increaseEmptinessVoxels(const TsdFusionPolicy& policy)
 {
-  if(_space)
+  typename L::TsdType* voxelTsd = (typename L::TsdType*)_tsd;
+  typename L::WeightType* voxelWeight = (typename L::WeightType*)_weight;
+  const obfloat decay = policy.getDecay();
+  const obfloat maxWeight = policy.getMaxWeight();
+
+  // Border voxels are updated by propagation from neighboring partitions
+  for(unsigned int z=0; z<_resZ; z++)
   {
-    for(unsigned int z=1; z<=_cellsZ; z++)
+    for(unsigned int y=0; y<_resY; y++)
     {
-      for(unsigned int y=1; y<=_cellsY; y++)
+      for(unsigned int x=0; x<_resX; x++)
       {
-        for(unsigned int x=1; x<=_cellsX; x++)
-        {
-          TsdVoxel* voxel = &_space[z][y][x];
-          voxel->weight += 1.0;
+        unsigned int i = getIndex(z, y, x);
+        obfloat weight = L::decodeWeight(voxelWeight[i]) * decay + 1.0;
+        obfloat tsd = L::decodeTsd(voxelTsd[i]);
 
-          if(isnan(voxel->tsd))
-          {
-            voxel->tsd = 1.0;
-          }
-          else
-          {
-            voxel->weight = min(voxel->weight, TSDSPACEMAXWEIGHT);
-            voxel->tsd    = (voxel->tsd * (voxel->weight - 1.0) + 1.0) / voxel->weight;
-          }
+        if(isnan(tsd))
+        {
+          tsd = 1.0;
+        }
+        else
+        {
+          weight = min(weight, maxWeight);
+          tsd    = (tsd * (weight - 1.0) + 1.0) / weight;
         }
+        voxelTsd[i]    = L::encodeTsd(tsd);
+        voxelWeight[i] = L::encodeWeight(weight);
       }
     }
   }
+}
+
+void TsdSpacePartition::increaseEmptiness(const TsdFusionPolicy& policy)
+{
+  if(_initialized)
+  {
+    _modified = true;
+    if(_layout==VOXEL_COMPACT)
+      increaseEmptinessVoxels<TsdVoxelCompact>(policy);
+    else
+      increaseEmptinessVoxels<TsdVoxelFull>(policy);
+  }
   else
   {
-    _initWeight += 1.0;
-    _initWeight = min(_initWeight, TSDSPACEMAXWEIGHT);
+    _initWeight = _initWeight * policy.getDecay() + 1.0;
+    _initWeight = min(_initWeight, policy.getMaxWeight());
   }
 }
 
-obfloat TsdSpacePartition::interpolateTrilinear(int x, int y, int z, obfloat dx, obfloat dy, obfloat dz) const
+template<class L>
+obfloat TsdSpacePartition::interpolateTrilinearVoxels(const unsigned int i, const obfloat dx, const obfloat dy, const obfloat dz) const
 {
+  const typename L::TsdType* t = (const typename L::TsdType*)_tsd;
+  const unsigned int sy = _strideY;
+  const unsigned int sz = _strideZ;
+
   // Interpolate
-  return _space[z][y][x].tsd * (1. - dx) * (1. - dy) * (1. - dz)
-      +  _space[z + 1][y + 0][x + 0].tsd * (1. - dx) * (1. - dy) * dz
-      +  _space[z + 0][y + 1][x + 0].tsd * (1. - dx) * dy * (1. - dz)
-      +  _space[z + 1][y + 1][x + 0].tsd * (1. - dx) * dy * dz
-      +  _space[z + 0][y + 0][x + 1].tsd * dx * (1. - dy) * (1. - dz)
-      +  _space[z + 1][y + 0][x + 1].tsd * dx * (1. - dy) * dz
-      +  _space[z + 0][y + 1][x + 1].tsd * dx * dy * (1. - dz)
-      +  _space[z + 1][y + 1][x + 1].tsd * dx * dy * dz;
+  return L::decodeTsd(t[i])           * (1. - dx) * (1. - dy) * (1. - dz)
+      +  L::decodeTsd(t[i + sz])      * (1. - dx) * (1. - dy) * dz
+      +  L::decodeTsd(t[i + sy])      * (1. - dx) * dy * (1. - dz)
+      +  L::decodeTsd(t[i + sz + sy]) * (1. - dx) * dy * dz
+      +  L::decodeTsd(t[i + 1])           * dx * (1. - dy) * (1. - dz)
+      +  L::decodeTsd(t[i + sz + 1])      * dx * (1. - dy) * dz
+      +  L::decodeTsd(t[i + sy + 1])      * dx * dy * (1. - dz)
+      +  L::decodeTsd(t[i + sz + sy + 1]) * dx * dy * dz;
+}
+
+obfloat TsdSpacePartition::interpolateTrilinear(int x, int y, int z, obfloat dx, obfloat dy, obfloat dz) const
+{
+  if(_level)
+  {
+    obfloat p[3] = {(obfloat)x + dx + 0.5, (obfloat)y + dy + 0.5, (obfloat)z + dz + 0.5};
+    return interpolateTrilinearLevel(p);
+  }
+
+  if(_layout==VOXEL_COMPACT)
+    return interpolateTrilinearVoxels<TsdVoxelCompact>(getIndex(z, y, x), dx, dy, dz);
+  return interpolateTrilinearVoxels<TsdVoxelFull>(getIndex(z, y, x), dx, dy, dz);
+}
+
+void TsdSpacePartition::setVoxel(const unsigned int i, const obfloat tsd, const obfloat weight)
+{
+  if(_layout==VOXEL_COMPACT)
+  {
+    ((TsdVoxelCompact::TsdType*)_tsd)[i]       = TsdVoxelCompact::encodeTsd(tsd);
+    ((TsdVoxelCompact::WeightType*)_weight)[i] = TsdVoxelCompact::encodeWeight(weight);
+  }
+  else
+  {
+    ((TsdVoxelFull::TsdType*)_tsd)[i]       = TsdVoxelFull::encodeTsd(tsd);
+    ((TsdVoxelFull::WeightType*)_weight)[i] = TsdVoxelFull::encodeWeight(weight);
+  }
 }
 
 void TsdSpacePartition::serialize(ofstream* f)
 {
+  // Cells are written in full resolution, i.e., coarser levels are upsampled
   unsigned int initializedCells = 0;
 
   for(unsigned int z=0 ; z<_cellsZ+1; z++)
@@ -306,7 +1047,7 @@ void TsdSpacePartition::serialize(ofstream* f)
     {
       for(unsigned int x=0; x<_cellsX+1; x++)
       {
-        if(!isnan(_space[z][y][x].tsd))
+        if(!isnan(getTsd(getCellIndex(z, y, x))))
           initializedCells++;
       }
     }
@@ -320,10 +1061,13 @@ void TsdSpacePartition::serialize(ofstream* f)
     {
       for(unsigned int x=0; x<_cellsX+1; x++)
       {
-        obfloat tsd = _space[z][y][x].tsd;
+        unsigned int i = getCellIndex(z, y, x);
+        obfloat tsd = getTsd(i);
         if(!isnan(tsd))
         {
-          *f << z << " " << y << " " << x << " " << tsd << " " << _space[z][y][x].weight << " " << (int)_space[z][y][x].rgb[0] << " " << (int)_space[z][y][x].rgb[1] << " " << (int)_space[z][y][x].rgb[2] << endl;
+          unsigned char rgb[3];
+          getRGB(z, y, x, rgb);
+          *f << z << " " << y << " " << x << " " << tsd << " " << getWeight(i) << " " << (int)rgb[0] << " " << (int)rgb[1] << " " << (int)rgb[2] << endl;
         }
       }
     }
@@ -332,7 +1076,9 @@ void TsdSpacePartition::serialize(ofstream* f)
 
 void TsdSpacePartition::load(ifstream* f)
 {
+  setLevel(0);
   init();
+  _modified = true;
 
   unsigned int initializedCells;
   unsigned int x, y, z;
@@ -346,15 +1092,123 @@ void TsdSpacePartition::load(ifstream* f)
   for(unsigned int i = 0; i<initializedCells; i++)
   {
     *f >> z >> y >> x >> tsd >> weight >> rgb0 >> rgb1 >> rgb2;
-    TsdVoxel* cell = &_space[z][y][x];
-    cell->tsd      = tsd;
-    cell->weight   = weight;
-    cell->rgb[0]   = (unsigned char)rgb0;
-    cell->rgb[1]   = (unsigned char)rgb1;
-    cell->rgb[2]   = (unsigned char)rgb2;
+    unsigned int idx = getIndex(z, y, x);
+    setVoxel(idx, tsd, weight);
+
+    // Omit color plane for uncolored data
+    if(!_rgb && (rgb0!=255 || rgb1!=255 || rgb2!=255)) prepareColor(false);
+    if(_rgb)
+    {
+      _rgb[3*idx]   = (unsigned char)rgb0;
+      _rgb[3*idx+1] = (unsigned char)rgb1;
+      _rgb[3*idx+2] = (unsigned char)rgb2;
+    }
   }
+}
 
-  _initializedPartitions++;
+template<class L>
+void TsdSpacePartition::serializeVoxels(vector<unsigned char> &buf) const
+{
+  const typename L::TsdType* tsd = (const typename L::TsdType*)_tsd;
+  const typename L::WeightType* weight = (const typename L::WeightType*)_weight;
+
+  buf.clear();
+  unsigned int i = 0;
+  while(i<_voxels)
+  {
+    unsigned int run[2];
+    unsigned int start = i;
+    while(i<_voxels && isnan(L::decodeTsd(tsd[i]))) i++;
+    run[0] = i-start;
+
+    start = i;
+    while(i<_voxels && !isnan(L::decodeTsd(tsd[i]))) i++;
+    run[1] = i-start;
+
+    size_t pos = buf.size();
+    size_t bytes = sizeof(run) + run[1]*(sizeof(typename L::TsdType) + sizeof(typename L::WeightType) + (hasColor() ? 3 : 0));
+    buf.resize(pos+bytes);
+    unsigned char* dst = &buf[pos];
+    memcpy(dst, run, sizeof(run));
+    dst += sizeof(run);
+    if(run[1]==0) continue;
+    memcpy(dst, &tsd[start], run[1]*sizeof(typename L::TsdType));
+    dst += run[1]*sizeof(typename L::TsdType);
+    memcpy(dst, &weight[start], run[1]*sizeof(typename L::WeightType));
+    dst += run[1]*sizeof(typename L::WeightType);
+    if(_rgb)
+    {
+      memcpy(dst, &_rgb[3*start], 3*run[1]);
+    }
+    else if(_color)
+    {
+      // Separately fused colors are stored with 8 bit, weights are not kept
+      for(unsigned int j=0; j<run[1]; j++, dst+=3)
+      {
+        const TsdColor& c = _color[start+j];
+        dst[0] = TsdColor::decodeChannel(c.rgb[0]);
+        dst[1] = TsdColor::decodeChannel(c.rgb[1]);
+        dst[2] = TsdColor::decodeChannel(c.rgb[2]);
+      }
+    }
+  }
+}
+
+void TsdSpacePartition::serialize(vector<unsigned char> &buf) const
+{
+  buf.clear();
+  if(!_initialized) return;
+
+  if(_layout==VOXEL_COMPACT)
+    serializeVoxels<TsdVoxelCompact>(buf);
+  else
+    serializeVoxels<TsdVoxelFull>(buf);
+}
+
+template<class L>
+bool TsdSpacePartition::loadVoxels(const unsigned char* buf, const size_t size, const bool color)
+{
+  typename L::TsdType* tsd = (typename L::TsdType*)_tsd;
+  typename L::WeightType* weight = (typename L::WeightType*)_weight;
+  const size_t voxelBytes = sizeof(typename L::TsdType) + sizeof(typename L::WeightType) + (color ? 3 : 0);
+
+  size_t pos = 0;
+  unsigned int i = 0;
+  while(pos<size)
+  {
+    unsigned int run[2];
+    if(size-pos < sizeof(run)) return false;
+    memcpy(run, &buf[pos], sizeof(run));
+    pos += sizeof(run);
+
+    if(run[0] > _voxels-i) return false;
+    i += run[0];
+    if(run[1] > _voxels-i || (size-pos)/voxelBytes < run[1]) return false;
+    if(run[1]==0) continue;
+
+    memcpy(&tsd[i], &buf[pos], run[1]*sizeof(typename L::TsdType));
+    pos += run[1]*sizeof(typename L::TsdType);
+    memcpy(&weight[i], &buf[pos], run[1]*sizeof(typename L::WeightType));
+    pos += run[1]*sizeof(typename L::WeightType);
+    if(color)
+    {
+      memcpy(&_rgb[3*i], &buf[pos], 3*run[1]);
+      pos += 3*run[1];
+    }
+    i += run[1];
+  }
+  return true;
+}
+
+bool TsdSpacePartition::load(const unsigned char* buf, const size_t size, const bool color)
+{
+  init();
+  _modified = true;
+  if(color) prepareColor(false);
+
+  if(_layout==VOXEL_COMPACT)
+    return loadVoxels<TsdVoxelCompact>(buf, size, color);
+  return loadVoxels<TsdVoxelFull>(buf, size, color);
 }
 
 }
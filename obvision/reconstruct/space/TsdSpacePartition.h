@@ -4,20 +4,84 @@
 #include "obcore/math/linalg/linalg.h"
 #include "obvision/reconstruct/space/TsdSpaceComponent.h"
 
+#include <cmath>
+
 namespace obvious
 {
 
+class TsdSpacePartitionPool;
+
+// number of resolution levels, level l stores voxels with 2^l times the cell size
+#define TSDSPACEPARTITION_LEVELS 3
+
+enum EnumTsdVoxelLayout { VOXEL_FULL=0,
+  VOXEL_COMPACT=1};
+
 /**
-* Struct for Class Tsd_space
-* Contains data that is saved in a voxel
-* @param tsdf value of the truncated signed distance function
-* @param weight used to calculate mean of all points in a voxel
-*/
-struct TsdVoxel
+ * @struct TsdVoxelFull
+ * @brief Voxel layout storing tsd and weight in full precision
+ */
+struct TsdVoxelFull
 {
-  obfloat tsd;
-  obfloat weight;
-  unsigned char rgb[3];
+  typedef obfloat TsdType;
+  typedef obfloat WeightType;
+
+  static obfloat decodeTsd(const TsdType tsd) { return tsd; }
+
+  static TsdType encodeTsd(const obfloat tsd) { return tsd; }
+
+  static obfloat decodeWeight(const WeightType weight) { return weight; }
+
+  static WeightType encodeWeight(const obfloat weight) { return weight; }
+};
+
+/**
+ * @struct TsdVoxelCompact
+ * @brief Voxel layout storing tsd in [-1; 1] and weight as 16 bit fixed-point numbers, i.e., 4 bytes per voxel
+ */
+struct TsdVoxelCompact
+{
+  typedef short TsdType;
+  typedef unsigned short WeightType;
+
+  static obfloat decodeTsd(const TsdType tsd)
+  {
+    if(tsd==-32768) return NAN;
+    return ((obfloat)tsd) * (1.0/32767.0);
+  }
+
+  static TsdType encodeTsd(obfloat tsd)
+  {
+    if(isnan(tsd)) return -32768;
+    if(tsd>1.0) tsd = 1.0;
+    if(tsd<-1.0) tsd = -1.0;
+    return (TsdType)floor(tsd*32767.0 + 0.5);
+  }
+
+  static obfloat decodeWeight(const WeightType weight) { return ((obfloat)weight) * (1.0/1024.0); }
+
+  static WeightType encodeWeight(obfloat weight)
+  {
+    if(weight<0.0) weight = 0.0;
+    if(weight>63.0) weight = 63.0;
+    return (WeightType)(weight*1024.0 + 0.5);
+  }
+};
+
+/**
+ * @struct TsdColor
+ * @brief Color of a voxel fused separately from the geometry, packed into 8 bytes. Channels are stored as 8.8 fixed-point numbers,
+ * i.e., averaging is not affected by rounding to 8 bit, the weight is encoded like in TsdVoxelCompact.
+ */
+struct TsdColor
+{
+  unsigned short rgb[3];
+
+  unsigned short weight;
+
+  static unsigned short encodeChannel(const obfloat c) { return (unsigned short)(c*256.0 + 0.5); }
+
+  static unsigned char decodeChannel(const unsigned short c) { return (unsigned char)((c + 128) >> 8); }
 };
 
 /**
@@ -40,25 +104,204 @@ public:
    * @param[in] dimY Number of cells in y-dimension
    * @param[in] dimZ Number of cells in z-dimension
    * @param[in] cellSize Size of cell in meters
+   * @param[in] origin world coordinates of cell index (0, 0, 0), NULL for the coordinate origin
+   * @param[in] layout memory layout of voxels
    */
-  TsdSpacePartition(const unsigned int x, const unsigned int y, const unsigned int z, const unsigned int dimX, const unsigned int dimY, const unsigned int dimZ, const obfloat cellSize);
+  TsdSpacePartition(const unsigned int x, const unsigned int y, const unsigned int z, const unsigned int dimX, const unsigned int dimY, const unsigned int dimZ, const obfloat cellSize, const obfloat* origin=NULL,
+                    const EnumTsdVoxelLayout layout=VOXEL_FULL);
 
   ~TsdSpacePartition();
 
+  /**
+   * Initialize coordinate matrices shared by all partitions, subsequent calls have no effect
+   * @param[in] cellsX Number of cells in x-dimension
+   * @param[in] cellsY Number of cells in y-dimension
+   * @param[in] cellsZ Number of cells in z-dimension
+   * @param[in] cellSize Size of cell in meters
+   */
+  static void initCoordinates(const unsigned int cellsX, const unsigned int cellsY, const unsigned int cellsZ, const obfloat cellSize);
+
+  /**
+   * Calculate bounding box of a partition without instantiating it
+   * @param[in] x start index in x-dimension
+   * @param[in] y start index in y-dimension
+   * @param[in] z start index in z-dimension
+   * @param[in] cellsX Number of cells in x-dimension
+   * @param[in] cellsY Number of cells in y-dimension
+   * @param[in] cellsZ Number of cells in z-dimension
+   * @param[in] cellSize Size of cell in meters
+   * @param[out] edgeCoordsHom homogeneous coordinates of edges (8x4 matrix)
+   * @param[out] centroid centroid of partition
+   * @param[out] circumradius circumradius of partition
+   * @param[in] origin world coordinates of cell index (0, 0, 0), NULL for the coordinate origin
+   */
+  static void calcEdgeCoords(const unsigned int x, const unsigned int y, const unsigned int z,
+                             const unsigned int cellsX, const unsigned int cellsY, const unsigned int cellsZ, const obfloat cellSize,
+                             Matrix* edgeCoordsHom, obfloat centroid[3], obfloat* circumradius, const obfloat* origin=NULL);
+
   static int getInitializedPartitionSize();
 
+  /**
+   * Preallocate voxel memory, so that partitions can be initialized without heap allocations
+   * @param[in] cellsX number of cells in x-dimension
+   * @param[in] cellsY number of cells in y-dimension
+   * @param[in] cellsZ number of cells in z-dimension
+   * @param[in] layout voxel layout
+   * @param[in] partitions number of partitions
+   */
+  static void reserve(const unsigned int cellsX, const unsigned int cellsY, const unsigned int cellsZ, const EnumTsdVoxelLayout layout, const unsigned int partitions);
+
   void reset();
 
-  obfloat& operator () (unsigned int z, unsigned int y, unsigned int x) const { return _space[z][y][x].tsd; }
+  /**
+   * Discard content, but keep allocated voxel memory for the next initialization. The partition is reset to the finest level,
+   * color planes are released and flags are cleared, i.e., it equals a newly created partition except for its location.
+   */
+  void recycle();
+
+  /**
+   * Move partition, content is not modified
+   * @param[in] x start index in x-dimension
+   * @param[in] y start index in y-dimension
+   * @param[in] z start index in z-dimension
+   * @param[in] origin world coordinates of cell index (0, 0, 0), NULL for the coordinate origin
+   */
+  void relocate(const unsigned int x, const unsigned int y, const unsigned int z, const obfloat* origin);
+
+  /**
+   * Copy voxel data and state of another partition with the same dimensions and layout, position is not modified.
+   * Allocated memory is reused.
+   * @param[in] src source partition
+   */
+  void cloneVoxels(const TsdSpacePartition* src);
+
+  /**
+   * Exchange voxel data and state with another partition with the same dimensions and layout, positions and stamps are kept
+   * @param[in,out] other partition
+   */
+  void swapVoxels(TsdSpacePartition* other);
+
+  /**
+   * Get index of voxel in internal arrays, including the border layer. Indices refer to the resolution of the current level,
+   * i.e., x<=getLevelWidth(), y<=getLevelHeight(), z<=getLevelDepth()
+   */
+  unsigned int getIndex(unsigned int z, unsigned int y, unsigned int x) const { return z*_strideZ + y*_strideY + x; }
+
+  /**
+   * Get index of voxel covering a cell of full resolution, including the border layer, i.e., x<=width, y<=height, z<=depth
+   */
+  unsigned int getCellIndex(unsigned int z, unsigned int y, unsigned int x) const
+  {
+    return getIndex((z==_cellsZ) ? _resZ : (z>>_level), (y==_cellsY) ? _resY : (y>>_level), (x==_cellsX) ? _resX : (x>>_level));
+  }
+
+  obfloat operator () (unsigned int z, unsigned int y, unsigned int x) const { return getTsd(getCellIndex(z, y, x)); }
+
+  /**
+   * Get tsd value by index
+   * @param[in] i voxel index
+   * @return tsd value (NAN for uninitialized voxels)
+   */
+  obfloat getTsd(unsigned int i) const
+  {
+    if(_layout==VOXEL_COMPACT) return TsdVoxelCompact::decodeTsd(((TsdVoxelCompact::TsdType*)_tsd)[i]);
+    return TsdVoxelFull::decodeTsd(((TsdVoxelFull::TsdType*)_tsd)[i]);
+  }
+
+  /**
+   * Get weight by index
+   * @param[in] i voxel index
+   * @return weight
+   */
+  obfloat getWeight(unsigned int i) const
+  {
+    if(_layout==VOXEL_COMPACT) return TsdVoxelCompact::decodeWeight(((TsdVoxelCompact::WeightType*)_weight)[i]);
+    return TsdVoxelFull::decodeWeight(((TsdVoxelFull::WeightType*)_weight)[i]);
+  }
 
   void getRGB(unsigned int z, unsigned int y, unsigned int x, unsigned char rgb[3]);
 
+  /**
+   * Interpolate color between the 8 voxels surrounding a position, see interpolateTrilinear.
+   * Voxels, whose color has not been fused separately, are omitted, see TsdFusionPolicy::setColorBand.
+   * @param[in] x cell index in x-direction
+   * @param[in] y cell index in y-direction
+   * @param[in] z cell index in z-direction
+   * @param[in] dx weight in x-direction
+   * @param[in] dy weight in y-direction
+   * @param[in] dz weight in z-direction
+   * @param[out] rgb interpolated color, white for partitions without color
+   */
+  void interpolateTrilinearRGB(int x, int y, int z, obfloat dx, obfloat dy, obfloat dz, unsigned char rgb[3]) const;
+
+  /**
+   * Fill border layer with data of a neighbor, which might be represented with a different level
+   * @param[in] neighbor neighboring partition
+   * @param[in] ox 1, if neighbor is located in positive x-direction, 0 otherwise
+   * @param[in] oy 1, if neighbor is located in positive y-direction, 0 otherwise
+   * @param[in] oz 1, if neighbor is located in positive z-direction, 0 otherwise
+   */
+  void copyBorder(const TsdSpacePartition* neighbor, const unsigned int ox, const unsigned int oy, const unsigned int oz);
+
+  /**
+   * Copy voxel of another partition with the same layout
+   * @param[in] i destination index
+   * @param[in] src source partition
+   * @param[in] iSrc source index
+   */
+  void copyVoxel(unsigned int i, const TsdSpacePartition* src, unsigned int iSrc);
+
+  EnumTsdVoxelLayout getVoxelLayout() const { return _layout; }
+
+  /**
+   * Determine whether color has been fused, the color plane is allocated on demand
+   */
+  bool hasColor() const { return _rgb!=NULL || _color!=NULL; }
+
+  /**
+   * Get memory consumption of voxel data
+   * @return number of bytes
+   */
+  unsigned int getVoxelMemory() const;
+
   void init();
 
   bool isInitialized();
 
   bool isEmpty();
 
+  /**
+   * Check, whether voxel data has been modified since the last call of resetModified, e.g., to refresh borders of neighbors
+   * @return modification flag
+   */
+  bool isModified() const { return _modified; }
+
+  /**
+   * Reset modification flag
+   */
+  void resetModified() { _modified = false; }
+
+  /**
+   * Check, whether partition might contain a surface, i.e., any voxel including the border layer is not
+   * truncated to free space. Ray casters skip partitions without surface. Modified partitions are assumed to contain a surface,
+   * until the flag has been refreshed with updateSurface.
+   * @return surface flag
+   */
+  bool hasSurface() const { return _surface || _modified; }
+
+  /**
+   * Refresh surface flag from voxel data, see hasSurface
+   */
+  void updateSurface();
+
+  /**
+   * Get stamp of the last push, which changed voxel data including the border layer
+   * @return stamp, see TsdSpace::getPushCount
+   */
+  unsigned int getStamp() const { return _stamp; }
+
+  void setStamp(const unsigned int stamp) { _stamp = stamp; }
+
   obfloat getInitWeight() const { return _initWeight; }
 
   void setInitWeight(obfloat weight) { _initWeight = weight; }
@@ -69,11 +312,19 @@ public:
 
   unsigned int getZ() const { return _z; }
 
-  static Matrix* getCellCoordsHom() { return _cellCoordsHom; }
+  /**
+   * Get homogeneous coordinates of voxel centers relative to the partition origin
+   * @param[in] level resolution level
+   */
+  static Matrix* getCellCoordsHom(const unsigned int level=0) { return _cellCoordsHom[level]; }
 
   void getCellCoordsOffset(obfloat offset[3]);
 
-  static Matrix* getPartitionCoords() { return _partCoords; }
+  /**
+   * Get voxel indices of partition
+   * @param[in] level resolution level
+   */
+  static Matrix* getPartitionCoords(const unsigned int level=0) { return _partCoords[level]; }
 
   unsigned int getWidth() const { return _cellsX; }
 
@@ -83,9 +334,60 @@ public:
 
   unsigned int getSize() const { return _cellsX*_cellsY*_cellsZ; }
 
-  void addTsd(const unsigned int x, const unsigned int y, const unsigned int z, const obfloat sd, const obfloat maxTruncation, const unsigned char rgb[3]);
+  /**
+   * Get resolution level, voxels of level l have 2^l times the cell size
+   * @return level
+   */
+  unsigned int getLevel() const { return _level; }
 
-  virtual void increaseEmptiness();
+  /**
+   * Get coarsest level, which keeps at least two voxels per dimension
+   * @return level
+   */
+  unsigned int getMaxLevel() const;
+
+  /**
+   * Change resolution level. Data of initialized partitions is resampled.
+   * @param[in] level resolution level, limited to getMaxLevel()
+   */
+  void setLevel(unsigned int level);
+
+  unsigned int getLevelWidth() const { return _resX; }
+
+  unsigned int getLevelHeight() const { return _resY; }
+
+  unsigned int getLevelDepth() const { return _resZ; }
+
+  unsigned int getLevelSize() const { return _resX*_resY*_resZ; }
+
+  /**
+   * Integrate signed distance into voxel
+   * @param[in] x voxel index in x-direction
+   * @param[in] y voxel index in y-direction
+   * @param[in] z voxel index in z-direction
+   * @param[in] sd signed distance
+   * @param[in] maxTruncation maximum truncation radius
+   * @param[in] rgb color, may be NULL
+   * @param[in] distance measured distance
+   * @param[in] policy fusion policy
+   */
+  void addTsd(const unsigned int x, const unsigned int y, const unsigned int z, const obfloat sd, const obfloat maxTruncation, const unsigned char rgb[3],
+              const obfloat distance, const TsdFusionPolicy& policy);
+
+  /**
+   * Integrate row of truncated signed distances, e.g., determined by TsdFusionKernel::projectRow
+   * @param[in] y row index
+   * @param[in] z slice index
+   * @param[in] indices measurement indices of voxels, voxels with negative indices are skipped
+   * @param[in] tsd truncated signed distances
+   * @param[in] rgb color image indexed by measurement indices, may be NULL
+   * @param[in] weights weights of measurements, may be NULL for constant weighting
+   * @param[in] policy fusion policy
+   */
+  void addTsdRow(const unsigned int y, const unsigned int z, const int* indices, const obfloat* tsd, const unsigned char* rgb,
+                 const obfloat* weights, const TsdFusionPolicy& policy);
+
+  virtual void increaseEmptiness(const TsdFusionPolicy& policy);
 
   obfloat interpolateTrilinear(int x, int y, int z, obfloat dx, obfloat dy, obfloat dz) const;
 
@@ -93,13 +395,110 @@ public:
 
   void load(ifstream* f);
 
+  /**
+   * Encode voxels in binary format. Runs of uninitialized voxels are skipped, i.e., the data consists of runs
+   * (number of skipped voxels, number of voxels) followed by the tsd, weight and optional color values of the run.
+   * @param[out] buf encoded data
+   */
+  void serialize(vector<unsigned char> &buf) const;
+
+  /**
+   * Decode voxels in binary format
+   * @param[in] buf encoded data
+   * @param[in] size number of bytes
+   * @param[in] color encoded data contains colors
+   * @return false, if data is corrupted
+   */
+  bool load(const unsigned char* buf, const size_t size, const bool color);
+
 private:
 
-  TsdVoxel*** _space;
+  template<class L> void initVoxels();
+
+  template<class L> void addTsdVoxel(const unsigned int i, const obfloat tsd, const obfloat inc, const obfloat decay, const obfloat maxWeight, const unsigned char rgb[3]);
+
+  template<class L> void addColorRow(const unsigned int i, const int* indices, const unsigned char* rgb, const obfloat* weights, const TsdFusionPolicy& policy);
+
+  template<class L> void increaseEmptinessVoxels(const TsdFusionPolicy& policy);
+
+  template<class L> void serializeVoxels(vector<unsigned char> &buf) const;
+
+  template<class L> bool loadVoxels(const unsigned char* buf, const size_t size, const bool color);
+
+  template<class L> bool hasSurfaceVoxels() const;
+
+  template<class L> obfloat interpolateTrilinearVoxels(const unsigned int i, const obfloat dx, const obfloat dy, const obfloat dz) const;
+
+  void initColor();
+
+  /**
+   * Provide color plane of the representation required by a fusion policy, colors of the other representation are converted
+   * @param[in] separate colors are fused separately, see TsdFusionPolicy::isColorSeparate
+   */
+  void prepareColor(const bool separate);
+
+  void addColorVoxel(const unsigned int i, const unsigned char rgb[3], const obfloat inc, const obfloat decay, const obfloat maxWeight);
+
+  void addColorRowSeparate(const unsigned int i, const int* indices, const obfloat* tsd, const unsigned char* rgb, const obfloat* weights, const TsdFusionPolicy& policy);
+
+  void copyColor(const unsigned int i, const TsdSpacePartition* src, const unsigned int iSrc);
+
+  void initLevel(const unsigned int level);
+
+  unsigned int getNearestIndex(const obfloat p[3]) const;
+
+  obfloat interpolateTrilinearLevel(const obfloat p[3]) const;
+
+  static TsdSpacePartitionPool* getPool(const unsigned int voxels, const EnumTsdVoxelLayout layout, size_t* offsetWeight);
+
+  void setVoxel(const unsigned int i, const obfloat tsd, const obfloat weight);
+
+  EnumTsdVoxelLayout _layout;
+
+  // structure of arrays: tsd and weight planes of layout type, optional color plane with either 3 bytes per voxel or separately fused colors
+  void* _tsd;
+
+  void* _weight;
+
+  unsigned char* _rgb;
+
+  TsdColor* _color;
+
+  // pools providing voxel memory
+  TsdSpacePartitionPool* _pool;
+
+  TsdSpacePartitionPool* _poolColor;
+
+  TsdSpacePartitionPool* _poolColorSeparate;
+
+  size_t _offsetWeight;
+
+  unsigned int _level;
+
+  // number of voxels per dimension at current level, excluding the border layer
+  unsigned int _resX;
+
+  unsigned int _resY;
+
+  unsigned int _resZ;
+
+  unsigned int _strideY;
+
+  unsigned int _strideZ;
+
+  unsigned int _voxels;
+
+  bool _initialized;
+
+  bool _modified;
+
+  bool _surface;
+
+  unsigned int _stamp;
 
-  static obvious::Matrix* _partCoords;
+  static obvious::Matrix* _partCoords[TSDSPACEPARTITION_LEVELS];
 
-  static obvious::Matrix* _cellCoordsHom;
+  static obvious::Matrix* _cellCoordsHom[TSDSPACEPARTITION_LEVELS];
 
   obfloat _cellSize;
 
@@ -0,0 +1,171 @@
+#include "TsdSpacePartitionPool.h"
+#include "obcore/base/Logger.h"
+
+#include <cstdlib>
+#include <algorithm>
+
+namespace obvious
+{
+
+#define TSDPOOL_ALIGNMENT 64
+#define TSDPOOL_SLABSIZE  (1<<20)
+
+std::vector<TsdSpacePartitionPool*> TsdSpacePartitionPool::_pools;
+
+TsdSpacePartitionPool* TsdSpacePartitionPool::getPool(const size_t blockSize)
+{
+  TsdSpacePartitionPool* pool = NULL;
+#pragma omp critical(tsdspacepartitionpool)
+  {
+    for(unsigned int i=0; i<_pools.size(); i++)
+    {
+      if(_pools[i]->_blockSize == blockSize)
+      {
+        pool = _pools[i];
+        break;
+      }
+    }
+    if(!pool)
+    {
+      pool = new TsdSpacePartitionPool(blockSize);
+      _pools.push_back(pool);
+    }
+  }
+  return pool;
+}
+
+void TsdSpacePartitionPool::trimAll()
+{
+#pragma omp critical(tsdspacepartitionpool)
+  {
+    for(unsigned int i=0; i<_pools.size(); i++)
+      _pools[i]->trim();
+  }
+}
+
+TsdSpacePartitionPool::TsdSpacePartitionPool(const size_t blockSize)
+{
+  _blockSize = blockSize;
+
+  // Blocks are padded to keep them aligned to cache lines
+  size_t stride = (blockSize + TSDPOOL_ALIGNMENT - 1) / TSDPOOL_ALIGNMENT * TSDPOOL_ALIGNMENT;
+  _blocksPerSlab = TSDPOOL_SLABSIZE / stride;
+  if(_blocksPerSlab==0) _blocksPerSlab = 1;
+
+  omp_init_lock(&_lock);
+}
+
+void TsdSpacePartitionPool::grow(const unsigned int slabs)
+{
+  size_t stride = (_blockSize + TSDPOOL_ALIGNMENT - 1) / TSDPOOL_ALIGNMENT * TSDPOOL_ALIGNMENT;
+  for(unsigned int s=0; s<slabs; s++)
+  {
+    void* mem = NULL;
+    if(posix_memalign(&mem, TSDPOOL_ALIGNMENT, stride*_blocksPerSlab)!=0)
+    {
+      LOGMSG(DBG_ERROR, "Could not allocate slab of " << stride*_blocksPerSlab << " bytes");
+      return;
+    }
+    unsigned char* slab = (unsigned char*)mem;
+    _slabs.insert(std::upper_bound(_slabs.begin(), _slabs.end(), slab), slab);
+
+    // Push in reverse order, so that blocks are handed out with increasing addresses
+    for(unsigned int i=_blocksPerSlab; i>0; i--)
+      _free.push_back(slab + (i-1)*stride);
+  }
+}
+
+void* TsdSpacePartitionPool::allocate()
+{
+  void* block = NULL;
+  omp_set_lock(&_lock);
+  if(_free.empty()) grow(1);
+  if(!_free.empty())
+  {
+    block = _free.back();
+    _free.pop_back();
+  }
+  omp_unset_lock(&_lock);
+  return block;
+}
+
+void TsdSpacePartitionPool::release(void* block)
+{
+  if(!block) return;
+  omp_set_lock(&_lock);
+  _free.push_back(block);
+  omp_unset_lock(&_lock);
+}
+
+void TsdSpacePartitionPool::reserve(const unsigned int blocks)
+{
+  omp_set_lock(&_lock);
+  if(_free.size() < blocks)
+  {
+    unsigned int missing = blocks - _free.size();
+    grow((missing + _blocksPerSlab - 1) / _blocksPerSlab);
+  }
+  omp_unset_lock(&_lock);
+}
+
+void TsdSpacePartitionPool::trim()
+{
+  omp_set_lock(&_lock);
+
+  // Count unused blocks per slab
+  std::vector<unsigned int> unused(_slabs.size(), 0);
+  for(unsigned int i=0; i<_free.size(); i++)
+  {
+    unsigned char* block = (unsigned char*)_free[i];
+    unsigned int s = std::upper_bound(_slabs.begin(), _slabs.end(), block) - _slabs.begin() - 1;
+    unused[s]++;
+  }
+
+  std::vector<unsigned char*> slabs;
+  std::vector<unsigned char*> released;
+  for(unsigned int s=0; s<_slabs.size(); s++)
+  {
+    if(unused[s]==_blocksPerSlab)
+      released.push_back(_slabs[s]);
+    else
+      slabs.push_back(_slabs[s]);
+  }
+
+  if(!released.empty())
+  {
+    // Keep free blocks of remaining slabs
+    std::vector<void*> remaining;
+    for(unsigned int i=0; i<_free.size(); i++)
+    {
+      unsigned char* block = (unsigned char*)_free[i];
+      unsigned char* slab = *(std::upper_bound(_slabs.begin(), _slabs.end(), block) - 1);
+      if(!std::binary_search(released.begin(), released.end(), slab))
+        remaining.push_back(block);
+    }
+    _free.swap(remaining);
+    _slabs.swap(slabs);
+
+    for(unsigned int s=0; s<released.size(); s++)
+      ::free(released[s]);
+  }
+
+  omp_unset_lock(&_lock);
+}
+
+unsigned int TsdSpacePartitionPool::getBlocks()
+{
+  omp_set_lock(&_lock);
+  unsigned int blocks = _slabs.size() * _blocksPerSlab;
+  omp_unset_lock(&_lock);
+  return blocks;
+}
+
+unsigned int TsdSpacePartitionPool::getFreeBlocks()
+{
+  omp_set_lock(&_lock);
+  unsigned int blocks = _free.size();
+  omp_unset_lock(&_lock);
+  return blocks;
+}
+
+}
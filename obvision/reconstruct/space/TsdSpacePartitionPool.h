@@ -0,0 +1,97 @@
+#ifndef TSDSPACEPARTITIONPOOL_H
+#define TSDSPACEPARTITIONPOOL_H
+
+#include <vector>
+#include <cstddef>
+#include <omp.h>
+
+namespace obvious
+{
+
+/**
+ * @class TsdSpacePartitionPool
+ * @brief Slab allocator for voxel blocks of partitions.
+ * Blocks of equal size are carved from large slabs and recycled via a free list, i.e., the initialization of partitions
+ * in fusion threads does not contend for the global heap. One pool exists per block size, pools can be used concurrently.
+ * @author Stefan May
+ */
+class TsdSpacePartitionPool
+{
+public:
+
+  /**
+   * Get pool for blocks of a certain size. Pools are created on first request and live until program termination.
+   * @param[in] blockSize size of blocks in bytes
+   * @return pool
+   */
+  static TsdSpacePartitionPool* getPool(const size_t blockSize);
+
+  /**
+   * Release memory of slabs, of which all blocks are unused, in all pools
+   */
+  static void trimAll();
+
+  /**
+   * Take block from pool, new slabs are allocated if the pool is exhausted
+   * @return block of getBlockSize() bytes aligned to 64 bytes, content is undefined
+   */
+  void* allocate();
+
+  /**
+   * Return block to pool
+   * @param[in] block block obtained by allocate(), NULL is ignored
+   */
+  void release(void* block);
+
+  /**
+   * Make sure that a number of blocks can be taken without allocating memory
+   * @param[in] blocks number of free blocks
+   */
+  void reserve(const unsigned int blocks);
+
+  /**
+   * Release memory of slabs, of which all blocks are unused
+   */
+  void trim();
+
+  /**
+   * Get size of blocks
+   * @return size in bytes
+   */
+  size_t getBlockSize() const { return _blockSize; }
+
+  /**
+   * Get number of blocks, i.e., of used and free blocks
+   * @return number of blocks
+   */
+  unsigned int getBlocks();
+
+  /**
+   * Get number of unused blocks
+   * @return number of blocks
+   */
+  unsigned int getFreeBlocks();
+
+private:
+
+  TsdSpacePartitionPool(const size_t blockSize);
+
+  void grow(const unsigned int slabs);
+
+  size_t _blockSize;
+
+  unsigned int _blocksPerSlab;
+
+  // sorted by address
+  std::vector<unsigned char*> _slabs;
+
+  std::vector<void*> _free;
+
+  omp_lock_t _lock;
+
+  static std::vector<TsdSpacePartitionPool*> _pools;
+};
+
+}
+
+#endif